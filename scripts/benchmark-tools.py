@@ -0,0 +1,212 @@
+#!/usr/bin/env python
+# End-to-end benchmark of the MorphLM tools on synthetic corpora.
+#
+# For every combination of corpus size, vocabulary size and ambiguity level,
+# generates a corpus with generate-morph-corpus.py, trains a model on it and
+# then runs loss, modes, disambig and sample on the test set. Reports
+# throughput (tokens/sec), startup time, per-sentence latency percentiles and
+# peak RSS for each tool, as a table on stdout and optionally as JSON.
+#
+# Example:
+#   python scripts/benchmark-tools.py --sentences 1000,10000 --ambiguity 1.5,3 --json results.json
+from __future__ import print_function
+import argparse
+import itertools
+import json
+import os
+import subprocess
+import sys
+import time
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+
+def percentile(values, p):
+  if not values:
+    return 0.0
+  values = sorted(values)
+  index = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+  return values[index]
+
+def count_tokens(filename):
+  tokens = 0
+  sentences = 0
+  with open(filename, 'rb') as f:
+    in_sentence = False
+    for line in f:
+      if line.strip():
+        tokens += 1
+        in_sentence = True
+      elif in_sentence:
+        sentences += 1
+        in_sentence = False
+  if in_sentence:
+    sentences += 1
+  return tokens, sentences
+
+def run_tool(command, stdin_filename, stdout_filename=None, sentence_lines=None, max_sentences=None):
+  """Runs a tool and measures it.
+
+  Per-sentence latency is the time between consecutive sentences showing up
+  on the tool's output, which the tools flush after every sentence. The
+  first sentence also waits for the tool to start up and load its model, so
+  it counts towards startup time instead of latency.
+  sentence_lines is a function that tells whether an output line ends a
+  sentence. If max_sentences is given, the tool is killed after that many.
+  """
+  stdin = open(stdin_filename, 'rb') if stdin_filename else open(os.devnull, 'rb')
+  stdout = subprocess.PIPE if sentence_lines else open(stdout_filename or os.devnull, 'wb')
+  with open(os.devnull, 'wb') as devnull:
+    start = time.time()
+    p = subprocess.Popen(command, stdin=stdin, stdout=stdout, stderr=devnull)
+    latencies = []
+    output_words = 0
+    output_sentences = 0
+    startup = None
+    last = start
+    killed = False
+    if sentence_lines:
+      for line in iter(p.stdout.readline, b''):
+        if sentence_lines(line):
+          output_words += len(line.split())
+          output_sentences += 1
+          now = time.time()
+          if startup is None:
+            startup = now - start
+          else:
+            latencies.append(now - last)
+          last = now
+          if max_sentences is not None and output_sentences >= max_sentences:
+            p.kill()
+            killed = True
+            break
+    _, status, usage = os.wait4(p.pid, 0)
+    p.returncode = status
+    elapsed = time.time() - start
+  stdin.close()
+  if not sentence_lines:
+    stdout.close()
+  if status != 0 and not killed:
+    raise RuntimeError('%s failed with status %d' % (' '.join(command), status))
+
+  # ru_maxrss is in kilobytes on Linux
+  return {
+    'seconds': elapsed,
+    'startup_seconds': startup,
+    'latencies': latencies,
+    'output_words': output_words,
+    'output_sentences': output_sentences,
+    'peak_rss_mb': usage.ru_maxrss / 1024.0,
+  }
+
+def summarize(tool, config, result, tokens, sentences):
+  latencies_ms = [1000.0 * x for x in result['latencies']]
+  return dict(config, **{
+    'tool': tool,
+    'seconds': result['seconds'],
+    'tokens_per_sec': tokens / result['seconds'] if result['seconds'] > 0 else 0.0,
+    'sentences_per_sec': sentences / result['seconds'] if result['seconds'] > 0 else 0.0,
+    'startup_seconds': result['startup_seconds'],
+    'latency_p50_ms': percentile(latencies_ms, 50),
+    'latency_p95_ms': percentile(latencies_ms, 95),
+    'latency_p99_ms': percentile(latencies_ms, 99),
+    'peak_rss_mb': result['peak_rss_mb'],
+  })
+
+def is_blank(line):
+  return not line.strip()
+
+def is_any(line):
+  return True
+
+def benchmark(args, sentences, vocab_size, ambiguity):
+  config = {'sentences': sentences, 'vocab_size': vocab_size, 'ambiguity': ambiguity}
+  name = 's%d-v%d-a%g' % (sentences, vocab_size, ambiguity)
+  corpus_dir = os.path.join(args.work_dir, name)
+  bin_dir = args.bin_dir
+  print('Generating corpus %s...' % name, file=sys.stderr)
+  subprocess.check_call([sys.executable, os.path.join(SCRIPT_DIR, 'generate-morph-corpus.py'),
+    '--output_dir', corpus_dir, '--sentences', str(sentences), '--test_sentences', str(args.test_sentences),
+    '--word_types', str(vocab_size * 4), '--roots', str(vocab_size * 2),
+    '--word_vocab_size', str(vocab_size), '--root_vocab_size', str(vocab_size),
+    '--ambiguity', str(ambiguity), '--seed', str(args.seed)])
+
+  train_text = os.path.join(corpus_dir, 'train.txt')
+  dev_text = os.path.join(corpus_dir, 'dev.txt')
+  test_text = os.path.join(corpus_dir, 'test.txt')
+  model = os.path.join(corpus_dir, 'model')
+  train_tokens, train_sentences = count_tokens(train_text)
+  test_tokens, test_sentences = count_tokens(test_text)
+
+  results = []
+  if 'train' in args.tools or not os.path.exists(model):
+    print('Training...', file=sys.stderr)
+    command = [os.path.join(bin_dir, 'train'), train_text, dev_text,
+      '--word_vocab', os.path.join(corpus_dir, 'word_vocab'),
+      '--root_vocab', os.path.join(corpus_dir, 'root_vocab'),
+      '--char_vocab', os.path.join(corpus_dir, 'char_vocab'),
+      '-i', str(args.iterations), '--dev_frequency', str(10 ** 9), '--report_frequency', str(10 ** 9)]
+    result = run_tool(command, None, stdout_filename=model)
+    tokens = train_tokens * args.iterations
+    results.append(summarize('train', config, result, tokens, train_sentences * args.iterations))
+
+  scorers = [
+    ('loss', [os.path.join(bin_dir, 'loss'), model], is_any),
+    ('modes', [os.path.join(bin_dir, 'modes'), model], is_blank),
+    ('disambig', [os.path.join(bin_dir, 'disambig'), model], is_blank),
+  ]
+  for tool, command, sentence_lines in scorers:
+    if tool not in args.tools:
+      continue
+    print('Running %s...' % tool, file=sys.stderr)
+    result = run_tool(command, test_text, sentence_lines=sentence_lines)
+    # loss prints a total after the last sentence
+    if tool == 'loss' and result['latencies']:
+      result['latencies'].pop()
+    results.append(summarize(tool, config, result, test_tokens, test_sentences))
+
+  if 'sample' in args.tools:
+    print('Running sample...', file=sys.stderr)
+    command = [os.path.join(bin_dir, 'sample'), model, '--max_length', str(args.sample_max_length)]
+    result = run_tool(command, None, sentence_lines=is_any, max_sentences=args.sample_sentences)
+    # sample prints one sentence per line, so its tokens are the words it wrote
+    results.append(summarize('sample', config, result, result['output_words'], result['output_sentences']))
+  return results
+
+def main():
+  parser = argparse.ArgumentParser(description='End-to-end benchmark of the MorphLM tools')
+  parser.add_argument('--bin_dir', default='bin')
+  parser.add_argument('--work_dir', default='benchmark')
+  parser.add_argument('--sentences', default='1000,10000', help='Comma-separated training corpus sizes')
+  parser.add_argument('--vocab_sizes', default='5000', help='Comma-separated word/root vocabulary sizes')
+  parser.add_argument('--ambiguity', default='1.5,3', help='Comma-separated mean numbers of analyses per word')
+  parser.add_argument('--tools', default='train,loss,modes,disambig,sample')
+  parser.add_argument('--iterations', type=int, default=1, help='Training epochs')
+  parser.add_argument('--test_sentences', type=int, default=500)
+  parser.add_argument('--sample_sentences', type=int, default=100)
+  parser.add_argument('--sample_max_length', type=int, default=50)
+  parser.add_argument('--seed', type=int, default=1)
+  parser.add_argument('--json', help='Also write the results to this file as JSON')
+  args = parser.parse_args()
+  args.tools = set(args.tools.split(','))
+
+  results = []
+  grid = itertools.product(
+    [int(x) for x in args.sentences.split(',')],
+    [int(x) for x in args.vocab_sizes.split(',')],
+    [float(x) for x in args.ambiguity.split(',')])
+  for sentences, vocab_size, ambiguity in grid:
+    results += benchmark(args, sentences, vocab_size, ambiguity)
+
+  columns = ['tool', 'sentences', 'vocab_size', 'ambiguity', 'seconds', 'tokens_per_sec', 'sentences_per_sec',
+    'startup_seconds', 'latency_p50_ms', 'latency_p95_ms', 'latency_p99_ms', 'peak_rss_mb']
+  print('\t'.join(columns))
+  for result in results:
+    # train has no per-sentence output, so no startup time
+    print('\t'.join(('%.3f' % result[c]) if isinstance(result[c], float) else '-' if result[c] is None else str(result[c]) for c in columns))
+
+  if args.json:
+    with open(args.json, 'w') as f:
+      json.dump(results, f, indent=2)
+
+if __name__ == '__main__':
+  main()
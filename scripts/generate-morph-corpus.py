@@ -0,0 +1,169 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# Generates a synthetic, morphologically analyzed corpus in the format the
+# MorphLM tools read (one word per line: the surface form followed by
+# analysis/probability pairs, blank lines between sentences), along with
+# word, root and character vocabulary files.
+#
+# Word frequencies are Zipfian, words are built from a root and a chain of
+# affixes, and words have a configurable number of competing analyses, so
+# the output exercises the same code paths as real omorfi output.
+#
+# Example:
+#   python generate-morph-corpus.py --output_dir corpus --sentences 10000 --ambiguity 3
+from __future__ import print_function, unicode_literals
+import argparse
+import bisect
+import io
+import os
+import random
+
+LETTERS = 'aaaeeiiiooouuyyäähjkkllmnnprssttv'
+VOWELS = 'aeiouyäö'
+
+def random_morph(rng, min_length, max_length):
+  length = rng.randint(min_length, max_length)
+  morph = ''
+  for i in range(length):
+    # Alternate consonants and vowels loosely, so morphemes look like words
+    pool = VOWELS if i % 2 == 1 else LETTERS
+    morph += rng.choice(pool)
+  return morph
+
+class Lexicon(object):
+  def __init__(self, rng, args):
+    self.rng = rng
+    self.roots = [random_morph(rng, 2, 7) for _ in range(args.roots)]
+    self.affixes = [random_morph(rng, 1, 3) for _ in range(args.affixes)]
+    # Affixes are Zipfian too: a few case endings are much more common.
+    self.affix_cdf = zipf_cdf(len(self.affixes), args.zipf)
+    self.root_cdf = zipf_cdf(len(self.roots), args.zipf)
+
+    self.words = []
+    self.analyses = []
+    seen = set()
+    while len(self.words) < args.word_types:
+      root = self.sample_root()
+      affixes = self.sample_affixes(args.max_affixes)
+      surface = root + ''.join(self.affixes[a] for a in affixes)
+      if surface in seen:
+        continue
+      seen.add(surface)
+      self.words.append(surface)
+      if rng.random() < args.unknown_rate:
+        self.analyses.append([('*UNKNOWN*', 1.0)])
+        continue
+      self.analyses.append(self.make_analyses(root, affixes, args))
+    self.word_cdf = zipf_cdf(len(self.words), args.zipf)
+
+  def sample_root(self):
+    return self.roots[sample(self.rng, self.root_cdf)]
+
+  def sample_affixes(self, max_affixes):
+    count = min(max_affixes, int(self.rng.expovariate(1.0)))
+    return [sample(self.rng, self.affix_cdf) for _ in range(count)]
+
+  def make_analyses(self, root, affixes, args):
+    # Geometric number of extra analyses, with the requested mean.
+    count = 1
+    while count < args.max_analyses and self.rng.random() < 1.0 - 1.0 / args.ambiguity:
+      count += 1
+
+    analyses = [root + ''.join('+' + self.affix_tag(a) for a in affixes)]
+    while len(analyses) < count:
+      # Competing analyses: a different segmentation, root or affix chain
+      other_root = root if self.rng.random() < 0.5 else self.sample_root()
+      other_affixes = self.sample_affixes(args.max_affixes)
+      analysis = other_root + ''.join('+' + self.affix_tag(a) for a in other_affixes)
+      if analysis not in analyses:
+        analyses.append(analysis)
+
+    weights = [self.rng.random() ** 2 for _ in analyses]
+    weights[0] += 1.0
+    total = sum(weights)
+    return [(analysis, weight / total) for analysis, weight in zip(analyses, weights)]
+
+  def affix_tag(self, affix):
+    return 'A%d' % affix
+
+  def sample_sentence(self, mean_length):
+    length = max(1, int(self.rng.gauss(mean_length, mean_length / 2.0)))
+    return [sample(self.rng, self.word_cdf) for _ in range(length)]
+
+def zipf_cdf(n, exponent):
+  cdf = []
+  total = 0.0
+  for rank in range(1, n + 1):
+    total += 1.0 / rank ** exponent
+    cdf.append(total)
+  return [x / total for x in cdf]
+
+def sample(rng, cdf):
+  return min(bisect.bisect_left(cdf, rng.random()), len(cdf) - 1)
+
+def write_corpus(filename, lexicon, sentence_count, mean_length, counts):
+  with io.open(filename, 'w', encoding='utf-8') as f:
+    for _ in range(sentence_count):
+      for word in lexicon.sample_sentence(mean_length):
+        if counts is not None:
+          counts[word] = counts.get(word, 0) + 1
+        fields = [lexicon.words[word]]
+        for analysis, prob in lexicon.analyses[word]:
+          fields.append(analysis)
+          fields.append('%.4f' % prob)
+        f.write('\t'.join(fields) + '\n')
+      f.write('\n')
+
+def write_vocab(filename, items):
+  with io.open(filename, 'w', encoding='utf-8') as f:
+    for item in items:
+      f.write(item + '\n')
+
+def main():
+  parser = argparse.ArgumentParser(description='Generate a synthetic morphologically analyzed corpus')
+  parser.add_argument('--output_dir', required=True)
+  parser.add_argument('--sentences', type=int, default=10000, help='Training sentences')
+  parser.add_argument('--dev_sentences', type=int, default=500)
+  parser.add_argument('--test_sentences', type=int, default=500)
+  parser.add_argument('--mean_length', type=float, default=12.0, help='Mean sentence length in words')
+  parser.add_argument('--word_types', type=int, default=20000, help='Number of distinct surface forms')
+  parser.add_argument('--roots', type=int, default=8000)
+  parser.add_argument('--affixes', type=int, default=150)
+  parser.add_argument('--max_affixes', type=int, default=4, help='Longest affix chain')
+  parser.add_argument('--ambiguity', type=float, default=2.0, help='Mean number of analyses per word')
+  parser.add_argument('--max_analyses', type=int, default=10)
+  parser.add_argument('--unknown_rate', type=float, default=0.02, help='Fraction of word types omorfi does not know')
+  parser.add_argument('--zipf', type=float, default=1.0, help='Zipf exponent of word, root and affix frequencies')
+  parser.add_argument('--word_vocab_size', type=int, default=5000, help='Most frequent words to put in the word vocab')
+  parser.add_argument('--root_vocab_size', type=int, default=5000, help='Most frequent roots to put in the root vocab')
+  parser.add_argument('--seed', type=int, default=1)
+  args = parser.parse_args()
+  assert args.ambiguity >= 1.0
+
+  rng = random.Random(args.seed)
+  lexicon = Lexicon(rng, args)
+  if not os.path.isdir(args.output_dir):
+    os.makedirs(args.output_dir)
+
+  counts = {}
+  write_corpus(os.path.join(args.output_dir, 'train.txt'), lexicon, args.sentences, args.mean_length, counts)
+  write_corpus(os.path.join(args.output_dir, 'dev.txt'), lexicon, args.dev_sentences, args.mean_length, None)
+  write_corpus(os.path.join(args.output_dir, 'test.txt'), lexicon, args.test_sentences, args.mean_length, None)
+
+  by_frequency = sorted(counts, key=lambda w: -counts[w])
+  write_vocab(os.path.join(args.output_dir, 'word_vocab'), [lexicon.words[w] for w in by_frequency[:args.word_vocab_size]])
+
+  root_counts = {}
+  chars = set()
+  for word in by_frequency:
+    chars.update(lexicon.words[word])
+    for analysis, _ in lexicon.analyses[word]:
+      root = analysis.split('+')[0]
+      if root != '*UNKNOWN*':
+        root_counts[root] = root_counts.get(root, 0) + counts[word]
+  roots = sorted(root_counts, key=lambda r: -root_counts[r])
+  write_vocab(os.path.join(args.output_dir, 'root_vocab'), roots[:args.root_vocab_size])
+  write_vocab(os.path.join(args.output_dir, 'char_vocab'), sorted(chars))
+
+if __name__ == '__main__':
+  main()
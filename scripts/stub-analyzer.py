@@ -0,0 +1,47 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# Stands in for omorfi behind an analyzer wrapper, for testing AnalyzerPool
+# and the tools built on it without omorfi installed. Speaks the same
+# protocol: reads one word per line and answers each with lines of
+# "word<TAB>root+affix+...<TAB>weight" followed by a blank line.
+#
+# Analyses are made up but deterministic: the word's first half is the
+# root, and its last one or two characters become affixes. Words with
+# digits in them are unknown (weight "inf").
+#
+# Example:
+#   printf 'talossa\n' | python scripts/stub-analyzer.py
+from __future__ import print_function
+import argparse
+import io
+import sys
+import time
+
+def analyze(word):
+  if any(c.isdigit() for c in word):
+    return [(word, 'inf')]
+  half = max(1, (len(word) + 1) // 2)
+  analyses = [(word[:half] + ''.join('+S_' + c for c in word[half:][-2:]), '1.5')]
+  if len(word) > 3:
+    analyses.append((word[:-1] + '+S_' + word[-1], '2.25'))
+  analyses.append((word, '4'))
+  return analyses
+
+def main():
+  parser = argparse.ArgumentParser(description='Fake morphological analyzer with omorfi\'s protocol')
+  parser.add_argument('--delay', type=float, default=0.0, help='Seconds to sleep per word, to imitate a slow analyzer')
+  args = parser.parse_args()
+
+  stdin = io.open(sys.stdin.fileno(), 'r', encoding='utf-8', newline='\n')
+  stdout = io.open(sys.stdout.fileno(), 'w', encoding='utf-8')
+  for line in iter(stdin.readline, ''):
+    word = line.strip()
+    if args.delay > 0:
+      time.sleep(args.delay)
+    for analysis, weight in analyze(word):
+      stdout.write('%s\t%s\t%s\n' % (word, analysis, weight))
+    stdout.write('\n')
+    stdout.flush()
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "allreduce.h"
+#include "framing.h"
+
+RingAllreduce::RingAllreduce(unsigned rank, const vector<string>& addresses) :
+    node_rank(rank), addresses(addresses), listen_fd(-1), next_fd(-1), previous_fd(-1) {
+  assert (rank < addresses.size());
+}
+
+RingAllreduce::~RingAllreduce() {
+  for (int fd : {listen_fd, next_fd, previous_fd}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+bool RingAllreduce::Connect(unsigned timeout) {
+  if (size() == 1) {
+    return true;
+  }
+
+  listen_fd = ListenSocket(addresses[node_rank]);
+  if (listen_fd < 0) {
+    return false;
+  }
+
+  // The kernel completes the connection to our successor's listening socket
+  // before it calls accept, so every node can connect first and accept
+  // second without deadlocking.
+  const string& next_address = addresses[(node_rank + 1) % size()];
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(timeout);
+  cerr << "Node " << node_rank << " connecting to " << next_address << "..." << endl;
+  while ((next_fd = ConnectSocket(next_address, true)) < 0) {
+    if (chrono::steady_clock::now() > deadline) {
+      cerr << "Timed out connecting to " << next_address << endl;
+      return false;
+    }
+    usleep(100000);
+  }
+
+  pollfd p = {listen_fd, POLLIN, 0};
+  int remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+  if (poll(&p, 1, max(remaining, 0)) <= 0 || (previous_fd = accept(listen_fd, nullptr, nullptr)) < 0) {
+    cerr << "Timed out waiting for node " << (node_rank + size() - 1) % size() << " to connect" << endl;
+    return false;
+  }
+  close(listen_fd);
+  listen_fd = -1;
+  cerr << "Node " << node_rank << " of " << size() << " connected" << endl;
+  return true;
+}
+
+bool RingAllreduce::Exchange(const char* send_buffer, size_t send_length, char* receive_buffer, size_t receive_length) {
+  while (send_length > 0 || receive_length > 0) {
+    pollfd fds[2] = {{next_fd, (short)(send_length > 0 ? POLLOUT : 0), 0}, {previous_fd, (short)(receive_length > 0 ? POLLIN : 0), 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (fds[0].revents & (POLLERR | POLLHUP)) {
+      return false;
+    }
+    if (fds[0].revents & POLLOUT) {
+      ssize_t r = send(next_fd, send_buffer, send_length, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        return false;
+      }
+      if (r > 0) {
+        send_buffer += r;
+        send_length -= r;
+      }
+    }
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t r = recv(previous_fd, receive_buffer, receive_length, MSG_DONTWAIT);
+      if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        return false;
+      }
+      if (r > 0) {
+        receive_buffer += r;
+        receive_length -= r;
+      }
+    }
+  }
+  return true;
+}
+
+template <class T, class Op>
+bool RingAllreduce::Reduce(T* data, size_t count, Op op) {
+  const unsigned n = size();
+  if (n == 1 || count == 0) {
+    return true;
+  }
+
+  // Chunk c is [offsets[c], offsets[c + 1]).
+  vector<size_t> offsets(n + 1);
+  for (unsigned c = 0; c <= n; ++c) {
+    offsets[c] = count * c / n;
+  }
+  auto chunk_bytes = [&](unsigned c) { return (offsets[c + 1] - offsets[c]) * sizeof(T); };
+  scratch.resize((count + n - 1) / n * sizeof(T));
+  T* incoming = (T*)scratch.data();
+
+  // After step s of the first lap, chunk rank - s - 1 holds the sum over
+  // s + 2 nodes, so after n - 1 steps we hold the full sum of chunk rank + 1.
+  for (unsigned step = 0; step + 1 < n; ++step) {
+    unsigned send_chunk = (node_rank + n - step) % n;
+    unsigned receive_chunk = (node_rank + n - step - 1) % n;
+    if (!Exchange((const char*)(data + offsets[send_chunk]), chunk_bytes(send_chunk), (char*)incoming, chunk_bytes(receive_chunk))) {
+      return false;
+    }
+    T* target = data + offsets[receive_chunk];
+    for (size_t i = 0; i < offsets[receive_chunk + 1] - offsets[receive_chunk]; ++i) {
+      target[i] = op(target[i], incoming[i]);
+    }
+  }
+
+  // The second lap passes the finished chunks on.
+  for (unsigned step = 0; step + 1 < n; ++step) {
+    unsigned send_chunk = (node_rank + 1 + n - step) % n;
+    unsigned receive_chunk = (node_rank + n - step) % n;
+    if (!Exchange((const char*)(data + offsets[send_chunk]), chunk_bytes(send_chunk), (char*)(data + offsets[receive_chunk]), chunk_bytes(receive_chunk))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RingAllreduce::Sum(float* data, size_t count) {
+  return Reduce(data, count, [](float a, float b) { return a + b; });
+}
+
+bool RingAllreduce::Or(uint8_t* data, size_t count) {
+  return Reduce(data, count, [](uint8_t a, uint8_t b) { return (uint8_t)(a | b); });
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Ring allreduce between the processes of a multi-node job, over plain TCP
+// or Unix sockets. Node i listens on addresses[i] and connects to node
+// i + 1, so the nodes form a ring. A vector is reduced by splitting it into
+// one chunk per node and passing chunks around the ring twice: the first
+// lap sums each chunk, the second hands the sums to everyone. Each node
+// sends and receives about twice the vector's size, however many nodes
+// there are, and every node ends up with bitwise identical results.
+class RingAllreduce {
+public:
+  RingAllreduce(unsigned rank, const vector<string>& addresses);
+  ~RingAllreduce();
+
+  RingAllreduce(const RingAllreduce&) = delete;
+  RingAllreduce& operator=(const RingAllreduce&) = delete;
+
+  // Sets up the ring, waiting up to timeout seconds for the other nodes.
+  bool Connect(unsigned timeout = 300);
+
+  unsigned rank() const { return node_rank; }
+  unsigned size() const { return addresses.size(); }
+
+  // Replaces data, on every node, with its element-wise sum (or bitwise or)
+  // over all nodes. Every node must make the same calls with the same
+  // counts. Returns false if a neighbour went away.
+  bool Sum(float* data, size_t count);
+  bool Or(uint8_t* data, size_t count);
+
+private:
+  template <class T, class Op>
+  bool Reduce(T* data, size_t count, Op op);
+  // Sends to the next node while receiving from the previous one, so that
+  // neither blocks the other when socket buffers fill up.
+  bool Exchange(const char* send_buffer, size_t send_length, char* receive_buffer, size_t receive_length);
+
+  unsigned node_rank;
+  vector<string> addresses;
+  int listen_fd;
+  int next_fd;
+  int previous_fd;
+  vector<char> scratch;
+};
@@ -0,0 +1,64 @@
+#include <boost/program_options.hpp>
+
+#include <iostream>
+
+#include "analyzer.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// Turns whitespace tokenized text (one sentence per line) into
+// morphologically analyzed text, as read by train, loss and friends.
+int main(int argc, char** argv) {
+  po::options_description desc("description");
+  desc.add_options()
+  ("analyzer", po::value<string>()->required(), "Analyzer command, e.g. a wrapper around omorfi-analyse-tokenised.sh (see scripts/stub-analyzer.py)")
+  ("processes,j", po::value<unsigned>()->default_value(1), "Number of analyzer processes to run")
+  ("batch_size", po::value<unsigned>()->default_value(64), "Number of words to write to an analyzer at once")
+  ("sentences_per_batch", po::value<unsigned>()->default_value(256), "Number of input sentences to analyze together")
+  ("cache", po::value<string>(), "Word analysis cache. Read at startup if it exists, and written at the end")
+  ("help", "Display this help message");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+
+  const unsigned sentences_per_batch = vm["sentences_per_batch"].as<unsigned>();
+  AnalysisCache cache;
+  if (vm.count("cache") && cache.Load(vm["cache"].as<string>())) {
+    cerr << "Loaded " << cache.size() << " word analyses from " << vm["cache"].as<string>() << endl;
+  }
+  AnalyzerPool analyzer(vm["analyzer"].as<string>(), vm["processes"].as<unsigned>(), vm["batch_size"].as<unsigned>(), &cache);
+
+  unsigned sentence_count = 0;
+  while (true) {
+    vector<string> words;
+    vector<vector<string>> sentences = ReadTokenizedSentences(cin, sentences_per_batch, &words);
+    if (sentences.empty()) {
+      break;
+    }
+
+    vector<WordAnalysis> analyses = analyzer.Analyze(words);
+    unsigned k = 0;
+    for (const vector<string>& sentence : sentences) {
+      for (const string& word : sentence) {
+        cout << FormatMorphLine(word, analyses[k++]) << "\n";
+      }
+      cout << "\n";
+    }
+    cout.flush();
+    sentence_count += sentences.size();
+  }
+
+  cerr << "Analyzed " << sentence_count << " sentences: " << cache.hits << " tokens from the cache, " << cache.misses << " word types from the analyzer" << endl;
+  if (vm.count("cache")) {
+    cache.Save(vm["cache"].as<string>());
+  }
+  return 0;
+}
@@ -0,0 +1,402 @@
+#include <cmath>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_set>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "analyzer.h"
+#include "io.h"
+
+Subprocess::Subprocess(const string& command) {
+  int input_pipe[2];
+  int output_pipe[2];
+  if (pipe(input_pipe) != 0 || pipe(output_pipe) != 0) {
+    cerr << "Unable to create pipes for " << command << endl;
+    exit(1);
+  }
+  // A child that dies would otherwise kill us with SIGPIPE on our next
+  // write, instead of letting us report it.
+  signal(SIGPIPE, SIG_IGN);
+
+  child = fork();
+  if (child < 0) {
+    cerr << "Unable to fork to run " << command << endl;
+    exit(1);
+  }
+  if (child == 0) {
+    dup2(input_pipe[0], 0);
+    dup2(output_pipe[1], 1);
+    close(input_pipe[0]);
+    close(input_pipe[1]);
+    close(output_pipe[0]);
+    close(output_pipe[1]);
+    execl("/bin/sh", "sh", "-c", command.c_str(), (char*) NULL);
+    cerr << "Unable to run " << command << endl;
+    _exit(127);
+  }
+
+  close(input_pipe[0]);
+  close(output_pipe[1]);
+  to_child = input_pipe[1];
+  from_child = output_pipe[0];
+  // Children forked later (e.g. the other analyzers of a pool) must not
+  // hold on to our ends of the pipes, or this child never sees EOF.
+  fcntl(to_child, F_SETFD, FD_CLOEXEC);
+  fcntl(from_child, F_SETFD, FD_CLOEXEC);
+}
+
+Subprocess::~Subprocess() {
+  close(to_child);
+  close(from_child);
+  waitpid(child, nullptr, 0);
+}
+
+void Subprocess::write(const string& input) {
+  size_t written = 0;
+  while (written < input.size()) {
+    ssize_t r = ::write(to_child, input.data() + written, input.size() - written);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      cerr << "Unable to write to child process " << child << ": " << strerror(errno) << endl;
+      exit(1);
+    }
+    written += r;
+  }
+}
+
+bool Subprocess::fill() {
+  char chunk[4096];
+  ssize_t r;
+  do {
+    r = read(from_child, chunk, sizeof(chunk));
+  } while (r < 0 && errno == EINTR);
+  if (r <= 0) {
+    return false;
+  }
+  buffer.append(chunk, r);
+  return true;
+}
+
+string Subprocess::read_line() {
+  size_t end;
+  while ((end = buffer.find('\n')) == string::npos) {
+    if (!fill()) {
+      string rest = buffer;
+      buffer.clear();
+      return rest;
+    }
+  }
+  string line = buffer.substr(0, end);
+  buffer.erase(0, end + 1);
+  return line;
+}
+
+string Subprocess::read_until_blank_line() {
+  ostringstream ss;
+  while (true) {
+    string s = read_line();
+    if (s.size() == 0) {
+      break;
+    }
+    ss << s << endl;
+  }
+  return ss.str();
+}
+
+string FormatMorphLine(const string& word, const WordAnalysis& analysis) {
+  assert (analysis.analyses.size() == analysis.probs.size());
+  assert (analysis.analyses.size() > 0);
+  ostringstream line;
+  line << word;
+  for (unsigned i = 0; i < analysis.analyses.size(); ++i) {
+    line << "\t" << analysis.analyses[i] << "\t" << analysis.probs[i];
+  }
+  return line.str();
+}
+
+AnalysisCache::AnalysisCache() : hits(0), misses(0), dirty(false) {}
+
+const WordAnalysis* AnalysisCache::Find(const string& word) const {
+  auto it = entries.find(word);
+  return (it != entries.end()) ? &it->second : nullptr;
+}
+
+void AnalysisCache::Insert(const string& word, const WordAnalysis& analysis) {
+  entries[word] = analysis;
+  dirty = true;
+}
+
+bool AnalysisCache::Load(const string& filename) {
+  ifstream f(filename);
+  if (!f.is_open()) {
+    return false;
+  }
+  unsigned line_number = 0;
+  for (string line; getline(f, line);) {
+    line_number++;
+    vector<string> pieces = tokenize(strip(line), "\t");
+    if (pieces.size() < 3 || pieces.size() % 2 != 1) {
+      cerr << "Ignoring malformed line " << line_number << " of analysis cache " << filename << endl;
+      continue;
+    }
+    WordAnalysis& analysis = entries[pieces[0]];
+    analysis.analyses.clear();
+    analysis.probs.clear();
+    for (unsigned i = 1; i < pieces.size(); i += 2) {
+      analysis.analyses.push_back(pieces[i]);
+      analysis.probs.push_back(atof(pieces[i + 1].c_str()));
+    }
+  }
+  dirty = false;
+  return true;
+}
+
+bool AnalysisCache::Save(const string& filename) const {
+  if (!dirty) {
+    return true;
+  }
+  // Written to a temporary file first, so an interrupted save never
+  // destroys the previous cache.
+  const string temp_filename = filename + ".tmp";
+  {
+    ofstream f(temp_filename);
+    if (!f.is_open()) {
+      cerr << "Unable to write analysis cache to " << temp_filename << endl;
+      return false;
+    }
+    for (const auto& entry : entries) {
+      f << FormatMorphLine(entry.first, entry.second) << "\n";
+    }
+  }
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    cerr << "Unable to move analysis cache into place at " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+AnalyzerPool::AnalyzerPool(const string& command, unsigned size, unsigned batch_size, AnalysisCache* cache) : batch_size(batch_size), cache((cache != nullptr) ? cache : &own_cache) {
+  assert (size > 0 && batch_size > 0);
+  workers.resize(size);
+  for (Worker& worker : workers) {
+    worker.process.reset(new Subprocess(command));
+    worker.written = 0;
+    // Writes must never block while the analyzer waits for us to read.
+    int flags = fcntl(worker.process->input_fd(), F_GETFL);
+    fcntl(worker.process->input_fd(), F_SETFL, flags | O_NONBLOCK);
+  }
+}
+
+vector<WordAnalysis> AnalyzerPool::Analyze(const vector<string>& words) {
+  vector<string> missing;
+  unordered_set<string> seen;
+  for (const string& word : words) {
+    if (cache->Find(word) == nullptr && seen.insert(word).second) {
+      missing.push_back(word);
+    }
+  }
+  cache->misses += missing.size();
+  cache->hits += words.size() - missing.size();
+  if (missing.size() > 0) {
+    Run(missing);
+  }
+
+  vector<WordAnalysis> analyses;
+  analyses.reserve(words.size());
+  for (const string& word : words) {
+    const WordAnalysis* analysis = cache->Find(word);
+    assert (analysis != nullptr);
+    analyses.push_back(*analysis);
+  }
+  return analyses;
+}
+
+// Deals the words out to the analyzers, then writes and reads whenever the
+// pipes allow until every word has been answered.
+void AnalyzerPool::Run(const vector<string>& words) {
+  const unsigned n = workers.size();
+  vector<unsigned> next(n);
+  for (unsigned k = 0; k < n; ++k) {
+    next[k] = k;
+  }
+
+  vector<pollfd> fds;
+  vector<unsigned> fd_workers;
+  while (true) {
+    fds.clear();
+    fd_workers.clear();
+    for (unsigned k = 0; k < n; ++k) {
+      Worker& worker = workers[k];
+      if (worker.written == worker.to_write.size() && next[k] < words.size()) {
+        // Queue the next batch of this analyzer's words
+        worker.to_write.clear();
+        worker.written = 0;
+        for (unsigned j = 0; j < batch_size && next[k] < words.size(); ++j, next[k] += n) {
+          worker.to_write += words[next[k]] + "\n";
+          worker.waiting.push_back(words[next[k]]);
+        }
+      }
+      if (worker.written < worker.to_write.size()) {
+        fds.push_back({worker.process->input_fd(), POLLOUT, 0});
+        fd_workers.push_back(k);
+      }
+      if (!worker.waiting.empty()) {
+        fds.push_back({worker.process->output_fd(), POLLIN, 0});
+        fd_workers.push_back(k);
+      }
+    }
+    if (fds.empty()) {
+      break;
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      cerr << "Error waiting for the analyzers: " << strerror(errno) << endl;
+      exit(1);
+    }
+
+    for (unsigned i = 0; i < fds.size(); ++i) {
+      Worker& worker = workers[fd_workers[i]];
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      if (fds[i].fd == worker.process->input_fd()) {
+        ssize_t r = write(fds[i].fd, worker.to_write.data() + worker.written, worker.to_write.size() - worker.written);
+        if (r < 0 && (errno == EAGAIN || errno == EINTR)) {
+          continue;
+        }
+        if (r < 0) {
+          cerr << "Analyzer " << worker.process->pid() << " stopped reading: " << strerror(errno) << endl;
+          exit(1);
+        }
+        worker.written += r;
+      }
+      else {
+        char chunk[65536];
+        ssize_t r = read(fds[i].fd, chunk, sizeof(chunk));
+        if (r < 0 && errno == EINTR) {
+          continue;
+        }
+        if (r <= 0) {
+          cerr << "Analyzer " << worker.process->pid() << " exited with " << worker.waiting.size() << " words unanswered" << endl;
+          exit(1);
+        }
+        worker.read_buffer.append(chunk, r);
+        while (ParseReply(worker)) {}
+      }
+    }
+  }
+}
+
+// Consumes the reply to the oldest word waiting for one, if all of it has
+// arrived.
+bool AnalyzerPool::ParseReply(Worker& worker) {
+  if (worker.waiting.empty()) {
+    return false;
+  }
+  vector<string> lines;
+  size_t start = 0;
+  while (true) {
+    size_t end = worker.read_buffer.find('\n', start);
+    if (end == string::npos) {
+      return false;
+    }
+    string line = strip(worker.read_buffer.substr(start, end - start));
+    start = end + 1;
+    if (line.empty()) {
+      break;
+    }
+    lines.push_back(line);
+  }
+  worker.read_buffer.erase(0, start);
+  cache->Insert(worker.waiting.front(), ToAnalysis(lines));
+  worker.waiting.pop_front();
+  return true;
+}
+
+// Turns the analyzer's costs into probabilities.
+WordAnalysis AnalyzerPool::ToAnalysis(const vector<string>& lines) {
+  WordAnalysis analysis;
+  vector<double> costs;
+  for (const string& line : lines) {
+    vector<string> pieces = tokenize(line, "\t");
+    if (pieces.size() < 2) {
+      continue;
+    }
+    string cost = (pieces.size() >= 3) ? pieces[2] : "0";
+    if (cost == "inf" || find(analysis.analyses.begin(), analysis.analyses.end(), pieces[1]) != analysis.analyses.end()) {
+      continue;
+    }
+    analysis.analyses.push_back(pieces[1]);
+    costs.push_back(atof(cost.c_str()));
+  }
+
+  if (analysis.analyses.empty()) {
+    analysis.analyses.push_back("*UNKNOWN*");
+    analysis.probs.push_back(1.0f);
+    return analysis;
+  }
+
+  const double min_cost = *min_element(costs.begin(), costs.end());
+  double total = 0.0;
+  for (double cost : costs) {
+    total += exp(min_cost - cost);
+  }
+  for (double cost : costs) {
+    analysis.probs.push_back(exp(min_cost - cost) / total);
+  }
+  return analysis;
+}
+
+vector<vector<string>> ReadTokenizedSentences(istream& f, unsigned max_sentences, vector<string>* words) {
+  vector<vector<string>> sentences;
+  for (string line; sentences.size() < max_sentences && getline(f, line);) {
+    istringstream tokens(line);
+    vector<string> sentence;
+    for (string token; tokens >> token;) {
+      sentence.push_back(token);
+    }
+    if (sentence.size() > 0) {
+      if (words != nullptr) {
+        words->insert(words->end(), sentence.begin(), sentence.end());
+      }
+      sentences.push_back(sentence);
+    }
+  }
+  return sentences;
+}
+
+vector<Sentence> ReadRawSentences(istream& f, AnalyzerPool& analyzer, unsigned max_sentences, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab) {
+  vector<string> words;
+  vector<vector<string>> sentences = ReadTokenizedSentences(f, max_sentences, &words);
+  vector<WordAnalysis> analyses = analyzer.Analyze(words);
+  vector<Sentence> out(sentences.size());
+  unsigned k = 0;
+  for (unsigned i = 0; i < sentences.size(); ++i) {
+    for (const string& word : sentences[i]) {
+      HandleMorphLine(FormatMorphLine(word, analyses[k++]), word_vocab, root_vocab, affix_vocab, char_vocab, out[i]);
+    }
+    EndMorphSentence(word_vocab, root_vocab, char_vocab, out[i]);
+  }
+  return out;
+}
+
+bool ReadRawSentence(istream& f, AnalyzerPool& analyzer, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, Sentence& out) {
+  vector<Sentence> sentences = ReadRawSentences(f, analyzer, 1, word_vocab, root_vocab, affix_vocab, char_vocab);
+  if (sentences.empty()) {
+    return false;
+  }
+  out = sentences[0];
+  return true;
+}
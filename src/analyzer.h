@@ -0,0 +1,125 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <iostream>
+#include <unordered_map>
+#include <sys/types.h>
+#include "dynet/dict.h"
+#include "utils.h"
+
+using namespace std;
+using namespace dynet;
+
+// A child process we talk to over its stdin and stdout.
+class Subprocess {
+public:
+  // command is run with /bin/sh -c, so it may contain arguments.
+  explicit Subprocess(const string& command);
+  // Closes the child's stdin and waits for it to exit.
+  ~Subprocess();
+
+  void write(const string& input);
+  string read_line();
+  string read_until_blank_line();
+
+  int input_fd() const { return to_child; }
+  int output_fd() const { return from_child; }
+  pid_t pid() const { return child; }
+
+private:
+  Subprocess(const Subprocess&) = delete;
+  Subprocess& operator=(const Subprocess&) = delete;
+  // Fills the read buffer. Returns false at end of file.
+  bool fill();
+
+  pid_t child;
+  int to_child;
+  int from_child;
+  string buffer;
+};
+
+// The analyses of one word type, in the same form as a line of
+// morphologically analyzed text: root+affix+... strings with probabilities.
+struct WordAnalysis {
+  vector<string> analyses;
+  vector<float> probs;
+};
+
+// Formats a word's analyses as a line of morphologically analyzed text.
+string FormatMorphLine(const string& word, const WordAnalysis& analysis);
+
+// Analyses of word types we've already seen. Saved as morphologically
+// analyzed text with one word type per line, so the cache can be reused
+// across runs (and models, since nothing in it depends on a vocabulary).
+class AnalysisCache {
+public:
+  AnalysisCache();
+  // Returns null if the word hasn't been analyzed yet.
+  const WordAnalysis* Find(const string& word) const;
+  void Insert(const string& word, const WordAnalysis& analysis);
+  // Loading a file that doesn't exist leaves the cache empty.
+  bool Load(const string& filename);
+  // Only writes anything if there are new entries since Load.
+  bool Save(const string& filename) const;
+
+  size_t size() const { return entries.size(); }
+  unsigned long long hits;
+  unsigned long long misses;
+
+private:
+  unordered_map<string, WordAnalysis> entries;
+  bool dirty;
+};
+
+// A pool of analyzer coprocesses, e.g. omorfi behind a wrapper. An analyzer
+// reads one word per line and answers each with one line per analysis,
+// "word<TAB>root+affix+...<TAB>weight", followed by a blank line, where the
+// weight is a cost (a negative log probability, "inf" if the word is
+// unknown). This is omorfi-analyse-tokenised's protocol, with analyses in
+// the form the rest of MorphLM expects.
+//
+// Words are written in batches without waiting for the answers, and the
+// answers are read as they arrive, so every analyzer is kept busy.
+class AnalyzerPool {
+public:
+  // Words are written to each analyzer batch_size at a time. The pool
+  // always caches what it learns, in cache if one is given.
+  AnalyzerPool(const string& command, unsigned size, unsigned batch_size, AnalysisCache* cache = nullptr);
+
+  // Analyzes a batch of words. Each word type is only analyzed once, and
+  // never if it's in the cache.
+  vector<WordAnalysis> Analyze(const vector<string>& words);
+
+private:
+  struct Worker {
+    unique_ptr<Subprocess> process;
+    // Words written to the analyzer that haven't been answered yet
+    deque<string> waiting;
+    string to_write;
+    size_t written;
+    string read_buffer;
+  };
+
+  void Run(const vector<string>& words);
+  bool ParseReply(Worker& worker);
+  static WordAnalysis ToAnalysis(const vector<string>& lines);
+
+  vector<Worker> workers;
+  unsigned batch_size;
+  // Used when we're not given a cache to keep
+  AnalysisCache own_cache;
+  AnalysisCache* cache;
+};
+
+// Reads up to max_sentences lines of whitespace tokenized text, skipping
+// empty ones. Optionally also returns all their words, in order.
+vector<vector<string>> ReadTokenizedSentences(istream& f, unsigned max_sentences, vector<string>* words = nullptr);
+
+// Reads a sentence of whitespace tokenized text (one sentence per line) and
+// analyzes it. The result is the same as reading the analyzed text with
+// ReadMorphSentence.
+bool ReadRawSentence(istream& f, AnalyzerPool& analyzer, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, Sentence& out);
+// Same for up to max_sentences sentences, which are analyzed together.
+vector<Sentence> ReadRawSentences(istream& f, AnalyzerPool& analyzer, unsigned max_sentences, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab);
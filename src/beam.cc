@@ -0,0 +1,489 @@
+#include <cassert>
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <functional>
+#include "beam.h"
+#include "engine_weights.h"
+#include "kernels.h"
+
+// Ids below this are UNK, <s> and </s> in the word, root and character
+// vocabularies (see train), none of which can be generated as a word.
+const WordId kFirstWordId = 3;
+
+// Indices of the k largest of scores[first, size), best first.
+static vector<unsigned> TopK(const float* scores, unsigned size, unsigned k, unsigned first) {
+  vector<unsigned> indices;
+  for (unsigned i = first; i < size; ++i) {
+    indices.push_back(i);
+  }
+  k = min(k, (unsigned)indices.size());
+  partial_sort(indices.begin(), indices.begin() + k, indices.end(), [&](unsigned a, unsigned b) { return scores[a] > scores[b]; });
+  indices.resize(k);
+  return indices;
+}
+
+static float LogAdd(float a, float b) {
+  if (a < b) {
+    swap(a, b);
+  }
+  return a + log1p(exp(b - a));
+}
+
+// Keeps kbest sorted, best first, and no longer than k.
+static void AddToKBest(KBestList& kbest, const Completion& completion, unsigned k) {
+  auto it = upper_bound(kbest.begin(), kbest.end(), completion, [](const Completion& a, const Completion& b) { return a.log_prob > b.log_prob; });
+  kbest.insert(it, completion);
+  if (kbest.size() > k) {
+    kbest.pop_back();
+  }
+}
+
+BeamSearch::BeamSearch(const InferenceEngine& engine, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, unsigned beam_size, unsigned max_word_length) :
+    engine(engine), word_vocab(word_vocab), root_vocab(root_vocab), affix_vocab(affix_vocab), char_vocab(char_vocab), beam_size(max(beam_size, 1u)), max_word_length(max_word_length), context_dim(engine.context_dim) {
+  assert (!engine.weights->config.bidirectional && "Generation not supported in bidirectional mode!");
+}
+
+// The state MakeLSTMInitialState gives each of the n columns of init.
+void BeamSearch::InitialState(const LSTMWeights& lstm, const float* init, unsigned n, LSTMState& state) {
+  const unsigned H = lstm.hidden_dim;
+  const unsigned layer_count = lstm.layers.size();
+  state.n = n;
+  state.c.resize(layer_count * H * n);
+  state.h.resize(layer_count * H * n);
+  for (unsigned l = 0; l < layer_count; ++l) {
+    for (unsigned j = 0; j < n; ++j) {
+      const float* src = init + (j * layer_count + l) * H;
+      copy(src, src + H, state.c.begin() + (l * n + j) * H);
+    }
+  }
+  Tanh(layer_count * H * n, state.c.data(), state.h.data());
+}
+
+// Feeds one input (a column of inputs, followed by the same column of
+// contexts if given) to each of the n LSTMs in state. This is one step of
+// InferenceEngine::RunLSTM, with the matrix-vector products turned into
+// matrix-matrix products over the columns.
+void BeamSearch::Step(const LSTMWeights& lstm, const float* inputs, unsigned input_rows, const float* contexts, LSTMState& state) {
+  const unsigned H = lstm.hidden_dim;
+  const unsigned n = state.n;
+  gates.resize(3 * H * n);
+  peepholes.resize(H * n);
+
+  const float* in = inputs;
+  unsigned in_rows = input_rows;
+  for (unsigned l = 0; l < lstm.layers.size(); ++l) {
+    const LSTMLayerWeights& layer = lstm.layers[l];
+    float* c = state.c.data() + l * H * n;
+    float* h = state.h.data() + l * H * n;
+
+    BroadcastColumns(layer.bias.data(), 3 * H, n, gates.data());
+    MatMulAdd(layer.wx.data(), 3 * H, in_rows, in, n, gates.data());
+    if (l == 0 && contexts != nullptr) {
+      MatMulAdd(layer.wx.data() + 3 * H * in_rows, 3 * H, layer.input_dim - in_rows, contexts, n, gates.data());
+    }
+    else {
+      assert (layer.input_dim == in_rows);
+    }
+    MatMulAdd(layer.wh.data(), 3 * H, H, h, n, gates.data());
+
+    fill(peepholes.begin(), peepholes.end(), 0.0f);
+    MatMulAdd(layer.c2i.data(), H, H, c, n, peepholes.data());
+    for (unsigned j = 0; j < n; ++j) {
+      float* g = gates.data() + j * 3 * H;
+      for (unsigned r = 0; r < H; ++r) {
+        g[r] += peepholes[j * H + r];
+      }
+      LSTMCellState(H, g, g + 2 * H, c + j * H, c + j * H);
+    }
+
+    fill(peepholes.begin(), peepholes.end(), 0.0f);
+    MatMulAdd(layer.c2o.data(), H, H, c, n, peepholes.data());
+    for (unsigned j = 0; j < n; ++j) {
+      float* g = gates.data() + j * 3 * H;
+      for (unsigned r = 0; r < H; ++r) {
+        g[H + r] += peepholes[j * H + r];
+      }
+      LSTMCellOutput(H, g + H, c + j * H, h + j * H);
+    }
+
+    in = h;
+    in_rows = H;
+  }
+}
+
+// Copies the given columns of from, in that order, into to.
+void BeamSearch::Gather(const LSTMWeights& lstm, const LSTMState& from, const vector<unsigned>& columns, LSTMState& to) {
+  const unsigned H = lstm.hidden_dim;
+  const unsigned layer_count = lstm.layers.size();
+  to.n = columns.size();
+  to.c.resize(layer_count * H * to.n);
+  to.h.resize(layer_count * H * to.n);
+  for (unsigned l = 0; l < layer_count; ++l) {
+    for (unsigned j = 0; j < to.n; ++j) {
+      assert (columns[j] < from.n);
+      unsigned src = (l * from.n + columns[j]) * H;
+      unsigned dest = (l * to.n + j) * H;
+      copy(from.c.begin() + src, from.c.begin() + src + H, to.c.begin() + dest);
+      copy(from.h.begin() + src, from.h.begin() + src + H, to.h.begin() + dest);
+    }
+  }
+}
+
+const float* BeamSearch::Top(const LSTMWeights& lstm, const LSTMState& state) const {
+  return state.h.data() + (lstm.layers.size() - 1) * lstm.hidden_dim * state.n;
+}
+
+void BeamSearch::FeedMLP(const MLPWeights& mlp, const float* inputs, unsigned n, vector<float>& outputs) {
+  hidden.resize(mlp.hidden_dim * n);
+  BroadcastColumns(mlp.wHb, mlp.hidden_dim, n, hidden.data());
+  MatMulAdd(mlp.wIH, mlp.hidden_dim, mlp.input_dim, inputs, n, hidden.data());
+  Tanh(mlp.hidden_dim * n, hidden.data(), hidden.data());
+  outputs.resize(mlp.output_dim * n);
+  BroadcastColumns(mlp.wOb, mlp.output_dim, n, outputs.data());
+  MatMulAdd(mlp.wHO, mlp.output_dim, mlp.hidden_dim, hidden.data(), n, outputs.data());
+}
+
+// Log distributions over the vocabulary for each of the n columns of inputs
+// (rows x n), as the columns of log_probs.
+void BeamSearch::LogSoftmax(const SoftmaxWeights& softmax, const float* inputs, unsigned rows, unsigned n, vector<float>& log_probs) {
+  if (softmax.quantized != nullptr) {
+    log_probs.clear();
+    for (unsigned j = 0; j < n; ++j) {
+      vector<float> column = softmax.quantized->LogDistribution(vector<float>(inputs + j * rows, inputs + (j + 1) * rows));
+      log_probs.insert(log_probs.end(), column.begin(), column.end());
+    }
+    return;
+  }
+
+  assert (softmax.input_dim == rows);
+  const unsigned V = softmax.vocab_size;
+  log_probs.resize(V * n);
+  BroadcastColumns(softmax.b, V, n, log_probs.data());
+  MatMulAdd(softmax.w, V, rows, inputs, n, log_probs.data());
+  for (unsigned j = 0; j < n; ++j) {
+    float* column = log_probs.data() + j * V;
+    log_softmax(column, V, column);
+  }
+}
+
+// Beam searches over one of the output decoders, for n contexts at once.
+// Column j of init is search j's initial state (as made by the decoder's
+// init MLP) and column j of contexts is appended to each of its inputs.
+// Returns up to width finished sequences per search, best first, without
+// their end_id. Ids below first_id are never generated.
+vector<vector<BeamSearch::Sequence>> BeamSearch::Decode(const LSTMWeights& lstm, const SoftmaxWeights& softmax, const EmbeddingTable& embeddings, const float* init, const float* contexts, unsigned n, WordId first_id, WordId end_id, unsigned width) {
+  const unsigned H = lstm.hidden_dim;
+  vector<vector<Sequence>> finished(n);
+
+  // The unfinished sequences, one per column of state, and which search
+  // each belongs to.
+  vector<Sequence> partial(n, Sequence {vector<WordId>(), 0.0f});
+  vector<unsigned> owners(n);
+  for (unsigned j = 0; j < n; ++j) {
+    owners[j] = j;
+  }
+  LSTMState state, next_state;
+  InitialState(lstm, init, n, state);
+
+  vector<float> log_probs;
+  vector<float> inputs;
+  vector<float> input_contexts;
+  for (unsigned length = 0; length < max_word_length && partial.size() > 0; ++length) {
+    LogSoftmax(softmax, Top(lstm, state), H, partial.size(), log_probs);
+    const unsigned V = log_probs.size() / partial.size();
+
+    // Each search's best extensions: (log prob, column, id).
+    vector<vector<tuple<float, unsigned, WordId>>> extensions(n);
+    for (unsigned j = 0; j < partial.size(); ++j) {
+      const float* column = log_probs.data() + j * V;
+      for (unsigned id : TopK(column, V, width, first_id)) {
+        extensions[owners[j]].push_back(make_tuple(partial[j].log_prob + column[id], j, (WordId)id));
+      }
+    }
+
+    vector<Sequence> next_partial;
+    vector<unsigned> next_owners;
+    vector<unsigned> survivors;
+    for (unsigned s = 0; s < n; ++s) {
+      vector<tuple<float, unsigned, WordId>>& e = extensions[s];
+      sort(e.begin(), e.end(), greater<tuple<float, unsigned, WordId>>());
+      for (unsigned i = 0; i < min(width, (unsigned)e.size()); ++i) {
+        float log_prob = get<0>(e[i]);
+        unsigned j = get<1>(e[i]);
+        WordId id = get<2>(e[i]);
+        // Log probabilities only go down, so once a search has width
+        // finished sequences nothing worse than all of them is kept.
+        if (finished[s].size() == width && log_prob <= finished[s].back().log_prob) {
+          break;
+        }
+        Sequence sequence {partial[j].ids, log_prob};
+        if (id == end_id) {
+          auto it = upper_bound(finished[s].begin(), finished[s].end(), sequence, [](const Sequence& a, const Sequence& b) { return a.log_prob > b.log_prob; });
+          finished[s].insert(it, sequence);
+          if (finished[s].size() > width) {
+            finished[s].pop_back();
+          }
+        }
+        else {
+          sequence.ids.push_back(id);
+          next_partial.push_back(sequence);
+          next_owners.push_back(s);
+          survivors.push_back(j);
+        }
+      }
+    }
+    if (next_partial.size() == 0) {
+      break;
+    }
+
+    const unsigned m = next_partial.size();
+    Gather(lstm, state, survivors, next_state);
+    swap(state, next_state);
+    inputs.resize(embeddings.dim * m);
+    input_contexts.resize(context_dim * m);
+    for (unsigned k = 0; k < m; ++k) {
+      embeddings.Lookup(next_partial[k].ids.back(), inputs.data() + k * embeddings.dim);
+      const float* context = contexts + next_owners[k] * context_dim;
+      copy(context, context + context_dim, input_contexts.begin() + k * context_dim);
+    }
+    Step(lstm, inputs.data(), embeddings.dim, input_contexts.data(), state);
+
+    partial.swap(next_partial);
+    owners.swap(next_owners);
+  }
+  return finished;
+}
+
+// Every way of extending each hypothesis in the beam (the columns of
+// main_state) by one word, with its log probability. With end_only, only
+// </s> is considered.
+vector<BeamSearch::Candidate> BeamSearch::Expand(const LSTMState& main_state, unsigned width, bool end_only) {
+  const InferenceEngine::Weights& w = *engine.weights;
+  const MorphLMConfig& config = w.config;
+  const unsigned n = main_state.n;
+  const float* contexts = Top(w.main_lstm_fwd, main_state);
+
+  vector<float> mode_log_probs;
+  FeedMLP(w.model_chooser, contexts, n, mode_log_probs);
+  const unsigned mode_count = w.model_chooser.output_dim;
+  for (unsigned j = 0; j < n; ++j) {
+    float* column = mode_log_probs.data() + j * mode_count;
+    log_softmax(column, mode_count, column);
+  }
+
+  // Mode 0 is </s>, then characters, morphemes and words, like Sample.
+  vector<Candidate> candidates;
+  for (unsigned j = 0; j < n; ++j) {
+    candidates.push_back(Candidate {j, "</s>", mode_log_probs[j * mode_count], false, Analysis()});
+  }
+  if (end_only) {
+    return candidates;
+  }
+  unsigned mode_index = 1;
+
+  {
+    vector<float> init;
+    FeedMLP(w.output_char_lstm_init, contexts, n, init);
+    WordId end_id = char_vocab.convert("</w>");
+    vector<vector<Sequence>> spellings = Decode(w.output_char_lstm, w.char_softmax, w.output_char_embeddings, init.data(), contexts, n, kFirstWordId, end_id, width);
+    for (unsigned j = 0; j < n; ++j) {
+      for (const Sequence& spelling : spellings[j]) {
+        if (spelling.ids.size() == 0) {
+          continue;
+        }
+        string surface;
+        for (WordId c : spelling.ids) {
+          surface += char_vocab.convert(c);
+        }
+        candidates.push_back(Candidate {j, surface, mode_log_probs[j * mode_count + mode_index] + spelling.log_prob, false, Analysis()});
+      }
+    }
+    mode_index++;
+  }
+
+  if (config.use_morphology) {
+    LogSoftmax(w.root_softmax, contexts, context_dim, n, scores);
+    const unsigned V = scores.size() / n;
+    vector<unsigned> parents;
+    vector<WordId> roots;
+    vector<float> root_log_probs;
+    for (unsigned j = 0; j < n; ++j) {
+      const float* column = scores.data() + j * V;
+      for (unsigned root : TopK(column, V, width, kFirstWordId)) {
+        parents.push_back(j);
+        roots.push_back(root);
+        root_log_probs.push_back(column[root]);
+      }
+    }
+
+    // The affix decoder starts from the root and the context, and then sees
+    // the context at every step.
+    const unsigned m = roots.size();
+    const unsigned root_dim = config.root_embedding_dim;
+    vector<float> decoder_inputs((root_dim + context_dim) * m);
+    vector<float> root_contexts(context_dim * m);
+    for (unsigned k = 0; k < m; ++k) {
+      float* x = decoder_inputs.data() + k * (root_dim + context_dim);
+      w.output_root_embeddings.Lookup(roots[k], x);
+      const float* context = contexts + parents[k] * context_dim;
+      copy(context, context + context_dim, x + root_dim);
+      copy(context, context + context_dim, root_contexts.begin() + k * context_dim);
+    }
+    vector<float> init;
+    FeedMLP(w.output_affix_lstm_init, decoder_inputs.data(), m, init);
+
+    // Affix ids below </w> are just UNK.
+    WordId end_id = affix_vocab.convert("</w>");
+    vector<vector<Sequence>> affix_sequences = Decode(w.output_affix_lstm, w.affix_softmax, w.output_affix_embeddings, init.data(), root_contexts.data(), m, end_id, end_id, width);
+    for (unsigned k = 0; k < m; ++k) {
+      unsigned j = parents[k];
+      for (const Sequence& affixes : affix_sequences[k]) {
+        Analysis analysis {roots[k], affixes.ids};
+        analysis.affixes.push_back(end_id);
+        string surface = root_vocab.convert(roots[k]);
+        for (WordId affix : affixes.ids) {
+          surface += "+" + affix_vocab.convert(affix);
+        }
+        float log_prob = mode_log_probs[j * mode_count + mode_index] + root_log_probs[k] + affixes.log_prob;
+        candidates.push_back(Candidate {j, surface, log_prob, true, analysis});
+      }
+    }
+    mode_index++;
+  }
+
+  if (config.use_words) {
+    LogSoftmax(w.word_softmax, contexts, context_dim, n, scores);
+    const unsigned V = scores.size() / n;
+    for (unsigned j = 0; j < n; ++j) {
+      const float* column = scores.data() + j * V;
+      for (unsigned word : TopK(column, V, width, kFirstWordId)) {
+        candidates.push_back(Candidate {j, word_vocab.convert(word), mode_log_probs[j * mode_count + mode_index] + column[word], false, Analysis()});
+      }
+    }
+    mode_index++;
+  }
+
+  // p(w | c) = \sum_M p(w | c, m) p(m), over the modes that produced w.
+  vector<Candidate> merged;
+  map<pair<unsigned, string>, unsigned> index;
+  for (const Candidate& candidate : candidates) {
+    auto key = make_pair(candidate.parent, candidate.surface);
+    auto it = index.find(key);
+    if (it == index.end()) {
+      index[key] = merged.size();
+      merged.push_back(candidate);
+      continue;
+    }
+    Candidate& existing = merged[it->second];
+    existing.log_prob = LogAdd(existing.log_prob, candidate.log_prob);
+    if (candidate.has_analysis && !existing.has_analysis) {
+      existing.has_analysis = true;
+      existing.analysis = candidate.analysis;
+    }
+  }
+  return merged;
+}
+
+// Feeds each chosen word to the main LSTM, continuing from its parent's
+// state, so column i of main_state becomes chosen[i]'s hypothesis.
+void BeamSearch::Advance(const vector<Candidate>& chosen, LSTMState& main_state) {
+  const InferenceEngine::Weights& w = *engine.weights;
+  // The main LSTM reads words the way they appear in the input, so each
+  // word needs a spelling, a word id and an analysis. Words generated
+  // without morphology get the analysis an unknown word gets from analyze,
+  // and analyses are spelled like their root.
+  Analysis unknown {root_vocab.convert("UNK"), vector<WordId>(1, affix_vocab.convert("</w>"))};
+  Sentence tokens;
+  vector<unsigned> parents;
+  for (const Candidate& candidate : chosen) {
+    parents.push_back(candidate.parent);
+    tokens.words.push_back(word_vocab.convert(candidate.surface));
+    tokens.analyses.push_back(vector<Analysis>(1, candidate.has_analysis ? candidate.analysis : unknown));
+    tokens.analysis_probs.push_back(vector<float>(1, 1.0f));
+
+    const string& spelling = candidate.has_analysis ? root_vocab.convert(candidate.analysis.root) : candidate.surface;
+    tokens.chars.push_back(vector<WordId>());
+    unsigned i = 0;
+    while (i < spelling.length()) {
+      unsigned len = UTF8Len(spelling[i]);
+      tokens.chars.back().push_back(char_vocab.convert(spelling.substr(i, len)));
+      i += len;
+    }
+    tokens.chars.back().push_back(char_vocab.convert("</w>"));
+  }
+
+  engine.EmbedSentence(tokens);
+  LSTMState next_state;
+  Gather(w.main_lstm_fwd, main_state, parents, next_state);
+  Step(w.main_lstm_fwd, engine.scratch.inputs.data(), engine.input_dim, nullptr, next_state);
+  swap(main_state, next_state);
+}
+
+void BeamSearch::StartPrefix(const Sentence& prefix, LSTMState& main_state) {
+  const InferenceEngine::Weights& w = *engine.weights;
+  assert (prefix.size() > 0);
+  InitialState(w.main_lstm_fwd, w.main_lstm_fwd_init, 1, main_state);
+  if (prefix.size() == 1) {
+    return;
+  }
+  engine.EmbedSentence(prefix);
+  for (unsigned i = 0; i + 1 < prefix.size(); ++i) {
+    Step(w.main_lstm_fwd, engine.scratch.inputs.data() + i * engine.input_dim, engine.input_dim, nullptr, main_state);
+  }
+}
+
+KBestList BeamSearch::Complete(const Sentence& prefix, unsigned k, unsigned max_length) {
+  LSTMState state;
+  StartPrefix(prefix, state);
+
+  KBestList kbest;
+  vector<Completion> beam(1, Completion {vector<string>(), 0.0f});
+  for (unsigned length = 0; beam.size() > 0; ++length) {
+    // The beam is sorted, and log probabilities only go down.
+    if (kbest.size() == k && beam[0].log_prob <= kbest.back().log_prob) {
+      break;
+    }
+
+    vector<Candidate> candidates = Expand(state, beam_size, length == max_length);
+    for (Candidate& candidate : candidates) {
+      candidate.log_prob += beam[candidate.parent].log_prob;
+    }
+    sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.log_prob > b.log_prob; });
+
+    vector<Candidate> chosen;
+    vector<Completion> next_beam;
+    for (const Candidate& candidate : candidates) {
+      if (kbest.size() == k && candidate.log_prob <= kbest.back().log_prob) {
+        break;
+      }
+      Completion completion {beam[candidate.parent].words, candidate.log_prob};
+      completion.words.push_back(candidate.surface);
+      if (candidate.surface == "</s>") {
+        AddToKBest(kbest, completion, k);
+      }
+      else if (chosen.size() < beam_size) {
+        chosen.push_back(candidate);
+        next_beam.push_back(completion);
+      }
+    }
+
+    if (chosen.size() > 0) {
+      Advance(chosen, state);
+    }
+    beam.swap(next_beam);
+  }
+  return kbest;
+}
+
+KBestList BeamSearch::NextWords(const Sentence& prefix, unsigned k) {
+  LSTMState state;
+  StartPrefix(prefix, state);
+
+  KBestList kbest;
+  for (const Candidate& candidate : Expand(state, max(beam_size, k), false)) {
+    AddToKBest(kbest, Completion {vector<string>(1, candidate.surface), candidate.log_prob}, k);
+  }
+  return kbest;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "dynet/dict.h"
+#include "engine.h"
+#include "utils.h"
+
+using namespace std;
+using namespace dynet;
+
+struct EmbeddingTable;
+
+// One generated continuation of a prefix, as surface strings, and its log
+// probability given the prefix.
+struct Completion {
+  vector<string> words;
+  float log_prob;
+};
+typedef vector<Completion> KBestList;
+
+// Beam search over a (forward only) MorphLM, for constrained generation:
+// the k best completions of a prefix, or the k best next words.
+//
+// Each step expands every hypothesis in the beam with all three output
+// modes: </s>, words from the word softmax, morphological analyses (the
+// best roots, each followed by a beam search over the affix decoder) and
+// character sequences (a beam search over the character decoder). The
+// same string produced by several modes is one word, whose probability is
+// the sum over those modes. A morpheme-mode word is shown as its analysis
+// (root+affix+...), since there is no generator to turn it back into text.
+//
+// All the hypotheses in the beam go through the main LSTM, the mode chooser
+// and the softmaxes together, as one matrix multiply per layer, and the
+// inner searches over the decoders are batched the same way.
+class BeamSearch {
+public:
+  BeamSearch(const InferenceEngine& engine, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, unsigned beam_size, unsigned max_word_length = 30);
+
+  // prefix is a sentence as read by ReadMorphSentence; its final </s> is
+  // ignored. Completions end with (and include) </s>, after at most
+  // max_length words.
+  KBestList Complete(const Sentence& prefix, unsigned k, unsigned max_length);
+  KBestList NextWords(const Sentence& prefix, unsigned k);
+
+private:
+  // Each LSTM layer's cell and hidden states for n hypotheses. Layer l's
+  // states are the H x n matrix starting at l * H * n.
+  struct LSTMState {
+    unsigned n;
+    vector<float> c;
+    vector<float> h;
+  };
+
+  // A finished output of one of the decoders.
+  struct Sequence {
+    vector<WordId> ids;
+    float log_prob;
+  };
+
+  // A possible next word for the hypothesis in column `parent`.
+  struct Candidate {
+    unsigned parent;
+    string surface;
+    float log_prob;
+    bool has_analysis;
+    Analysis analysis;
+  };
+
+  void InitialState(const LSTMWeights& lstm, const float* init, unsigned n, LSTMState& state);
+  void Step(const LSTMWeights& lstm, const float* inputs, unsigned input_rows, const float* contexts, LSTMState& state);
+  void Gather(const LSTMWeights& lstm, const LSTMState& from, const vector<unsigned>& columns, LSTMState& to);
+  const float* Top(const LSTMWeights& lstm, const LSTMState& state) const;
+
+  void FeedMLP(const MLPWeights& mlp, const float* inputs, unsigned n, vector<float>& outputs);
+  void LogSoftmax(const SoftmaxWeights& softmax, const float* inputs, unsigned rows, unsigned n, vector<float>& log_probs);
+
+  vector<vector<Sequence>> Decode(const LSTMWeights& lstm, const SoftmaxWeights& softmax, const EmbeddingTable& embeddings, const float* init, const float* contexts, unsigned n, WordId first_id, WordId end_id, unsigned width);
+  vector<Candidate> Expand(const LSTMState& main_state, unsigned width, bool end_only);
+  void Advance(const vector<Candidate>& chosen, LSTMState& main_state);
+  void StartPrefix(const Sentence& prefix, LSTMState& main_state);
+
+  InferenceEngine engine;
+  Dict& word_vocab;
+  Dict& root_vocab;
+  Dict& affix_vocab;
+  Dict& char_vocab;
+  unsigned beam_size;
+  unsigned max_word_length;
+  unsigned context_dim;
+
+  vector<float> gates;
+  vector<float> peepholes;
+  vector<float> hidden;
+  vector<float> scores;
+};
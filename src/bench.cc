@@ -0,0 +1,565 @@
+#include "dynet/dynet.h"
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <functional>
+#include <random>
+#include <chrono>
+#include <cmath>
+
+#include "morphlm.h"
+#include "io.h"
+#include "memory.h"
+#include "engine.h"
+#include "kernels.h"
+#include "utils.h"
+
+using namespace dynet;
+using namespace dynet::expr;
+using namespace std;
+namespace po = boost::program_options;
+
+typedef chrono::steady_clock Clock;
+
+struct BenchmarkResult {
+  string name;
+  unsigned tokens;
+  vector<double> ns_per_token;
+};
+
+// Runs one repetition of a benchmark and returns the number of tokens it
+// processed.
+typedef function<unsigned()> Benchmark;
+
+BenchmarkResult RunBenchmark(const string& name, unsigned warmup, unsigned repetitions, Benchmark benchmark) {
+  BenchmarkResult result;
+  result.name = name;
+  result.tokens = 0;
+  for (unsigned i = 0; i < warmup; ++i) {
+    benchmark();
+  }
+  for (unsigned i = 0; i < repetitions; ++i) {
+    Clock::time_point start = Clock::now();
+    unsigned tokens = benchmark();
+    double ns = chrono::duration<double, nano>(Clock::now() - start).count();
+    result.tokens = tokens;
+    result.ns_per_token.push_back(ns / tokens);
+  }
+  return result;
+}
+
+void WriteResults(const vector<BenchmarkResult>& results, bool json, ostream& out) {
+  if (json) {
+    out << "[" << endl;
+  }
+  else {
+    out << "benchmark\ttokens\trepetitions\tns_per_token\tstddev\tmin" << endl;
+  }
+
+  for (unsigned i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& result = results[i];
+    const vector<double>& v = result.ns_per_token;
+    double mean = 0.0;
+    double best = v.empty() ? 0.0 : v[0];
+    for (double x : v) {
+      mean += x;
+      best = min(best, x);
+    }
+    mean /= max((size_t)1, v.size());
+    double variance = 0.0;
+    for (double x : v) {
+      variance += (x - mean) * (x - mean);
+    }
+    double stddev = (v.size() > 1) ? sqrt(variance / (v.size() - 1)) : 0.0;
+
+    if (json) {
+      out << "  {\"benchmark\": \"" << result.name << "\", \"tokens\": " << result.tokens << ", \"repetitions\": " << v.size();
+      out << ", \"ns_per_token\": " << mean << ", \"stddev\": " << stddev << ", \"min\": " << best << "}" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    else {
+      out << result.name << "\t" << result.tokens << "\t" << v.size() << "\t" << mean << "\t" << stddev << "\t" << best << endl;
+    }
+  }
+
+  if (json) {
+    out << "]" << endl;
+  }
+}
+
+Sentence RandomSentence(const MorphLMConfig& config, const SentenceShape& shape, mt19937& rng) {
+  // Ids 0-3 are UNK and the special symbols, so stay clear of them.
+  auto random_id = [&](unsigned vocab_size) {
+    return (WordId)uniform_int_distribution<unsigned>(min(4u, vocab_size - 1), vocab_size - 1)(rng);
+  };
+
+  Sentence sentence;
+  for (unsigned i = 0; i < shape.words; ++i) {
+    sentence.words.push_back(random_id(config.word_vocab_size));
+    sentence.chars.push_back(vector<WordId>());
+    for (unsigned j = 0; j < shape.chars_per_word; ++j) {
+      sentence.chars.back().push_back(random_id(config.char_vocab_size));
+    }
+    sentence.analyses.push_back(vector<Analysis>());
+    sentence.analysis_probs.push_back(vector<float>());
+    for (unsigned j = 0; j < shape.analyses_per_word; ++j) {
+      Analysis analysis;
+      analysis.root = random_id(config.root_vocab_size);
+      for (unsigned k = 0; k < shape.affixes_per_analysis; ++k) {
+        analysis.affixes.push_back(random_id(config.affix_vocab_size));
+      }
+      sentence.analyses.back().push_back(analysis);
+      sentence.analysis_probs.back().push_back(1.0f / shape.analyses_per_word);
+    }
+  }
+
+  // </s> is id 2 in every vocabulary. It ends the sentence the way
+  // EndMorphSentence does, which BuildGraph relies on.
+  const WordId end_of_sentence = 2;
+  sentence.words.push_back(end_of_sentence);
+  Analysis eos_analysis = {end_of_sentence, vector<WordId>()};
+  sentence.analyses.push_back(vector<Analysis>(1, eos_analysis));
+  sentence.analysis_probs.push_back(vector<float>(1, 1.0f));
+  sentence.chars.push_back(vector<WordId>(1, end_of_sentence));
+  return sentence;
+}
+
+// Morphologically analyzed text in the same format as our corpora, with
+// made up words, roots and affixes.
+string RandomMorphText(const SentenceShape& shape, unsigned sentence_count, mt19937& rng) {
+  const string letters = "abcdefghijklmnopqrstuvwxyz";
+  auto random_string = [&](unsigned length) {
+    string s;
+    for (unsigned i = 0; i < length; ++i) {
+      s += letters[uniform_int_distribution<unsigned>(0, letters.size() - 1)(rng)];
+    }
+    return s;
+  };
+
+  ostringstream ss;
+  for (unsigned i = 0; i < sentence_count; ++i) {
+    for (unsigned j = 0; j < shape.words; ++j) {
+      ss << random_string(shape.chars_per_word);
+      for (unsigned k = 0; k < shape.analyses_per_word; ++k) {
+        ss << "\t" << random_string(4);
+        for (unsigned l = 0; l < shape.affixes_per_analysis; ++l) {
+          ss << "+" << random_string(2);
+        }
+        ss << "\t" << 1.0 / shape.analyses_per_word;
+      }
+      ss << "\n";
+    }
+    ss << "\n";
+  }
+  return ss.str();
+}
+
+double ReferenceLogSumExp(const vector<float>& v) {
+  double m = -INFINITY;
+  for (float x : v) {
+    m = max(m, (double)x);
+  }
+  if (std::isinf(m)) {
+    return m;
+  }
+  double sum = 0.0;
+  for (float x : v) {
+    sum += exp((double)x - m);
+  }
+  return m + log(sum);
+}
+
+// Compares logsumexp, log_softmax, sample_multinomial and the inference
+// engine's kernels on every set of numeric kernels this CPU supports
+// against a double precision reference.
+// Returns false if any of them is off by more than the tolerance.
+bool CheckNumericKernels(mt19937& rng) {
+  // Lengths around the vector widths, scales from tiny to huge, and some
+  // -inf scores (impossible outcomes).
+  vector<vector<float>> cases;
+  for (unsigned n : {1u, 2u, 7u, 8u, 9u, 15u, 16u, 17u, 33u, 100u, 1000u, 50000u}) {
+    for (float scale : {1e-3f, 1.0f, 30.0f, 1e4f}) {
+      vector<float> v(n);
+      for (float& x : v) {
+        x = uniform_real_distribution<float>(-scale, scale)(rng) + 1e3f;
+      }
+      cases.push_back(v);
+      for (unsigned i = 0; i < n; i += 3) {
+        v[i] = -INFINITY;
+      }
+      v[n - 1] = 0.0f;
+      cases.push_back(v);
+    }
+  }
+  cases.push_back(vector<float>(5, -INFINITY));
+
+  bool ok = true;
+  for (const string& name : supported_numeric_kernels()) {
+    set_numeric_kernels(name);
+    double worst = 0.0;
+    for (const vector<float>& v : cases) {
+      double expected = ReferenceLogSumExp(v);
+      float actual = logsumexp(v);
+      vector<float> normalized = log_softmax(v);
+      if (std::isinf(expected)) {
+        if (actual != expected) {
+          cerr << name << ": logsumexp of " << v.size() << " -inf scores is " << actual << endl;
+          ok = false;
+        }
+        continue;
+      }
+      // Relative to the largest score, since that's what limits float.
+      double tolerance = 1e-6 * max(1.0, fabs(expected));
+      worst = max(worst, fabs(actual - expected) / max(1.0, fabs(expected)));
+      if (fabs(actual - expected) > 10 * tolerance) {
+        cerr << name << ": logsumexp of " << v.size() << " scores is " << actual << ", expected " << expected << endl;
+        ok = false;
+      }
+      for (unsigned i = 0; i < v.size(); ++i) {
+        if (fabs(normalized[i] - (v[i] - expected)) > 10 * tolerance && !std::isinf(v[i])) {
+          cerr << name << ": log_softmax[" << i << "] of " << v.size() << " scores is " << normalized[i] << ", expected " << v[i] - expected << endl;
+          ok = false;
+          break;
+        }
+      }
+    }
+
+    // Sampling: the frequencies should match the distribution, and
+    // impossible outcomes should never come up.
+    vector<float> logprobs = {log(0.5f), -INFINITY, log(0.3f), log(0.15f), -INFINITY, log(0.05f)};
+    for (unsigned i = 0; i < 20; ++i) {
+      logprobs.push_back(-INFINITY);
+    }
+    const unsigned samples = 200000;
+    vector<unsigned> counts(logprobs.size());
+    mt19937 sample_rng(1);
+    for (unsigned i = 0; i < samples; ++i) {
+      counts[sample_multinomial(logprobs, sample_rng)]++;
+    }
+    for (unsigned i = 0; i < logprobs.size(); ++i) {
+      double expected = exp((double)logprobs[i]);
+      double actual = (double)counts[i] / samples;
+      if (fabs(actual - expected) > 0.01 || (expected == 0.0 && counts[i] > 0)) {
+        cerr << name << ": outcome " << i << " was sampled with frequency " << actual << ", expected " << expected << endl;
+        ok = false;
+      }
+    }
+    cerr << name << ": largest relative logsumexp error " << worst << endl;
+
+    // The inference engine's kernels, on sizes that leave vector tails.
+    const unsigned rows = 37, cols = 29, n = 6;
+    vector<float> W(rows * cols), X(cols * n), Y(rows * n, 0.5f);
+    for (float& x : W) {
+      x = uniform_real_distribution<float>(-2.0f, 2.0f)(rng);
+    }
+    for (float& x : X) {
+      x = uniform_real_distribution<float>(-2.0f, 2.0f)(rng);
+    }
+    MatMulAdd(W.data(), rows, cols, X.data(), n, Y.data());
+    double matmul_error = 0.0;
+    for (unsigned j = 0; j < n; ++j) {
+      for (unsigned r = 0; r < rows; ++r) {
+        double expected = 0.5;
+        for (unsigned c = 0; c < cols; ++c) {
+          expected += (double)W[c * rows + r] * X[j * cols + c];
+        }
+        matmul_error = max(matmul_error, fabs(Y[j * rows + r] - expected));
+      }
+    }
+
+    // Gate inputs up to +-200, past where exp overflows.
+    vector<float> gates(rows), inputs(rows), c_prev(rows), c(rows), h(rows), t(rows);
+    for (unsigned k = 0; k < rows; ++k) {
+      gates[k] = uniform_real_distribution<float>(-200.0f, 200.0f)(rng);
+      inputs[k] = uniform_real_distribution<float>(-5.0f, 5.0f)(rng);
+      c_prev[k] = uniform_real_distribution<float>(-2.0f, 2.0f)(rng);
+    }
+    LSTMCellState(rows, gates.data(), inputs.data(), c_prev.data(), c.data());
+    LSTMCellOutput(rows, inputs.data(), c.data(), h.data());
+    Tanh(rows, gates.data(), t.data());
+    double cell_error = 0.0;
+    for (unsigned k = 0; k < rows; ++k) {
+      double gate = 1.0 / (1.0 + exp(-(double)gates[k]));
+      double expected_c = (1.0 - gate) * c_prev[k] + gate * tanh((double)inputs[k]);
+      double expected_h = tanh((double)c[k]) / (1.0 + exp(-(double)inputs[k]));
+      cell_error = max(cell_error, fabs(c[k] - expected_c));
+      cell_error = max(cell_error, fabs(h[k] - expected_h));
+      cell_error = max(cell_error, fabs(t[k] - tanh((double)gates[k])));
+    }
+    if (!(matmul_error < 1e-4) || !(cell_error < 1e-5)) {
+      cerr << name << ": MatMulAdd is off by " << matmul_error << ", the LSTM cell kernels by " << cell_error << endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// Scores random sentences with the inference engine on one thread and on
+// several, including a copy of a multithreaded engine, and returns false
+// unless every token's loss is the same.
+bool CheckEngineThreads(const MorphLM& lm, const MorphLMConfig& config, const SentenceShape& shape, mt19937& rng) {
+  InferenceEngine single(lm);
+  bool ok = true;
+  for (unsigned threads : {2u, 3u, 4u}) {
+    InferenceEngine threaded(lm);
+    threaded.SetThreads(threads);
+    InferenceEngine copy(threaded);
+    for (unsigned n = 0; n < 10; ++n) {
+      Sentence sentence = RandomSentence(config, shape, rng);
+      vector<float> expected, actual, copied;
+      float expected_total = single.ScoreSentence(sentence, &expected);
+      float actual_total = threaded.ScoreSentence(sentence, &actual);
+      float copied_total = copy.ScoreSentence(sentence, &copied);
+      if (actual != expected || copied != expected || actual_total != expected_total || copied_total != expected_total) {
+        cerr << threads << " threads: sentence " << n << " scored " << actual_total << " (" << copied_total << " on a copy), expected " << expected_total << endl;
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
+
+  po::options_description desc("description");
+  desc.add_options()
+  ("help", "Display this help message")
+  ("benchmarks", po::value<string>()->default_value(""), "Comma-separated benchmarks to run (default: all)")
+  ("repetitions,n", po::value<unsigned>()->default_value(20), "Number of timed repetitions of each benchmark")
+  ("warmup", po::value<unsigned>()->default_value(2), "Number of untimed repetitions before timing")
+  ("json", "Print results as JSON instead of tab-separated values")
+  ("sentence_length", po::value<unsigned>()->default_value(20), "Words per sentence")
+  ("word_length", po::value<unsigned>()->default_value(8), "Characters per word")
+  ("analyses", po::value<unsigned>()->default_value(3), "Analyses per word")
+  ("affixes", po::value<unsigned>()->default_value(3), "Affixes per analysis")
+  ("logsumexp_size", po::value<unsigned>()->default_value(64), "Length of the vectors given to logsumexp")
+  ("check_numeric", "Check logsumexp, log_softmax, sample_multinomial and the inference engine's kernels on every instruction set this CPU supports against a double precision reference, and exit")
+  ("check_threads", "Check that the inference engine scores the same with one thread as with several, and exit")
+  ("bidir", "Benchmark a bidirectional model")
+  ("word_vocab_size", po::value<unsigned>()->default_value(50000), "Model dimension, as in MorphLMConfig")
+  ("root_vocab_size", po::value<unsigned>()->default_value(50000), "Model dimension, as in MorphLMConfig")
+  ("affix_vocab_size", po::value<unsigned>()->default_value(500), "Model dimension, as in MorphLMConfig")
+  ("char_vocab_size", po::value<unsigned>()->default_value(100), "Model dimension, as in MorphLMConfig")
+  ("word_embedding_dim", po::value<unsigned>()->default_value(128), "Model dimension, as in MorphLMConfig")
+  ("root_embedding_dim", po::value<unsigned>()->default_value(128), "Model dimension, as in MorphLMConfig")
+  ("affix_embedding_dim", po::value<unsigned>()->default_value(64), "Model dimension, as in MorphLMConfig")
+  ("char_embedding_dim", po::value<unsigned>()->default_value(64), "Model dimension, as in MorphLMConfig")
+  ("model_chooser_hidden_dim", po::value<unsigned>()->default_value(16), "Model dimension, as in MorphLMConfig")
+  ("affix_lstm_init_hidden_dim", po::value<unsigned>()->default_value(128), "Model dimension, as in MorphLMConfig")
+  ("char_lstm_init_hidden_dim", po::value<unsigned>()->default_value(64), "Model dimension, as in MorphLMConfig")
+  ("main_lstm_dim", po::value<unsigned>()->default_value(256), "Model dimension, as in MorphLMConfig")
+  ("affix_lstm_dim", po::value<unsigned>()->default_value(128), "Model dimension, as in MorphLMConfig")
+  ("char_lstm_dim", po::value<unsigned>()->default_value(64), "Model dimension, as in MorphLMConfig");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+
+  if (vm.count("check_numeric")) {
+    mt19937 rng(1);
+    if (!CheckNumericKernels(rng)) {
+      return 1;
+    }
+    cerr << "Numeric kernels OK" << endl;
+    return 0;
+  }
+
+  MorphLMConfig config;
+  config.bidirectional = (vm.count("bidir") != 0);
+  config.use_words = true;
+  config.use_morphology = true;
+  config.word_vocab_size = vm["word_vocab_size"].as<unsigned>();
+  config.root_vocab_size = vm["root_vocab_size"].as<unsigned>();
+  config.affix_vocab_size = vm["affix_vocab_size"].as<unsigned>();
+  config.char_vocab_size = vm["char_vocab_size"].as<unsigned>();
+  config.word_embedding_dim = vm["word_embedding_dim"].as<unsigned>();
+  config.root_embedding_dim = vm["root_embedding_dim"].as<unsigned>();
+  config.affix_embedding_dim = vm["affix_embedding_dim"].as<unsigned>();
+  config.char_embedding_dim = vm["char_embedding_dim"].as<unsigned>();
+  config.model_chooser_hidden_dim = vm["model_chooser_hidden_dim"].as<unsigned>();
+  config.affix_lstm_init_hidden_dim = vm["affix_lstm_init_hidden_dim"].as<unsigned>();
+  config.char_lstm_init_hidden_dim = vm["char_lstm_init_hidden_dim"].as<unsigned>();
+  config.main_lstm_dim = vm["main_lstm_dim"].as<unsigned>();
+  config.affix_lstm_dim = vm["affix_lstm_dim"].as<unsigned>();
+  config.char_lstm_dim = vm["char_lstm_dim"].as<unsigned>();
+
+  SentenceShape shape(vm["sentence_length"].as<unsigned>(), vm["word_length"].as<unsigned>(), vm["analyses"].as<unsigned>(), vm["affixes"].as<unsigned>());
+  const unsigned repetitions = vm["repetitions"].as<unsigned>();
+  const unsigned warmup = vm["warmup"].as<unsigned>();
+  const unsigned logsumexp_size = vm["logsumexp_size"].as<unsigned>();
+  assert (shape.words > 0 && shape.chars_per_word > 0 && shape.analyses_per_word > 0);
+
+  set<string> selected;
+  for (const string& name : tokenize(vm["benchmarks"].as<string>(), ",")) {
+    if (name.length() > 0) {
+      selected.insert(name);
+    }
+  }
+
+  // Sized for the words plus the </s> RandomSentence ends them with.
+  SentenceShape pool_shape = shape;
+  pool_shape.words++;
+  InitializeDynet(dynet_args, &config, pool_shape, 1, false, 2);
+  Model dynet_model;
+  MorphLM lm(dynet_model, config);
+  lm.SetDropout(0.0f);
+
+  mt19937 rng(1);
+  if (vm.count("check_threads")) {
+    if (!CheckEngineThreads(lm, config, shape, rng)) {
+      return 1;
+    }
+    cerr << "Inference engine threads OK" << endl;
+    return 0;
+  }
+
+  Sentence sentence = RandomSentence(config, shape, rng);
+  const unsigned context_dim = config.bidirectional ? 2 * config.main_lstm_dim : config.main_lstm_dim;
+  const unsigned input_dim = config.char_lstm_dim + config.affix_lstm_dim + config.word_embedding_dim;
+  vector<float> random_input(max(context_dim, input_dim));
+  for (float& x : random_input) {
+    x = uniform_real_distribution<float>(-1.0f, 1.0f)(rng);
+  }
+  vector<float> input_values(random_input.begin(), random_input.begin() + input_dim);
+  vector<float> context_values(random_input.begin(), random_input.begin() + context_dim);
+
+  vector<pair<string, Benchmark>> benchmarks;
+  benchmarks.push_back(make_pair("EmbedCharacterSequence", [&]() {
+    ComputationGraph cg;
+    lm.NewGraph(cg);
+    vector<Expression> outputs;
+    for (unsigned i = 0; i < sentence.size(); ++i) {
+      outputs.push_back(lm.EmbedCharacterSequence(sentence.chars[i], cg));
+    }
+    cg.forward(sum(outputs));
+    return sentence.size();
+  }));
+  benchmarks.push_back(make_pair("EmbedAnalyses", [&]() {
+    ComputationGraph cg;
+    lm.NewGraph(cg);
+    vector<Expression> outputs;
+    for (unsigned i = 0; i < sentence.size(); ++i) {
+      outputs.push_back(lm.EmbedAnalyses(sentence.analyses[i], sentence.analysis_probs[i], cg));
+    }
+    cg.forward(sum(outputs));
+    return sentence.size();
+  }));
+  benchmarks.push_back(make_pair("GetContexts", [&]() {
+    ComputationGraph cg;
+    lm.NewGraph(cg);
+    vector<Expression> inputs;
+    for (unsigned i = 0; i < sentence.size(); ++i) {
+      inputs.push_back(input(cg, {input_dim}, input_values));
+    }
+    vector<Expression> contexts = lm.GetContexts(inputs, cg);
+    cg.forward(sum(contexts));
+    return sentence.size();
+  }));
+  benchmarks.push_back(make_pair("ComputeCharLoss", [&]() {
+    ComputationGraph cg;
+    lm.NewGraph(cg);
+    Expression context = input(cg, {context_dim}, context_values);
+    vector<Expression> losses;
+    for (unsigned i = 0; i < sentence.size(); ++i) {
+      losses.push_back(lm.ComputeCharLoss(context, sentence.chars[i], cg));
+    }
+    cg.forward(sum(losses));
+    return sentence.size();
+  }));
+  benchmarks.push_back(make_pair("ComputeMorphemeLoss", [&]() {
+    ComputationGraph cg;
+    lm.NewGraph(cg);
+    Expression context = input(cg, {context_dim}, context_values);
+    vector<Expression> losses;
+    for (unsigned i = 0; i < sentence.size(); ++i) {
+      losses.push_back(lm.ComputeMorphemeLoss(context, sentence.analyses[i], sentence.analysis_probs[i], cg));
+    }
+    cg.forward(sum(losses));
+    return sentence.size();
+  }));
+  benchmarks.push_back(make_pair("BuildGraph", [&]() {
+    ComputationGraph cg;
+    Expression loss = lm.BuildGraph(sentence, cg);
+    cg.forward(loss);
+    return sentence.size();
+  }));
+
+  // Each "token" is one call, on a vector of logsumexp_size random scores.
+  vector<vector<float>> scores(1000, vector<float>(logsumexp_size));
+  for (vector<float>& v : scores) {
+    for (float& x : v) {
+      x = uniform_real_distribution<float>(-20.0f, 0.0f)(rng);
+    }
+  }
+  // Keeps the compiler from optimizing the calls away
+  volatile float sink = 0.0f;
+  benchmarks.push_back(make_pair("logsumexp", [&]() {
+    for (const vector<float>& v : scores) {
+      sink = logsumexp(v);
+    }
+    return (unsigned)scores.size();
+  }));
+
+  // The same, once with each set of kernels the CPU supports.
+  const string default_kernels = numeric_kernels();
+  vector<float> normalized(logsumexp_size);
+  for (const string& kernels : supported_numeric_kernels()) {
+    benchmarks.push_back(make_pair("logsumexp/" + kernels, [&, kernels]() {
+      set_numeric_kernels(kernels);
+      for (const vector<float>& v : scores) {
+        sink = logsumexp(v);
+      }
+      set_numeric_kernels(default_kernels);
+      return (unsigned)scores.size();
+    }));
+    benchmarks.push_back(make_pair("log_softmax/" + kernels, [&, kernels]() {
+      set_numeric_kernels(kernels);
+      for (const vector<float>& v : scores) {
+        log_softmax(&v[0], v.size(), &normalized[0]);
+        sink = normalized[0];
+      }
+      set_numeric_kernels(default_kernels);
+      return (unsigned)scores.size();
+    }));
+    benchmarks.push_back(make_pair("sample_multinomial/" + kernels, [&, kernels]() {
+      set_numeric_kernels(kernels);
+      for (const vector<float>& v : scores) {
+        sink = sample_multinomial(v, rng);
+      }
+      set_numeric_kernels(default_kernels);
+      return (unsigned)scores.size();
+    }));
+  }
+
+  const unsigned text_sentences = 100;
+  const string text = RandomMorphText(shape, text_sentences, rng);
+  benchmarks.push_back(make_pair("ReadMorphSentence", [&]() {
+    Dict word_vocab, root_vocab, affix_vocab, char_vocab;
+    istringstream ss(text);
+    Sentence s;
+    unsigned tokens = 0;
+    while (ReadMorphSentence(ss, word_vocab, root_vocab, affix_vocab, char_vocab, s)) {
+      tokens += s.size();
+    }
+    return tokens;
+  }));
+
+  vector<BenchmarkResult> results;
+  for (const pair<string, Benchmark>& benchmark : benchmarks) {
+    if (selected.size() > 0 && selected.count(benchmark.first) == 0) {
+      continue;
+    }
+    cerr << "Running " << benchmark.first << "..." << endl;
+    results.push_back(RunBenchmark(benchmark.first, warmup, repetitions, benchmark.second));
+  }
+
+  WriteResults(results, vm.count("json") > 0, cout);
+  return 0;
+}
@@ -0,0 +1,203 @@
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+
+#include "thread_pool.h"
+#include "utils.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// Counts words, roots, affixes and characters in morphologically analyzed
+// text, and writes the vocab files train expects. The file is split into one
+// byte range per thread, and each thread counts its range into its own maps.
+// Every map is split into shards by hash, so that the merge can also run in
+// parallel, one shard per task.
+
+enum VocabType { kWords, kRoots, kAffixes, kChars, kVocabTypeCount };
+const char* kVocabNames[] = {"word", "root", "affix", "char"};
+const char* kVocabPlurals[] = {"words", "roots", "affixes", "chars"};
+
+typedef unordered_map<string, unsigned long long> CountMap;
+
+// counts[type][shard]
+struct ShardedCounts {
+  vector<CountMap> counts[kVocabTypeCount];
+
+  explicit ShardedCounts(unsigned shard_count) {
+    for (unsigned type = 0; type < kVocabTypeCount; ++type) {
+      counts[type].resize(shard_count);
+    }
+  }
+
+  void Add(VocabType type, const string& key) {
+    vector<CountMap>& shards = counts[type];
+    shards[hash<string>()(key) % shards.size()][key]++;
+  }
+};
+
+// The symbols train adds to every vocabulary itself.
+bool IsReserved(const string& s) {
+  return s == "UNK" || s == "<s>" || s == "</s>" || s == "</w>" || s == "*UNKNOWN*";
+}
+
+// Counts one line in the format of HandleMorphLine.
+void CountLine(const string& line, ShardedCounts& counts) {
+  vector<string> pieces = tokenize(line, "\t");
+  if (pieces.size() < 3 || pieces.size() % 2 != 1) {
+    return;
+  }
+
+  const string& word = pieces[0];
+  counts.Add(kWords, word);
+  for (unsigned i = 1; i < pieces.size(); i += 2) {
+    vector<string> morphemes = tokenize(pieces[i], "+");
+    if (morphemes.size() == 0) {
+      continue;
+    }
+    counts.Add(kRoots, morphemes[0]);
+    for (unsigned j = 1; j < morphemes.size(); ++j) {
+      counts.Add(kAffixes, morphemes[j]);
+    }
+  }
+
+  for (unsigned i = 0; i < word.length();) {
+    // Stray continuation bytes count as characters of their own.
+    unsigned len = max(UTF8Len(word[i]), 1u);
+    counts.Add(kChars, word.substr(i, len));
+    i += len;
+  }
+}
+
+// Counts the lines that start in [begin, end).
+void CountRange(const string& filename, streamoff begin, streamoff end, ShardedCounts& counts) {
+  ifstream f(filename);
+  f.seekg(begin > 0 ? begin - 1 : 0);
+  string line;
+  if (begin > 0) {
+    // Finishes the line that straddles begin, which belongs to the previous
+    // range. If begin starts a line, this only reads the newline before it.
+    getline(f, line);
+  }
+  while (f.tellg() < end && getline(f, line)) {
+    line = strip(line);
+    if (line.length() > 0) {
+      CountLine(line, counts);
+    }
+  }
+}
+
+// Most frequent first, ties in byte order so that the output is repeatable.
+vector<pair<string, unsigned long long>> ChooseVocab(const vector<CountMap>& shards, unsigned long long min_count, unsigned max_size) {
+  vector<pair<string, unsigned long long>> entries;
+  for (const CountMap& shard : shards) {
+    for (const auto& entry : shard) {
+      if (entry.second >= min_count && !IsReserved(entry.first)) {
+        entries.push_back(entry);
+      }
+    }
+  }
+  sort(entries.begin(), entries.end(), [](const pair<string, unsigned long long>& a, const pair<string, unsigned long long>& b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+  if (max_size > 0 && entries.size() > max_size) {
+    entries.resize(max_size);
+  }
+  return entries;
+}
+
+int main(int argc, char** argv) {
+  po::options_description desc("description");
+  desc.add_options()
+  ("text", po::value<string>()->required(), "Morphologically analyzed text to count")
+  ("word_vocab", po::value<string>()->required(), "Output file for the word vocabulary")
+  ("root_vocab", po::value<string>()->required(), "Output file for the root vocabulary")
+  ("affix_vocab", po::value<string>()->required(), "Output file for the affix vocabulary")
+  ("char_vocab", po::value<string>()->required(), "Output file for the character vocabulary")
+  ("min_word_count", po::value<unsigned long long>()->default_value(1), "Drop words seen fewer times than this")
+  ("min_root_count", po::value<unsigned long long>()->default_value(1), "Drop roots seen fewer times than this")
+  ("min_affix_count", po::value<unsigned long long>()->default_value(1), "Drop affixes seen fewer times than this")
+  ("min_char_count", po::value<unsigned long long>()->default_value(1), "Drop characters seen fewer times than this")
+  ("max_words", po::value<unsigned>()->default_value(0), "Keep at most this many of the most frequent words (0 for no limit)")
+  ("max_roots", po::value<unsigned>()->default_value(0), "Keep at most this many of the most frequent roots (0 for no limit)")
+  ("max_affixes", po::value<unsigned>()->default_value(0), "Keep at most this many of the most frequent affixes (0 for no limit)")
+  ("max_chars", po::value<unsigned>()->default_value(0), "Keep at most this many of the most frequent characters (0 for no limit)")
+  ("threads,j", po::value<unsigned>()->default_value(thread::hardware_concurrency()), "Number of threads to count with")
+  ("help", "Display this help message");
+
+  po::positional_options_description positional_options;
+  positional_options.add("text", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(positional_options).run(), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+
+  const string text_filename = vm["text"].as<string>();
+  const unsigned thread_count = max(vm["threads"].as<unsigned>(), 1u);
+  ifstream f(text_filename, ios::ate);
+  if (!f.is_open()) {
+    cerr << "Unable to open " << text_filename << endl;
+    return 1;
+  }
+  const streamoff file_size = f.tellg();
+  f.close();
+
+  // Several ranges per thread, so that a thread that gets long lines
+  // doesn't hold up the others.
+  const unsigned range_count = (file_size > 0) ? thread_count * 4 : 0;
+  ThreadPool pool(thread_count);
+  vector<ShardedCounts> range_counts(range_count, ShardedCounts(thread_count));
+  cerr << "Counting " << text_filename << " with " << thread_count << " threads...";
+  pool.ParallelFor(range_count, [&](unsigned i, unsigned) {
+    streamoff begin = file_size * i / range_count;
+    streamoff end = file_size * (i + 1) / range_count;
+    CountRange(text_filename, begin, end, range_counts[i]);
+  });
+
+  ShardedCounts totals(thread_count);
+  pool.ParallelFor(thread_count, [&](unsigned shard, unsigned) {
+    for (unsigned type = 0; type < kVocabTypeCount; ++type) {
+      CountMap& total = totals.counts[type][shard];
+      for (ShardedCounts& counts : range_counts) {
+        for (const auto& entry : counts.counts[type][shard]) {
+          total[entry.first] += entry.second;
+        }
+        counts.counts[type][shard].clear();
+      }
+    }
+  });
+  cerr << " Done!" << endl;
+
+  const string filenames[] = {vm["word_vocab"].as<string>(), vm["root_vocab"].as<string>(), vm["affix_vocab"].as<string>(), vm["char_vocab"].as<string>()};
+  const unsigned long long min_counts[] = {vm["min_word_count"].as<unsigned long long>(), vm["min_root_count"].as<unsigned long long>(), vm["min_affix_count"].as<unsigned long long>(), vm["min_char_count"].as<unsigned long long>()};
+  const unsigned max_sizes[] = {vm["max_words"].as<unsigned>(), vm["max_roots"].as<unsigned>(), vm["max_affixes"].as<unsigned>(), vm["max_chars"].as<unsigned>()};
+  for (unsigned type = 0; type < kVocabTypeCount; ++type) {
+    unsigned long long seen = 0;
+    for (const CountMap& shard : totals.counts[type]) {
+      seen += shard.size();
+    }
+    vector<pair<string, unsigned long long>> vocab = ChooseVocab(totals.counts[type], min_counts[type], max_sizes[type]);
+
+    ofstream out(filenames[type]);
+    if (!out.is_open()) {
+      cerr << "Unable to write the " << kVocabNames[type] << " vocabulary to " << filenames[type] << endl;
+      return 1;
+    }
+    for (const auto& entry : vocab) {
+      out << entry.first << "\n";
+    }
+    cerr << "Kept " << vocab.size() << " of " << seen << " " << kVocabPlurals[type] << " in " << filenames[type] << endl;
+  }
+
+  return 0;
+}
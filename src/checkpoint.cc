@@ -0,0 +1,86 @@
+#include <cstring>
+#include <algorithm>
+#include <cassert>
+#include "dynet/expr.h"
+#include "checkpoint.h"
+#include "memory.h"
+
+using namespace dynet::expr;
+
+CheckpointedLoss::CheckpointedLoss(MorphLM& lm, unsigned chunk_size) : lm(lm), chunk_size(chunk_size) {
+  assert (chunk_size > 0);
+  context_dim = lm.config.bidirectional ? 2 * lm.config.main_lstm_dim : lm.config.main_lstm_dim;
+  // Training processes share the parameter pool, but each needs its own
+  // holders, so point them at memory that fork() will copy.
+  holder_memory.resize(2 * chunk_size * context_dim);
+  for (unsigned i = 0; i < chunk_size; ++i) {
+    context_holders.push_back(scratch_model.add_parameters({context_dim}));
+    ParameterStorage* holder = context_holders.back().get();
+    holder->values.v = &holder_memory[2 * i * context_dim];
+    holder->g.v = &holder_memory[(2 * i + 1) * context_dim];
+  }
+}
+
+dynet::real CheckpointedLoss::Compute(const Sentence& sentence, bool learn) {
+  assert (sentence.size() > 0);
+  const unsigned n = sentence.size();
+
+  vector<vector<float>> contexts(n);
+  {
+    ComputationGraph cg;
+    lm.NewGraph(cg);
+    vector<Expression> context_exprs = lm.GetContexts(lm.EmbedSentence(sentence, cg), cg);
+    for (unsigned i = 0; i < n; ++i) {
+      contexts[i] = as_vector(cg.incremental_forward(context_exprs[i]));
+    }
+    memory_monitor.Sample();
+  }
+
+  dynet::real loss = 0.0;
+  vector<vector<float>> context_grads(n);
+  for (unsigned start = 0; start < n; start += chunk_size) {
+    const unsigned end = min(n, start + chunk_size);
+    ComputationGraph cg;
+    lm.NewGraph(cg);
+    vector<Expression> losses;
+    for (unsigned i = start; i < end; ++i) {
+      assert (contexts[i].size() == context_dim);
+      Expression context;
+      if (learn) {
+        // A parameter rather than an input, so that backward computes its gradient.
+        memcpy(context_holders[i - start].get()->values.v, contexts[i].data(), sizeof(float) * context_dim);
+        context = parameter(cg, context_holders[i - start]);
+      }
+      else {
+        context = input(cg, {context_dim}, contexts[i]);
+      }
+      losses.push_back(lm.ComputePositionLoss(sentence, i, context, cg));
+    }
+    Expression chunk_loss = sum(losses);
+    loss += as_scalar(cg.forward(chunk_loss));
+    if (learn) {
+      scratch_model.reset_gradient();
+      cg.backward(chunk_loss);
+      for (unsigned i = start; i < end; ++i) {
+        context_grads[i] = as_vector(context_holders[i - start].get()->g);
+      }
+    }
+    memory_monitor.Sample();
+  }
+
+  if (learn) {
+    ComputationGraph cg;
+    lm.NewGraph(cg);
+    vector<Expression> context_exprs = lm.GetContexts(lm.EmbedSentence(sentence, cg), cg);
+    vector<Expression> surrogates;
+    for (unsigned i = 0; i < n; ++i) {
+      surrogates.push_back(dot_product(context_exprs[i], input(cg, {context_dim}, context_grads[i])));
+    }
+    Expression surrogate = sum(surrogates);
+    cg.forward(surrogate);
+    cg.backward(surrogate);
+    memory_monitor.Sample();
+  }
+
+  return loss;
+}
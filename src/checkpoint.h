@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+#include "dynet/dynet.h"
+#include "dynet/model.h"
+#include "morphlm.h"
+
+using namespace std;
+using namespace dynet;
+
+// Computes a sentence's loss and gradients without ever holding the whole
+// graph BuildGraph would build. Most of that graph is the per-position
+// decoders (the character LSTM, the morpheme LSTM over every analysis and
+// the softmaxes), so they are built at most chunk_size positions at a time:
+//
+//  1. Run the input embedders and the main LSTM, keep the context vectors'
+//     values and throw the graph away.
+//  2. For each chunk of positions, feed the saved contexts to the mode
+//     chooser and the decoders through scratch parameters, run forward and
+//     backward, and keep the gradients that reach the contexts.
+//  3. Rebuild the main LSTM's graph and backpropagate those gradients
+//     through it, as the gradient of sum_i dot(context_i, gradient_i).
+//
+// The main LSTM part of the graph is built twice, so training is somewhat
+// slower, but peak memory is set by the main LSTM over the whole sentence
+// plus the decoders of chunk_size positions. Dropout is not supported, since
+// step 3 would sample different masks than step 1.
+class CheckpointedLoss {
+public:
+  CheckpointedLoss(MorphLM& lm, unsigned chunk_size);
+
+  // Returns the sentence's loss, like BuildGraph. If learn is set, also
+  // accumulates its gradients into the model's parameters, ready for the
+  // trainer's update.
+  dynet::real Compute(const Sentence& sentence, bool learn);
+
+private:
+  MorphLM& lm;
+  unsigned chunk_size;
+  unsigned context_dim;
+  // Holds the context vectors of one chunk while its decoders are built.
+  // Kept apart from the model so that the trainer never updates them.
+  Model scratch_model;
+  vector<Parameter> context_holders;
+  vector<float> holder_memory;
+};
@@ -0,0 +1,176 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cassert>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+
+#include "framing.h"
+
+using namespace std;
+namespace po = boost::program_options;
+typedef chrono::steady_clock Clock;
+
+// Splits morphologically analyzed text into one request payload per sentence.
+vector<string> ReadRequests(istream& f) {
+  vector<string> requests;
+  string current;
+  for (string line; getline(f, line);) {
+    if (line.find_first_not_of(" \t\r") == string::npos) {
+      if (current.size() > 0) {
+        requests.push_back(current);
+        current.clear();
+      }
+      continue;
+    }
+    current += line + "\n";
+  }
+  if (current.size() > 0) {
+    requests.push_back(current);
+  }
+  return requests;
+}
+
+double Percentile(vector<double>& sorted_values, double p) {
+  assert (sorted_values.size() > 0);
+  unsigned index = (unsigned)(p * (sorted_values.size() - 1) + 0.5);
+  return sorted_values[index];
+}
+
+// Sends requests the server must refuse (bytes that aren't UTF-8, which
+// ReadMorphSentence can't split into characters) and returns false unless
+// each one gets an error back on a connection that stays usable.
+bool CheckErrors(const string& socket_path) {
+  const vector<pair<string, string>> malformed = {
+    {"stray continuation byte", "ab\x80" "c\tab+X\t1.0\n"},
+    {"0xFE byte", "\xfe\tUNK\t1.0\n"},
+    {"0xFF byte", "a\xff\tUNK\t1.0\n"},
+    {"truncated two-byte sequence", "ab\xc3\tab\t1.0\n"},
+    {"truncated three-byte sequence", "\xe2\x82\tUNK\t1.0\n"},
+    {"truncated sequence on a later line", "a\ta\t1.0\nb\xf0\x9f\x98\tb\t1.0\n"},
+  };
+
+  int fd = ConnectUnixSocket(socket_path);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = true;
+  string response;
+  for (const pair<string, string>& request : malformed) {
+    if (!WriteFrame(fd, request.second) || !ReadFrame(fd, response)) {
+      cerr << "The server hung up after a " << request.first << endl;
+      close(fd);
+      return false;
+    }
+    if (response.compare(0, 6, "ERROR ") != 0) {
+      cerr << "The server accepted a " << request.first << ": " << response << endl;
+      ok = false;
+    }
+    else {
+      cerr << request.first << ": " << response << endl;
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+// Load generator for morphlm_server: replays the sentences from stdin over
+// several concurrent connections and reports throughput and latency.
+int main(int argc, char** argv) {
+  po::options_description desc("description");
+  desc.add_options()
+  ("socket,s", po::value<string>()->default_value("morphlm.sock"), "Path of the server's Unix domain socket")
+  ("connections,c", po::value<unsigned>()->default_value(4), "Number of concurrent connections")
+  ("requests,n", po::value<unsigned>(), "Total number of requests to send, cycling through the input (default: each sentence once)")
+  ("print,p", "Print each sentence's score, in input order, like loss does")
+  ("check_errors", "First check that malformed requests (invalid UTF-8) get error responses")
+  ("help", "Display this help message");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+
+  const string socket_path = vm["socket"].as<string>();
+  const unsigned connection_count = vm["connections"].as<unsigned>();
+  const bool print_scores = vm.count("print") > 0;
+
+  if (vm.count("check_errors") && !CheckErrors(socket_path)) {
+    return 1;
+  }
+
+  vector<string> requests = ReadRequests(cin);
+  if (requests.size() == 0) {
+    cerr << "No sentences on stdin" << endl;
+    return 1;
+  }
+  const unsigned request_count = vm.count("requests") ? vm["requests"].as<unsigned>() : requests.size();
+
+  vector<double> latencies(request_count);
+  vector<float> scores(request_count);
+  atomic<unsigned> next_request(0);
+  atomic<unsigned> error_count(0);
+
+  auto worker = [&]() {
+    int fd = ConnectUnixSocket(socket_path);
+    if (fd < 0) {
+      error_count++;
+      return;
+    }
+
+    string response;
+    vector<float> token_losses;
+    for (unsigned i = next_request++; i < request_count; i = next_request++) {
+      Clock::time_point start = Clock::now();
+      if (!WriteFrame(fd, requests[i % requests.size()]) || !ReadFrame(fd, response)) {
+        error_count++;
+        break;
+      }
+      latencies[i] = chrono::duration<double, milli>(Clock::now() - start).count();
+
+      if (!ParseScores(response, scores[i], token_losses)) {
+        cerr << "Request " << i << " failed: " << response << endl;
+        error_count++;
+      }
+    }
+    close(fd);
+  };
+
+  Clock::time_point start = Clock::now();
+  vector<thread> threads;
+  for (unsigned i = 0; i < connection_count; ++i) {
+    threads.push_back(thread(worker));
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  double elapsed = chrono::duration<double>(Clock::now() - start).count();
+
+  if (print_scores) {
+    float total = 0.0f;
+    for (unsigned i = 0; i < request_count; ++i) {
+      cout << scores[i] << endl;
+      total += scores[i];
+    }
+    cout << "Total: " << total << endl;
+  }
+
+  vector<double> sorted_latencies(latencies.begin(), latencies.begin() + min(request_count, (unsigned)next_request));
+  sort(sorted_latencies.begin(), sorted_latencies.end());
+  cerr << request_count << " requests over " << connection_count << " connections in " << elapsed << " s (" << request_count / elapsed << " requests/s), " << error_count << " errors" << endl;
+  if (sorted_latencies.size() > 0) {
+    cerr << "Latency (ms): p50 " << Percentile(sorted_latencies, 0.50) << ", p95 " << Percentile(sorted_latencies, 0.95) << ", p99 " << Percentile(sorted_latencies, 0.99) << ", max " << sorted_latencies.back() << endl;
+  }
+
+  return error_count > 0 ? 1 : 0;
+}
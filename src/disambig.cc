@@ -5,6 +5,9 @@
 #include <fstream>
 
 #include "io.h"
+#include "memory.h"
+#include "engine.h"
+#include "metrics.h"
 #include "utils.h"
 
 using namespace dynet;
@@ -12,14 +15,20 @@ using namespace std;
 namespace po = boost::program_options;
 
 int main(int argc, char** argv) {
-  dynet::initialize(argc, argv);
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
 
   po::options_description desc("description");
   desc.add_options()
   ("model", po::value<string>()->required(), "model files, as output by train")
   ("start_index,i", po::value<unsigned>()->default_value(0), "Index of first sentence")
+  ("fast,f", "Score with the graph-free inference engine instead of DyNet")
+  ("profile", "Report time and graph nodes per model component")
+  ("profile_output", po::value<string>(), "With --profile, also write the profile to this file (JSON if it ends in .json, otherwise CSV)")
   ("help", "Display this help message");
 
+  AddAnalysisLimitOptions(desc);
+  AddMetricsOptions(desc);
+
   po::positional_options_description positional_options;
   positional_options.add("model", 1);
 
@@ -32,8 +41,14 @@ int main(int argc, char** argv) {
   }
 
   po::notify(vm);
+  if (!ConfigureAnalysisLimit(vm) || !ConfigureMetrics(vm, "disambig")) {
+    return 1;
+  }
 
   const string model_filename = vm["model"].as<string>();
+  const bool use_engine = vm.count("fast") > 0;
+
+  InitializeDynetForModel(dynet_args, model_filename);
 
   Model dynet_model;
   Dict word_vocab, root_vocab, affix_vocab, char_vocab;
@@ -42,10 +57,19 @@ int main(int argc, char** argv) {
   cerr << "Loading model from " << model_filename << "...";
   Deserialize(model_filename, word_vocab, root_vocab, affix_vocab, char_vocab, lm, dynet_model);
   cerr << " Done!" << endl;
+  InferenceEngine engine(lm);
+  Profiler profiler;
+  const bool profile = vm.count("profile") > 0;
+  if (profile) {
+    lm.profiler = &profiler;
+  }
 
   unsigned sentence_number = vm["start_index"].as<unsigned>();
   Sentence input;
+  metrics.StartWaiting();
   while(ReadMorphSentence(cin, word_vocab, root_vocab, affix_vocab, char_vocab, input)) {
+    metrics.StartSentence();
+    const bool fits = memory_monitor.Fits(EstimateGraphBytes(lm.config, ShapeOf(input)));
     for (unsigned i = 0; i < input.analyses.size(); ++i) {
       vector<float> losses;
       assert (input.analyses[i].size() > 0);
@@ -58,10 +82,22 @@ int main(int argc, char** argv) {
           temp_input.analyses[i].clear();
           temp_input.analyses[i].push_back(input.analyses[i][j]);
 
-          ComputationGraph cg;
-          lm.NewGraph(cg);
-          Expression loss = lm.BuildGraph(temp_input, cg);
-          losses.push_back(-as_scalar(loss.value()));
+          if (use_engine || !fits) {
+            losses.push_back(-engine.ScoreSentence(temp_input));
+          }
+          else {
+            ComputationGraph cg;
+            if (profile) {
+              profiler.StartGraph(cg);
+            }
+            lm.NewGraph(cg);
+            Expression loss = lm.BuildGraph(temp_input, cg);
+            losses.push_back(-as_scalar(profile ? profiler.Forward(cg, loss) : loss.value()));
+            if (profile) {
+              profiler.EndSentence(temp_input.size(), false);
+            }
+            memory_monitor.Sample();
+          }
         }
       }
       assert (losses.size() == input.analyses[i].size());
@@ -75,7 +111,17 @@ int main(int argc, char** argv) {
     cout << endl;
     cout.flush();
     sentence_number++;
+    metrics.EndSentence(input);
   }
 
+  memory_monitor.Report(cerr);
+  analysis_limit.Report(cerr);
+  if (profile) {
+    profiler.Report(cerr);
+    if (vm.count("profile_output")) {
+      profiler.WriteFile(vm["profile_output"].as<string>());
+    }
+  }
+  FinishMetrics(vm);
   return 0;
 }
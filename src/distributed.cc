@@ -0,0 +1,116 @@
+#include <cstring>
+#include "distributed.h"
+
+bool BroadcastParameters(RingAllreduce& ring, Model& model) {
+  const vector<ParameterStorage*>& params = model.parameters_list();
+  const vector<LookupParameterStorage*>& lookups = model.lookup_parameters_list();
+
+  // The vocabularies are the likeliest thing to differ between nodes, so
+  // compare the number of rows of every lookup parameter as well.
+  vector<float> shape = {(float)params.size(), (float)lookups.size()};
+  for (LookupParameterStorage* p : lookups) {
+    shape.push_back(p->values.size());
+  }
+  vector<float> total = shape;
+  if (!ring.Sum(total.data(), total.size())) {
+    return false;
+  }
+  for (unsigned i = 0; i < shape.size(); ++i) {
+    if (total[i] != shape[i] * ring.size()) {
+      cerr << "The nodes' models have different shapes. Do they all use the same vocabularies?" << endl;
+      return false;
+    }
+  }
+
+  // Node 0 contributes its values and everyone else zeros.
+  vector<float> buffer;
+  for (ParameterStorage* p : params) {
+    buffer.insert(buffer.end(), p->values.v, p->values.v + p->dim.size());
+  }
+  for (LookupParameterStorage* p : lookups) {
+    for (const Tensor& row : p->values) {
+      buffer.insert(buffer.end(), row.v, row.v + p->dim.size());
+    }
+  }
+  if (ring.rank() != 0) {
+    fill(buffer.begin(), buffer.end(), 0.0f);
+  }
+  if (!ring.Sum(buffer.data(), buffer.size())) {
+    return false;
+  }
+
+  const float* in = buffer.data();
+  for (ParameterStorage* p : params) {
+    memcpy(p->values.v, in, sizeof(float) * p->dim.size());
+    in += p->dim.size();
+  }
+  for (LookupParameterStorage* p : lookups) {
+    for (Tensor& row : p->values) {
+      memcpy(row.v, in, sizeof(float) * p->dim.size());
+      in += p->dim.size();
+    }
+  }
+  return true;
+}
+
+bool SumGradients(RingAllreduce& ring, Model& model, vector<float>& extras) {
+  const vector<ParameterStorage*>& params = model.parameters_list();
+  const vector<LookupParameterStorage*>& lookups = model.lookup_parameters_list();
+
+  // First agree on which lookup rows have gradients anywhere, one bit per
+  // row, so that only those rows are sent.
+  size_t total_rows = 0;
+  for (LookupParameterStorage* p : lookups) {
+    total_rows += p->values.size();
+  }
+  vector<uint8_t> touched((total_rows + 7) / 8);
+  size_t base = 0;
+  for (LookupParameterStorage* p : lookups) {
+    for (unsigned row : p->non_zero_grads) {
+      touched[(base + row) / 8] |= 1 << ((base + row) % 8);
+    }
+    base += p->values.size();
+  }
+  if (!ring.Or(touched.data(), touched.size())) {
+    return false;
+  }
+  auto is_touched = [&](size_t row) { return (touched[row / 8] >> (row % 8)) & 1; };
+
+  // Rows this node didn't touch still hold zeros.
+  vector<float> buffer;
+  for (ParameterStorage* p : params) {
+    buffer.insert(buffer.end(), p->g.v, p->g.v + p->dim.size());
+  }
+  base = 0;
+  for (LookupParameterStorage* p : lookups) {
+    for (unsigned row = 0; row < p->values.size(); ++row) {
+      if (is_touched(base + row)) {
+        buffer.insert(buffer.end(), p->grads[row].v, p->grads[row].v + p->dim.size());
+      }
+    }
+    base += p->values.size();
+  }
+  buffer.insert(buffer.end(), extras.begin(), extras.end());
+  if (!ring.Sum(buffer.data(), buffer.size())) {
+    return false;
+  }
+
+  const float* in = buffer.data();
+  for (ParameterStorage* p : params) {
+    memcpy(p->g.v, in, sizeof(float) * p->dim.size());
+    in += p->dim.size();
+  }
+  base = 0;
+  for (LookupParameterStorage* p : lookups) {
+    for (unsigned row = 0; row < p->values.size(); ++row) {
+      if (is_touched(base + row)) {
+        memcpy(p->grads[row].v, in, sizeof(float) * p->dim.size());
+        p->non_zero_grads.insert(row);
+        in += p->dim.size();
+      }
+    }
+    base += p->values.size();
+  }
+  copy(in, in + extras.size(), extras.begin());
+  return true;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include "dynet/dynet.h"
+#include "dynet/training.h"
+#include "dynet/mp.h"
+#include "allreduce.h"
+
+#include <random>
+#include <vector>
+#include <numeric>
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+
+using namespace dynet;
+using namespace dynet::mp;
+using namespace std;
+
+// Synchronous data-parallel training across nodes (processes, usually on
+// different machines). Every node holds a full copy of the model and walks
+// its own strided shard of the same shuffled order, like a Hogwild worker.
+// Every sync_every sentences the nodes sum their gradients with a ring
+// allreduce (see allreduce.h) and all of them apply the same update, so
+// the copies never drift apart. Node 0 reports progress, runs the dev set
+// and saves the model; the others wait for it at their next sync.
+
+// Makes every node's parameters equal to node 0's. Returns false if the
+// nodes' models don't have the same shape, or the ring broke.
+bool BroadcastParameters(RingAllreduce& ring, Model& model);
+
+// Sums the gradients of every node: the dense ones, and the union of the
+// rows of lookup parameters that any node touched. extras are summed along
+// with them.
+bool SumGradients(RingAllreduce& ring, Model& model, vector<float>& extras);
+
+template <class D, class S>
+void RunDistributed(RingAllreduce& ring, ILearner<D, S>* learner, Trainer* trainer, Model& model, const vector<D>& train_data, const vector<D>& dev_data, unsigned num_iterations, unsigned dev_frequency, unsigned report_frequency, unsigned sync_every) {
+  assert (sync_every > 0);
+  const unsigned node_count = ring.size();
+  const unsigned rank = ring.rank();
+
+  // Every node shuffles the same way, with node 0's seed. (Seeds stay below
+  // 2^24 so that they survive being summed as floats.)
+  vector<float> seed(1, (rank == 0) ? (float)(random_device()() % (1 << 24)) : 0.0f);
+  if (!ring.Sum(seed.data(), seed.size())) {
+    cerr << "Lost the connection to the other nodes" << endl;
+    exit(1);
+  }
+
+  vector<unsigned> order(train_data.size());
+  iota(order.begin(), order.end(), 0);
+  // Every node takes part in the same number of syncs, even if its shard is
+  // a sentence shorter than node 0's.
+  const unsigned shard_size = (order.size() + node_count - 1) / node_count;
+
+  S report_stats = S();
+  S best_dev_stats;
+  bool first_dev_run = true;
+  unsigned long long processed = 0;
+  unsigned long long next_report = report_frequency;
+  unsigned long long next_dev = dev_frequency;
+  bool stopped = false;
+  auto run_dev = [&](double fractional_iter) {
+    if (rank != 0) {
+      return;
+    }
+    S dev_stats = S();
+    for (const D& datum : dev_data) {
+      dev_stats += learner->LearnFromDatum(datum, false);
+    }
+    bool new_best = (first_dev_run || dev_stats < best_dev_stats);
+    first_dev_run = false;
+    cerr << fractional_iter << "\t" << "dev loss = " << dev_stats << (new_best ? " (New best!)" : "") << endl;
+    if (new_best) {
+      learner->SaveModel();
+      best_dev_stats = dev_stats;
+    }
+  };
+
+  for (unsigned iter = 0; iter < num_iterations && !stopped; ++iter) {
+    mt19937 rng((unsigned)seed[0] + iter);
+    shuffle(order.begin(), order.end(), rng);
+
+    for (unsigned start = 0; start < shard_size && !stopped; start += sync_every) {
+      unsigned local_count = 0;
+      for (unsigned j = start; j < min(start + sync_every, shard_size); ++j) {
+        unsigned i = j * node_count + rank;
+        if (i >= order.size()) {
+          break;
+        }
+        report_stats += learner->LearnFromDatum(train_data[order[i]], true);
+        local_count++;
+      }
+
+      // Whoever is asked to stop tells everyone else at the sync.
+      vector<float> extras = {(float)local_count, stop_requested ? 1.0f : 0.0f};
+      if (!SumGradients(ring, model, extras)) {
+        cerr << "Lost the connection to the other nodes" << endl;
+        exit(1);
+      }
+      // Gradients are summed over each node's sentences and averaged over
+      // the nodes.
+      trainer->update(1.0 / node_count);
+      processed += (unsigned long long)extras[0];
+      stopped = (extras[1] > 0.0f);
+
+      const double fractional_iter = (double)processed / train_data.size();
+      if (processed >= next_report) {
+        if (rank == 0) {
+          cerr << fractional_iter << "\t" << "loss = " << report_stats << " (node 0's shard)" << endl;
+        }
+        report_stats = S();
+        next_report = (processed / report_frequency + 1) * report_frequency;
+      }
+      if (processed >= next_dev && !stopped) {
+        run_dev(fractional_iter);
+        next_dev = (processed / dev_frequency + 1) * dev_frequency;
+      }
+    }
+
+    if (!stopped) {
+      trainer->update_epoch();
+      // Score the dev set at the end of every iteration, like RunResumable.
+      run_dev(iter + 1.0);
+    }
+  }
+}
@@ -0,0 +1,520 @@
+#include <cassert>
+#include <algorithm>
+#include "engine.h"
+#include "engine_weights.h"
+#include "kernels.h"
+
+// Order of the parameters of each layer of a DyNet LSTMBuilder. This is the
+// coupled input/forget gate LSTM with (full matrix) peephole connections.
+enum LSTMParameterIndex { kX2I, kH2I, kC2I, kBI, kX2O, kH2O, kC2O, kBO, kX2C, kH2C, kBC };
+
+static float* Grow(vector<float>& v, size_t size) {
+  if (v.size() < size) {
+    v.resize(size);
+  }
+  return v.data();
+}
+
+static void StackRows(const vector<const Tensor*>& blocks, vector<float>& out) {
+  unsigned rows = blocks[0]->d.rows();
+  unsigned cols = blocks[0]->d.cols();
+  unsigned total_rows = rows * blocks.size();
+  out.resize(total_rows * cols);
+  for (unsigned c = 0; c < cols; ++c) {
+    for (unsigned k = 0; k < blocks.size(); ++k) {
+      assert (blocks[k]->d.rows() == rows && blocks[k]->d.cols() == cols);
+      const float* src = blocks[k]->v + c * rows;
+      copy(src, src + rows, out.begin() + c * total_rows + k * rows);
+    }
+  }
+}
+
+static LSTMWeights PackLSTM(const LSTMBuilder& builder) {
+  LSTMWeights lstm;
+  for (const vector<Parameter>& p : builder.params) {
+    LSTMLayerWeights layer;
+    const Tensor& x2i = p[kX2I].get()->values;
+    lstm.hidden_dim = x2i.d.rows();
+    layer.input_dim = x2i.d.cols();
+    StackRows({&p[kX2I].get()->values, &p[kX2O].get()->values, &p[kX2C].get()->values}, layer.wx);
+    StackRows({&p[kH2I].get()->values, &p[kH2O].get()->values, &p[kH2C].get()->values}, layer.wh);
+    StackRows({&p[kBI].get()->values, &p[kBO].get()->values, &p[kBC].get()->values}, layer.bias);
+    layer.c2i = as_vector(p[kC2I].get()->values);
+    layer.c2o = as_vector(p[kC2O].get()->values);
+    lstm.layers.push_back(layer);
+  }
+  return lstm;
+}
+
+static MLPWeights PackMLP(const MLP& mlp) {
+  vector<Parameter> p = mlp.GetParameters();
+  MLPWeights weights;
+  weights.hidden_dim = p[0].get()->values.d.rows();
+  weights.input_dim = p[0].get()->values.d.cols();
+  weights.output_dim = p[2].get()->values.d.rows();
+  weights.wIH = p[0].get()->values.v;
+  weights.wHb = p[1].get()->values.v;
+  weights.wHO = p[2].get()->values.v;
+  weights.wOb = p[3].get()->values.v;
+  return weights;
+}
+
+static SoftmaxWeights PackSoftmax(const MorphLM& lm, const SoftmaxBuilder* softmax, const QuantizedSoftmax* quantized) {
+  SoftmaxWeights weights = {0, 0, nullptr, nullptr, quantized};
+  if (softmax != nullptr) {
+    Parameter w, b;
+    lm.GetSoftmaxParameters(softmax, w, b);
+    weights.vocab_size = w.get()->values.d.rows();
+    weights.input_dim = w.get()->values.d.cols();
+    weights.w = w.get()->values.v;
+    weights.b = b.get()->values.v;
+    weights.quantized = nullptr;
+  }
+  return weights;
+}
+
+static EmbeddingTable PackEmbeddings(const LookupParameter& table, unsigned dim) {
+  return EmbeddingTable {dim, table.get(), nullptr};
+}
+
+static EmbeddingTable PackEmbeddings(const QuantizedMatrix& table) {
+  return EmbeddingTable {table.cols(), nullptr, &table};
+}
+
+InferenceEngine::InferenceEngine(const MorphLM& lm) {
+  const MorphLMConfig& config = lm.config;
+  const bool quantized = (config.storage != kFloat32);
+  shared_ptr<Weights> w = make_shared<Weights>();
+  w->config = config;
+
+  if (config.use_words) {
+    w->input_word_embeddings = quantized ? PackEmbeddings(lm.quantized_word_embeddings) : PackEmbeddings(lm.input_word_embeddings, config.word_embedding_dim);
+    w->word_softmax = PackSoftmax(lm, lm.word_softmax, &lm.quantized_word_softmax);
+  }
+  if (config.use_morphology) {
+    w->input_root_embeddings = quantized ? PackEmbeddings(lm.quantized_root_embeddings) : PackEmbeddings(lm.input_root_embeddings, lm.input_affix_lstm.params.size() * config.affix_lstm_dim);
+    w->input_affix_embeddings = PackEmbeddings(lm.input_affix_embeddings, config.affix_embedding_dim);
+    w->input_affix_lstm = PackLSTM(lm.input_affix_lstm);
+    w->root_softmax = PackSoftmax(lm, lm.root_softmax, &lm.quantized_root_softmax);
+    w->affix_softmax = PackSoftmax(lm, lm.affix_softmax, nullptr);
+    w->output_root_embeddings = quantized ? PackEmbeddings(lm.quantized_output_root_embeddings) : PackEmbeddings(lm.output_root_embeddings, config.root_embedding_dim);
+    w->output_affix_embeddings = PackEmbeddings(lm.output_affix_embeddings, config.affix_embedding_dim);
+    w->output_affix_lstm_init = PackMLP(lm.output_affix_lstm_init);
+    w->output_affix_lstm = PackLSTM(lm.output_affix_lstm);
+  }
+  w->input_char_embeddings = PackEmbeddings(lm.input_char_embeddings, config.char_embedding_dim);
+  w->input_char_lstm_init = lm.input_char_lstm_init.get()->values.v;
+  w->input_char_lstm = PackLSTM(lm.input_char_lstm);
+
+  w->main_lstm_fwd_init = lm.main_lstm_fwd_init.get()->values.v;
+  w->main_lstm_fwd = PackLSTM(lm.main_lstm_fwd);
+  if (config.bidirectional) {
+    w->main_lstm_rev_init = lm.main_lstm_rev_init.get()->values.v;
+    w->main_lstm_rev = PackLSTM(lm.main_lstm_rev);
+  }
+  w->model_chooser = PackMLP(lm.model_chooser);
+
+  w->char_softmax = PackSoftmax(lm, lm.char_softmax, nullptr);
+  w->output_char_embeddings = PackEmbeddings(lm.output_char_embeddings, config.char_embedding_dim);
+  w->output_char_lstm_init = PackMLP(lm.output_char_lstm_init);
+  w->output_char_lstm = PackLSTM(lm.output_char_lstm);
+
+  input_dim = config.char_lstm_dim;
+  if (config.use_morphology) {
+    input_dim += config.affix_lstm_dim;
+  }
+  if (config.use_words) {
+    input_dim += config.word_embedding_dim;
+  }
+  context_dim = config.bidirectional ? 2 * config.main_lstm_dim : config.main_lstm_dim;
+  weights = w;
+}
+
+InferenceEngine::InferenceEngine(const InferenceEngine& other) : InferenceEngine(other.weights, other.input_dim, other.context_dim) {
+  SetThreads(other.pool ? other.pool->size() : 1);
+}
+
+InferenceEngine::InferenceEngine(shared_ptr<const Weights> weights, unsigned input_dim, unsigned context_dim) : weights(weights), input_dim(input_dim), context_dim(context_dim) {}
+
+void InferenceEngine::SetThreads(unsigned threads) {
+  lanes.clear();
+  pool.reset();
+  if (threads <= 1) {
+    return;
+  }
+  pool.reset(new ThreadPool(threads));
+  for (unsigned k = 0; k < threads; ++k) {
+    lanes.push_back(unique_ptr<InferenceEngine>(new InferenceEngine(weights, input_dim, context_dim)));
+  }
+}
+
+// Runs an LSTM whose initial state comes from MakeLSTMInitialState(init) over
+// `length` inputs (input_cols x length). If context is given, it is appended
+// to every input, the way the output decoders use it; its contribution to the
+// gates is the same at each timestep, so it is only computed once.
+// Writes the top layer's hidden state before the first input and after each
+// input to the columns of states (H x (length + 1)).
+void InferenceEngine::RunLSTM(const LSTMWeights& lstm, const float* init, const float* inputs, unsigned input_cols, unsigned length, const float* context, vector<float>& states) {
+  const unsigned H = lstm.hidden_dim;
+  const unsigned layer_count = lstm.layers.size();
+  Scratch& s = scratch;
+  Grow(s.gates, 3 * H * max(length, 1u));
+  Grow(s.gate_bias, 3 * H);
+  Grow(s.layer_a, H * max(length, 1u));
+  Grow(s.layer_b, H * max(length, 1u));
+  Grow(s.c_prev, H);
+  Grow(s.c, H);
+  Grow(s.h0, H);
+  float* out_states = Grow(states, H * (length + 1));
+
+  const float* in = inputs;
+  unsigned in_dim = input_cols;
+  for (unsigned l = 0; l < layer_count; ++l) {
+    const LSTMLayerWeights& layer = lstm.layers[l];
+    float* gates = s.gates.data();
+    const float* bias = layer.bias.data();
+    if (l == 0 && context != nullptr) {
+      copy(layer.bias.begin(), layer.bias.end(), s.gate_bias.begin());
+      MatVecAdd(layer.wx.data() + 3 * H * input_cols, 3 * H, layer.input_dim - input_cols, context, s.gate_bias.data());
+      bias = s.gate_bias.data();
+    }
+    else {
+      assert (layer.input_dim == in_dim);
+    }
+
+    if (length > 0) {
+      BroadcastColumns(bias, 3 * H, length, gates);
+      MatMulAdd(layer.wx.data(), 3 * H, in_dim, in, length, gates);
+    }
+
+    float* c_prev = s.c_prev.data();
+    float* c = s.c.data();
+    copy(init + l * H, init + (l + 1) * H, c_prev);
+    Tanh(H, c_prev, s.h0.data());
+    const float* h_prev = s.h0.data();
+
+    float* out = (l % 2 == 0) ? s.layer_a.data() : s.layer_b.data();
+    for (unsigned t = 0; t < length; ++t) {
+      float* g = gates + t * 3 * H;
+      MatVecAdd(layer.wh.data(), 3 * H, H, h_prev, g);
+      MatVecAdd(layer.c2i.data(), H, H, c_prev, g);
+      LSTMCellState(H, g, g + 2 * H, c_prev, c);
+      MatVecAdd(layer.c2o.data(), H, H, c, g + H);
+      float* h = out + t * H;
+      LSTMCellOutput(H, g + H, c, h);
+      swap(c_prev, c);
+      h_prev = h;
+    }
+
+    in = out;
+    in_dim = H;
+  }
+
+  Tanh(H, init + (layer_count - 1) * H, out_states);
+  copy(in, in + H * length, out_states + H);
+}
+
+void InferenceEngine::FeedMLP(const MLPWeights& mlp, const float* input, float* output) {
+  float* hidden = Grow(scratch.hidden, mlp.hidden_dim);
+  copy(mlp.wHb, mlp.wHb + mlp.hidden_dim, hidden);
+  MatVecAdd(mlp.wIH, mlp.hidden_dim, mlp.input_dim, input, hidden);
+  Tanh(mlp.hidden_dim, hidden, hidden);
+  copy(mlp.wOb, mlp.wOb + mlp.output_dim, output);
+  MatVecAdd(mlp.wHO, mlp.output_dim, mlp.hidden_dim, hidden, output);
+}
+
+float InferenceEngine::SoftmaxLoss(const SoftmaxWeights& softmax, const float* h, unsigned ref) {
+  if (softmax.quantized != nullptr) {
+    return softmax.quantized->NegLogSoftmax(vector<float>(h, h + context_dim), ref);
+  }
+  float* scores = Grow(scratch.scores, softmax.vocab_size);
+  copy(softmax.b, softmax.b + softmax.vocab_size, scores);
+  MatVecAdd(softmax.w, softmax.vocab_size, softmax.input_dim, h, scores);
+  return logsumexp(scores, softmax.vocab_size) - scores[ref];
+}
+
+// Writes word i's input embedding to x.
+void InferenceEngine::EmbedWord(const Sentence& sentence, unsigned i, float* x) {
+  const Weights& w = *weights;
+  const MorphLMConfig& config = w.config;
+  const vector<WordId>& chars = sentence.chars[i];
+  float* sequence = Grow(scratch.sequence, config.char_embedding_dim * chars.size());
+  for (unsigned k = 0; k < chars.size(); ++k) {
+    w.input_char_embeddings.Lookup(chars[k], sequence + k * config.char_embedding_dim);
+  }
+  RunLSTM(w.input_char_lstm, w.input_char_lstm_init, sequence, config.char_embedding_dim, chars.size(), nullptr, scratch.states);
+  const float* char_embedding = scratch.states.data() + chars.size() * config.char_lstm_dim;
+  copy(char_embedding, char_embedding + config.char_lstm_dim, x);
+  unsigned offset = config.char_lstm_dim;
+
+  if (config.use_morphology) {
+    const vector<Analysis>& analyses = sentence.analyses[i];
+    assert (analyses.size() > 0);
+    for (unsigned j = 0; j < analyses.size(); ++j) {
+      const vector<WordId>& affixes = analyses[j].affixes;
+      float* init = Grow(scratch.lstm_init, w.input_root_embeddings.dim);
+      w.input_root_embeddings.Lookup(analyses[j].root, init);
+      sequence = Grow(scratch.sequence, config.affix_embedding_dim * affixes.size());
+      for (unsigned k = 0; k < affixes.size(); ++k) {
+        w.input_affix_embeddings.Lookup(affixes[k], sequence + k * config.affix_embedding_dim);
+      }
+      RunLSTM(w.input_affix_lstm, init, sequence, config.affix_embedding_dim, affixes.size(), nullptr, scratch.states);
+      const float* analysis_embedding = scratch.states.data() + affixes.size() * config.affix_lstm_dim;
+      if (j == 0) {
+        copy(analysis_embedding, analysis_embedding + config.affix_lstm_dim, x + offset);
+      }
+      else {
+        ElementwiseMax(config.affix_lstm_dim, analysis_embedding, x + offset);
+      }
+    }
+    offset += config.affix_lstm_dim;
+  }
+
+  if (config.use_words) {
+    w.input_word_embeddings.Lookup(sentence.words[i], x + offset);
+  }
+}
+
+// The words are independent of each other, so with a pool each worker
+// embeds whichever word comes next.
+void InferenceEngine::EmbedSentence(const Sentence& sentence) {
+  float* inputs = Grow(scratch.inputs, input_dim * sentence.size());
+  if (pool) {
+    pool->ParallelFor(sentence.size(), [&](unsigned i, unsigned worker) {
+      lanes[worker]->EmbedWord(sentence, i, inputs + i * input_dim);
+    });
+    return;
+  }
+  for (unsigned i = 0; i < sentence.size(); ++i) {
+    EmbedWord(sentence, i, inputs + i * input_dim);
+  }
+}
+
+// Context i is the main LSTM's state before it reads word i (concatenated
+// with the reverse LSTM's state before it reads word i, if bidirectional).
+void InferenceEngine::ComputeContexts(unsigned length) {
+  const Weights& w = *weights;
+  const unsigned H = w.config.main_lstm_dim;
+  float* contexts = Grow(scratch.contexts, context_dim * length);
+  if (!w.config.bidirectional) {
+    RunLSTM(w.main_lstm_fwd, w.main_lstm_fwd_init, scratch.inputs.data(), input_dim, length - 1, nullptr, scratch.fwd_contexts);
+    copy(scratch.fwd_contexts.begin(), scratch.fwd_contexts.begin() + H * length, contexts);
+    return;
+  }
+
+  float* reversed = Grow(scratch.sequence, input_dim * (length - 1));
+  for (unsigned k = 0; k + 1 < length; ++k) {
+    const float* x = scratch.inputs.data() + (length - 1 - k) * input_dim;
+    copy(x, x + input_dim, reversed + k * input_dim);
+  }
+  // The two directions only share their inputs, so with a pool they run
+  // side by side.
+  auto run = [&](unsigned direction, InferenceEngine& engine) {
+    if (direction == 0) {
+      engine.RunLSTM(w.main_lstm_fwd, w.main_lstm_fwd_init, scratch.inputs.data(), input_dim, length - 1, nullptr, scratch.fwd_contexts);
+    }
+    else {
+      engine.RunLSTM(w.main_lstm_rev, w.main_lstm_rev_init, reversed, input_dim, length - 1, nullptr, scratch.states);
+    }
+  };
+  if (pool) {
+    pool->ParallelFor(2, [&](unsigned direction, unsigned worker) { run(direction, *lanes[worker]); });
+  }
+  else {
+    run(0, *this);
+    run(1, *this);
+  }
+  for (unsigned j = 0; j < length; ++j) {
+    const float* fwd = scratch.fwd_contexts.data() + j * H;
+    const float* rev = scratch.states.data() + (length - 1 - j) * H;
+    copy(fwd, fwd + H, contexts + j * context_dim);
+    copy(rev, rev + H, contexts + j * context_dim + H);
+  }
+}
+
+const float* InferenceEngine::Context(unsigned i) const {
+  return scratch.contexts.data() + i * context_dim;
+}
+
+void InferenceEngine::ModelChooser(const float* context, vector<float>& log_probs) {
+  const MLPWeights& mlp = weights->model_chooser;
+  log_probs.resize(mlp.output_dim);
+  FeedMLP(mlp, context, log_probs.data());
+  log_softmax(log_probs.data(), log_probs.size(), log_probs.data());
+}
+
+float InferenceEngine::CharLoss(const float* context, const vector<WordId>& ref) {
+  const Weights& w = *weights;
+  const MorphLMConfig& config = w.config;
+  assert (ref.size() > 0);
+  float* init = Grow(scratch.lstm_init, w.output_char_lstm_init.output_dim);
+  FeedMLP(w.output_char_lstm_init, context, init);
+
+  // The state after the last character is never used, so it isn't computed.
+  unsigned length = ref.size() - 1;
+  float* sequence = Grow(scratch.sequence, config.char_embedding_dim * length);
+  for (unsigned k = 0; k < length; ++k) {
+    w.output_char_embeddings.Lookup(ref[k], sequence + k * config.char_embedding_dim);
+  }
+  RunLSTM(w.output_char_lstm, init, sequence, config.char_embedding_dim, length, context, scratch.states);
+
+  float loss = 0.0f;
+  for (unsigned k = 0; k < ref.size(); ++k) {
+    loss += SoftmaxLoss(w.char_softmax, scratch.states.data() + k * config.char_lstm_dim, ref[k]);
+  }
+  return loss;
+}
+
+float InferenceEngine::AnalysisLoss(const float* context, const Analysis& ref) {
+  const Weights& w = *weights;
+  const MorphLMConfig& config = w.config;
+  float loss = SoftmaxLoss(w.root_softmax, context, ref.root);
+  if (ref.affixes.size() == 0) {
+    return loss;
+  }
+
+  float* decoder_input = Grow(scratch.decoder_input, config.root_embedding_dim + context_dim);
+  w.output_root_embeddings.Lookup(ref.root, decoder_input);
+  copy(context, context + context_dim, decoder_input + config.root_embedding_dim);
+  float* init = Grow(scratch.lstm_init, w.output_affix_lstm_init.output_dim);
+  FeedMLP(w.output_affix_lstm_init, decoder_input, init);
+
+  unsigned length = ref.affixes.size() - 1;
+  float* sequence = Grow(scratch.sequence, config.affix_embedding_dim * length);
+  for (unsigned k = 0; k < length; ++k) {
+    w.output_affix_embeddings.Lookup(ref.affixes[k], sequence + k * config.affix_embedding_dim);
+  }
+  RunLSTM(w.output_affix_lstm, init, sequence, config.affix_embedding_dim, length, context, scratch.states);
+
+  for (unsigned k = 0; k < ref.affixes.size(); ++k) {
+    loss += SoftmaxLoss(w.affix_softmax, scratch.states.data() + k * config.affix_lstm_dim, ref.affixes[k]);
+  }
+  return loss;
+}
+
+// NB: This mirrors MorphLM::ComputeMorphemeLoss, which takes the logsumexp
+// of the analyses' losses (not of their log probabilities).
+float InferenceEngine::MorphemeLoss(const float* context, const vector<Analysis>& refs) {
+  vector<float> losses(refs.size());
+  for (unsigned i = 0; i < refs.size(); ++i) {
+    losses[i] = AnalysisLoss(context, refs[i]);
+  }
+  return logsumexp(losses);
+}
+
+float InferenceEngine::WordLoss(const float* context, WordId ref) {
+  return SoftmaxLoss(weights->word_softmax, context, ref);
+}
+
+// The loss of word i given its context, as in MorphLM::ComputePositionLoss.
+float InferenceEngine::PositionLoss(const Sentence& sentence, unsigned i, const float* context, ModePruning* pruning) {
+  const MorphLMConfig& config = weights->config;
+  vector<float> mode_log_probs;
+  ModelChooser(context, mode_log_probs);
+  if (i == sentence.size() - 1) {
+    assert (sentence.words[i] == 2); // </s>
+    return -mode_log_probs[0];
+  }
+
+  const bool has_morphemes = config.use_morphology && sentence.analyses[i].size() > 0 && sentence.analyses[i][0].root != 0;
+  const bool has_word = config.use_words && sentence.words[i] != 0;
+  vector<bool> keep(1 + has_morphemes + has_word, true);
+  float skipped_prob = 0.0f;
+  if (pruning != nullptr) {
+    vector<float> log_priors(mode_log_probs.begin() + 1, mode_log_probs.begin() + 1 + keep.size());
+    skipped_prob = pruning->SelectModes(log_priors, keep);
+  }
+
+  vector<float> mode_losses;
+  unsigned mode_index = 1;
+  if (keep[mode_index - 1]) {
+    mode_losses.push_back(mode_log_probs[mode_index] - CharLoss(context, sentence.chars[i]));
+  }
+  mode_index++;
+  if (has_morphemes) {
+    if (keep[mode_index - 1]) {
+      mode_losses.push_back(mode_log_probs[mode_index] - MorphemeLoss(context, sentence.analyses[i]));
+    }
+    mode_index++;
+  }
+  if (has_word) {
+    if (keep[mode_index - 1]) {
+      mode_losses.push_back(mode_log_probs[mode_index] - WordLoss(context, sentence.words[i]));
+    }
+    mode_index++;
+  }
+  float loss = -logsumexp(mode_losses);
+  if (pruning != nullptr) {
+    pruning->AddToken(skipped_prob, loss);
+  }
+  return loss;
+}
+
+float InferenceEngine::ScoreSentence(const Sentence& sentence, vector<float>* token_losses, ModePruning* pruning) {
+  assert (sentence.size() > 0);
+  EmbedSentence(sentence);
+  ComputeContexts(sentence.size());
+
+  // Given the contexts, the positions are independent. ModePruning keeps
+  // running totals, so it keeps them in order on one thread.
+  vector<float> losses(sentence.size());
+  if (pool && pruning == nullptr) {
+    pool->ParallelFor(sentence.size(), [&](unsigned i, unsigned worker) {
+      losses[i] = lanes[worker]->PositionLoss(sentence, i, Context(i), nullptr);
+    });
+  }
+  else {
+    for (unsigned i = 0; i < sentence.size(); ++i) {
+      losses[i] = PositionLoss(sentence, i, Context(i), pruning);
+    }
+  }
+
+  // Summed in order, so the total doesn't depend on the thread count.
+  float total = 0.0f;
+  for (float loss : losses) {
+    total += loss;
+  }
+  if (token_losses != nullptr) {
+    *token_losses = losses;
+  }
+  return total;
+}
+
+vector<vector<float>> InferenceEngine::ModeLogProbs(const Sentence& sentence) {
+  assert (sentence.size() > 0);
+  EmbedSentence(sentence);
+  ComputeContexts(sentence.size());
+
+  vector<vector<float>> mode_log_probs(sentence.size());
+  for (unsigned i = 0; i < sentence.size(); ++i) {
+    ModelChooser(Context(i), mode_log_probs[i]);
+  }
+  return mode_log_probs;
+}
+
+vector<vector<float>> InferenceEngine::ModePosteriors(const Sentence& sentence) {
+  assert (sentence.size() > 0);
+  const MorphLMConfig& config = weights->config;
+  EmbedSentence(sentence);
+  ComputeContexts(sentence.size());
+
+  vector<vector<float>> mode_log_probs(sentence.size());
+  for (unsigned i = 0; i < sentence.size(); ++i) {
+    const float* context = Context(i);
+    vector<float>& mode_losses = mode_log_probs[i];
+    mode_losses.push_back(-CharLoss(context, sentence.chars[i]));
+    if (config.use_morphology) {
+      if (sentence.analyses[i].size() > 0 and sentence.analyses[i][0].root != 0) {
+        mode_losses.push_back(-MorphemeLoss(context, sentence.analyses[i]));
+      }
+    }
+    if (config.use_words) {
+      if (sentence.words[i] != 0) {
+        mode_losses.push_back(-WordLoss(context, sentence.words[i]));
+      }
+    }
+
+    log_softmax(mode_losses.data(), mode_losses.size(), mode_losses.data());
+  }
+  return mode_log_probs;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "morphlm.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+struct LSTMWeights;
+struct MLPWeights;
+struct SoftmaxWeights;
+
+// Graph-free re-implementation of MorphLM's forward pass, for inference.
+// It reads the trained parameters out of a MorphLM and computes exactly what
+// BuildGraph, ShowModeProbs and ShowModePosteriors compute, but with fused
+// LSTM cell kernels, one matrix multiply for the input projections of all
+// timesteps of each LSTM layer, and scratch buffers that are reused across
+// sentences instead of a ComputationGraph per sentence.
+//
+// The weights are shared between copies of an engine, so each thread can
+// cheaply get its own copy (with its own scratch space). The MorphLM and its
+// Model must outlive every engine built from them.
+//
+// With SetThreads, the independent parts of scoring one sentence (each
+// word's input encoders, the forward and reverse main LSTMs, and each
+// position's output decoders) run in parallel, for lower latency. Scores are
+// the same either way.
+class InferenceEngine {
+public:
+  explicit InferenceEngine(const MorphLM& lm);
+  // Copies get their own threads (and scratch space).
+  InferenceEngine(const InferenceEngine& other);
+  InferenceEngine& operator=(const InferenceEngine&) = delete;
+
+  // Splits each sentence's work across this many threads, including the
+  // calling one.
+  void SetThreads(unsigned threads);
+
+  // Returns the sentence's total loss, and optionally each token's loss.
+  // With pruning, improbable modes are skipped (see ModePruning), but the
+  // caller still has to call pruning->EndSentence().
+  float ScoreSentence(const Sentence& sentence, vector<float>* token_losses = nullptr, ModePruning* pruning = nullptr);
+  vector<vector<float>> ModeLogProbs(const Sentence& sentence);
+  vector<vector<float>> ModePosteriors(const Sentence& sentence);
+
+  struct Weights;
+
+private:
+  // A single-threaded engine on the given weights, e.g. one of the lanes.
+  InferenceEngine(shared_ptr<const Weights> weights, unsigned input_dim, unsigned context_dim);
+
+  // Buffers reused across calls. Each is only grown, never shrunk.
+  struct Scratch {
+    vector<float> gates;
+    vector<float> gate_bias;
+    vector<float> layer_a;
+    vector<float> layer_b;
+    vector<float> c_prev;
+    vector<float> c;
+    vector<float> h0;
+    vector<float> lstm_init;
+    vector<float> states;
+    vector<float> inputs;
+    vector<float> sequence;
+    vector<float> fwd_contexts;
+    vector<float> contexts;
+    vector<float> hidden;
+    vector<float> scores;
+    vector<float> decoder_input;
+  };
+
+  void RunLSTM(const LSTMWeights& lstm, const float* init, const float* inputs, unsigned input_cols, unsigned length, const float* context, vector<float>& states);
+  void FeedMLP(const MLPWeights& mlp, const float* input, float* output);
+  float SoftmaxLoss(const SoftmaxWeights& softmax, const float* h, unsigned ref);
+
+  void EmbedWord(const Sentence& sentence, unsigned i, float* x);
+  void EmbedSentence(const Sentence& sentence);
+  void ComputeContexts(unsigned length);
+  const float* Context(unsigned i) const;
+  void ModelChooser(const float* context, vector<float>& log_probs);
+  float CharLoss(const float* context, const vector<WordId>& ref);
+  float AnalysisLoss(const float* context, const Analysis& ref);
+  float MorphemeLoss(const float* context, const vector<Analysis>& refs);
+  float WordLoss(const float* context, WordId ref);
+  float PositionLoss(const Sentence& sentence, unsigned i, const float* context, ModePruning* pruning);
+
+  friend class BeamSearch;
+
+  shared_ptr<const Weights> weights;
+  Scratch scratch;
+  unsigned input_dim;
+  unsigned context_dim;
+
+  // With more than one thread, worker k of the pool works in lanes[k], a
+  // single-threaded copy of this engine.
+  unique_ptr<ThreadPool> pool;
+  vector<unique_ptr<InferenceEngine>> lanes;
+};
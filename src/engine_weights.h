@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "engine.h"
+
+using namespace std;
+
+// The inference engine's packed copies of (or pointers into) a MorphLM's
+// parameters. Only for code that works directly on the engine's weights,
+// like BeamSearch.
+
+struct LSTMLayerWeights {
+  unsigned input_dim;
+  // Input, output and candidate gates stacked on top of each other, so one
+  // matrix multiply computes all three.
+  vector<float> wx; // 3H x input_dim
+  vector<float> wh; // 3H x H
+  vector<float> bias; // 3H
+  vector<float> c2i; // H x H
+  vector<float> c2o; // H x H
+};
+
+struct LSTMWeights {
+  unsigned hidden_dim;
+  vector<LSTMLayerWeights> layers;
+};
+
+struct MLPWeights {
+  unsigned input_dim;
+  unsigned hidden_dim;
+  unsigned output_dim;
+  const float* wIH;
+  const float* wHb;
+  const float* wHO;
+  const float* wOb;
+};
+
+struct SoftmaxWeights {
+  unsigned vocab_size;
+  unsigned input_dim;
+  const float* w;
+  const float* b;
+  const QuantizedSoftmax* quantized;
+};
+
+struct EmbeddingTable {
+  unsigned dim;
+  const LookupParameterStorage* table;
+  const QuantizedMatrix* quantized;
+
+  void Lookup(WordId id, float* out) const {
+    if (quantized != nullptr) {
+      vector<float> row = quantized->Row(id);
+      copy(row.begin(), row.end(), out);
+    }
+    else {
+      const float* row = table->values[id].v;
+      copy(row, row + dim, out);
+    }
+  }
+};
+
+struct InferenceEngine::Weights {
+  MorphLMConfig config;
+
+  EmbeddingTable input_word_embeddings;
+  EmbeddingTable input_root_embeddings;
+  EmbeddingTable input_affix_embeddings;
+  EmbeddingTable input_char_embeddings;
+
+  const float* input_char_lstm_init;
+  LSTMWeights input_affix_lstm;
+  LSTMWeights input_char_lstm;
+
+  const float* main_lstm_fwd_init;
+  const float* main_lstm_rev_init;
+  LSTMWeights main_lstm_fwd;
+  LSTMWeights main_lstm_rev;
+  MLPWeights model_chooser;
+
+  SoftmaxWeights word_softmax;
+  SoftmaxWeights root_softmax;
+  SoftmaxWeights affix_softmax;
+  SoftmaxWeights char_softmax;
+
+  EmbeddingTable output_root_embeddings;
+  EmbeddingTable output_affix_embeddings;
+  EmbeddingTable output_char_embeddings;
+
+  MLPWeights output_affix_lstm_init;
+  MLPWeights output_char_lstm_init;
+
+  LSTMWeights output_affix_lstm;
+  LSTMWeights output_char_lstm;
+};
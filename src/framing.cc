@@ -0,0 +1,234 @@
+#include <iostream>
+#include <sstream>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "framing.h"
+
+static bool ReadFully(int fd, char* buffer, size_t length) {
+  while (length > 0) {
+    ssize_t r = read(fd, buffer, length);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    buffer += r;
+    length -= r;
+  }
+  return true;
+}
+
+static bool WriteFully(int fd, const char* buffer, size_t length) {
+  while (length > 0) {
+    ssize_t r = send(fd, buffer, length, MSG_NOSIGNAL);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    buffer += r;
+    length -= r;
+  }
+  return true;
+}
+
+bool ReadFrame(int fd, string& payload) {
+  uint32_t header;
+  if (!ReadFully(fd, (char*)&header, sizeof(header))) {
+    return false;
+  }
+  uint32_t length = ntohl(header);
+  if (length > kMaxFrameSize) {
+    cerr << "Refusing frame of " << length << " bytes" << endl;
+    return false;
+  }
+  payload.resize(length);
+  return length == 0 || ReadFully(fd, &payload[0], length);
+}
+
+bool WriteFrame(int fd, const string& payload) {
+  assert (payload.size() <= kMaxFrameSize);
+  uint32_t header = htonl((uint32_t)payload.size());
+  return WriteFully(fd, (const char*)&header, sizeof(header)) && WriteFully(fd, payload.data(), payload.size());
+}
+
+static bool FillAddress(const string& path, sockaddr_un& address) {
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    cerr << "Socket path too long: " << path << endl;
+    return false;
+  }
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return true;
+}
+
+int ListenUnixSocket(const string& path) {
+  sockaddr_un address;
+  if (!FillAddress(path, address)) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    cerr << "Unable to create socket: " << strerror(errno) << endl;
+    return -1;
+  }
+
+  unlink(path.c_str());
+  if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+    cerr << "Unable to listen on " << path << ": " << strerror(errno) << endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int ConnectUnixSocket(const string& path, bool quiet) {
+  sockaddr_un address;
+  if (!FillAddress(path, address)) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    cerr << "Unable to create socket: " << strerror(errno) << endl;
+    return -1;
+  }
+
+  if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+    if (!quiet) {
+      cerr << "Unable to connect to " << path << ": " << strerror(errno) << endl;
+    }
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Splits host:port. Anything without a numeric port is a Unix socket path.
+static bool SplitHostPort(const string& address, string& host, string& port) {
+  size_t colon = address.rfind(':');
+  if (colon == string::npos || colon + 1 == address.size() || address.find('/') != string::npos) {
+    return false;
+  }
+  host = address.substr(0, colon);
+  port = address.substr(colon + 1);
+  return port.find_first_not_of("0123456789") == string::npos;
+}
+
+static addrinfo* ResolveTcpAddress(const string& host, const string& port, bool passive) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  addrinfo* result = nullptr;
+  int r = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+  if (r != 0) {
+    cerr << "Unable to resolve " << host << ":" << port << ": " << gai_strerror(r) << endl;
+    return nullptr;
+  }
+  return result;
+}
+
+int ListenSocket(const string& address) {
+  string host, port;
+  if (!SplitHostPort(address, host, port)) {
+    return ListenUnixSocket(address);
+  }
+
+  addrinfo* result = ResolveTcpAddress(host, port, true);
+  if (result == nullptr) {
+    return -1;
+  }
+  int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (fd < 0) {
+    cerr << "Unable to create socket: " << strerror(errno) << endl;
+    freeaddrinfo(result);
+    return -1;
+  }
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, result->ai_addr, result->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0) {
+    cerr << "Unable to listen on " << address << ": " << strerror(errno) << endl;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  return fd;
+}
+
+int ConnectSocket(const string& address, bool quiet) {
+  string host, port;
+  if (!SplitHostPort(address, host, port)) {
+    return ConnectUnixSocket(address, quiet);
+  }
+
+  addrinfo* result = ResolveTcpAddress(host, port, false);
+  if (result == nullptr) {
+    return -1;
+  }
+  int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (fd < 0) {
+    cerr << "Unable to create socket: " << strerror(errno) << endl;
+    freeaddrinfo(result);
+    return -1;
+  }
+
+  if (connect(fd, result->ai_addr, result->ai_addrlen) != 0) {
+    if (!quiet) {
+      cerr << "Unable to connect to " << address << ": " << strerror(errno) << endl;
+    }
+    close(fd);
+    fd = -1;
+  }
+  else {
+    // Don't let Nagle's algorithm hold back small writes.
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  freeaddrinfo(result);
+  return fd;
+}
+
+string FormatScores(const vector<float>& token_losses) {
+  float total = 0.0f;
+  for (float loss : token_losses) {
+    total += loss;
+  }
+
+  ostringstream ss;
+  ss << total;
+  for (float loss : token_losses) {
+    ss << "\n" << loss;
+  }
+  return ss.str();
+}
+
+bool ParseScores(const string& payload, float& total, vector<float>& token_losses) {
+  if (payload.compare(0, 5, "ERROR") == 0) {
+    return false;
+  }
+
+  istringstream ss(payload);
+  token_losses.clear();
+  if (!(ss >> total)) {
+    return false;
+  }
+  for (float loss; ss >> loss;) {
+    token_losses.push_back(loss);
+  }
+  return true;
+}
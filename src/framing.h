@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Wire protocol used by morphlm_server and its clients.
+// Every message is a frame: a 4-byte big-endian payload length followed by
+// the payload itself.
+//
+// A request payload is one morphologically analyzed sentence in the same
+// format loss reads from stdin (one token per line, without the blank line
+// that ends the sentence).
+//
+// A response payload is either "ERROR <message>", or the sentence's total
+// negative log loss on the first line followed by one line per token
+// (including the final </s>) with that token's loss.
+const unsigned kMaxFrameSize = 16 * 1024 * 1024;
+
+bool ReadFrame(int fd, string& payload);
+bool WriteFrame(int fd, const string& payload);
+
+int ListenUnixSocket(const string& path);
+int ConnectUnixSocket(const string& path, bool quiet = false);
+// An address is either host:port for TCP or the path of a Unix socket.
+int ListenSocket(const string& address);
+// With quiet set, failing to connect is not reported (for callers that retry).
+int ConnectSocket(const string& address, bool quiet = false);
+
+string FormatScores(const vector<float>& token_losses);
+bool ParseScores(const string& payload, float& total, vector<float>& token_losses);
@@ -0,0 +1,306 @@
+#pragma once
+#include "dynet/dynet.h"
+#include "dynet/training.h"
+#include "dynet/mp.h"
+#include "io.h"
+
+#include <atomic>
+#include <random>
+#include <vector>
+#include <numeric>
+#include <iostream>
+#include <algorithm>
+#include <new>
+#include <climits>
+#include <cassert>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace dynet;
+using namespace dynet::mp;
+using namespace std;
+
+// Hogwild training: N workers share one set of parameters and update them
+// without any locking. DyNet only allows one ComputationGraph per process,
+// so the workers are processes rather than threads, but they are forked
+// once, up front, and after that they share nothing but the parameters
+// (which live in DyNet's shared memory pool, see dynet::initialize) and a
+// handful of counters. Each worker walks its own strided shard of the same
+// shuffled order, so no sentences ever need to be sent to it, and the
+// parent only watches the counters to report progress and run the dev set.
+
+// Per-worker training stats since the last report, guarded by a spinlock.
+template <class S>
+struct HogwildSlot {
+  atomic_flag lock;
+  S stats;
+};
+
+template <class S>
+struct HogwildState {
+  atomic<bool> stop;
+  atomic<bool> paused;
+  // Number of workers in the middle of a training step
+  atomic<unsigned> busy;
+  atomic<unsigned> finished;
+  atomic<unsigned long long> processed;
+  // Used by the asynchronous dev set evaluator
+  atomic<bool> snapshot_taken;
+  S dev_stats;
+  HogwildSlot<S> slots[1];
+
+  static size_t Bytes(unsigned num_workers) {
+    return sizeof(HogwildState<S>) + (num_workers - 1) * sizeof(HogwildSlot<S>);
+  }
+};
+
+template <class S>
+HogwildState<S>* CreateHogwildState(unsigned num_workers) {
+  void* memory = mmap(nullptr, HogwildState<S>::Bytes(num_workers), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    cerr << "Unable to allocate shared memory for Hogwild training" << endl;
+    exit(1);
+  }
+  HogwildState<S>* state = new (memory) HogwildState<S>();
+  state->stop = false;
+  state->paused = false;
+  state->busy = 0;
+  state->finished = 0;
+  state->processed = 0;
+  state->snapshot_taken = false;
+  for (unsigned i = 0; i < num_workers; ++i) {
+    new (&state->slots[i]) HogwildSlot<S>();
+    state->slots[i].lock.clear();
+  }
+  return state;
+}
+
+template <class S>
+void AddHogwildStats(HogwildSlot<S>& slot, const S& stats) {
+  while (slot.lock.test_and_set(memory_order_acquire)) {}
+  slot.stats += stats;
+  slot.lock.clear(memory_order_release);
+}
+
+// Returns and clears the stats of every worker.
+template <class S>
+S CollectHogwildStats(HogwildState<S>* state, unsigned num_workers) {
+  S total = S();
+  for (unsigned i = 0; i < num_workers; ++i) {
+    HogwildSlot<S>& slot = state->slots[i];
+    while (slot.lock.test_and_set(memory_order_acquire)) {}
+    total += slot.stats;
+    slot.stats = S();
+    slot.lock.clear(memory_order_release);
+  }
+  return total;
+}
+
+template <class D, class S>
+void RunHogwildWorker(unsigned worker_id, unsigned num_workers, ILearner<D, S>* learner, Trainer* trainer, const vector<D>& train_data, unsigned num_iterations, unsigned seed, HogwildState<S>* state) {
+  vector<unsigned> order(train_data.size());
+  iota(order.begin(), order.end(), 0);
+  HogwildSlot<S>& slot = state->slots[worker_id];
+
+  for (unsigned iter = 0; iter < num_iterations; ++iter) {
+    // Every worker shuffles the same way, and takes every n-th sentence
+    mt19937 rng(seed + iter);
+    shuffle(order.begin(), order.end(), rng);
+    for (unsigned i = worker_id; i < order.size(); i += num_workers) {
+      // Announce ourselves before checking for a pause, so that the parent
+      // never sees zero busy workers while we're about to start a step.
+      while (true) {
+        state->busy++;
+        if (!state->paused || state->stop || stop_requested) {
+          break;
+        }
+        state->busy--;
+        usleep(1000);
+      }
+      if (state->stop || stop_requested) {
+        state->busy--;
+        break;
+      }
+
+      S stats = learner->LearnFromDatum(train_data[order[i]], true);
+      trainer->update();
+      AddHogwildStats(slot, stats);
+      state->processed++;
+      state->busy--;
+    }
+    if (state->stop || stop_requested) {
+      break;
+    }
+    trainer->update_epoch();
+  }
+  state->finished++;
+}
+
+template <class D, class S>
+S EvaluateHogwildDev(ILearner<D, S>* learner, const vector<D>& dev_data) {
+  S dev_stats = S();
+  for (const D& datum : dev_data) {
+    dev_stats += learner->LearnFromDatum(datum, false);
+  }
+  return dev_stats;
+}
+
+// Pauses the workers and waits until none of them is in a training step.
+template <class S>
+void PauseHogwildWorkers(HogwildState<S>* state) {
+  state->paused = true;
+  while (state->busy > 0) {
+    usleep(100);
+  }
+}
+
+// Forks a process that scores the dev set on a snapshot of the parameters,
+// and saves that snapshot if it's the best so far. The workers are only
+// held while the snapshot is copied, not while the dev set is scored.
+template <class D, class S>
+pid_t StartDevEvaluator(ILearner<D, S>* learner, Model& dynet_model, const vector<D>& dev_data, const S& best_dev_stats, bool first_dev_run, HogwildState<S>* state) {
+  PauseHogwildWorkers(state);
+  state->snapshot_taken = false;
+  pid_t pid = fork();
+  if (pid == -1) {
+    cerr << "Fork failed. Exiting..." << endl;
+    exit(1);
+  }
+  else if (pid == 0) {
+    DetachParameters(dynet_model);
+    state->snapshot_taken = true;
+    S dev_stats = EvaluateHogwildDev(learner, dev_data);
+    if (first_dev_run || dev_stats < best_dev_stats) {
+      learner->SaveModel();
+    }
+    state->dev_stats = dev_stats;
+    _exit(0);
+  }
+
+  while (!state->snapshot_taken && waitpid(pid, nullptr, WNOHANG) == 0) {
+    usleep(100);
+  }
+  state->paused = false;
+  return pid;
+}
+
+// If dev_model is given, the dev set is scored asynchronously on snapshots
+// of its parameters while the workers keep training.
+template <class D, class S>
+void RunHogwild(unsigned num_workers, ILearner<D, S>* learner, Trainer* trainer, const vector<D>& train_data, const vector<D>& dev_data, unsigned num_iterations, unsigned dev_frequency, unsigned report_frequency, Model* dev_model = nullptr) {
+  assert (num_workers > 0);
+  HogwildState<S>* state = CreateHogwildState<S>(num_workers);
+  const unsigned seed = random_device()();
+
+  for (unsigned i = 0; i < num_workers; ++i) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      cerr << "Fork failed. Exiting..." << endl;
+      exit(1);
+    }
+    else if (pid == 0) {
+      RunHogwildWorker(i, num_workers, learner, trainer, train_data, num_iterations, seed, state);
+      _exit(0);
+    }
+  }
+
+  S best_dev_stats;
+  bool first_dev_run = true;
+  auto report_dev = [&](double fractional_iter, S dev_stats) {
+    bool new_best = (first_dev_run || dev_stats < best_dev_stats);
+    first_dev_run = false;
+    cerr << fractional_iter << "\t" << "dev loss = " << dev_stats << (new_best ? " (New best!)" : "") << endl;
+    if (new_best) {
+      best_dev_stats = dev_stats;
+    }
+    return new_best;
+  };
+
+  unsigned long long next_report = report_frequency;
+  unsigned long long next_dev = dev_frequency;
+  unsigned long long last_dev = 0;
+  unsigned alive = num_workers;
+  pid_t evaluator = -1;
+  double evaluator_iter = 0.0;
+  bool dev_pending = false;
+  while (true) {
+    usleep(1000);
+    if (stop_requested) {
+      state->stop = true;
+    }
+
+    // Notice workers that die, rather than waiting for them forever.
+    int status;
+    pid_t pid;
+    while ((alive > 0 || evaluator != -1) && (pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      if (pid == evaluator) {
+        evaluator = -1;
+        if (success) {
+          report_dev(evaluator_iter, state->dev_stats);
+        }
+        else {
+          cerr << "Dev set evaluator died" << endl;
+        }
+        continue;
+      }
+      alive--;
+      if (!success) {
+        cerr << "Hogwild worker " << pid << " died. Stopping..." << endl;
+        state->stop = true;
+      }
+    }
+
+    const unsigned long long processed = state->processed;
+    const bool done = (alive == 0 || state->finished == num_workers);
+    const double fractional_iter = (double)processed / train_data.size();
+    if (processed >= next_report || (done && processed > next_report - report_frequency)) {
+      S training_stats = CollectHogwildStats(state, num_workers);
+      cerr << fractional_iter << "\t" << "loss = " << training_stats << endl;
+      next_report = (processed / report_frequency + 1) * report_frequency;
+    }
+
+    if (processed >= next_dev) {
+      dev_pending = true;
+      last_dev = processed;
+      next_dev = (processed / dev_frequency + 1) * dev_frequency;
+    }
+    if (dev_pending && !done) {
+      if (dev_model != nullptr) {
+        // A dev check that comes due while the previous one is still
+        // running starts as soon as that one finishes.
+        if (evaluator == -1) {
+          evaluator_iter = fractional_iter;
+          evaluator = StartDevEvaluator(learner, *dev_model, dev_data, best_dev_stats, first_dev_run, state);
+          dev_pending = false;
+        }
+      }
+      else {
+        // Hold the workers while the dev set is scored, like run_multi_process does.
+        PauseHogwildWorkers(state);
+        if (report_dev(fractional_iter, EvaluateHogwildDev(learner, dev_data))) {
+          learner->SaveModel();
+        }
+        state->paused = false;
+        dev_pending = false;
+      }
+    }
+
+    if (done && evaluator == -1) {
+      // Score the dev set once more at the very end of training.
+      const bool stopped = (state->stop || stop_requested);
+      if (!stopped && (dev_pending || processed > last_dev)) {
+        if (report_dev(fractional_iter, EvaluateHogwildDev(learner, dev_data))) {
+          learner->SaveModel();
+        }
+      }
+      break;
+    }
+  }
+
+  while (alive > 0 && wait(nullptr) > 0) {
+    alive--;
+  }
+  munmap(state, HogwildState<S>::Bytes(num_workers));
+}
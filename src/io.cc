@@ -1,6 +1,86 @@
 #include <fstream>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
 #include "io.h"
 
+AnalysisLimit analysis_limit;
+
+AnalysisLimit::AnalysisLimit() : analysis_cap(0), mass(1.0f), tokens(0), pruned_tokens(0), analyses_read(0), analyses_kept(0) {}
+
+void AnalysisLimit::Set(unsigned max_analyses, float mass) {
+  analysis_cap = max_analyses;
+  this->mass = mass;
+}
+
+void AnalysisLimit::Apply(vector<Analysis>& analyses, vector<float>& probs) {
+  assert (analyses.size() == probs.size());
+  if (!active()) {
+    return;
+  }
+  tokens++;
+  analyses_read += analyses.size();
+
+  vector<unsigned> order(analyses.size());
+  iota(order.begin(), order.end(), 0);
+  stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return probs[a] > probs[b]; });
+  const float target = mass * accumulate(probs.begin(), probs.end(), 0.0f);
+  // A mass of 1 keeps everything, and so does a token whose analyses all
+  // have probability 0, whatever the running sum says.
+  const bool by_mass = mass < 1.0f && target > 0.0f;
+
+  vector<bool> keep(analyses.size(), false);
+  unsigned kept = 0;
+  float covered = 0.0f;
+  for (unsigned i : order) {
+    if (kept > 0 && ((analysis_cap > 0 && kept >= analysis_cap) || (by_mass && covered >= target))) {
+      break;
+    }
+    keep[i] = true;
+    covered += probs[i];
+    kept++;
+  }
+  analyses_kept += kept;
+  if (kept == analyses.size()) {
+    return;
+  }
+
+  pruned_tokens++;
+  unsigned j = 0;
+  for (unsigned i = 0; i < analyses.size(); ++i) {
+    if (keep[i]) {
+      analyses[j] = analyses[i];
+      probs[j] = probs[i];
+      j++;
+    }
+  }
+  analyses.resize(kept);
+  probs.resize(kept);
+}
+
+void AnalysisLimit::Report(ostream& out) const {
+  if (!active() || tokens == 0) {
+    return;
+  }
+  out << "Analysis limit: pruned " << pruned_tokens << " of " << tokens << " tokens, keeping " << analyses_kept << " of " << analyses_read << " analyses (" << (double)analyses_kept / tokens << " per token, down from " << (double)analyses_read / tokens << ")" << endl;
+}
+
+void AddAnalysisLimitOptions(po::options_description& desc) {
+  desc.add_options()
+  ("max_analyses", po::value<unsigned>()->default_value(0), "Keep at most this many of each token's analyses, the ones with the highest analyzer probability (0 keeps all)")
+  ("analysis_mass", po::value<float>()->default_value(1.0f), "Keep no more of each token's most probable analyses than needed to cover this much of its probability (1 keeps all)");
+}
+
+bool ConfigureAnalysisLimit(const po::variables_map& vm) {
+  float mass = vm["analysis_mass"].as<float>();
+  if (mass <= 0.0f || mass > 1.0f) {
+    cerr << "--analysis_mass must be more than 0 and at most 1" << endl;
+    return false;
+  }
+  analysis_limit.Set(vm["max_analyses"].as<unsigned>(), mass);
+  return true;
+}
+
 bool ReadVocab(const string& filename, Dict& vocab) {
   ifstream f(filename);
   if (!f.is_open()) {
@@ -49,6 +129,7 @@ void HandleMorphLine(const string& line, Dict& word_vocab, Dict& root_vocab, Dic
     float prob = atof(pieces[i + 1].c_str());
     out.analysis_probs.back().push_back(prob);
   }
+  analysis_limit.Apply(out.analyses.back(), out.analysis_probs.back());
 
   out.chars.push_back(vector<WordId>());
   unsigned i = 0;
@@ -161,6 +242,7 @@ vector<Sentence> ReadMorphText(const string& filename, Dict& word_vocab, Dict& r
       float prob = atof(pieces[i + 1].c_str());
       current.analysis_probs.back().push_back(prob);
     }
+    analysis_limit.Apply(current.analyses.back(), current.analysis_probs.back());
 
     current.chars.push_back(vector<WordId>());
     unsigned i = 0;
@@ -192,12 +274,44 @@ vector<Sentence> ReadMorphText(const string& filename, Dict& word_vocab, Dict& r
   return corpus;
 }
 
+// Models start with this line and a copy of their MorphLMConfig, so that
+// tools can size DyNet's memory pools before DyNet is initialized (see
+// memory.h). Older models start directly with the archive.
+const string kModelMagic = "MorphLM model\n";
+
+static bool ReadModelMagic(istream& f) {
+  string magic(kModelMagic.size(), '\0');
+  f.read(&magic[0], magic.size());
+  if (f && magic == kModelMagic) {
+    return true;
+  }
+  f.clear();
+  f.seekg(0);
+  return false;
+}
+
+bool PeekModelConfig(const string& filename, MorphLMConfig& config) {
+  ifstream f(filename);
+  if (!f.is_open()) {
+    cerr << "Unable to open model file " << filename << endl;
+    return false;
+  }
+  if (!ReadModelMagic(f)) {
+    return false;
+  }
+  boost::archive::binary_iarchive ia(f);
+  ia & config;
+  return true;
+}
+
 void Serialize(const Dict& word_vocab, const Dict& root_vocab, const Dict& affix_vocab, const Dict& char_vocab, const MorphLM& lm, Model& dynet_model) {
   int r = ftruncate(fileno(stdout), 0);
   if (r != 0) {}
   fseek(stdout, 0, SEEK_SET);
 
+  cout << kModelMagic;
   boost::archive::binary_oarchive oa(cout);
+  oa & lm.config;
   oa & dynet_model;
   oa & word_vocab;
   oa & root_vocab;
@@ -208,7 +322,12 @@ void Serialize(const Dict& word_vocab, const Dict& root_vocab, const Dict& affix
 
 void Deserialize(const string& filename, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, MorphLM& lm, Model& dynet_model) {
   ifstream f(filename);
+  bool has_header = ReadModelMagic(f);
   boost::archive::binary_iarchive ia(f);
+  if (has_header) {
+    MorphLMConfig header_config;
+    ia & header_config;
+  }
   ia & dynet_model;
   ia & word_vocab;
   ia & root_vocab;
@@ -223,3 +342,94 @@ void Deserialize(const string& filename, Dict& word_vocab, Dict& root_vocab, Dic
   assert (char_vocab.is_frozen());
 }
 
+
+// Copies parameter values between two models built by the same sequence of
+// add_parameters calls, except that `to` lacks the parameters whose indices
+// (in `from`) are listed as skipped.
+void CopyParameters(const Model& from, Model& to, const set<unsigned>& skipped_params, const set<unsigned>& skipped_lookup_params) {
+  const vector<ParameterStorage*>& from_params = from.parameters_list();
+  const vector<ParameterStorage*>& to_params = to.parameters_list();
+  assert (from_params.size() == to_params.size() + skipped_params.size());
+  unsigned j = 0;
+  for (unsigned i = 0; i < from_params.size(); ++i) {
+    if (skipped_params.count(i) > 0) {
+      continue;
+    }
+    assert (from_params[i]->dim.size() == to_params[j]->dim.size());
+    memcpy(to_params[j]->values.v, from_params[i]->values.v, sizeof(float) * from_params[i]->dim.size());
+    j++;
+  }
+
+  const vector<LookupParameterStorage*>& from_lookups = from.lookup_parameters_list();
+  const vector<LookupParameterStorage*>& to_lookups = to.lookup_parameters_list();
+  assert (from_lookups.size() == to_lookups.size() + skipped_lookup_params.size());
+  j = 0;
+  for (unsigned i = 0; i < from_lookups.size(); ++i) {
+    if (skipped_lookup_params.count(i) > 0) {
+      continue;
+    }
+    assert (from_lookups[i]->values.size() == to_lookups[j]->values.size());
+    for (unsigned k = 0; k < from_lookups[i]->values.size(); ++k) {
+      memcpy(to_lookups[j]->values[k].v, from_lookups[i]->values[k].v, sizeof(float) * from_lookups[i]->dim.size());
+    }
+    j++;
+  }
+}
+
+void CopyParameters(const Model& from, Model& to, const map<unsigned, vector<WordId>>& kept_rows, const map<unsigned, vector<WordId>>& kept_lookup_rows) {
+  const vector<ParameterStorage*>& from_params = from.parameters_list();
+  const vector<ParameterStorage*>& to_params = to.parameters_list();
+  assert (from_params.size() == to_params.size());
+  for (unsigned i = 0; i < from_params.size(); ++i) {
+    auto it = kept_rows.find(i);
+    if (it == kept_rows.end()) {
+      assert (from_params[i]->dim.size() == to_params[i]->dim.size());
+      memcpy(to_params[i]->values.v, from_params[i]->values.v, sizeof(float) * from_params[i]->dim.size());
+      continue;
+    }
+
+    // Matrices are column-major, so a row is strided by the row count.
+    const vector<WordId>& rows = it->second;
+    const unsigned from_rows = from_params[i]->dim.rows();
+    const unsigned cols = from_params[i]->dim.cols();
+    assert (to_params[i]->dim.rows() == rows.size());
+    assert (to_params[i]->dim.cols() == cols);
+    for (unsigned c = 0; c < cols; ++c) {
+      for (unsigned r = 0; r < rows.size(); ++r) {
+        to_params[i]->values.v[c * rows.size() + r] = from_params[i]->values.v[c * from_rows + rows[r]];
+      }
+    }
+  }
+
+  const vector<LookupParameterStorage*>& from_lookups = from.lookup_parameters_list();
+  const vector<LookupParameterStorage*>& to_lookups = to.lookup_parameters_list();
+  assert (from_lookups.size() == to_lookups.size());
+  for (unsigned i = 0; i < from_lookups.size(); ++i) {
+    assert (from_lookups[i]->dim.size() == to_lookups[i]->dim.size());
+    auto it = kept_lookup_rows.find(i);
+    const unsigned count = (it == kept_lookup_rows.end()) ? from_lookups[i]->values.size() : it->second.size();
+    assert (to_lookups[i]->values.size() == count);
+    for (unsigned k = 0; k < count; ++k) {
+      const unsigned source = (it == kept_lookup_rows.end()) ? k : it->second[k];
+      memcpy(to_lookups[i]->values[k].v, from_lookups[i]->values[source].v, sizeof(float) * from_lookups[i]->dim.size());
+    }
+  }
+}
+
+void DetachParameters(Model& dynet_model) {
+  for (ParameterStorage* p : dynet_model.parameters_list()) {
+    float* values = new float[p->dim.size()];
+    memcpy(values, p->values.v, sizeof(float) * p->dim.size());
+    p->values.v = values;
+  }
+
+  for (LookupParameterStorage* p : dynet_model.lookup_parameters_list()) {
+    const size_t row_size = p->dim.size();
+    float* values = new float[row_size * p->values.size()];
+    for (unsigned k = 0; k < p->values.size(); ++k) {
+      memcpy(values + k * row_size, p->values[k].v, sizeof(float) * row_size);
+      p->values[k].v = values + k * row_size;
+    }
+    p->all_values.v = values;
+  }
+}
@@ -1,16 +1,67 @@
 #pragma once
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
+#include <boost/program_options.hpp>
 #include <vector>
+#include <set>
+#include <map>
+#include <atomic>
 #include "dynet/dict.h"
 #include "morphlm.h"
 #include "utils.h"
 
 using namespace std;
 using namespace dynet;
+namespace po = boost::program_options;
 
+// Caps the number of analyses kept for each token, keeping the ones the
+// analyzer gave the highest probability: at most max_analyses of them, and
+// no more than needed to cover mass of the token's total probability. At
+// least one analysis always survives, and the survivors keep their order.
+// Every reader of morphologically analyzed text applies it, so training
+// and inference see the same analyses and the work per token is bounded.
+class AnalysisLimit {
+public:
+  AnalysisLimit();
+  // 0 analyses and a mass of 1 mean no limit.
+  void Set(unsigned max_analyses, float mass);
+  unsigned max_analyses() const { return analysis_cap; }
+  bool active() const { return analysis_cap > 0 || mass < 1.0f; }
+
+  void Apply(vector<Analysis>& analyses, vector<float>& probs);
+  void Report(ostream& out) const;
+
+private:
+  unsigned analysis_cap;
+  float mass;
+  atomic<unsigned long long> tokens;
+  atomic<unsigned long long> pruned_tokens;
+  atomic<unsigned long long> analyses_read;
+  atomic<unsigned long long> analyses_kept;
+};
+
+extern AnalysisLimit analysis_limit;
+
+void AddAnalysisLimitOptions(po::options_description& desc);
+// Sets analysis_limit from the options. Returns false if they're invalid.
+bool ConfigureAnalysisLimit(const po::variables_map& vm);
+
+// Adds one line of morphologically analyzed text (a word followed by
+// analysis/probability pairs) to a sentence, and ends the sentence.
+void HandleMorphLine(const string& line, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, Sentence& out);
+void EndMorphSentence(Dict& word_vocab, Dict& root_vocab, Dict& char_vocab, Sentence& out);
 bool ReadMorphSentence(istream& f, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, Sentence& out);
 bool ReadVocab(const string& filename, Dict& vocab);
 vector<Sentence> ReadMorphText(const string& filename, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab);
+bool PeekModelConfig(const string& filename, MorphLMConfig& config);
 void Serialize(const Dict& word_vocab, const Dict& root_vocab, const Dict& affix_vocab, const Dict& char_vocab, const MorphLM& translator, Model& dynet_model);
 void Deserialize(const string& filename, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, MorphLM& lm, Model& dynet_model);
+void CopyParameters(const Model& from, Model& to, const set<unsigned>& skipped_params, const set<unsigned>& skipped_lookup_params);
+// Copies parameter values between two models built by the same sequence of
+// add_parameters calls, where the parameters listed in kept_rows (by index)
+// have fewer rows in `to`: row i of `to` is row kept_rows[index][i] of `from`.
+void CopyParameters(const Model& from, Model& to, const map<unsigned, vector<WordId>>& kept_rows, const map<unsigned, vector<WordId>>& kept_lookup_rows);
+// Moves the values of every parameter into freshly allocated private memory.
+// After a fork, this gives the child a frozen snapshot of a model whose
+// parameters live in DyNet's shared memory pool.
+void DetachParameters(Model& dynet_model);
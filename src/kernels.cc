@@ -0,0 +1,206 @@
+#include <cmath>
+#include <algorithm>
+#include "kernels.h"
+#include "simd.h"
+
+using namespace std;
+
+template <typename S>
+SIMD_INLINE typename S::V SimdSigmoid(typename S::V x) {
+  return S::Div(S::Set(1.0f), S::Add(S::Set(1.0f), SimdExp<S>(S::Sub(S::Set(0.0f), x))));
+}
+
+template <typename S>
+SIMD_INLINE typename S::V SimdTanh(typename S::V x) {
+  // tanh(x) = 2 * sigmoid(2x) - 1
+  return S::Sub(S::Mul(S::Set(2.0f), SimdSigmoid<S>(S::Add(x, x))), S::Set(1.0f));
+}
+
+template <>
+SIMD_INLINE float SimdTanh<Scalar>(float x) {
+  return tanh(x);
+}
+
+template <typename S>
+SIMD_INLINE void SimdMatMulAdd(const float* W, unsigned rows, unsigned cols, const float* X, unsigned n, float* Y) {
+  typedef typename S::V V;
+  // Four output columns at a time, so each column of W is read from memory
+  // once per four inputs.
+  const unsigned kBlock = 4;
+  for (unsigned j0 = 0; j0 < n; j0 += kBlock) {
+    unsigned block = min(kBlock, n - j0);
+    const float* x[kBlock];
+    float* y[kBlock];
+    for (unsigned k = 0; k < kBlock; ++k) {
+      unsigned j = j0 + min(k, block - 1);
+      x[k] = X + (size_t)j * cols;
+      y[k] = Y + (size_t)j * rows;
+    }
+
+    for (unsigned c = 0; c < cols; ++c) {
+      const float* w = W + (size_t)c * rows;
+      if (block == kBlock) {
+        float x0 = x[0][c], x1 = x[1][c], x2 = x[2][c], x3 = x[3][c];
+        V vx0 = S::Set(x0), vx1 = S::Set(x1), vx2 = S::Set(x2), vx3 = S::Set(x3);
+        unsigned r = 0;
+        for (; r + S::kWidth <= rows; r += S::kWidth) {
+          V vw = S::Load(w + r);
+          S::Store(y[0] + r, S::Fma(vw, vx0, S::Load(y[0] + r)));
+          S::Store(y[1] + r, S::Fma(vw, vx1, S::Load(y[1] + r)));
+          S::Store(y[2] + r, S::Fma(vw, vx2, S::Load(y[2] + r)));
+          S::Store(y[3] + r, S::Fma(vw, vx3, S::Load(y[3] + r)));
+        }
+        for (; r < rows; ++r) {
+          y[0][r] += w[r] * x0;
+          y[1][r] += w[r] * x1;
+          y[2][r] += w[r] * x2;
+          y[3][r] += w[r] * x3;
+        }
+      }
+      else {
+        for (unsigned k = 0; k < block; ++k) {
+          float xk = x[k][c];
+          V vxk = S::Set(xk);
+          unsigned r = 0;
+          for (; r + S::kWidth <= rows; r += S::kWidth) {
+            S::Store(y[k] + r, S::Fma(S::Load(w + r), vxk, S::Load(y[k] + r)));
+          }
+          for (; r < rows; ++r) {
+            y[k][r] += w[r] * xk;
+          }
+        }
+      }
+    }
+  }
+}
+
+// (1 - sigmoid(i)) * c_prev + sigmoid(i) * tanh(w)
+template <typename S>
+SIMD_INLINE typename S::V CellState(typename S::V i, typename S::V w, typename S::V c_prev) {
+  // = c_prev + sigmoid(i) * (tanh(w) - c_prev)
+  return S::Fma(SimdSigmoid<S>(i), S::Sub(SimdTanh<S>(w), c_prev), c_prev);
+}
+
+template <typename S>
+SIMD_INLINE void SimdLSTMCellState(unsigned n, const float* i, const float* w, const float* c_prev, float* c) {
+  unsigned k = 0;
+  for (; k + S::kWidth <= n; k += S::kWidth) {
+    S::Store(c + k, CellState<S>(S::Load(i + k), S::Load(w + k), S::Load(c_prev + k)));
+  }
+  for (; k < n; ++k) {
+    c[k] = CellState<Scalar>(i[k], w[k], c_prev[k]);
+  }
+}
+
+template <typename S>
+SIMD_INLINE void SimdLSTMCellOutput(unsigned n, const float* o, const float* c, float* h) {
+  unsigned k = 0;
+  for (; k + S::kWidth <= n; k += S::kWidth) {
+    S::Store(h + k, S::Mul(SimdSigmoid<S>(S::Load(o + k)), SimdTanh<S>(S::Load(c + k))));
+  }
+  for (; k < n; ++k) {
+    h[k] = SimdSigmoid<Scalar>(o[k]) * SimdTanh<Scalar>(c[k]);
+  }
+}
+
+template <typename S>
+SIMD_INLINE void SimdTanhArray(unsigned n, const float* x, float* y) {
+  unsigned k = 0;
+  for (; k + S::kWidth <= n; k += S::kWidth) {
+    S::Store(y + k, SimdTanh<S>(S::Load(x + k)));
+  }
+  for (; k < n; ++k) {
+    y[k] = SimdTanh<Scalar>(x[k]);
+  }
+}
+
+// The kernels compiled for one instruction set.
+struct DenseKernels {
+  void (*mat_mul_add)(const float* W, unsigned rows, unsigned cols, const float* X, unsigned n, float* Y);
+  void (*lstm_cell_state)(unsigned n, const float* i, const float* w, const float* c_prev, float* c);
+  void (*lstm_cell_output)(unsigned n, const float* o, const float* c, float* h);
+  void (*tanh)(unsigned n, const float* x, float* y);
+};
+
+static const DenseKernels kScalarKernels = {
+  SimdMatMulAdd<Scalar>, SimdLSTMCellState<Scalar>, SimdLSTMCellOutput<Scalar>, SimdTanhArray<Scalar>
+};
+
+#ifdef HAVE_SIMD_DISPATCH
+AVX2_TARGET static void Avx2MatMulAdd(const float* W, unsigned rows, unsigned cols, const float* X, unsigned n, float* Y) {
+  SimdMatMulAdd<Avx2>(W, rows, cols, X, n, Y);
+}
+
+AVX2_TARGET static void Avx2LSTMCellState(unsigned n, const float* i, const float* w, const float* c_prev, float* c) {
+  SimdLSTMCellState<Avx2>(n, i, w, c_prev, c);
+}
+
+AVX2_TARGET static void Avx2LSTMCellOutput(unsigned n, const float* o, const float* c, float* h) {
+  SimdLSTMCellOutput<Avx2>(n, o, c, h);
+}
+
+AVX2_TARGET static void Avx2Tanh(unsigned n, const float* x, float* y) {
+  SimdTanhArray<Avx2>(n, x, y);
+}
+
+AVX512_TARGET static void Avx512MatMulAdd(const float* W, unsigned rows, unsigned cols, const float* X, unsigned n, float* Y) {
+  SimdMatMulAdd<Avx512>(W, rows, cols, X, n, Y);
+}
+
+AVX512_TARGET static void Avx512LSTMCellState(unsigned n, const float* i, const float* w, const float* c_prev, float* c) {
+  SimdLSTMCellState<Avx512>(n, i, w, c_prev, c);
+}
+
+AVX512_TARGET static void Avx512LSTMCellOutput(unsigned n, const float* o, const float* c, float* h) {
+  SimdLSTMCellOutput<Avx512>(n, o, c, h);
+}
+
+AVX512_TARGET static void Avx512Tanh(unsigned n, const float* x, float* y) {
+  SimdTanhArray<Avx512>(n, x, y);
+}
+
+static const DenseKernels kAvx2Kernels = {Avx2MatMulAdd, Avx2LSTMCellState, Avx2LSTMCellOutput, Avx2Tanh};
+static const DenseKernels kAvx512Kernels = {Avx512MatMulAdd, Avx512LSTMCellState, Avx512LSTMCellOutput, Avx512Tanh};
+#endif
+
+static const DenseKernels& Kernels() {
+  switch (simd_level()) {
+#ifdef HAVE_SIMD_DISPATCH
+    case kAvx512Simd: return kAvx512Kernels;
+    case kAvx2Simd: return kAvx2Kernels;
+#endif
+    default: return kScalarKernels;
+  }
+}
+
+void MatVecAdd(const float* W, unsigned rows, unsigned cols, const float* x, float* y) {
+  Kernels().mat_mul_add(W, rows, cols, x, 1, y);
+}
+
+void MatMulAdd(const float* W, unsigned rows, unsigned cols, const float* X, unsigned n, float* Y) {
+  Kernels().mat_mul_add(W, rows, cols, X, n, Y);
+}
+
+void BroadcastColumns(const float* b, unsigned rows, unsigned n, float* Y) {
+  for (unsigned j = 0; j < n; ++j) {
+    copy(b, b + rows, Y + (size_t)j * rows);
+  }
+}
+
+void LSTMCellState(unsigned n, const float* i, const float* w, const float* c_prev, float* c) {
+  Kernels().lstm_cell_state(n, i, w, c_prev, c);
+}
+
+void LSTMCellOutput(unsigned n, const float* o, const float* c, float* h) {
+  Kernels().lstm_cell_output(n, o, c, h);
+}
+
+void Tanh(unsigned n, const float* x, float* y) {
+  Kernels().tanh(n, x, y);
+}
+
+void ElementwiseMax(unsigned n, const float* x, float* y) {
+  for (unsigned k = 0; k < n; ++k) {
+    y[k] = max(y[k], x[k]);
+  }
+}
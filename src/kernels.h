@@ -0,0 +1,26 @@
+#pragma once
+
+// Dense float kernels used by the graph-free inference engine. Matrices are
+// column-major, like DyNet's, and may be unaligned. Like logsumexp and
+// log_softmax in utils.h (which the engine uses for its softmaxes), they use
+// AVX-512, AVX2+FMA or scalar loops, whichever is the widest the CPU
+// supports, picked at run time.
+
+// y += W x, where W is rows x cols.
+void MatVecAdd(const float* W, unsigned rows, unsigned cols, const float* x, float* y);
+
+// Y += W X, where W is rows x cols, X is cols x n and Y is rows x n.
+void MatMulAdd(const float* W, unsigned rows, unsigned cols, const float* X, unsigned n, float* Y);
+
+// Y[:, j] = b for each of the n columns of Y.
+void BroadcastColumns(const float* b, unsigned rows, unsigned n, float* Y);
+
+// First half of the (coupled input/forget gate) LSTM cell:
+// c = (1 - sigmoid(i)) * c_prev + sigmoid(i) * tanh(w)
+void LSTMCellState(unsigned n, const float* i, const float* w, const float* c_prev, float* c);
+
+// Second half of the LSTM cell: h = sigmoid(o) * tanh(c)
+void LSTMCellOutput(unsigned n, const float* o, const float* c, float* h);
+
+void Tanh(unsigned n, const float* x, float* y);
+void ElementwiseMax(unsigned n, const float* x, float* y);
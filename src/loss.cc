@@ -3,8 +3,14 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <chrono>
 
 #include "io.h"
+#include "memory.h"
+#include "engine.h"
+#include "score_cache.h"
+#include "metrics.h"
 #include "utils.h"
 
 using namespace dynet;
@@ -12,14 +18,25 @@ using namespace std;
 namespace po = boost::program_options;
 
 int main(int argc, char** argv) {
-  dynet::initialize(argc, argv);
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
 
   po::options_description desc("description");
   desc.add_options()
   ("model", po::value<string>()->required(), "model files, as output by train")
   ("perp,p", "Show model perplexity instead of negative log loss")
+  ("fast,f", "Score with the graph-free inference engine instead of DyNet")
+  ("engine_threads", po::value<unsigned>()->default_value(1), "Number of threads the inference engine splits each sentence across")
+  ("check_engine", "Score with both DyNet and the inference engine and report the largest difference")
+  ("prune_modes", po::value<float>(), "Skip the modes whose prior probability is below this, e.g. 0.001. Scores become approximate, with a reported bound on their error")
+  ("check_pruning", "With --prune_modes, also score exactly and report the speedup and the largest difference")
+  ("score_cache", po::value<string>(), "File to keep sentence and per-token scores in, created if it doesn't exist. Sentences already in it, from this run or an earlier one with the same model, aren't scored again")
+  ("profile", "Report time and graph nodes per model component")
+  ("profile_output", po::value<string>(), "With --profile, also write the profile to this file (JSON if it ends in .json, otherwise CSV)")
   ("help", "Display this help message");
 
+  AddAnalysisLimitOptions(desc);
+  AddMetricsOptions(desc);
+
   po::positional_options_description positional_options;
   positional_options.add("model", 1);
 
@@ -32,9 +49,30 @@ int main(int argc, char** argv) {
   }
 
   po::notify(vm);
+  if (!ConfigureAnalysisLimit(vm) || !ConfigureMetrics(vm, "loss")) {
+    return 1;
+  }
 
   const string model_filename = vm["model"].as<string>();
   const bool show_perp = vm.count("perp") > 0;
+  const bool use_engine = vm.count("fast") > 0;
+  const bool check_engine = vm.count("check_engine") > 0;
+  const bool prune = vm.count("prune_modes") > 0;
+  const bool check_pruning = prune && vm.count("check_pruning") > 0;
+  if (prune && check_engine) {
+    cerr << "--prune_modes can't be combined with --check_engine" << endl;
+    return 1;
+  }
+  if (prune && (vm["prune_modes"].as<float>() < 0.0f || vm["prune_modes"].as<float>() >= 1.0f)) {
+    cerr << "--prune_modes must be at least 0 and less than 1" << endl;
+    return 1;
+  }
+  if (vm.count("score_cache") && (check_engine || check_pruning)) {
+    cerr << "--score_cache can't be combined with --check_engine or --check_pruning" << endl;
+    return 1;
+  }
+
+  InitializeDynetForModel(dynet_args, model_filename);
 
   Model dynet_model;
   Dict word_vocab, root_vocab, affix_vocab, char_vocab;
@@ -42,16 +80,121 @@ int main(int argc, char** argv) {
   cerr << "Loading model from " << model_filename << "...";
   Deserialize(model_filename, word_vocab, root_vocab, affix_vocab, char_vocab, lm, dynet_model);
   cerr << " Done!" << endl;
+  InferenceEngine engine(lm);
+  engine.SetThreads(vm["engine_threads"].as<unsigned>());
+  Profiler profiler;
+  const bool profile = vm.count("profile") > 0;
+  if (profile) {
+    lm.profiler = &profiler;
+  }
+  ModePruning pruning(prune ? vm["prune_modes"].as<float>() : 0.0f);
+  ModePruning* pruning_pointer = prune ? &pruning : nullptr;
+  lm.pruning = pruning_pointer;
+  ScoreCache score_cache;
+  if (vm.count("score_cache")) {
+    ostringstream settings;
+    settings << "loss";
+    if (prune) {
+      settings << " prune_modes=" << vm["prune_modes"].as<float>();
+    }
+    if (!score_cache.Open(vm["score_cache"].as<string>()) || !score_cache.SetModel(model_filename, settings.str())) {
+      return 1;
+    }
+    cerr << "Loaded " << score_cache.size() << " cached scores from " << vm["score_cache"].as<string>() << endl;
+  }
+  double scoring_seconds = 0.0;
+  double exact_seconds = 0.0;
+  float max_pruning_difference = 0.0f;
 
   unsigned sentence_number = 0;
   dynet::real total_loss = 0;
   unsigned total_words = 0;
+  float max_difference = 0.0f;
+  unsigned uncompared_sentences = 0;
   Sentence input;
+  metrics.StartWaiting();
   while(ReadMorphSentence(cin, word_vocab, root_vocab, affix_vocab, char_vocab, input)) {
-    ComputationGraph cg;
-    Expression loss_expr = lm.BuildGraph(input, cg);
-    dynet::real loss = as_scalar(loss_expr.value());
+    metrics.StartSentence();
+    dynet::real loss;
+    vector<float> token_losses;
+    ScoreKey key;
+    vector<vector<float>> cached;
+    bool hit = false;
+    if (score_cache.is_open()) {
+      key = score_cache.Key(input);
+      hit = score_cache.Find(key, cached);
+    }
+    // Sentences too big for DyNet's memory pools go to the inference engine.
+    bool fits = hit || memory_monitor.Fits(EstimateGraphBytes(lm.config, ShapeOf(input)));
+    bool engine_scored = (use_engine && !check_engine) || !fits;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (hit) {
+      loss = cached[0][0];
+    }
+    else if (engine_scored) {
+      loss = engine.ScoreSentence(input, &token_losses, pruning_pointer);
+      if (prune) {
+        pruning.EndSentence();
+      }
+    }
+    else {
+      ComputationGraph cg;
+      if (profile) {
+        profiler.StartGraph(cg);
+      }
+      lm.NewGraph(cg);
+      vector<Expression> token_loss_exprs = lm.ComputeTokenLosses(input, cg);
+      Expression loss_expr = sum(token_loss_exprs);
+      loss = as_scalar(profile ? profiler.Forward(cg, loss_expr) : loss_expr.value());
+      if (score_cache.is_open()) {
+        for (Expression e : token_loss_exprs) {
+          token_losses.push_back(as_scalar(e.value()));
+        }
+      }
+      if (prune) {
+        pruning.EndSentence();
+      }
+      memory_monitor.Sample();
+    }
+    scoring_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (score_cache.is_open()) {
+      metrics.Add(hit ? kScoreCacheHitsMetric : kScoreCacheMissesMetric);
+      if (!hit) {
+        // The total, then each token's loss.
+        score_cache.Insert(key, {{loss}, token_losses});
+      }
+    }
+    if (check_pruning) {
+      dynet::real exact_loss;
+      start = chrono::steady_clock::now();
+      if (engine_scored) {
+        exact_loss = engine.ScoreSentence(input);
+      }
+      else {
+        lm.pruning = nullptr;
+        lm.profiler = nullptr;
+        ComputationGraph cg;
+        exact_loss = as_scalar(lm.BuildGraph(input, cg).value());
+        lm.pruning = pruning_pointer;
+        lm.profiler = profile ? &profiler : nullptr;
+      }
+      exact_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      max_pruning_difference = max(max_pruning_difference, fabs(loss - exact_loss));
+    }
+    if (check_engine) {
+      // Sentences that didn't fit were already scored by the engine, so
+      // comparing them would only compare the engine with itself.
+      if (engine_scored) {
+        uncompared_sentences++;
+      }
+      else {
+        max_difference = max(max_difference, fabs(engine.ScoreSentence(input) - loss));
+      }
+    }
     unsigned words = input.size();
+    if (profile && !hit) {
+      profiler.EndSentence(words, false);
+    }
     if (show_perp) {
       cout << exp(loss / words) << endl;
     }
@@ -63,6 +206,7 @@ int main(int argc, char** argv) {
     sentence_number++;
     total_loss += loss;
     total_words += words;
+    metrics.EndSentence(input);
   }
 
   if (show_perp) {
@@ -72,5 +216,31 @@ int main(int argc, char** argv) {
     cout << "Total: " << total_loss << endl;
   }
 
+  memory_monitor.Report(cerr);
+  analysis_limit.Report(cerr);
+  if (score_cache.is_open()) {
+    score_cache.Report(cerr);
+  }
+  if (profile) {
+    profiler.Report(cerr);
+    if (vm.count("profile_output")) {
+      profiler.WriteFile(vm["profile_output"].as<string>());
+    }
+  }
+  if (check_engine) {
+    cerr << "Largest difference between DyNet and the inference engine: " << max_difference << endl;
+    if (uncompared_sentences > 0) {
+      cerr << "  " << uncompared_sentences << " sentences did not fit in DyNet's memory pools and were not compared" << endl;
+    }
+  }
+  if (prune) {
+    pruning.Report(cerr);
+  }
+  if (check_pruning) {
+    cerr << "  speedup: " << exact_seconds / scoring_seconds << "x (" << scoring_seconds << "s pruned, " << exact_seconds << "s exact)" << endl;
+    cerr << "  largest difference from exact scores: " << max_pruning_difference << " nats per sentence" << endl;
+  }
+  FinishMetrics(vm);
+
   return 0;
 }
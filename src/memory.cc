@@ -0,0 +1,340 @@
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "dynet/dynet.h"
+#include "memory.h"
+#include "io.h"
+#include "utils.h"
+
+const unsigned lstm_layer_count = 2;
+const size_t kMegabyte = 1 << 20;
+
+// Planned capacity of the forward, backward and parameter pools, in bytes.
+static vector<size_t> pool_capacity(3, 0);
+
+MemoryMonitor memory_monitor;
+const SentenceShape kDefaultShape(100, 32, 16, 8);
+
+SentenceShape::SentenceShape() : words(0), chars_per_word(0), analyses_per_word(0), affixes_per_analysis(0) {}
+
+SentenceShape::SentenceShape(unsigned words, unsigned chars_per_word, unsigned analyses_per_word, unsigned affixes_per_analysis) :
+  words(words), chars_per_word(chars_per_word), analyses_per_word(analyses_per_word), affixes_per_analysis(affixes_per_analysis) {}
+
+void SentenceShape::Update(const SentenceShape& other) {
+  words = max(words, other.words);
+  chars_per_word = max(chars_per_word, other.chars_per_word);
+  analyses_per_word = max(analyses_per_word, other.analyses_per_word);
+  affixes_per_analysis = max(affixes_per_analysis, other.affixes_per_analysis);
+}
+
+SentenceShape ShapeOf(const Sentence& sentence) {
+  SentenceShape shape;
+  shape.words = sentence.size();
+  for (unsigned i = 0; i < sentence.size(); ++i) {
+    shape.chars_per_word = max(shape.chars_per_word, (unsigned)sentence.chars[i].size());
+    shape.analyses_per_word = max(shape.analyses_per_word, (unsigned)sentence.analyses[i].size());
+    for (const Analysis& analysis : sentence.analyses[i]) {
+      shape.affixes_per_analysis = max(shape.affixes_per_analysis, (unsigned)analysis.affixes.size());
+    }
+  }
+  return shape;
+}
+
+SentenceShape ScanMorphText(const string& filename) {
+  SentenceShape shape;
+  ifstream f(filename);
+  unsigned words = 1; // </s>
+  for (string line; getline(f, line);) {
+    line = strip(line);
+    if (line.length() == 0) {
+      shape.words = max(shape.words, words);
+      words = 1;
+      continue;
+    }
+    words++;
+
+    vector<string> pieces = tokenize(line, "\t");
+    // Characters plus </w>, and affixes plus </w>, like HandleMorphLine.
+    shape.chars_per_word = max(shape.chars_per_word, UTF8StringLen(pieces[0]) + 1);
+    unsigned analyses = pieces.size() / 2;
+    if (analysis_limit.max_analyses() > 0) {
+      analyses = min(analyses, analysis_limit.max_analyses());
+    }
+    shape.analyses_per_word = max(shape.analyses_per_word, analyses);
+    for (unsigned i = 1; i < pieces.size(); i += 2) {
+      unsigned affixes = count(pieces[i].begin(), pieces[i].end(), '+') + 1;
+      shape.affixes_per_analysis = max(shape.affixes_per_analysis, affixes);
+    }
+  }
+  shape.words = max(shape.words, words);
+  return shape;
+}
+
+static size_t LSTMParameterFloats(unsigned input_dim, unsigned hidden_dim) {
+  size_t total = 0;
+  for (unsigned i = 0; i < lstm_layer_count; ++i) {
+    size_t layer_input_dim = (i == 0) ? input_dim : hidden_dim;
+    total += 3 * hidden_dim * layer_input_dim + 5 * hidden_dim * hidden_dim + 3 * hidden_dim;
+  }
+  return total;
+}
+
+static size_t MLPParameterFloats(unsigned input_dim, unsigned hidden_dim, unsigned output_dim) {
+  return (size_t)hidden_dim * (input_dim + 1) + (size_t)output_dim * (hidden_dim + 1);
+}
+
+static unsigned ContextDim(const MorphLMConfig& config) {
+  return config.bidirectional ? 2 * config.main_lstm_dim : config.main_lstm_dim;
+}
+
+static unsigned InputDim(const MorphLMConfig& config) {
+  unsigned input_dim = config.char_lstm_dim;
+  if (config.use_morphology) {
+    input_dim += config.affix_lstm_dim;
+  }
+  if (config.use_words) {
+    input_dim += config.word_embedding_dim;
+  }
+  return input_dim;
+}
+
+// Parameters (as opposed to lookup parameters) get a node, and thus a copy
+// in the forward pool, in every graph.
+static size_t DenseParameterFloats(const MorphLMConfig& config) {
+  const bool quantized = (config.storage != kFloat32);
+  const unsigned context_dim = ContextDim(config);
+  const unsigned input_dim = InputDim(config);
+  const unsigned mode_count = 2 + (config.use_morphology ? 1 : 0) + (config.use_words ? 1 : 0);
+
+  size_t total = lstm_layer_count * config.char_lstm_dim;
+  total += LSTMParameterFloats(config.char_embedding_dim, config.char_lstm_dim);
+  total += lstm_layer_count * config.main_lstm_dim + LSTMParameterFloats(input_dim, config.main_lstm_dim);
+  if (config.bidirectional) {
+    total += lstm_layer_count * config.main_lstm_dim + LSTMParameterFloats(input_dim, config.main_lstm_dim);
+  }
+  total += MLPParameterFloats(context_dim, config.model_chooser_hidden_dim, mode_count);
+  total += (size_t)config.char_vocab_size * (config.char_lstm_dim + 1);
+  total += MLPParameterFloats(context_dim, config.char_lstm_init_hidden_dim, lstm_layer_count * config.char_lstm_dim);
+  total += LSTMParameterFloats(config.char_embedding_dim + context_dim, config.char_lstm_dim);
+
+  if (config.use_words && !quantized) {
+    total += (size_t)config.word_vocab_size * (context_dim + 1);
+  }
+  if (config.use_morphology) {
+    total += LSTMParameterFloats(config.affix_embedding_dim, config.affix_lstm_dim);
+    if (!quantized) {
+      total += (size_t)config.root_vocab_size * (context_dim + 1);
+    }
+    total += (size_t)config.affix_vocab_size * (config.affix_lstm_dim + 1);
+    total += MLPParameterFloats(context_dim + config.root_embedding_dim, config.affix_lstm_init_hidden_dim, lstm_layer_count * config.affix_lstm_dim);
+    total += LSTMParameterFloats(config.affix_embedding_dim + context_dim, config.affix_lstm_dim);
+  }
+  return total;
+}
+
+static size_t LookupParameterFloats(const MorphLMConfig& config) {
+  const bool quantized = (config.storage != kFloat32);
+  size_t total = (size_t)config.char_vocab_size * config.char_embedding_dim * 2;
+  if (config.use_words && !quantized) {
+    total += (size_t)config.word_vocab_size * config.word_embedding_dim;
+  }
+  if (config.use_morphology) {
+    if (!quantized) {
+      total += (size_t)config.root_vocab_size * lstm_layer_count * config.affix_lstm_dim;
+      total += (size_t)config.root_vocab_size * config.root_embedding_dim;
+    }
+    total += (size_t)config.affix_vocab_size * config.affix_embedding_dim * 2;
+  }
+  return total;
+}
+
+size_t EstimateParameterBytes(const MorphLMConfig& config) {
+  return sizeof(float) * (DenseParameterFloats(config) + LookupParameterFloats(config));
+}
+
+// Values produced by one step of a DyNet LSTMBuilder: per layer, three
+// affine transforms and about nine elementwise nodes of the hidden size.
+static size_t LSTMStepFloats(unsigned input_dim, unsigned hidden_dim) {
+  return input_dim + lstm_layer_count * 12 * hidden_dim;
+}
+
+// Initial state from MakeLSTMInitialState: a pickrange and a tanh per layer.
+static size_t LSTMInitFloats(unsigned hidden_dim) {
+  return lstm_layer_count * 2 * hidden_dim;
+}
+
+// Forward pool floats per word for embedding it and running the main LSTM.
+static size_t InputWordFloats(const MorphLMConfig& config, const SentenceShape& shape) {
+  const unsigned input_dim = InputDim(config);
+  const size_t chars = shape.chars_per_word;
+  const size_t analyses = max(shape.analyses_per_word, 1u);
+  const size_t affixes = shape.affixes_per_analysis;
+
+  size_t word = LSTMInitFloats(config.char_lstm_dim) + chars * LSTMStepFloats(config.char_embedding_dim, config.char_lstm_dim);
+  if (config.use_morphology) {
+    size_t analysis = lstm_layer_count * config.affix_lstm_dim + LSTMInitFloats(config.affix_lstm_dim);
+    analysis += affixes * LSTMStepFloats(config.affix_embedding_dim, config.affix_lstm_dim);
+    word += analyses * (analysis + config.affix_lstm_dim);
+  }
+  if (config.use_words) {
+    word += config.word_embedding_dim;
+  }
+  word += input_dim + LSTMStepFloats(input_dim, config.main_lstm_dim) * (config.bidirectional ? 2 : 1) + ContextDim(config);
+  return word;
+}
+
+// Forward pool floats per word for the mode chooser and the decoders.
+static size_t OutputWordFloats(const MorphLMConfig& config, const SentenceShape& shape) {
+  const unsigned context_dim = ContextDim(config);
+  const size_t chars = shape.chars_per_word;
+  const size_t analyses = max(shape.analyses_per_word, 1u);
+  const size_t affixes = shape.affixes_per_analysis;
+
+  size_t word = config.model_chooser_hidden_dim * 2 + 16;
+  word += config.char_lstm_init_hidden_dim + 2 * LSTMInitFloats(config.char_lstm_dim);
+  word += chars * (LSTMStepFloats(config.char_embedding_dim + context_dim, config.char_lstm_dim) + config.char_embedding_dim + config.char_vocab_size + 2);
+  if (config.use_morphology) {
+    size_t analysis = config.root_vocab_size + config.root_embedding_dim + context_dim;
+    analysis += config.affix_lstm_init_hidden_dim + 2 * LSTMInitFloats(config.affix_lstm_dim);
+    analysis += affixes * (LSTMStepFloats(config.affix_embedding_dim + context_dim, config.affix_lstm_dim) + config.affix_embedding_dim + config.affix_vocab_size + 2);
+    word += analyses * (analysis + 1);
+  }
+  if (config.use_words) {
+    word += config.word_vocab_size + 2;
+  }
+  return word;
+}
+
+size_t EstimateGraphBytes(const MorphLMConfig& config, const SentenceShape& shape, unsigned sentence_count, unsigned recompute_chunk) {
+  const size_t words = (size_t)sentence_count * shape.words;
+  size_t floats = 0;
+  if (recompute_chunk == 0) {
+    floats = words * (InputWordFloats(config, shape) + OutputWordFloats(config, shape));
+  }
+  else {
+    // The graph for the main LSTM (which also holds the contexts' gradients
+    // when it is recomputed) and the graphs for each chunk of decoders are
+    // never alive at the same time.
+    const size_t chunk = min(words, (size_t)recompute_chunk);
+    floats = max(words * (InputWordFloats(config, shape) + ContextDim(config) + 2), chunk * (OutputWordFloats(config, shape) + ContextDim(config)));
+  }
+  floats += DenseParameterFloats(config);
+  // Leave room for DyNet's per-node alignment and for our approximations.
+  return sizeof(float) * floats * 5 / 4 + kMegabyte;
+}
+
+vector<string> ExtractDynetArgs(int& argc, char** argv) {
+  vector<string> dynet_args;
+  int kept = 1;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg.compare(0, 7, "--dynet") == 0) {
+      dynet_args.push_back(arg);
+      if (arg.find('=') == string::npos && i + 1 < argc) {
+        dynet_args.push_back(argv[++i]);
+      }
+    }
+    else {
+      argv[kept++] = argv[i];
+    }
+  }
+  argc = kept;
+  argv[argc] = nullptr;
+  return dynet_args;
+}
+
+static size_t ToMegabytes(size_t bytes) {
+  return (bytes + kMegabyte - 1) / kMegabyte;
+}
+
+// Understands both a single size, which DyNet splits evenly between the
+// three pools, and separate "forward,backward,parameters" sizes.
+static void ParseMemoryDescriptor(const string& descriptor) {
+  vector<string> sizes = tokenize(descriptor, ",");
+  if (sizes.size() == 1) {
+    size_t each = stoul(sizes[0]) * kMegabyte / 3;
+    pool_capacity.assign(3, each);
+  }
+  else if (sizes.size() == 3) {
+    for (unsigned i = 0; i < 3; ++i) {
+      pool_capacity[i] = stoul(sizes[i]) * kMegabyte;
+    }
+  }
+}
+
+void InitializeDynet(const vector<string>& dynet_args, const MorphLMConfig* config, const SentenceShape& shape, unsigned sentence_count, bool training, unsigned parameter_copies, bool shared_parameters, unsigned recompute_chunk) {
+  vector<string> args = {"morphlm"};
+  bool has_memory = false;
+  for (unsigned i = 0; i < dynet_args.size(); ++i) {
+    args.push_back(dynet_args[i]);
+    if (dynet_args[i] == "--dynet-mem" || dynet_args[i] == "--dynet_mem") {
+      if (i + 1 < dynet_args.size()) {
+        ParseMemoryDescriptor(dynet_args[i + 1]);
+      }
+      has_memory = true;
+    }
+    else if (dynet_args[i].compare(0, 12, "--dynet-mem=") == 0) {
+      ParseMemoryDescriptor(dynet_args[i].substr(12));
+      has_memory = true;
+    }
+  }
+
+  if (!has_memory && config != nullptr) {
+    size_t graph_bytes = EstimateGraphBytes(*config, shape, sentence_count, recompute_chunk);
+    size_t parameter_bytes = EstimateParameterBytes(*config) * parameter_copies;
+    // CheckpointedLoss's context holders, with their gradients
+    parameter_bytes += sizeof(float) * 2 * recompute_chunk * ContextDim(*config);
+    pool_capacity[0] = ToMegabytes(graph_bytes) * kMegabyte;
+    pool_capacity[1] = ToMegabytes(training ? graph_bytes : kMegabyte) * kMegabyte;
+    pool_capacity[2] = ToMegabytes(parameter_bytes * 9 / 8 + kMegabyte) * kMegabyte;
+
+    ostringstream descriptor;
+    descriptor << pool_capacity[0] / kMegabyte << "," << pool_capacity[1] / kMegabyte << "," << pool_capacity[2] / kMegabyte;
+    args.push_back("--dynet-mem");
+    args.push_back(descriptor.str());
+    cerr << "Sizing DyNet memory pools for " << sentence_count << " sentence(s) of up to " << shape.words << " words: " << descriptor.str() << " MB" << endl;
+  }
+  else if (!has_memory) {
+    cerr << "Model has no configuration header; using DyNet's default memory pools" << endl;
+  }
+
+  int argc = args.size();
+  vector<char*> argv;
+  for (string& arg : args) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(nullptr);
+  char** argv_pointer = argv.data();
+  dynet::initialize(argc, argv_pointer, shared_parameters);
+}
+
+void InitializeDynetForModel(const vector<string>& dynet_args, const string& model_filename, const SentenceShape& shape, unsigned sentence_count, unsigned model_count) {
+  MorphLMConfig config;
+  bool has_config = PeekModelConfig(model_filename, config);
+  // Every parameter has a gradient, even when we don't train.
+  InitializeDynet(dynet_args, has_config ? &config : nullptr, shape, sentence_count, false, 2 * model_count);
+}
+
+MemoryMonitor::MemoryMonitor() : peak(3, 0) {}
+
+void MemoryMonitor::Sample() {
+  for (unsigned i = 0; i < 3; ++i) {
+    peak[i] = max(peak[i], default_device->pools[i]->used);
+  }
+}
+
+bool MemoryMonitor::Fits(size_t graph_bytes) const {
+  return pool_capacity[0] == 0 || graph_bytes <= pool_capacity[0];
+}
+
+void MemoryMonitor::Report(ostream& out) const {
+  const char* names[] = {"forward", "backward", "parameters"};
+  out << "Peak DyNet memory:";
+  for (unsigned i = 0; i < 3; ++i) {
+    out << (i > 0 ? "," : "") << " " << names[i] << " " << (double)peak[i] / kMegabyte << " MB";
+    if (pool_capacity[i] > 0) {
+      out << " of " << pool_capacity[i] / kMegabyte;
+    }
+  }
+  out << endl;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iostream>
+#include "morphlm.h"
+
+using namespace std;
+
+// DyNet allocates everything from three fixed-size pools (forward values,
+// backward gradients and parameters) whose sizes are set once, by
+// dynet::initialize. Rather than trusting --dynet-mem, tools estimate what
+// their graphs need from the model's configuration and the largest sentence
+// they expect, and size the pools accordingly.
+
+// The largest dimensions of a sentence (or of a whole input file).
+struct SentenceShape {
+  unsigned words;
+  unsigned chars_per_word;
+  unsigned analyses_per_word;
+  unsigned affixes_per_analysis;
+
+  SentenceShape();
+  SentenceShape(unsigned words, unsigned chars_per_word, unsigned analyses_per_word, unsigned affixes_per_analysis);
+  void Update(const SentenceShape& other);
+};
+
+// What inference tools plan for when they can't see their input in advance.
+// Anything bigger is scored with the InferenceEngine instead.
+extern const SentenceShape kDefaultShape;
+
+SentenceShape ShapeOf(const Sentence& sentence);
+// Scans morphologically analyzed text (without looking anything up in the
+// vocabularies, so it can be done before a model is loaded).
+SentenceShape ScanMorphText(const string& filename);
+
+size_t EstimateParameterBytes(const MorphLMConfig& config);
+// Upper bound on the forward pool memory used by a graph holding
+// sentence_count sentences of the given shape. With a nonzero
+// recompute_chunk, the largest of the graphs CheckpointedLoss builds instead.
+size_t EstimateGraphBytes(const MorphLMConfig& config, const SentenceShape& shape, unsigned sentence_count = 1, unsigned recompute_chunk = 0);
+
+// Removes DyNet's own command line arguments (--dynet-mem, --dynet-seed, ...)
+// from argv, so the rest can be parsed before DyNet is initialized.
+vector<string> ExtractDynetArgs(int& argc, char** argv);
+
+// Initializes DyNet with pools big enough for graphs of sentence_count
+// sentences of the given shape. parameter_copies is the number of copies of
+// the model's parameters that live in the parameter pool: two (values and
+// gradients) plus whatever the trainer keeps (e.g. two more for Adam).
+// An explicit --dynet-mem always wins.
+void InitializeDynet(const vector<string>& dynet_args, const MorphLMConfig* config, const SentenceShape& shape, unsigned sentence_count, bool training, unsigned parameter_copies, bool shared_parameters = false, unsigned recompute_chunk = 0);
+
+// Same as above for a tool that only runs inference with a serialized model,
+// using the configuration stored in the model file's header.
+void InitializeDynetForModel(const vector<string>& dynet_args, const string& model_filename, const SentenceShape& shape = kDefaultShape, unsigned sentence_count = 1, unsigned model_count = 1);
+
+// Tracks the peak usage of DyNet's pools. Call Sample() while a graph is
+// still alive (after forward, or after backward when training).
+class MemoryMonitor {
+public:
+  MemoryMonitor();
+  void Sample();
+  // Whether a graph of this size fits in the forward pool.
+  bool Fits(size_t graph_bytes) const;
+  void Report(ostream& out) const;
+
+private:
+  vector<size_t> peak;
+};
+
+extern MemoryMonitor memory_monitor;
@@ -0,0 +1,328 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include "metrics.h"
+
+Metrics metrics;
+
+struct MetricDescription {
+  const char* name;
+  const char* help;
+};
+
+const MetricDescription kCounterDescriptions[kCounterCount] = {
+  {"morphlm_sentences_total", "Sentences processed"},
+  {"morphlm_tokens_total", "Tokens processed"},
+  {"morphlm_unknown_tokens_total", "Tokens whose word is not in the model's vocabulary"},
+  {"morphlm_score_cache_hits_total", "Sentences answered from the score cache"},
+  {"morphlm_score_cache_misses_total", "Sentences looked up in the score cache and scored"},
+};
+
+const MetricDescription kHistogramDescriptions[kHistogramCount] = {
+  {"morphlm_sentence_latency_seconds", "Time from having a sentence to being done with it"},
+  {"morphlm_queue_wait_seconds", "Time spent waiting for the next sentence to arrive"},
+};
+
+const char* kHistogramNames[kHistogramCount] = {"sentence latency", "queue wait"};
+
+struct Metrics::Shard {
+  explicit Shard(thread::id owner) : owner(owner), waiting(false) {
+    for (unsigned i = 0; i < kCounterCount; ++i) {
+      counters[i].store(0);
+    }
+    for (unsigned h = 0; h < kHistogramCount; ++h) {
+      for (unsigned i = 0; i <= kHistogramBuckets; ++i) {
+        buckets[h][i].store(0);
+      }
+      sums[h].store(0.0);
+    }
+  }
+
+  // Only the owner writes, so a load and a store are enough.
+  static void Add(atomic<unsigned long long>& a, unsigned long long n) {
+    a.store(a.load(memory_order_relaxed) + n, memory_order_relaxed);
+  }
+
+  thread::id owner;
+  atomic<unsigned long long> counters[kCounterCount];
+  atomic<unsigned long long> buckets[kHistogramCount][kHistogramBuckets + 1];
+  atomic<double> sums[kHistogramCount];
+  // Only used by the owner
+  Clock::time_point wait_start;
+  Clock::time_point sentence_start;
+  bool waiting;
+};
+
+MetricsSnapshot::MetricsSnapshot() : uptime(0.0) {
+  fill(counters, counters + kCounterCount, 0);
+  for (unsigned h = 0; h < kHistogramCount; ++h) {
+    fill(buckets[h], buckets[h] + kHistogramBuckets + 1, 0);
+    sums[h] = 0.0;
+  }
+}
+
+double MetricsSnapshot::BucketBound(unsigned bucket) {
+  return (bucket < kHistogramBuckets) ? 1e-5 * pow(2.0, bucket / 2.0) : INFINITY;
+}
+
+unsigned long long MetricsSnapshot::Count(MetricHistogram histogram) const {
+  unsigned long long count = 0;
+  for (unsigned i = 0; i <= kHistogramBuckets; ++i) {
+    count += buckets[histogram][i];
+  }
+  return count;
+}
+
+double MetricsSnapshot::Percentile(MetricHistogram histogram, double p) const {
+  const unsigned long long count = Count(histogram);
+  if (count == 0) {
+    return 0.0;
+  }
+  const double rank = p * count;
+  unsigned long long below = 0;
+  for (unsigned i = 0; i <= kHistogramBuckets; ++i) {
+    const unsigned long long in_bucket = buckets[histogram][i];
+    if (in_bucket > 0 && below + in_bucket >= rank) {
+      if (i == kHistogramBuckets) {
+        return BucketBound(i - 1);
+      }
+      // Buckets are geometric, so interpolate in log space.
+      double lower = (i > 0) ? BucketBound(i - 1) : BucketBound(0) / sqrt(2.0);
+      double fraction = max(0.0, (rank - below) / in_bucket);
+      return lower * pow(BucketBound(i) / lower, fraction);
+    }
+    below += in_bucket;
+  }
+  return BucketBound(kHistogramBuckets - 1);
+}
+
+Metrics::Metrics() : start(Clock::now()), exporting(false) {}
+
+Metrics::~Metrics() {
+  StopExport();
+}
+
+Metrics::Shard& Metrics::LocalShard() {
+  // Remembers the last shard this thread used, which is almost always the
+  // right one, since there's usually only one Metrics.
+  static thread_local const Metrics* cached_owner = nullptr;
+  static thread_local Shard* cached_shard = nullptr;
+  if (cached_owner == this) {
+    return *cached_shard;
+  }
+
+  lock_guard<mutex> lock(shards_mutex);
+  const thread::id id = this_thread::get_id();
+  Shard* shard = nullptr;
+  for (Shard& s : shards) {
+    if (s.owner == id) {
+      shard = &s;
+    }
+  }
+  if (shard == nullptr) {
+    shards.emplace_back(id);
+    shard = &shards.back();
+  }
+  cached_owner = this;
+  cached_shard = shard;
+  return *shard;
+}
+
+void Metrics::Add(MetricCounter counter, unsigned long long n) {
+  Shard::Add(LocalShard().counters[counter], n);
+}
+
+void Metrics::Observe(MetricHistogram histogram, double seconds) {
+  Shard& shard = LocalShard();
+  unsigned bucket = 0;
+  if (seconds > MetricsSnapshot::BucketBound(0)) {
+    bucket = (unsigned)min(ceil(2.0 * log2(seconds / MetricsSnapshot::BucketBound(0))), (double)kHistogramBuckets);
+  }
+  // Rounding in log2 may leave a value just past its bucket's bound.
+  while (bucket < kHistogramBuckets && seconds > MetricsSnapshot::BucketBound(bucket)) {
+    bucket++;
+  }
+  Shard::Add(shard.buckets[histogram][bucket], 1);
+  shard.sums[histogram].store(shard.sums[histogram].load(memory_order_relaxed) + seconds, memory_order_relaxed);
+}
+
+void Metrics::StartWaiting() {
+  Shard& shard = LocalShard();
+  shard.wait_start = Clock::now();
+  shard.waiting = true;
+}
+
+void Metrics::StartSentence() {
+  Shard& shard = LocalShard();
+  shard.sentence_start = Clock::now();
+  if (shard.waiting) {
+    Observe(kQueueWaitMetric, chrono::duration<double>(shard.sentence_start - shard.wait_start).count());
+  }
+}
+
+void Metrics::EndSentence(const Sentence& sentence) {
+  Shard& shard = LocalShard();
+  Clock::time_point now = Clock::now();
+  Observe(kLatencyMetric, chrono::duration<double>(now - shard.sentence_start).count());
+  unsigned unknown = 0;
+  for (WordId word : sentence.words) {
+    if (word == 0) {
+      unknown++;
+    }
+  }
+  Shard::Add(shard.counters[kSentencesMetric], 1);
+  Shard::Add(shard.counters[kTokensMetric], sentence.size());
+  Shard::Add(shard.counters[kUnknownTokensMetric], unknown);
+  if (shard.waiting) {
+    shard.wait_start = now;
+  }
+}
+
+MetricsSnapshot Metrics::Snapshot() const {
+  MetricsSnapshot snapshot;
+  snapshot.uptime = chrono::duration<double>(Clock::now() - start).count();
+  lock_guard<mutex> lock(shards_mutex);
+  for (const Shard& shard : shards) {
+    for (unsigned i = 0; i < kCounterCount; ++i) {
+      snapshot.counters[i] += shard.counters[i].load(memory_order_relaxed);
+    }
+    for (unsigned h = 0; h < kHistogramCount; ++h) {
+      for (unsigned i = 0; i <= kHistogramBuckets; ++i) {
+        snapshot.buckets[h][i] += shard.buckets[h][i].load(memory_order_relaxed);
+      }
+      snapshot.sums[h] += shard.sums[h].load(memory_order_relaxed);
+    }
+  }
+  return snapshot;
+}
+
+void Metrics::WritePrometheus(ostream& out) const {
+  const MetricsSnapshot snapshot = Snapshot();
+  const string labels = "tool=\"" + tool + "\"";
+  out << setprecision(9);
+  for (unsigned i = 0; i < kCounterCount; ++i) {
+    const MetricDescription& d = kCounterDescriptions[i];
+    out << "# HELP " << d.name << " " << d.help << ".\n";
+    out << "# TYPE " << d.name << " counter\n";
+    out << d.name << "{" << labels << "} " << snapshot.counters[i] << "\n";
+  }
+  for (unsigned h = 0; h < kHistogramCount; ++h) {
+    const MetricDescription& d = kHistogramDescriptions[h];
+    out << "# HELP " << d.name << " " << d.help << ".\n";
+    out << "# TYPE " << d.name << " histogram\n";
+    unsigned long long cumulative = 0;
+    for (unsigned i = 0; i <= kHistogramBuckets; ++i) {
+      cumulative += snapshot.buckets[h][i];
+      out << d.name << "_bucket{" << labels << ",le=\"";
+      if (i < kHistogramBuckets) {
+        out << MetricsSnapshot::BucketBound(i);
+      }
+      else {
+        out << "+Inf";
+      }
+      out << "\"} " << cumulative << "\n";
+    }
+    out << d.name << "_sum{" << labels << "} " << snapshot.sums[h] << "\n";
+    out << d.name << "_count{" << labels << "} " << cumulative << "\n";
+  }
+  out << "# HELP morphlm_uptime_seconds Time since the tool started.\n";
+  out << "# TYPE morphlm_uptime_seconds gauge\n";
+  out << "morphlm_uptime_seconds{" << labels << "} " << snapshot.uptime << "\n";
+}
+
+bool Metrics::WriteFile(const string& filename) const {
+  const string temp_filename = filename + ".tmp";
+  {
+    ofstream f(temp_filename);
+    if (!f.is_open()) {
+      cerr << "Unable to write metrics to " << temp_filename << endl;
+      return false;
+    }
+    WritePrometheus(f);
+    if (!f) {
+      return false;
+    }
+  }
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    cerr << "Unable to write metrics to " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+void Metrics::Report(ostream& out) const {
+  const MetricsSnapshot snapshot = Snapshot();
+  const unsigned long long tokens = snapshot.counters[kTokensMetric];
+  out << "Metrics: " << snapshot.counters[kSentencesMetric] << " sentences, " << tokens << " tokens in " << snapshot.uptime << "s (" << tokens / snapshot.uptime << " tokens/sec)";
+  if (tokens > 0) {
+    out << ", " << 100.0 * snapshot.counters[kUnknownTokensMetric] / tokens << "% unknown";
+  }
+  out << endl;
+  for (unsigned h = 0; h < kHistogramCount; ++h) {
+    MetricHistogram histogram = (MetricHistogram)h;
+    if (snapshot.Count(histogram) == 0) {
+      continue;
+    }
+    out << "  " << kHistogramNames[h] << " (ms): mean " << 1000.0 * snapshot.sums[h] / snapshot.Count(histogram);
+    out << ", p50 " << 1000.0 * snapshot.Percentile(histogram, 0.50);
+    out << ", p95 " << 1000.0 * snapshot.Percentile(histogram, 0.95);
+    out << ", p99 " << 1000.0 * snapshot.Percentile(histogram, 0.99) << endl;
+  }
+  const unsigned long long lookups = snapshot.counters[kScoreCacheHitsMetric] + snapshot.counters[kScoreCacheMissesMetric];
+  if (lookups > 0) {
+    out << "  score cache hit rate: " << 100.0 * snapshot.counters[kScoreCacheHitsMetric] / lookups << "%" << endl;
+  }
+}
+
+void Metrics::StartExport(const string& filename, double interval) {
+  StopExport();
+  export_filename = filename;
+  exporting = true;
+  exporter = thread([this, interval]() {
+    unique_lock<mutex> lock(export_mutex);
+    while (exporting) {
+      export_wakeup.wait_for(lock, chrono::duration<double>(interval));
+      WriteFile(export_filename);
+    }
+  });
+}
+
+void Metrics::StopExport() {
+  if (!exporter.joinable()) {
+    return;
+  }
+  {
+    lock_guard<mutex> lock(export_mutex);
+    exporting = false;
+  }
+  export_wakeup.notify_all();
+  exporter.join();
+}
+
+void AddMetricsOptions(po::options_description& desc) {
+  desc.add_options()
+  ("metrics", "On exit, report latency percentiles, throughput, the unknown word rate and cache hit rates")
+  ("metrics_file", po::value<string>(), "Write the same metrics to this file in Prometheus' text format, every --metrics_interval seconds and on exit")
+  ("metrics_interval", po::value<double>()->default_value(10.0), "Seconds between writes of --metrics_file");
+}
+
+bool ConfigureMetrics(const po::variables_map& vm, const string& tool) {
+  metrics.tool = tool;
+  if (vm.count("metrics_file")) {
+    if (vm["metrics_interval"].as<double>() <= 0.0) {
+      cerr << "--metrics_interval must be positive" << endl;
+      return false;
+    }
+    metrics.StartExport(vm["metrics_file"].as<string>(), vm["metrics_interval"].as<double>());
+  }
+  return true;
+}
+
+void FinishMetrics(const po::variables_map& vm) {
+  // The exporter writes the file one last time on its way out.
+  metrics.StopExport();
+  if (vm.count("metrics")) {
+    metrics.Report(cerr);
+  }
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <condition_variable>
+#include <boost/program_options.hpp>
+#include "utils.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// Production metrics for the inference tools: per-sentence latency, time
+// spent waiting for input, tokens, unknown words and score cache hits. Every
+// thread that records anything gets its own shard, which only it writes
+// (with relaxed atomics, so recording never takes a lock or contends with
+// another thread), and the shards are summed whenever the metrics are read.
+// They can be printed as a summary on exit, and written to a file in
+// Prometheus' text format every few seconds, e.g. for node_exporter's
+// textfile collector.
+
+enum MetricCounter {
+  kSentencesMetric = 0,
+  kTokensMetric,
+  // Tokens whose word is UNK
+  kUnknownTokensMetric,
+  kScoreCacheHitsMetric,
+  kScoreCacheMissesMetric,
+  kCounterCount,
+};
+
+enum MetricHistogram {
+  // From having a sentence to being done with it
+  kLatencyMetric = 0,
+  // From asking for the next sentence to having it, i.e. time spent idle,
+  // waiting on the input queue (usually stdin)
+  kQueueWaitMetric,
+  kHistogramCount,
+};
+
+// Latencies from 10us to about two minutes, each bucket sqrt(2) times as
+// wide as the previous one, plus one for anything longer.
+const unsigned kHistogramBuckets = 48;
+
+struct MetricsSnapshot {
+  MetricsSnapshot();
+  unsigned long long Count(MetricHistogram histogram) const;
+  // Estimated from the buckets, so good to within a bucket's width.
+  double Percentile(MetricHistogram histogram, double p) const;
+  static double BucketBound(unsigned bucket);
+
+  unsigned long long counters[kCounterCount];
+  unsigned long long buckets[kHistogramCount][kHistogramBuckets + 1];
+  double sums[kHistogramCount];
+  double uptime;
+};
+
+class Metrics {
+public:
+  typedef chrono::steady_clock Clock;
+
+  Metrics();
+  ~Metrics();
+
+  void Add(MetricCounter counter, unsigned long long n = 1);
+  void Observe(MetricHistogram histogram, double seconds);
+
+  // For a tool that reads sentences one at a time: call StartWaiting before
+  // asking for the first one, StartSentence when it arrives, and EndSentence
+  // when it's done, which also starts waiting for the next one.
+  void StartWaiting();
+  void StartSentence();
+  void EndSentence(const Sentence& sentence);
+
+  MetricsSnapshot Snapshot() const;
+  void WritePrometheus(ostream& out) const;
+  // Writes to a temporary file and renames it, so readers never see half a
+  // file.
+  bool WriteFile(const string& filename) const;
+  void Report(ostream& out) const;
+
+  // Rewrites filename every interval seconds, from a thread of its own,
+  // until StopExport, which writes it one last time.
+  void StartExport(const string& filename, double interval);
+  void StopExport();
+
+  // Labels every exported metric with tool="..."
+  string tool;
+
+private:
+  struct Shard;
+  Shard& LocalShard();
+
+  Clock::time_point start;
+  mutable mutex shards_mutex;
+  // A deque, so that threads can keep pointers to their shards.
+  deque<Shard> shards;
+
+  thread exporter;
+  mutex export_mutex;
+  condition_variable export_wakeup;
+  bool exporting;
+  string export_filename;
+};
+
+extern Metrics metrics;
+
+void AddMetricsOptions(po::options_description& desc);
+// Starts exporting if asked to. tool is the program's name.
+bool ConfigureMetrics(const po::variables_map& vm, const string& tool);
+// Writes the final metrics where they were asked for.
+void FinishMetrics(const po::variables_map& vm);
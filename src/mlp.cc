@@ -9,7 +9,14 @@ MLP::MLP(Model& model, unsigned input_size, unsigned hidden_size, unsigned outpu
   p_wOb = model.add_parameters({output_size});
 }
 
-void MLP::NewGraph(ComputationGraph& cg) {
+void MLP::NewGraph(ComputationGraph& cg, bool update) {
+  if (!update) {
+    wIH = const_parameter(cg, p_wIH);
+    wHb = const_parameter(cg, p_wHb);
+    wHO = const_parameter(cg, p_wHO);
+    wOb = const_parameter(cg, p_wOb);
+    return;
+  }
   wIH = parameter(cg, p_wIH);
   wHb = parameter(cg, p_wHb);
   wHO = parameter(cg, p_wHO);
@@ -21,3 +28,8 @@ Expression MLP::Feed(Expression input) {
   Expression o = affine_transform({wOb, wHO, h});
   return o;
 }
+
+// In the order they were added to the model.
+vector<Parameter> MLP::GetParameters() const {
+  return {p_wIH, p_wHb, p_wHO, p_wOb};
+}
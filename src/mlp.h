@@ -11,8 +11,10 @@ class MLP {
 public:
   MLP();
   MLP(Model& model, unsigned input_size, unsigned hidden_size, unsigned output_size);
-  void NewGraph(ComputationGraph& cg);
+  // Without update, the parameters enter the graph as constants.
+  void NewGraph(ComputationGraph& cg, bool update = true);
   Expression Feed(Expression input);
+  vector<Parameter> GetParameters() const;
 
 private:
   Parameter p_wIH;
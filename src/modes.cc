@@ -5,6 +5,10 @@
 #include <fstream>
 
 #include "io.h"
+#include "memory.h"
+#include "engine.h"
+#include "score_cache.h"
+#include "metrics.h"
 #include "utils.h"
 
 using namespace dynet;
@@ -12,14 +16,21 @@ using namespace std;
 namespace po = boost::program_options;
 
 int main(int argc, char** argv) {
-  dynet::initialize(argc, argv);
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
 
   po::options_description desc("description");
   desc.add_options()
   ("model", po::value<string>()->required(), "model files, as output by train")
   ("posterior,p", "Show model posterior distributions instead of priors")
+  ("fast,f", "Score with the graph-free inference engine instead of DyNet")
+  ("score_cache", po::value<string>(), "File to keep mode distributions in, created if it doesn't exist. Sentences already in it, from this run or an earlier one with the same model, aren't scored again")
+  ("profile", "Report time and graph nodes per model component")
+  ("profile_output", po::value<string>(), "With --profile, also write the profile to this file (JSON if it ends in .json, otherwise CSV)")
   ("help", "Display this help message");
 
+  AddAnalysisLimitOptions(desc);
+  AddMetricsOptions(desc);
+
   po::positional_options_description positional_options;
   positional_options.add("model", 1);
 
@@ -32,9 +43,15 @@ int main(int argc, char** argv) {
   }
 
   po::notify(vm);
+  if (!ConfigureAnalysisLimit(vm) || !ConfigureMetrics(vm, "modes")) {
+    return 1;
+  }
 
   const string model_filename = vm["model"].as<string>();
   const bool show_posterior = vm.count("posterior") > 0;
+  const bool use_engine = vm.count("fast") > 0;
+
+  InitializeDynetForModel(dynet_args, model_filename);
 
   Model dynet_model;
   Dict word_vocab, root_vocab, affix_vocab, char_vocab;
@@ -42,10 +59,26 @@ int main(int argc, char** argv) {
   cerr << "Loading model from " << model_filename << "...";
   Deserialize(model_filename, word_vocab, root_vocab, affix_vocab, char_vocab, lm, dynet_model);
   cerr << " Done!" << endl;
+  InferenceEngine engine(lm);
+  Profiler profiler;
+  const bool profile = vm.count("profile") > 0;
+  if (profile) {
+    lm.profiler = &profiler;
+  }
+
+  ScoreCache score_cache;
+  if (vm.count("score_cache")) {
+    if (!score_cache.Open(vm["score_cache"].as<string>()) || !score_cache.SetModel(model_filename, show_posterior ? "modes posterior" : "modes prior")) {
+      return 1;
+    }
+    cerr << "Loaded " << score_cache.size() << " cached sentences from " << vm["score_cache"].as<string>() << endl;
+  }
 
   unsigned sentence_number = 0;
   Sentence input;
+  metrics.StartWaiting();
   while(ReadMorphSentence(cin, word_vocab, root_vocab, affix_vocab, char_vocab, input)) {
+    metrics.StartSentence();
     for (unsigned i = 0; i < input.words.size(); ++i) {
       if (i > 0) { cerr << " "; }
       for (unsigned j = 0; j < input.chars[i].size() - 1; ++j) {
@@ -53,10 +86,39 @@ int main(int argc, char** argv) {
       }
     }
     cerr << endl;
-    ComputationGraph cg;
-    vector<Expression> mode_log_probs = show_posterior ? lm.ShowModePosteriors(input, cg) : lm.ShowModeProbs(input, cg);
-    for (Expression e : mode_log_probs) {
-      vector<float> v = as_vector(e.value());
+    vector<vector<float>> mode_log_probs;
+    ScoreKey key;
+    bool hit = false;
+    if (score_cache.is_open()) {
+      key = score_cache.Key(input);
+      hit = score_cache.Find(key, mode_log_probs);
+    }
+    if (!hit) {
+      if (use_engine || !memory_monitor.Fits(EstimateGraphBytes(lm.config, ShapeOf(input)))) {
+        mode_log_probs = show_posterior ? engine.ModePosteriors(input) : engine.ModeLogProbs(input);
+      }
+      else {
+        ComputationGraph cg;
+        if (profile) {
+          profiler.StartGraph(cg);
+        }
+        vector<Expression> mode_exprs = show_posterior ? lm.ShowModePosteriors(input, cg) : lm.ShowModeProbs(input, cg);
+        if (profile) {
+          profiler.Forward(cg, mode_exprs.back());
+        }
+        for (Expression e : mode_exprs) {
+          mode_log_probs.push_back(as_vector(e.value()));
+        }
+        memory_monitor.Sample();
+      }
+      if (score_cache.is_open()) {
+        score_cache.Insert(key, mode_log_probs);
+      }
+    }
+    if (score_cache.is_open()) {
+      metrics.Add(hit ? kScoreCacheHitsMetric : kScoreCacheMissesMetric);
+    }
+    for (const vector<float>& v : mode_log_probs) {
       for (unsigned i = 0; i < v.size(); ++i) {
         cout << ((i != 0) ? " " : "") << v[i];
       }
@@ -65,8 +127,24 @@ int main(int argc, char** argv) {
     cout << endl;
     cout.flush();
 
+    if (profile && !hit) {
+      profiler.EndSentence(input.size(), false);
+    }
     sentence_number++;
+    metrics.EndSentence(input);
   }
 
+  memory_monitor.Report(cerr);
+  analysis_limit.Report(cerr);
+  if (score_cache.is_open()) {
+    score_cache.Report(cerr);
+  }
+  if (profile) {
+    profiler.Report(cerr);
+    if (vm.count("profile_output")) {
+      profiler.WriteFile(vm["profile_output"].as<string>());
+    }
+  }
+  FinishMetrics(vm);
   return 0;
 }
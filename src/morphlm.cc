@@ -1,11 +1,13 @@
+#include <algorithm>
 #include <boost/algorithm/string/join.hpp>
+#include "dynet/globals.h"
 #include "morphlm.h"
 #define SAFE_DELETE(p) if ((p) != nullptr) { delete (p); (p) = nullptr; }
 
 const unsigned lstm_layer_count = 2;
 
 MorphLM::MorphLM() :
-    word_softmax(nullptr), root_softmax(nullptr), affix_softmax(nullptr), char_softmax(nullptr) {}
+    word_softmax(nullptr), root_softmax(nullptr), affix_softmax(nullptr), char_softmax(nullptr), profiler(nullptr), pruning(nullptr), frozen(0) {}
 
 MorphLM::~MorphLM() {
   SAFE_DELETE(word_softmax);
@@ -15,14 +17,17 @@ MorphLM::~MorphLM() {
 }
 
 MorphLM::MorphLM(Model& model, const MorphLMConfig& config) :
-    word_softmax(nullptr), root_softmax(nullptr), affix_softmax(nullptr), char_softmax(nullptr) {
+    word_softmax(nullptr), root_softmax(nullptr), affix_softmax(nullptr), char_softmax(nullptr), profiler(nullptr), pruning(nullptr), frozen(0) {
   this->config = config;
+  bool quantized = (config.storage != kFloat32);
 
-  if (config.use_words) {
+  if (config.use_words && !quantized) {
     input_word_embeddings = model.add_lookup_parameters(config.word_vocab_size, {config.word_embedding_dim});
   }
   if (config.use_morphology) {
-    input_root_embeddings = model.add_lookup_parameters(config.root_vocab_size, {lstm_layer_count * config.affix_lstm_dim});
+    if (!quantized) {
+      input_root_embeddings = model.add_lookup_parameters(config.root_vocab_size, {lstm_layer_count * config.affix_lstm_dim});
+    }
     input_affix_embeddings = model.add_lookup_parameters(config.affix_vocab_size, {config.affix_embedding_dim});
   }
   input_char_embeddings = model.add_lookup_parameters(config.char_vocab_size, {config.char_embedding_dim});
@@ -54,17 +59,21 @@ MorphLM::MorphLM(Model& model, const MorphLMConfig& config) :
   }
   model_chooser = MLP(model, context_dim, config.model_chooser_hidden_dim, output_mode_count);
 
-  if (config.use_words) {
+  if (config.use_words && !quantized) {
     word_softmax = new StandardSoftmaxBuilder(context_dim, config.word_vocab_size, model);
   }
   if (config.use_morphology) {
-    root_softmax = new StandardSoftmaxBuilder(context_dim, config.root_vocab_size, model);
+    if (!quantized) {
+      root_softmax = new StandardSoftmaxBuilder(context_dim, config.root_vocab_size, model);
+    }
     affix_softmax = new StandardSoftmaxBuilder(config.affix_lstm_dim, config.affix_vocab_size, model);
   }
   char_softmax = new StandardSoftmaxBuilder(config.char_lstm_dim, config.char_vocab_size, model);
 
   if (config.use_morphology) {
-    output_root_embeddings = model.add_lookup_parameters(config.root_vocab_size, {config.root_embedding_dim});
+    if (!quantized) {
+      output_root_embeddings = model.add_lookup_parameters(config.root_vocab_size, {config.root_embedding_dim});
+    }
     output_affix_embeddings = model.add_lookup_parameters(config.affix_vocab_size, {config.affix_embedding_dim});
   }
   output_char_embeddings = model.add_lookup_parameters(config.char_vocab_size, {config.char_embedding_dim});
@@ -81,44 +90,68 @@ MorphLM::MorphLM(Model& model, const MorphLMConfig& config) :
 }
 
 void MorphLM::NewGraph(ComputationGraph& cg) {
-  Expression input_char_lstm_init_expr = parameter(cg, input_char_lstm_init);
+  Expression input_char_lstm_init_expr = ParameterExpression(cg, input_char_lstm_init, kFreezeInputCharLSTM);
   input_char_lstm_init_v = MakeLSTMInitialState(input_char_lstm_init_expr, config.char_lstm_dim, lstm_layer_count);
 
   if (config.use_morphology) {
-    input_affix_lstm.new_graph(cg);
+    NewLSTMGraph(input_affix_lstm, kFreezeInputAffixLSTM, cg);
   }
-  input_char_lstm.new_graph(cg);
+  NewLSTMGraph(input_char_lstm, kFreezeInputCharLSTM, cg);
 
-  Expression main_lstm_fwd_init_expr = parameter(cg, main_lstm_fwd_init);
+  Expression main_lstm_fwd_init_expr = ParameterExpression(cg, main_lstm_fwd_init, kFreezeMainLSTM);
   main_lstm_fwd_init_v = MakeLSTMInitialState(main_lstm_fwd_init_expr, config.main_lstm_dim, lstm_layer_count);
-  main_lstm_fwd.new_graph(cg);
+  NewLSTMGraph(main_lstm_fwd, kFreezeMainLSTM, cg);
 
   if (config.bidirectional) {
-    Expression main_lstm_rev_init_expr = parameter(cg, main_lstm_rev_init);
+    Expression main_lstm_rev_init_expr = ParameterExpression(cg, main_lstm_rev_init, kFreezeMainLSTM);
     main_lstm_rev_init_v = MakeLSTMInitialState(main_lstm_rev_init_expr, config.main_lstm_dim, lstm_layer_count);
-    main_lstm_rev.new_graph(cg);
+    NewLSTMGraph(main_lstm_rev, kFreezeMainLSTM, cg);
   }
 
-  model_chooser.NewGraph(cg);
+  model_chooser.NewGraph(cg, !(frozen & kFreezeModelChooser));
 
-  if (config.use_words) {
+  if (word_softmax != nullptr) {
     word_softmax->new_graph(cg);
   }
-  if (config.use_morphology) {
+  if (root_softmax != nullptr) {
     root_softmax->new_graph(cg);
+  }
+  if (config.use_morphology) {
     affix_softmax->new_graph(cg);
   }
   char_softmax->new_graph(cg);
 
   if (config.use_morphology) {
-    output_affix_lstm_init.NewGraph(cg);
+    output_affix_lstm_init.NewGraph(cg, !(frozen & kFreezeOutputAffixLSTM));
   }
-  output_char_lstm_init.NewGraph(cg);
+  output_char_lstm_init.NewGraph(cg, !(frozen & kFreezeOutputCharLSTM));
 
   if (config.use_morphology) {
-    output_affix_lstm.new_graph(cg);
+    NewLSTMGraph(output_affix_lstm, kFreezeOutputAffixLSTM, cg);
+  }
+  NewLSTMGraph(output_char_lstm, kFreezeOutputCharLSTM, cg);
+}
+
+Expression MorphLM::ParameterExpression(ComputationGraph& cg, Parameter p, unsigned component) {
+  return (frozen & component) ? const_parameter(cg, p) : parameter(cg, p);
+}
+
+Expression MorphLM::Lookup(ComputationGraph& cg, LookupParameter p, WordId index, unsigned component) {
+  return (frozen & component) ? const_lookup(cg, p, index) : lookup(cg, p, index);
+}
+
+// LSTMBuilder always adds its weights to the graph as parameters, so for a
+// frozen LSTM we swap in constants for them. The parameter nodes it added
+// are left unused, and only ever receive zero gradients.
+void MorphLM::NewLSTMGraph(LSTMBuilder& lstm, unsigned component, ComputationGraph& cg) {
+  lstm.new_graph(cg);
+  if (frozen & component) {
+    for (unsigned i = 0; i < lstm.params.size(); ++i) {
+      for (unsigned j = 0; j < lstm.params[i].size(); ++j) {
+        lstm.param_vars[i][j] = const_parameter(cg, lstm.params[i][j]);
+      }
+    }
   }
-  output_char_lstm.new_graph(cg);
 }
 
 Expression MorphLM::EmbedInput(const Sentence& sentence, unsigned i, ComputationGraph& cg) {
@@ -168,6 +201,7 @@ vector<Expression> MorphLM::ShowModeProbs(const Sentence& sentence, ComputationG
 }
 
 vector<Expression> MorphLM::GetContexts(const vector<Expression>& inputs, ComputationGraph& cg) {
+  ProfileScope scope(profiler, kMainLSTM, cg);
   vector<Expression> context_vectors(inputs.size());
   main_lstm_fwd.start_new_sequence(main_lstm_fwd_init_v);
   for (unsigned i = 0; i < inputs.size(); ++i) {
@@ -233,59 +267,91 @@ vector<Expression> MorphLM::ShowModePosteriors(const Sentence& sentence, Computa
 Expression MorphLM::BuildGraph(const Sentence& sentence, ComputationGraph& cg) {
   assert (sentence.size() > 0);
   NewGraph(cg);
+  return sum(ComputeTokenLosses(sentence, cg));
+}
 
+// Like BuildGraph, but returns the loss of each token separately and does
+// not call NewGraph, so several sentences can share one graph.
+vector<Expression> MorphLM::ComputeTokenLosses(const Sentence& sentence, ComputationGraph& cg) {
+  assert (sentence.size() > 0);
   vector<Expression> inputs = EmbedSentence(sentence, cg);
 
   vector<Expression> losses;
   vector<Expression> context_vectors = GetContexts(inputs, cg);;
   for (unsigned i = 0; i < inputs.size(); ++i) {
-    Expression& context = context_vectors[i];
-    Expression mode_log_probs = log_softmax(model_chooser.Feed(context));
-    if (i == inputs.size() - 1) {
-      assert (sentence.words[i] == 2); // </s>
-      Expression loss = -pick(mode_log_probs, (unsigned)0);
-      losses.push_back(loss);
-      break;
-    }
+    losses.push_back(ComputePositionLoss(sentence, i, context_vectors[i], cg));
+  }
 
-    // Have -log p(w | c, m) for each of the three values of m
-    // Want total_loss = -log p(w | c).
-    // p(w | c) = \sum_M p(w | c, m) p(m)
-    // so log p(w | c) = logsumexp_M log p(w | c, m) + log p(m)
-    // so total_loss = -logsumexp_M -mode_losses + mode_log_probs
-    // = -logsumexp(mode_log_probs - mode_losses);
+  assert (losses.size() == sentence.size());
 
-    vector<Expression> mode_losses;
-    unsigned mode_index = 1;
+  return losses;
+}
 
+// The loss of the i-th token of a sentence given the main LSTM's context
+// vector at that position.
+Expression MorphLM::ComputePositionLoss(const Sentence& sentence, unsigned i, Expression context, ComputationGraph& cg) {
+  Expression mode_log_probs;
+  {
+    ProfileScope scope(profiler, kModeChooser, cg);
+    mode_log_probs = log_softmax(model_chooser.Feed(context));
+  }
+  if (i == sentence.size() - 1) {
+    assert (sentence.words[i] == 2); // </s>
+    return -pick(mode_log_probs, (unsigned)0);
+  }
+
+  // Have -log p(w | c, m) for each of the three values of m
+  // Want total_loss = -log p(w | c).
+  // p(w | c) = \sum_M p(w | c, m) p(m)
+  // so log p(w | c) = logsumexp_M log p(w | c, m) + log p(m)
+  // so total_loss = -logsumexp_M -mode_losses + mode_log_probs
+  // = -logsumexp(mode_log_probs - mode_losses);
+
+  // Mode 0 is the end of the sentence. The rest are numbered in this order,
+  // skipping the ones that don't apply to this token.
+  const bool has_morphemes = config.use_morphology && sentence.analyses[i].size() > 0 && sentence.analyses[i][0].root != 0;
+  const bool has_word = config.use_words && sentence.words[i] != 0;
+  vector<bool> keep(1 + has_morphemes + has_word, true);
+  float skipped_prob = 0.0f;
+  if (pruning != nullptr) {
+    vector<float> log_priors = as_vector(cg.incremental_forward(mode_log_probs));
+    log_priors = vector<float>(log_priors.begin() + 1, log_priors.begin() + 1 + keep.size());
+    skipped_prob = pruning->SelectModes(log_priors, keep);
+  }
+
+  vector<Expression> mode_losses;
+  unsigned mode_index = 1;
+
+  if (keep[mode_index - 1]) {
     Expression char_loss = ComputeCharLoss(context, sentence.chars[i], cg);
-    char_loss = pick(mode_log_probs, mode_index++) - char_loss;
+    char_loss = pick(mode_log_probs, mode_index) - char_loss;
     mode_losses.push_back(char_loss);
+  }
+  mode_index++;
 
-    if (config.use_morphology) {
-      if (sentence.analyses[i].size() > 0 && sentence.analyses[i][0].root != 0) {
-        Expression morpheme_loss = ComputeMorphemeLoss(context, sentence.analyses[i], sentence.analysis_probs[i], cg);
-        morpheme_loss = pick(mode_log_probs, mode_index++) - morpheme_loss;
-        mode_losses.push_back(morpheme_loss);
-      }
+  if (has_morphemes) {
+    if (keep[mode_index - 1]) {
+      Expression morpheme_loss = ComputeMorphemeLoss(context, sentence.analyses[i], sentence.analysis_probs[i], cg);
+      morpheme_loss = pick(mode_log_probs, mode_index) - morpheme_loss;
+      mode_losses.push_back(morpheme_loss);
     }
+    mode_index++;
+  }
 
-    if (config.use_words) {
-      if (sentence.words[i] != 0) {
-        Expression word_loss = ComputeWordLoss(context, sentence.words[i], cg);
-        word_loss = pick(mode_log_probs, mode_index++) - word_loss;
-        mode_losses.push_back(word_loss);
-      }
+  if (has_word) {
+    if (keep[mode_index - 1]) {
+      Expression word_loss = ComputeWordLoss(context, sentence.words[i], cg);
+      word_loss = pick(mode_log_probs, mode_index) - word_loss;
+      mode_losses.push_back(word_loss);
     }
-
-    Expression total_loss = -logsumexp(mode_losses);
-
-    losses.push_back(total_loss);
+    mode_index++;
   }
 
-  assert (losses.size() == sentence.size());
-
-  return sum(losses);
+  Expression total_loss = -logsumexp(mode_losses);
+  if (pruning != nullptr) {
+    pruning->AddToken(skipped_prob, total_loss);
+  }
+  return total_loss;
 }
 
 void MorphLM::SetDropout(float r) {
@@ -301,18 +367,118 @@ void MorphLM::SetDropout(float r) {
   output_char_lstm.set_dropout(r);
 }
 
+size_t MorphLM::Freeze(Model& model, unsigned components) {
+  frozen |= components;
+  vector<Parameter> params;
+  vector<LookupParameter> lookup_params;
+  auto add_lstm = [&](const LSTMBuilder& lstm) {
+    for (const vector<Parameter>& layer : lstm.params) {
+      params.insert(params.end(), layer.begin(), layer.end());
+    }
+  };
+  auto add_mlp = [&](const MLP& mlp) {
+    vector<Parameter> p = mlp.GetParameters();
+    params.insert(params.end(), p.begin(), p.end());
+  };
+
+  if ((components & kFreezeInputWordEmbeddings) && config.use_words) {
+    lookup_params.push_back(input_word_embeddings);
+  }
+  if ((components & kFreezeInputMorphemeEmbeddings) && config.use_morphology) {
+    lookup_params.push_back(input_root_embeddings);
+    lookup_params.push_back(input_affix_embeddings);
+  }
+  if (components & kFreezeInputCharEmbeddings) {
+    lookup_params.push_back(input_char_embeddings);
+  }
+  if ((components & kFreezeInputAffixLSTM) && config.use_morphology) {
+    add_lstm(input_affix_lstm);
+  }
+  if (components & kFreezeInputCharLSTM) {
+    params.push_back(input_char_lstm_init);
+    add_lstm(input_char_lstm);
+  }
+  if (components & kFreezeMainLSTM) {
+    params.push_back(main_lstm_fwd_init);
+    add_lstm(main_lstm_fwd);
+    if (config.bidirectional) {
+      params.push_back(main_lstm_rev_init);
+      add_lstm(main_lstm_rev);
+    }
+  }
+  if (components & kFreezeModelChooser) {
+    add_mlp(model_chooser);
+  }
+  if (components & kFreezeOutputEmbeddings) {
+    if (config.use_morphology) {
+      lookup_params.push_back(output_root_embeddings);
+      lookup_params.push_back(output_affix_embeddings);
+    }
+    lookup_params.push_back(output_char_embeddings);
+  }
+  if ((components & kFreezeOutputAffixLSTM) && config.use_morphology) {
+    add_mlp(output_affix_lstm_init);
+    add_lstm(output_affix_lstm);
+  }
+  if (components & kFreezeOutputCharLSTM) {
+    add_mlp(output_char_lstm_init);
+    add_lstm(output_char_lstm);
+  }
+
+  size_t weights = 0;
+  for (const Parameter& p : params) {
+    model.set_updated_param(&p, false);
+    weights += p.get()->dim.size();
+  }
+  for (const LookupParameter& p : lookup_params) {
+    model.set_updated_lookup_param(&p, false);
+    weights += p.get()->values.size() * p.get()->dim.size();
+  }
+  return weights;
+}
+
+// StandardSoftmaxBuilder keeps its parameters private. They are allocated
+// right after the model chooser's, two per softmax, in the order the
+// constructor builds the softmaxes, so we can find them by index.
+void MorphLM::GetSoftmaxParameters(const SoftmaxBuilder* softmax, Parameter& w, Parameter& b) const {
+  assert (softmax != nullptr);
+  Parameter last = model_chooser.GetParameters().back();
+  unsigned long index = last.index + 1;
+  for (const SoftmaxBuilder* s : {word_softmax, root_softmax, affix_softmax, char_softmax}) {
+    if (s == nullptr) {
+      continue;
+    }
+    if (s == softmax) {
+      w = Parameter(last.mp, index);
+      b = Parameter(last.mp, index + 1);
+      return;
+    }
+    index += 2;
+  }
+  assert (false);
+}
+
 Expression MorphLM::EmbedWord(const WordId word, ComputationGraph& cg) {
-  return lookup(cg, input_word_embeddings, word);
+  ProfileScope scope(profiler, kInputWords, cg);
+  if (config.storage != kFloat32) {
+    return input(cg, {quantized_word_embeddings.cols()}, quantized_word_embeddings.Row(word));
+  }
+  return Lookup(cg, input_word_embeddings, word, kFreezeInputWordEmbeddings);
 }
 
 Expression MorphLM::EmbedAnalysis(const Analysis& analysis, ComputationGraph& cg) {
-
-  Expression root_embedding = lookup(cg, input_root_embeddings, analysis.root);
+  Expression root_embedding;
+  if (config.storage != kFloat32) {
+    root_embedding = input(cg, {quantized_root_embeddings.cols()}, quantized_root_embeddings.Row(analysis.root));
+  }
+  else {
+    root_embedding = Lookup(cg, input_root_embeddings, analysis.root, kFreezeInputMorphemeEmbeddings);
+  }
   vector<Expression> hinit = MakeLSTMInitialState(root_embedding, config.affix_lstm_dim, lstm_layer_count);
   input_affix_lstm.start_new_sequence(hinit);
 
   for (WordId affix : analysis.affixes) {
-    Expression affix_embedding = lookup(cg, input_affix_embeddings, affix);
+    Expression affix_embedding = Lookup(cg, input_affix_embeddings, affix, kFreezeInputMorphemeEmbeddings);
     input_affix_lstm.add_input(affix_embedding);
   }
 
@@ -320,6 +486,7 @@ Expression MorphLM::EmbedAnalysis(const Analysis& analysis, ComputationGraph& cg
 }
 
 Expression MorphLM::EmbedAnalyses(const vector<Analysis>& analyses, const vector<float>& probs, ComputationGraph& cg) {
+  ProfileScope scope(profiler, kInputAffixes, cg);
   assert (analyses.size() > 0);
   vector<Expression> analysis_embeddings(analyses.size());
   for (unsigned i = 0; i < analyses.size(); ++i) {
@@ -336,22 +503,42 @@ Expression MorphLM::EmbedAnalyses(const vector<Analysis>& analyses, const vector
 }
 
 Expression MorphLM::EmbedCharacterSequence(const vector<WordId>& chars, ComputationGraph& cg) {
+  ProfileScope scope(profiler, kInputChars, cg);
   input_char_lstm.start_new_sequence(input_char_lstm_init_v);
   for (WordId c : chars) {
-    Expression char_embedding = lookup(cg, input_char_embeddings, c);
+    Expression char_embedding = Lookup(cg, input_char_embeddings, c, kFreezeInputCharEmbeddings);
     input_char_lstm.add_input(char_embedding);
   }
   return input_char_lstm.back();
 }
 
+// Quantized softmaxes are evaluated outside of the graph, so their losses
+// enter it as constants. They are only meant for inference.
 Expression MorphLM::ComputeWordLoss(Expression context, WordId ref, ComputationGraph& cg) {
+  ProfileScope scope(profiler, kWordSoftmax, cg);
+  if (config.storage != kFloat32) {
+    return input(cg, quantized_word_softmax.NegLogSoftmax(as_vector(context.value()), ref));
+  }
   return word_softmax->neg_log_softmax(context, ref);
 }
 
+Expression MorphLM::EmbedOutputRoot(WordId root, ComputationGraph& cg) {
+  if (config.storage != kFloat32) {
+    return input(cg, {quantized_output_root_embeddings.cols()}, quantized_output_root_embeddings.Row(root));
+  }
+  return Lookup(cg, output_root_embeddings, root, kFreezeOutputEmbeddings);
+}
+
 Expression MorphLM::ComputeAnalysisLoss(Expression context, const Analysis& ref, ComputationGraph& cg) {
-  Expression root_loss = root_softmax->neg_log_softmax(context, ref.root);
+  Expression root_loss;
+  if (config.storage != kFloat32) {
+    root_loss = input(cg, quantized_root_softmax.NegLogSoftmax(as_vector(context.value()), ref.root));
+  }
+  else {
+    root_loss = root_softmax->neg_log_softmax(context, ref.root);
+  }
 
-  Expression root_embedding = lookup(cg, output_root_embeddings, ref.root);
+  Expression root_embedding = EmbedOutputRoot(ref.root, cg);
   Expression c = output_affix_lstm_init.Feed(concatenate({root_embedding, context}));
   vector<Expression> hinit = MakeLSTMInitialState(c, config.affix_lstm_dim, lstm_layer_count);
 
@@ -363,7 +550,7 @@ Expression MorphLM::ComputeAnalysisLoss(Expression context, const Analysis& ref,
     Expression loss = affix_softmax->neg_log_softmax(h, affix);
     losses.push_back(loss);
 
-    Expression affix_embedding =lookup(cg, output_affix_embeddings, affix);
+    Expression affix_embedding = Lookup(cg, output_affix_embeddings, affix, kFreezeOutputEmbeddings);
     Expression input = concatenate({affix_embedding, context});
     output_affix_lstm.add_input(input);
   }
@@ -371,6 +558,7 @@ Expression MorphLM::ComputeAnalysisLoss(Expression context, const Analysis& ref,
 }
 
 Expression MorphLM::ComputeMorphemeLoss(Expression context, const vector<Analysis>& refs, const vector<float>& probs, ComputationGraph& cg) {
+  ProfileScope scope(profiler, kMorphemeLoss, cg);
   vector<Expression> losses(refs.size());
   for (unsigned i = 0; i < refs.size(); ++i) {
     losses[i] = ComputeAnalysisLoss(context, refs[i], cg);
@@ -379,6 +567,7 @@ Expression MorphLM::ComputeMorphemeLoss(Expression context, const vector<Analysi
 }
 
 Expression MorphLM::ComputeCharLoss(Expression context, const vector<WordId>& ref, ComputationGraph& cg) {
+  ProfileScope scope(profiler, kCharDecoder, cg);
   Expression c = output_char_lstm_init.Feed(context);
   vector<Expression> hinit = MakeLSTMInitialState(c, config.char_lstm_dim, lstm_layer_count);
   output_char_lstm.start_new_sequence(hinit);
@@ -389,7 +578,7 @@ Expression MorphLM::ComputeCharLoss(Expression context, const vector<WordId>& re
     Expression char_loss = char_softmax->neg_log_softmax(h, w);
     losses.push_back(char_loss);
 
-    Expression char_embedding = lookup(cg, output_char_embeddings, w);
+    Expression char_embedding = Lookup(cg, output_char_embeddings, w, kFreezeOutputEmbeddings);
     Expression input = concatenate({char_embedding, context});
     output_char_lstm.add_input(input);
   }
@@ -422,8 +611,8 @@ vector<WordId> MorphLM::SampleCharSequence(Expression context, unsigned max_leng
 }
 
 Analysis MorphLM::SampleMorphAnalysis(Expression context, unsigned max_length, ComputationGraph& cg) {
-  WordId root = root_softmax->sample(context);
-  Expression root_embedding = lookup(cg, output_root_embeddings, root);
+  WordId root = SampleRoot(context);
+  Expression root_embedding = EmbedOutputRoot(root, cg);
 
   Expression c = output_affix_lstm_init.Feed(concatenate({root_embedding, context}));
   vector<Expression> hinit = MakeLSTMInitialState(c, config.affix_lstm_dim, lstm_layer_count);
@@ -449,8 +638,6 @@ Analysis MorphLM::SampleMorphAnalysis(Expression context, unsigned max_length, C
 
 Sentence MorphLM::Sample(unsigned max_length, ComputationGraph& cg, WordFillerOuter* wfo) {
   assert (!config.bidirectional && "Sampling not supported in bidirectional mode!");
-  random_device rd;
-  mt19937 rng(rd());
   Sentence sentence;
 
   NewGraph(cg);
@@ -462,7 +649,7 @@ Sentence MorphLM::Sample(unsigned max_length, ComputationGraph& cg, WordFillerOu
     vector<float> mode_log_prob_vals = as_vector(mode_log_probs.value());
     assert (!config.use_morphology); // HACK: For now this doesn't work with morphology-enabled models.
 
-    unsigned mode = sample_multinomial(mode_log_prob_vals, rng);
+    unsigned mode = sample_multinomial(mode_log_prob_vals, *rndeng);
     if (mode == 0) {
       // We sampled </s>
       break;
@@ -490,7 +677,7 @@ Sentence MorphLM::Sample(unsigned max_length, ComputationGraph& cg, WordFillerOu
     }
     else {
       // Generate a word directly
-      WordId word_id = word_softmax->sample(context);
+      WordId word_id = SampleWord(context);
       sentence.words.push_back(word_id);
       sentence.analyses.push_back(vector<Analysis>());
       sentence.analysis_probs.push_back(vector<float>());
@@ -503,6 +690,22 @@ Sentence MorphLM::Sample(unsigned max_length, ComputationGraph& cg, WordFillerOu
   return sentence;
 }
 
+// Everything is sampled with DyNet's generator, as the float32 softmaxes
+// are, so that --dynet-seed makes samples reproducible.
+WordId MorphLM::SampleWord(Expression context) {
+  if (config.storage != kFloat32) {
+    return sample_multinomial(quantized_word_softmax.LogDistribution(as_vector(context.value())), *rndeng);
+  }
+  return word_softmax->sample(context);
+}
+
+WordId MorphLM::SampleRoot(Expression context) {
+  if (config.storage != kFloat32) {
+    return sample_multinomial(quantized_root_softmax.LogDistribution(as_vector(context.value())), *rndeng);
+  }
+  return root_softmax->sample(context);
+}
+
 vector<Expression> MakeLSTMInitialState(Expression c, unsigned lstm_dim, unsigned lstm_layer_count) {
   vector<Expression> hinit(lstm_layer_count * 2);
   for (unsigned i = 0; i < lstm_layer_count; ++i) {
@@ -559,3 +762,42 @@ void WordFillerOuter::FillFromWord(Sentence& sentence) {
     chars.push_back(char_vocab->convert("</w>"));
   }
 }
+
+const vector<pair<string, unsigned>> kFreezableComponentNames = {
+  {"input_word_embeddings", kFreezeInputWordEmbeddings},
+  {"input_morpheme_embeddings", kFreezeInputMorphemeEmbeddings},
+  {"input_char_embeddings", kFreezeInputCharEmbeddings},
+  {"input_affix_lstm", kFreezeInputAffixLSTM},
+  {"input_char_lstm", kFreezeInputCharLSTM},
+  {"main_lstm", kFreezeMainLSTM},
+  {"model_chooser", kFreezeModelChooser},
+  {"output_embeddings", kFreezeOutputEmbeddings},
+  {"output_affix_lstm", kFreezeOutputAffixLSTM},
+  {"output_char_lstm", kFreezeOutputCharLSTM},
+  {"input_encoders", kFreezeInputWordEmbeddings | kFreezeInputMorphemeEmbeddings | kFreezeInputCharEmbeddings | kFreezeInputAffixLSTM | kFreezeInputCharLSTM},
+  {"embeddings", kFreezeInputWordEmbeddings | kFreezeInputMorphemeEmbeddings | kFreezeInputCharEmbeddings | kFreezeOutputEmbeddings},
+};
+
+bool ParseFreezableComponents(const string& names, unsigned& components) {
+  components = 0;
+  for (const string& name : tokenize(names, ",")) {
+    if (name.length() == 0) {
+      continue;
+    }
+    auto it = find_if(kFreezableComponentNames.begin(), kFreezableComponentNames.end(), [&](const pair<string, unsigned>& entry) { return entry.first == name; });
+    if (it == kFreezableComponentNames.end()) {
+      cerr << "Unknown component to freeze: " << name << ". Choose from " << FreezableComponentNames() << endl;
+      return false;
+    }
+    components |= it->second;
+  }
+  return true;
+}
+
+string FreezableComponentNames() {
+  vector<string> names;
+  for (const pair<string, unsigned>& entry : kFreezableComponentNames) {
+    names.push_back(entry.first);
+  }
+  return boost::algorithm::join(names, ", ");
+}
@@ -1,10 +1,14 @@
 #pragma once
 #include <boost/serialization/access.hpp>
+#include <boost/serialization/version.hpp>
 #include "dynet/expr.h"
 #include "dynet/lstm.h"
 #include "dynet/cfsm-builder.h"
 #include "utils.h"
 #include "mlp.h"
+#include "quantized.h"
+#include "profile.h"
+#include "pruning.h"
 
 using namespace std;
 using namespace dynet;
@@ -33,10 +37,13 @@ struct MorphLMConfig {
   unsigned affix_lstm_dim;
   unsigned char_lstm_dim;
 
+  // One of StorageType. Only set by the quantize tool.
+  unsigned storage = kFloat32;
+
 private:
   friend class boost::serialization::access;
   template<class Archive>
-  void serialize(Archive& ar, const unsigned int) {
+  void serialize(Archive& ar, const unsigned int version) {
     ar & bidirectional;
     ar & use_words;
     ar & use_morphology;
@@ -58,8 +65,38 @@ private:
     ar & main_lstm_dim;
     ar & affix_lstm_dim;
     ar & char_lstm_dim;
+
+    if (version >= 1) {
+      ar & storage;
+    }
   }
 };
+BOOST_CLASS_VERSION(MorphLMConfig, 1)
+
+// Parts of a MorphLM that can be held fixed while training, e.g. to adapt
+// a model to a new domain quickly. A frozen part's weights enter graphs as
+// constants, so the backward pass computes no gradients for them (and
+// stops altogether below the lowest trainable part), and the trainer skips
+// their updates. The LSTMs include the parameters of their initial states.
+enum FreezableComponent {
+  kFreezeInputWordEmbeddings = 1 << 0,
+  // Input root and affix embeddings
+  kFreezeInputMorphemeEmbeddings = 1 << 1,
+  kFreezeInputCharEmbeddings = 1 << 2,
+  kFreezeInputAffixLSTM = 1 << 3,
+  kFreezeInputCharLSTM = 1 << 4,
+  kFreezeMainLSTM = 1 << 5,
+  kFreezeModelChooser = 1 << 6,
+  // Output root, affix and char embeddings
+  kFreezeOutputEmbeddings = 1 << 7,
+  kFreezeOutputAffixLSTM = 1 << 8,
+  kFreezeOutputCharLSTM = 1 << 9,
+};
+
+// Parses a comma separated list of component names, as listed by
+// FreezableComponentNames, into a mask of FreezableComponents.
+bool ParseFreezableComponents(const string& names, unsigned& components);
+string FreezableComponentNames();
 
 class WordFillerOuter {
 public:
@@ -86,7 +123,13 @@ public:
   vector<Expression> GetContexts(const vector<Expression>& inputs, ComputationGraph& cg);
   vector<Expression> ShowModePosteriors(const Sentence& sentence, ComputationGraph& cg);
   Expression BuildGraph(const Sentence& sentence, ComputationGraph& cg);
+  vector<Expression> ComputeTokenLosses(const Sentence& sentence, ComputationGraph& cg);
+  Expression ComputePositionLoss(const Sentence& sentence, unsigned i, Expression context, ComputationGraph& cg);
   void SetDropout(float r);
+  // Holds the given FreezableComponents fixed from now on. Returns the
+  // number of weights frozen.
+  size_t Freeze(Model& model, unsigned components);
+  void GetSoftmaxParameters(const SoftmaxBuilder* softmax, Parameter& w, Parameter& b) const;
 
   Expression EmbedWord(const WordId word, ComputationGraph& cg);
   Expression EmbedAnalysis(const Analysis& analysis, ComputationGraph& cg);
@@ -95,12 +138,20 @@ public:
   Expression EmbedInput(const Sentence& sentence, unsigned i, ComputationGraph& cg);
   vector<Expression> EmbedSentence(const Sentence& sentence, ComputationGraph& cg);
 
+  Expression EmbedOutputRoot(WordId root, ComputationGraph& cg);
   Expression ComputeWordLoss(Expression context, WordId ref, ComputationGraph& cg);
   Expression ComputeAnalysisLoss(Expression context, const Analysis& ref, ComputationGraph& cg);
   Expression ComputeMorphemeLoss(Expression context, const vector<Analysis>& refs, const vector<float>& probs, ComputationGraph& cg);
   Expression ComputeCharLoss(Expression context, const vector<WordId>& ref, ComputationGraph& cg);
 
+  // Graph inputs that are constants if component is frozen.
+  Expression ParameterExpression(ComputationGraph& cg, Parameter p, unsigned component);
+  Expression Lookup(ComputationGraph& cg, LookupParameter p, WordId index, unsigned component);
+  void NewLSTMGraph(LSTMBuilder& lstm, unsigned component, ComputationGraph& cg);
+
   Sentence Sample(unsigned max_length, ComputationGraph& cg, WordFillerOuter* wfo);
+  WordId SampleWord(Expression context);
+  WordId SampleRoot(Expression context);
   Analysis SampleMorphAnalysis(Expression context, unsigned max_length, ComputationGraph& cg);
   vector<WordId> SampleCharSequence(Expression context, unsigned max_length, ComputationGraph& cg);
 
@@ -142,16 +193,43 @@ public:
   LSTMBuilder output_affix_lstm;
   LSTMBuilder output_char_lstm;
 
+  // Replace input_word_embeddings, input_root_embeddings, word_softmax,
+  // root_softmax and output_root_embeddings when config.storage is int8,
+  // bf16 or fp16.
+  QuantizedMatrix quantized_word_embeddings;
+  QuantizedMatrix quantized_root_embeddings;
+  QuantizedMatrix quantized_output_root_embeddings;
+  QuantizedSoftmax quantized_word_softmax;
+  QuantizedSoftmax quantized_root_softmax;
+
+  // Attributes graph building and forward time to components, if set.
+  Profiler* profiler;
+  // Skips improbable modes when scoring, if set. Inference only.
+  ModePruning* pruning;
+  // The FreezableComponents held fixed by Freeze.
+  unsigned frozen;
+
   friend class boost::serialization::access;
   template<class Archive>
   void serialize(Archive& ar, const unsigned int) {
     ar & config;
+    bool quantized = (config.storage != kFloat32);
 
     if (config.use_words) {
-      ar & input_word_embeddings;
+      if (quantized) {
+        ar & quantized_word_embeddings;
+      }
+      else {
+        ar & input_word_embeddings;
+      }
     }
     if (config.use_morphology) {
-      ar & input_root_embeddings;
+      if (quantized) {
+        ar & quantized_root_embeddings;
+      }
+      else {
+        ar & input_root_embeddings;
+      }
       ar & input_affix_embeddings;
     }
     ar & input_char_embeddings;
@@ -171,16 +249,31 @@ public:
     ar & model_chooser;
 
     if (config.use_words) {
-      ar & word_softmax;
+      if (quantized) {
+        ar & quantized_word_softmax;
+      }
+      else {
+        ar & word_softmax;
+      }
     }
     if (config.use_morphology) {
-      ar & root_softmax;
+      if (quantized) {
+        ar & quantized_root_softmax;
+      }
+      else {
+        ar & root_softmax;
+      }
       ar & affix_softmax;
     }
     ar & char_softmax;
 
     if (config.use_morphology) {
-      ar & output_root_embeddings;
+      if (quantized) {
+        ar & quantized_output_root_embeddings;
+      }
+      else {
+        ar & output_root_embeddings;
+      }
       ar & output_affix_embeddings;
     }
     ar & output_char_embeddings;
@@ -1,29 +1,39 @@
 #include "dynet/dynet.h"
 
 #include <boost/program_options.hpp>
+#include <boost/algorithm/string/join.hpp>
 
 #include <iostream>
 #include <fstream>
 
 #include "io.h"
-#include "kbestlist.h"
+#include "memory.h"
+#include "engine.h"
+#include "beam.h"
 #include "utils.h"
 
 using namespace dynet;
 using namespace std;
 namespace po = boost::program_options;
 
+// Reads prefixes (morphologically analyzed text, like loss) from stdin and
+// writes the k best completions of each, or its k best next words, as
+//   sentence number ||| words ||| log probability
 int main(int argc, char** argv) {
-  dynet::initialize(argc, argv);
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
 
   po::options_description desc("description");
   desc.add_options()
-  ("model", po::value<string>()->required(), "model file(s), as output by train")
+  ("model", po::value<string>()->required(), "model file, as output by train")
   ("kbest_size", po::value<unsigned>()->default_value(10), "K-best list size")
-  ("beam_size", po::value<unsigned>()->default_value(10), "Beam size")
-  ("max_length", po::value<unsigned>()->default_value(100), "Maximum length of output sentences")
+  ("beam_size", po::value<unsigned>()->default_value(10), "Beam size, for sentences and for the character and affix decoders")
+  ("max_length", po::value<unsigned>()->default_value(100), "Maximum number of words to add to each prefix")
+  ("max_word_length", po::value<unsigned>()->default_value(30), "Maximum number of characters or affixes in a generated word")
+  ("next_words", "Only predict the next word of each prefix")
   ("help", "Display this help message");
 
+  AddAnalysisLimitOptions(desc);
+
   po::positional_options_description positional_options;
   positional_options.add("model", 1);
 
@@ -36,44 +46,41 @@ int main(int argc, char** argv) {
   }
 
   po::notify(vm);
+  if (!ConfigureAnalysisLimit(vm)) {
+    return 1;
+  }
 
   const string model_filename = vm["model"].as<string>();
   const unsigned beam_size = vm["beam_size"].as<unsigned>();
   const unsigned max_length = vm["max_length"].as<unsigned>();
   const unsigned kbest_size = vm["kbest_size"].as<unsigned>();
+  const bool next_words = vm.count("next_words") > 0;
+
+  InitializeDynetForModel(dynet_args, model_filename);
 
   Model dynet_model;
-  Translator translator;
-  vector<Dict*> dicts;
-  Deserialize(model_filename, dicts, translator, dynet_model);
-
-  Dict* source_vocab = dicts[0];
-  Dict* target_vocab = dicts[1];
-  Dict* label_vocab = translator.IsT2S() ? dicts[2] : nullptr;
-
-  assert (source_vocab->Contains("<s>"));
-  assert (source_vocab->Contains("</s>"));
-  WordId ktSOS = target_vocab->Convert("<s>");
-  WordId ktEOS = target_vocab->Convert("</s>");
-  assert (source_vocab->is_frozen());
-  assert (target_vocab->is_frozen());
-
-  string line;
+  MorphLM lm;
+  Dict word_vocab, root_vocab, affix_vocab, char_vocab;
+  Deserialize(model_filename, word_vocab, root_vocab, affix_vocab, char_vocab, lm, dynet_model);
+  if (lm.config.bidirectional) {
+    cerr << "Generation needs a forward-only model" << endl;
+    return 1;
+  }
+
+  InferenceEngine engine(lm);
+  BeamSearch search(engine, word_vocab, root_vocab, affix_vocab, char_vocab, beam_size, vm["max_word_length"].as<unsigned>());
+
+  Sentence prefix;
   unsigned sentence_number = 0;
-  while(getline(cin, line)) {
-    cerr << line << endl;
-    TranslatorInput* source;
-    if (translator.IsT2S()) {
-      source = new SyntaxTree(line, source_vocab, label_vocab);
+  while (ReadMorphSentence(cin, word_vocab, root_vocab, affix_vocab, char_vocab, prefix)) {
+    KBestList kbest = next_words ? search.NextWords(prefix, kbest_size) : search.Complete(prefix, kbest_size, max_length);
+    for (const Completion& completion : kbest) {
+      cout << sentence_number << " ||| " << boost::algorithm::join(completion.words, " ") << " ||| " << completion.log_prob << "\n";
     }
-    else {
-      source = ReadSentence(line, *source_vocab);
-    }
-
-    KBestList<Sentence> kbest = translator.Translate(source, kbest_size, beam_size, ktSOS, ktEOS, max_length);
-    OutputKBestList(sentence_number, kbest, *target_vocab);
+    cout.flush();
     sentence_number++;
   }
 
+  analysis_limit.Report(cerr);
   return 0;
 }
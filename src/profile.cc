@@ -0,0 +1,202 @@
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cassert>
+#include "profile.h"
+
+ProfileStats::ProfileStats() {
+  Clear();
+}
+
+void ProfileStats::Clear() {
+  sentences = 0;
+  tokens = 0;
+  seconds = 0.0;
+  for (unsigned i = 0; i < kComponentCount; ++i) {
+    build_seconds[i] = 0.0;
+    forward_seconds[i] = 0.0;
+    nodes[i] = 0;
+  }
+  backward_seconds = 0.0;
+  update_seconds = 0.0;
+}
+
+ProfileStats& ProfileStats::operator+=(const ProfileStats& rhs) {
+  sentences += rhs.sentences;
+  tokens += rhs.tokens;
+  seconds += rhs.seconds;
+  for (unsigned i = 0; i < kComponentCount; ++i) {
+    build_seconds[i] += rhs.build_seconds[i];
+    forward_seconds[i] += rhs.forward_seconds[i];
+    nodes[i] += rhs.nodes[i];
+  }
+  backward_seconds += rhs.backward_seconds;
+  update_seconds += rhs.update_seconds;
+  return *this;
+}
+
+Profiler::Profiler() : building(false), after_learning(false), scoped_build_seconds(0.0), scope_first_node(0) {
+  window_start = Clock::now();
+}
+
+double Profiler::Seconds(Clock::time_point start, Clock::time_point end) {
+  return chrono::duration<double>(end - start).count();
+}
+
+const char* Profiler::ComponentName(unsigned component) {
+  static const char* names[] = {"input_chars", "input_affixes", "input_words", "main_lstm", "mode_chooser", "char_decoder", "morpheme_loss", "word_softmax", "other"};
+  assert (component < kComponentCount);
+  return names[component];
+}
+
+void Profiler::StartGraph(const ComputationGraph& cg) {
+  Clock::time_point now = Clock::now();
+  if (after_learning) {
+    window.update_seconds += Seconds(last_sentence_end, now);
+    after_learning = false;
+  }
+  node_components.assign(cg.nodes.size(), kOtherNodes);
+  graph_start = now;
+  scoped_build_seconds = 0.0;
+  building = true;
+}
+
+void Profiler::FinishBuild() {
+  if (!building) {
+    return;
+  }
+  building = false;
+  double build_seconds = Seconds(graph_start, Clock::now());
+  window.build_seconds[kOtherNodes] += max(0.0, build_seconds - scoped_build_seconds);
+}
+
+void Profiler::BeginScope(const ComputationGraph& cg) {
+  scope_first_node = cg.nodes.size();
+  scope_start = Clock::now();
+}
+
+void Profiler::EndScope(ProfileComponent component, const ComputationGraph& cg) {
+  double seconds = Seconds(scope_start, Clock::now());
+  window.build_seconds[component] += seconds;
+  scoped_build_seconds += seconds;
+  node_components.resize(cg.nodes.size(), kOtherNodes);
+  for (VariableIndex i = scope_first_node; i < cg.nodes.size(); ++i) {
+    node_components[i] = component;
+  }
+}
+
+const Tensor& Profiler::Forward(ComputationGraph& cg, const Expression& last) {
+  FinishBuild();
+  node_components.resize(cg.nodes.size(), kOtherNodes);
+  for (VariableIndex i = 0; i <= last.i; ++i) {
+    window.nodes[node_components[i]]++;
+  }
+
+  // Nodes that were already evaluated (e.g. by Expression::value() while
+  // building the graph) cost nothing here.
+  for (VariableIndex i = 0; i <= last.i; ++i) {
+    Clock::time_point start = Clock::now();
+    cg.incremental_forward(Expression(&cg, i));
+    window.forward_seconds[node_components[i]] += Seconds(start, Clock::now());
+  }
+  return cg.incremental_forward(last);
+}
+
+void Profiler::Backward(ComputationGraph& cg, const Expression& last) {
+  Clock::time_point start = Clock::now();
+  cg.backward(last);
+  window.backward_seconds += Seconds(start, Clock::now());
+}
+
+void Profiler::EndSentence(unsigned tokens, bool learning) {
+  FinishBuild();
+  window.sentences++;
+  window.tokens += tokens;
+  last_sentence_end = Clock::now();
+  after_learning = learning;
+}
+
+void Profiler::Report(ostream& out) {
+  Clock::time_point now = Clock::now();
+  window.seconds = Seconds(window_start, now);
+  const double sentences = max(window.sentences, 1ULL);
+
+  out << "Profile: " << window.sentences << " sentences, " << window.tokens << " tokens in " << window.seconds << "s (";
+  out << window.tokens / window.seconds << " tokens/sec, " << window.sentences / window.seconds << " sentences/sec)" << endl;
+  out << "  " << setw(14) << left << "component" << right << setw(12) << "nodes/sent" << setw(12) << "build ms" << setw(12) << "forward ms" << endl;
+  for (unsigned i = 0; i < kComponentCount; ++i) {
+    out << "  " << setw(14) << left << ComponentName(i) << right;
+    out << setw(12) << window.nodes[i] / sentences;
+    out << setw(12) << 1000.0 * window.build_seconds[i] / sentences;
+    out << setw(12) << 1000.0 * window.forward_seconds[i] / sentences << endl;
+  }
+  out << "  backward " << 1000.0 * window.backward_seconds / sentences << " ms/sent, update " << 1000.0 * window.update_seconds / sentences << " ms/sent" << endl;
+
+  total += window;
+  window.Clear();
+  window_start = now;
+}
+
+ProfileStats Profiler::CurrentTotal() const {
+  ProfileStats stats = total;
+  stats += window;
+  stats.seconds += Seconds(window_start, Clock::now());
+  return stats;
+}
+
+void Profiler::WriteCSV(ostream& out) const {
+  ProfileStats stats = CurrentTotal();
+  out << "metric,value" << endl;
+  out << "seconds," << stats.seconds << endl;
+  out << "sentences," << stats.sentences << endl;
+  out << "tokens," << stats.tokens << endl;
+  out << "sentences_per_second," << stats.sentences / stats.seconds << endl;
+  out << "tokens_per_second," << stats.tokens / stats.seconds << endl;
+  for (unsigned i = 0; i < kComponentCount; ++i) {
+    out << ComponentName(i) << ".nodes," << stats.nodes[i] << endl;
+    out << ComponentName(i) << ".build_seconds," << stats.build_seconds[i] << endl;
+    out << ComponentName(i) << ".forward_seconds," << stats.forward_seconds[i] << endl;
+  }
+  out << "backward_seconds," << stats.backward_seconds << endl;
+  out << "update_seconds," << stats.update_seconds << endl;
+}
+
+void Profiler::WriteJSON(ostream& out) const {
+  ProfileStats stats = CurrentTotal();
+  out << "{\"seconds\": " << stats.seconds << ", \"sentences\": " << stats.sentences << ", \"tokens\": " << stats.tokens;
+  out << ", \"sentences_per_second\": " << stats.sentences / stats.seconds << ", \"tokens_per_second\": " << stats.tokens / stats.seconds;
+  out << ", \"backward_seconds\": " << stats.backward_seconds << ", \"update_seconds\": " << stats.update_seconds;
+  out << ", \"components\": {";
+  for (unsigned i = 0; i < kComponentCount; ++i) {
+    out << (i > 0 ? ", " : "") << "\"" << ComponentName(i) << "\": {\"nodes\": " << stats.nodes[i];
+    out << ", \"build_seconds\": " << stats.build_seconds[i] << ", \"forward_seconds\": " << stats.forward_seconds[i] << "}";
+  }
+  out << "}}" << endl;
+}
+
+void Profiler::WriteFile(const string& filename) const {
+  ofstream f(filename);
+  if (!f.is_open()) {
+    cerr << "Unable to write profile to " << filename << endl;
+    return;
+  }
+  const string extension = ".json";
+  if (filename.size() >= extension.size() && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0) {
+    WriteJSON(f);
+  }
+  else {
+    WriteCSV(f);
+  }
+}
+
+ProfileScope::ProfileScope(Profiler* profiler, ProfileComponent component, const ComputationGraph& cg) : profiler(profiler), component(component), cg(cg) {
+  if (profiler != nullptr) {
+    profiler->BeginScope(cg);
+  }
+}
+
+ProfileScope::~ProfileScope() {
+  if (profiler != nullptr) {
+    profiler->EndScope(component, cg);
+  }
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include "dynet/dynet.h"
+#include "dynet/expr.h"
+
+using namespace std;
+using namespace dynet;
+using namespace dynet::expr;
+
+// The parts of a MorphLM graph we attribute time and nodes to.
+enum ProfileComponent {
+  kInputChars = 0,
+  kInputAffixes,
+  kInputWords,
+  kMainLSTM,
+  kModeChooser,
+  kCharDecoder,
+  kMorphemeLoss,
+  kWordSoftmax,
+  kOtherNodes,
+  kComponentCount,
+};
+
+struct ProfileStats {
+  ProfileStats();
+  void Clear();
+  ProfileStats& operator+=(const ProfileStats& rhs);
+
+  unsigned long long sentences;
+  unsigned long long tokens;
+  double seconds;
+  double build_seconds[kComponentCount];
+  double forward_seconds[kComponentCount];
+  unsigned long long nodes[kComponentCount];
+  double backward_seconds;
+  double update_seconds;
+};
+
+// Records where the time goes while building and running graphs. Graph
+// building is attributed to components by ProfileScope, and the forward
+// pass is run one node at a time so that each node's time can be charged
+// to the component that created it. DyNet's backward pass can't be split
+// up that way, so it's only timed as a whole. Time spent between the end
+// of a training example and the start of the next one is the trainer's
+// update (and the training loop's bookkeeping).
+class Profiler {
+public:
+  Profiler();
+
+  void StartGraph(const ComputationGraph& cg);
+  const Tensor& Forward(ComputationGraph& cg, const Expression& last);
+  void Backward(ComputationGraph& cg, const Expression& last);
+  void EndSentence(unsigned tokens, bool learning);
+
+  void BeginScope(const ComputationGraph& cg);
+  void EndScope(ProfileComponent component, const ComputationGraph& cg);
+
+  // Writes the stats since the previous report, then starts a new window.
+  void Report(ostream& out);
+  // Writes the stats since the profiler was created, as CSV or JSON.
+  void WriteCSV(ostream& out) const;
+  void WriteJSON(ostream& out) const;
+  // Picks the format from the file name's extension.
+  void WriteFile(const string& filename) const;
+
+  static const char* ComponentName(unsigned component);
+
+private:
+  typedef chrono::steady_clock Clock;
+  static double Seconds(Clock::time_point start, Clock::time_point end);
+  void FinishBuild();
+
+  // Totals since the profiler was created, including the current window.
+  ProfileStats CurrentTotal() const;
+
+  ProfileStats window;
+  // Everything before the current window
+  ProfileStats total;
+  Clock::time_point window_start;
+  Clock::time_point graph_start;
+  Clock::time_point scope_start;
+  Clock::time_point last_sentence_end;
+  bool building;
+  bool after_learning;
+  double scoped_build_seconds;
+  VariableIndex scope_first_node;
+  // Which component created each node of the current graph
+  vector<unsigned char> node_components;
+};
+
+// Attributes the nodes created (and time spent) during its lifetime to a
+// component. Does nothing when profiler is null.
+class ProfileScope {
+public:
+  ProfileScope(Profiler* profiler, ProfileComponent component, const ComputationGraph& cg);
+  ~ProfileScope();
+
+private:
+  Profiler* profiler;
+  ProfileComponent component;
+  const ComputationGraph& cg;
+};
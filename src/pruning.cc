@@ -0,0 +1,68 @@
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include "pruning.h"
+
+ModePruning::ModePruning(float threshold) : sentences(0), modes_evaluated(0), modes_skipped(0), sentence_bound(0.0), max_sentence_bound(0.0), total_bound(0.0) {
+  assert (threshold >= 0.0f && threshold < 1.0f);
+  log_threshold = log(threshold);
+}
+
+float ModePruning::SelectModes(const vector<float>& log_priors, vector<bool>& keep) {
+  assert (log_priors.size() > 0);
+  const unsigned best = max_element(log_priors.begin(), log_priors.end()) - log_priors.begin();
+  float skipped_prob = 0.0f;
+  keep.resize(log_priors.size());
+  for (unsigned i = 0; i < log_priors.size(); ++i) {
+    keep[i] = (i == best || log_priors[i] >= log_threshold);
+    if (keep[i]) {
+      modes_evaluated++;
+    }
+    else {
+      modes_skipped++;
+      skipped_prob += exp(log_priors[i]);
+    }
+  }
+  return skipped_prob;
+}
+
+double ModePruning::ErrorBound(double skipped_prob, double pruned_loss) {
+  if (skipped_prob <= 0.0) {
+    return 0.0;
+  }
+  // log1p(P e^L') overflows for large L', where the bound is L' anyway.
+  if (pruned_loss > 80.0) {
+    return pruned_loss;
+  }
+  return min(log1p(skipped_prob * exp(pruned_loss)), pruned_loss);
+}
+
+void ModePruning::AddToken(float skipped_prob, float pruned_loss) {
+  sentence_bound += ErrorBound(skipped_prob, pruned_loss);
+}
+
+void ModePruning::AddToken(float skipped_prob, const Expression& pruned_loss) {
+  if (skipped_prob > 0.0f) {
+    pending_tokens.push_back(make_pair(skipped_prob, pruned_loss));
+  }
+}
+
+double ModePruning::EndSentence() {
+  for (const pair<float, Expression>& token : pending_tokens) {
+    AddToken(token.first, as_scalar(token.second.value()));
+  }
+  pending_tokens.clear();
+
+  double bound = sentence_bound;
+  sentences++;
+  max_sentence_bound = max(max_sentence_bound, bound);
+  total_bound += bound;
+  sentence_bound = 0.0;
+  return bound;
+}
+
+void ModePruning::Report(ostream& out) const {
+  const unsigned long long modes = modes_evaluated + modes_skipped;
+  out << "Mode pruning: skipped " << modes_skipped << " of " << modes << " mode losses (" << 100.0 * modes_skipped / max(modes, 1ULL) << "%)" << endl;
+  out << "  error bound: at most " << max_sentence_bound << " nats per sentence, " << total_bound << " nats in total over " << sentences << " sentences" << endl;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <iostream>
+#include "dynet/dynet.h"
+#include "dynet/expr.h"
+
+using namespace std;
+using namespace dynet;
+using namespace dynet::expr;
+
+// Approximate scoring that skips the modes (characters, morphemes, words)
+// whose prior probability from the model chooser is below a threshold.
+//
+// A token's loss is L = -log \sum_m p(m) p(w | m). Dropping the modes in a
+// set K leaves L' = -log \sum_{m not in K} p(m) p(w | m) >= L, and since
+// p(w | m) <= 1,
+//   L' - L = log(1 + \sum_K p(m) p(w | m) / e^{-L'}) <= log(1 + P_K e^{L'})
+// where P_K is the prior mass that was skipped. It is also at most L',
+// since L >= 0. Both are known without evaluating the skipped modes, so
+// every pruned score comes with a guaranteed bound on its error.
+class ModePruning {
+public:
+  explicit ModePruning(float threshold);
+
+  // Decides which of a token's candidate modes to evaluate, given their
+  // log prior probabilities. The most probable one is always kept. Returns
+  // the prior probability of the skipped ones.
+  float SelectModes(const vector<float>& log_priors, vector<bool>& keep);
+
+  // Records the pruned loss of a token, once it's known.
+  void AddToken(float skipped_prob, float pruned_loss);
+  // Same, for a loss that will only be computed by the graph's forward pass.
+  void AddToken(float skipped_prob, const Expression& pruned_loss);
+  // Call after the sentence has been scored (and before its graph is
+  // destroyed). Returns the bound on the error of the sentence's score.
+  double EndSentence();
+
+  static double ErrorBound(double skipped_prob, double pruned_loss);
+
+  void Report(ostream& out) const;
+
+private:
+  float log_threshold;
+  unsigned long long sentences;
+  unsigned long long modes_evaluated;
+  unsigned long long modes_skipped;
+  double sentence_bound;
+  double max_sentence_bound;
+  double total_bound;
+  vector<pair<float, Expression>> pending_tokens;
+};
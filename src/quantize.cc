@@ -0,0 +1,138 @@
+#include "dynet/dynet.h"
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+
+#include "io.h"
+#include "memory.h"
+#include "utils.h"
+
+using namespace dynet;
+using namespace std;
+namespace po = boost::program_options;
+
+// Returns the total loss of the corpus and the time (in seconds) it took.
+pair<dynet::real, double> Evaluate(MorphLM& lm, const vector<Sentence>& corpus) {
+  auto start = chrono::steady_clock::now();
+  dynet::real total_loss = 0;
+  for (const Sentence& sentence : corpus) {
+    ComputationGraph cg;
+    Expression loss_expr = lm.BuildGraph(sentence, cg);
+    total_loss += as_scalar(loss_expr.value());
+    memory_monitor.Sample();
+  }
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return make_pair(total_loss, elapsed);
+}
+
+int main(int argc, char** argv) {
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
+
+  po::options_description desc("description");
+  desc.add_options()
+  ("model", po::value<string>()->required(), "model file, as output by train")
+  ("format", po::value<string>()->default_value("int8"), "Storage for the vocabulary-sized tables: int8 (with a scale per row), bf16 or fp16")
+  ("dev_text", po::value<string>(), "Morphologically analyzed text used to report the perplexity and speed change")
+  ("help", "Display this help message");
+
+  AddAnalysisLimitOptions(desc);
+
+  po::positional_options_description positional_options;
+  positional_options.add("model", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(positional_options).run(), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+  if (!ConfigureAnalysisLimit(vm)) {
+    return 1;
+  }
+
+  const string model_filename = vm["model"].as<string>();
+  StorageType format;
+  if (!ParseStorageType(vm["format"].as<string>(), format)) {
+    cerr << "Unknown --format " << vm["format"].as<string>() << ", expected int8, bf16 or fp16" << endl;
+    return 1;
+  }
+
+  SentenceShape shape = kDefaultShape;
+  if (vm.count("dev_text")) {
+    shape = ScanMorphText(vm["dev_text"].as<string>());
+  }
+  // The quantized copy is smaller than the original, so planning for two
+  // full models leaves enough room for both.
+  InitializeDynetForModel(dynet_args, model_filename, shape, 1, 2);
+
+  Model dynet_model;
+  Dict word_vocab, root_vocab, affix_vocab, char_vocab;
+  MorphLM lm;
+  cerr << "Loading model from " << model_filename << "...";
+  Deserialize(model_filename, word_vocab, root_vocab, affix_vocab, char_vocab, lm, dynet_model);
+  cerr << " Done!" << endl;
+
+  if (lm.config.storage != kFloat32) {
+    cerr << "Model is already quantized (" << StorageTypeName(lm.config.storage) << ")" << endl;
+    return 1;
+  }
+
+  MorphLMConfig config = lm.config;
+  config.storage = format;
+  Model quantized_model;
+  MorphLM quantized_lm(quantized_model, config);
+
+  set<unsigned> skipped_params;
+  set<unsigned> skipped_lookup_params;
+  Parameter w, b;
+  if (config.use_words) {
+    skipped_lookup_params.insert(lm.input_word_embeddings.index);
+    lm.GetSoftmaxParameters(lm.word_softmax, w, b);
+    skipped_params.insert(w.index);
+    skipped_params.insert(b.index);
+    quantized_lm.quantized_word_embeddings.Quantize(lm.input_word_embeddings.get()->values, format);
+    quantized_lm.quantized_word_softmax.Quantize(w, b, format);
+  }
+  if (config.use_morphology) {
+    skipped_lookup_params.insert(lm.input_root_embeddings.index);
+    skipped_lookup_params.insert(lm.output_root_embeddings.index);
+    lm.GetSoftmaxParameters(lm.root_softmax, w, b);
+    skipped_params.insert(w.index);
+    skipped_params.insert(b.index);
+    quantized_lm.quantized_root_embeddings.Quantize(lm.input_root_embeddings.get()->values, format);
+    quantized_lm.quantized_root_softmax.Quantize(w, b, format);
+    quantized_lm.quantized_output_root_embeddings.Quantize(lm.output_root_embeddings.get()->values, format);
+  }
+  CopyParameters(dynet_model, quantized_model, skipped_params, skipped_lookup_params);
+
+  size_t quantized_bytes = quantized_lm.quantized_word_embeddings.bytes() + quantized_lm.quantized_root_embeddings.bytes() + quantized_lm.quantized_output_root_embeddings.bytes();
+  quantized_bytes += quantized_lm.quantized_word_softmax.bytes() + quantized_lm.quantized_root_softmax.bytes();
+  size_t original_bytes = sizeof(float) * dynet_model.parameter_count();
+  size_t final_bytes = sizeof(float) * quantized_model.parameter_count() + quantized_bytes;
+  cerr << "Model size: " << original_bytes / 1048576.0 << " MB -> " << final_bytes / 1048576.0 << " MB (" << StorageTypeName(format) << ")" << endl;
+
+  if (vm.count("dev_text")) {
+    lm.SetDropout(0.0f);
+    quantized_lm.SetDropout(0.0f);
+    vector<Sentence> dev_text = ReadMorphText(vm["dev_text"].as<string>(), word_vocab, root_vocab, affix_vocab, char_vocab);
+    unsigned word_count = 0;
+    for (const Sentence& sentence : dev_text) {
+      word_count += sentence.size();
+    }
+
+    pair<dynet::real, double> before = Evaluate(lm, dev_text);
+    pair<dynet::real, double> after = Evaluate(quantized_lm, dev_text);
+    cerr << "Dev perplexity: " << exp(before.first / word_count) << " -> " << exp(after.first / word_count) << endl;
+    cerr << "Dev words/sec: " << word_count / before.second << " -> " << word_count / after.second << endl;
+  }
+
+  memory_monitor.Report(cerr);
+  analysis_limit.Report(cerr);
+  Serialize(word_vocab, root_vocab, affix_vocab, char_vocab, quantized_lm, quantized_model);
+  return 0;
+}
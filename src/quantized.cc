@@ -0,0 +1,290 @@
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include "quantized.h"
+#include "utils.h"
+#include "simd.h"
+
+bool ParseStorageType(const string& name, StorageType& type) {
+  if (name == "int8") {
+    type = kInt8;
+  }
+  else if (name == "bf16") {
+    type = kBFloat16;
+  }
+  else if (name == "fp16") {
+    type = kFloat16;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+const char* StorageTypeName(unsigned type) {
+  switch (type) {
+    case kFloat32: return "float32";
+    case kInt8: return "int8";
+    case kBFloat16: return "bf16";
+    case kFloat16: return "fp16";
+  }
+  return "unknown";
+}
+
+// Both conversions from float round to nearest, ties to even.
+uint16_t FloatToBFloat16(float x) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  if (std::isnan(x)) {
+    return (bits >> 16) | 0x40;
+  }
+  bits += 0x7fff + ((bits >> 16) & 1);
+  return bits >> 16;
+}
+
+float BFloat16ToFloat(uint16_t x) {
+  uint32_t bits = (uint32_t)x << 16;
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+uint16_t FloatToHalf(float x) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  float a = fabs(x);
+  if (std::isnan(x)) {
+    return sign | 0x7e00;
+  }
+  if (a >= 65520.0f) {
+    // Rounds past the largest half, 65504.
+    return sign | 0x7c00;
+  }
+  if (a < 6.103515625e-05f) {
+    // Subnormal: a multiple of 2^-24. (Rounding up to 1024 gives the
+    // smallest normal half, which has the same bits.)
+    return sign | (uint16_t)nearbyint(a * 16777216.0f);
+  }
+  uint32_t magnitude = bits & 0x7fffffff;
+  magnitude += 0xfff + ((magnitude >> 13) & 1);
+  return sign | (uint16_t)((magnitude >> 13) - (112 << 10));
+}
+
+float HalfToFloat(uint16_t x) {
+  uint32_t sign = (uint32_t)(x & 0x8000) << 16;
+  uint32_t exponent = (x >> 10) & 0x1f;
+  uint32_t mantissa = x & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0) {
+    float f = ldexp((float)mantissa, -24);
+    return sign ? -f : f;
+  }
+  else if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  }
+  else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+QuantizedMatrix::QuantizedMatrix() : format(kInt8), row_count(0), col_count(0) {}
+
+size_t QuantizedMatrix::bytes() const {
+  return data.size() * sizeof(int8_t) + scales.size() * sizeof(float) + halves.size() * sizeof(uint16_t);
+}
+
+void QuantizedMatrix::Resize(unsigned rows, unsigned cols, StorageType format) {
+  assert (format == kInt8 || format == kBFloat16 || format == kFloat16);
+  this->format = format;
+  row_count = rows;
+  col_count = cols;
+  data.clear();
+  scales.clear();
+  halves.clear();
+  if (format == kInt8) {
+    data.resize((size_t)row_count * col_count);
+    scales.resize(row_count);
+  }
+  else {
+    halves.resize((size_t)row_count * col_count);
+  }
+}
+
+void QuantizedMatrix::QuantizeRow(unsigned row, const float* values, unsigned stride) {
+  if (format != kInt8) {
+    uint16_t* out = &halves[(size_t)row * col_count];
+    for (unsigned c = 0; c < col_count; ++c) {
+      out[c] = (format == kBFloat16) ? FloatToBFloat16(values[c * stride]) : FloatToHalf(values[c * stride]);
+    }
+    return;
+  }
+
+  float max_abs = 0.0f;
+  for (unsigned c = 0; c < col_count; ++c) {
+    max_abs = max(max_abs, fabs(values[c * stride]));
+  }
+
+  float scale = (max_abs > 0.0f) ? max_abs / 127.0f : 1.0f;
+  int8_t* out = &data[(size_t)row * col_count];
+  for (unsigned c = 0; c < col_count; ++c) {
+    float q = round(values[c * stride] / scale);
+    out[c] = (int8_t)max(-127.0f, min(127.0f, q));
+  }
+  scales[row] = scale;
+}
+
+void QuantizedMatrix::Quantize(const Tensor& matrix, StorageType format) {
+  // DyNet matrices are column-major, so row r starts at v[r] with stride rows.
+  Resize(matrix.d.rows(), matrix.d.cols(), format);
+  for (unsigned r = 0; r < row_count; ++r) {
+    QuantizeRow(r, matrix.v + r, row_count);
+  }
+}
+
+void QuantizedMatrix::Quantize(const vector<Tensor>& table, StorageType format) {
+  assert (table.size() > 0);
+  Resize(table.size(), table[0].d.size(), format);
+  for (unsigned r = 0; r < row_count; ++r) {
+    assert (table[r].d.size() == col_count);
+    QuantizeRow(r, table[r].v, 1);
+  }
+}
+
+#ifdef HAVE_SIMD_DISPATCH
+template <typename S>
+SIMD_INLINE float SimdDot(unsigned format, const void* w, const float* x, unsigned n) {
+  typename S::V acc = S::Set(0.0f);
+  unsigned c = 0;
+  float sum = 0.0f;
+  if (format == kBFloat16) {
+    const uint16_t* h = (const uint16_t*)w;
+    for (; c + S::kWidth <= n; c += S::kWidth) {
+      acc = S::Fma(S::LoadBFloat16(h + c), S::Load(x + c), acc);
+    }
+    for (; c < n; ++c) {
+      sum += BFloat16ToFloat(h[c]) * x[c];
+    }
+  }
+  else if (format == kFloat16) {
+    const uint16_t* h = (const uint16_t*)w;
+    for (; c + S::kWidth <= n; c += S::kWidth) {
+      acc = S::Fma(S::LoadHalf(h + c), S::Load(x + c), acc);
+    }
+    for (; c < n; ++c) {
+      sum += HalfToFloat(h[c]) * x[c];
+    }
+  }
+  else {
+    const int8_t* q = (const int8_t*)w;
+    for (; c + S::kWidth <= n; c += S::kWidth) {
+      acc = S::Fma(S::LoadInt8(q + c), S::Load(x + c), acc);
+    }
+    for (; c < n; ++c) {
+      sum += (float)q[c] * x[c];
+    }
+  }
+  return S::ReduceAdd(acc) + sum;
+}
+
+AVX2_TARGET static float Avx2Dot(unsigned format, const void* w, const float* x, unsigned n) {
+  return SimdDot<Avx2>(format, w, x, n);
+}
+
+AVX512_TARGET static float Avx512Dot(unsigned format, const void* w, const float* x, unsigned n) {
+  return SimdDot<Avx512>(format, w, x, n);
+}
+#endif
+
+float QuantizedMatrix::Dot(unsigned row, const float* x) const {
+  assert (row < row_count);
+  const void* w = (format == kInt8) ? (const void*)&data[(size_t)row * col_count] : (const void*)&halves[(size_t)row * col_count];
+  const float scale = (format == kInt8) ? scales[row] : 1.0f;
+#ifdef HAVE_SIMD_DISPATCH
+  switch (simd_level()) {
+    case kAvx512Simd: return Avx512Dot(format, w, x, col_count) * scale;
+    case kAvx2Simd: return Avx2Dot(format, w, x, col_count) * scale;
+    default: break;
+  }
+#endif
+
+  float sum = 0.0f;
+  if (format == kBFloat16) {
+    const uint16_t* h = (const uint16_t*)w;
+    for (unsigned c = 0; c < col_count; ++c) {
+      sum += BFloat16ToFloat(h[c]) * x[c];
+    }
+  }
+  else if (format == kFloat16) {
+    const uint16_t* h = (const uint16_t*)w;
+    for (unsigned c = 0; c < col_count; ++c) {
+      sum += HalfToFloat(h[c]) * x[c];
+    }
+  }
+  else {
+    const int8_t* q = (const int8_t*)w;
+    for (unsigned c = 0; c < col_count; ++c) {
+      sum += (float)q[c] * x[c];
+    }
+  }
+  return sum * scale;
+}
+
+void QuantizedMatrix::MatVec(const float* x, float* y) const {
+  for (unsigned r = 0; r < row_count; ++r) {
+    y[r] = Dot(r, x);
+  }
+}
+
+vector<float> QuantizedMatrix::Row(unsigned row) const {
+  assert (row < row_count);
+  vector<float> out(col_count);
+  if (format != kInt8) {
+    const uint16_t* w = &halves[(size_t)row * col_count];
+    for (unsigned c = 0; c < col_count; ++c) {
+      out[c] = (format == kBFloat16) ? BFloat16ToFloat(w[c]) : HalfToFloat(w[c]);
+    }
+    return out;
+  }
+  const int8_t* w = &data[(size_t)row * col_count];
+  for (unsigned c = 0; c < col_count; ++c) {
+    out[c] = w[c] * scales[row];
+  }
+  return out;
+}
+
+void QuantizedSoftmax::Quantize(const Parameter& w, const Parameter& b, StorageType format) {
+  this->w.Quantize(w.get()->values, format);
+  this->b = as_vector(b.get()->values);
+  assert (this->b.size() == this->w.rows());
+}
+
+size_t QuantizedSoftmax::bytes() const {
+  return w.bytes() + b.size() * sizeof(float);
+}
+
+vector<float> QuantizedSoftmax::LogDistribution(const vector<float>& h) const {
+  assert (h.size() == w.cols());
+  vector<float> scores(w.rows());
+  w.MatVec(&h[0], &scores[0]);
+  for (unsigned i = 0; i < scores.size(); ++i) {
+    scores[i] += b[i];
+  }
+
+  log_softmax(&scores[0], scores.size(), &scores[0]);
+  return scores;
+}
+
+float QuantizedSoftmax::NegLogSoftmax(const vector<float>& h, unsigned ref) const {
+  assert (h.size() == w.cols());
+  vector<float> scores(w.rows());
+  w.MatVec(&h[0], &scores[0]);
+  for (unsigned i = 0; i < scores.size(); ++i) {
+    scores[i] += b[i];
+  }
+  return logsumexp(scores) - scores[ref];
+}
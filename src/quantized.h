@@ -0,0 +1,99 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <string>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/version.hpp>
+#include <boost/serialization/vector.hpp>
+#include "dynet/dynet.h"
+
+using namespace std;
+using namespace dynet;
+
+// How MorphLM stores its vocabulary-sized tables (the input word and root
+// embeddings, the word and root softmaxes and the output root embeddings).
+enum StorageType {
+  kFloat32 = 0,
+  kInt8 = 1,
+  // The top half of a float32: same range, 8 bits of mantissa.
+  kBFloat16 = 2,
+  // IEEE half precision: 11 bits of mantissa, but only up to 65504.
+  kFloat16 = 3,
+};
+
+// Parses "int8", "bf16" or "fp16". Returns false for anything else.
+bool ParseStorageType(const string& name, StorageType& type);
+const char* StorageTypeName(unsigned type);
+
+uint16_t FloatToBFloat16(float x);
+float BFloat16ToFloat(uint16_t x);
+uint16_t FloatToHalf(float x);
+float HalfToFloat(uint16_t x);
+
+// A matrix stored row-major in a compact format. With kInt8, each weight is
+// a signed byte and each row has a float scale, i.e.
+// W[r][c] ~= data[r][c] * scales[r]. With kBFloat16 and kFloat16, each
+// weight is 16 bits. Either way, products are accumulated in float.
+class QuantizedMatrix {
+public:
+  QuantizedMatrix();
+
+  // Quantizes a {rows, cols} parameter matrix.
+  void Quantize(const Tensor& matrix, StorageType format = kInt8);
+  // Quantizes a lookup table, one row per entry.
+  void Quantize(const vector<Tensor>& table, StorageType format = kInt8);
+
+  unsigned rows() const { return row_count; }
+  unsigned cols() const { return col_count; }
+  size_t bytes() const;
+
+  float Dot(unsigned row, const float* x) const;
+  void MatVec(const float* x, float* y) const;
+  vector<float> Row(unsigned row) const;
+
+private:
+  void Resize(unsigned rows, unsigned cols, StorageType format);
+  void QuantizeRow(unsigned row, const float* values, unsigned stride);
+
+  unsigned format;
+  unsigned row_count;
+  unsigned col_count;
+  vector<int8_t> data;
+  vector<float> scales;
+  vector<uint16_t> halves;
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive& ar, const unsigned int version) {
+    ar & row_count;
+    ar & col_count;
+    ar & data;
+    ar & scales;
+    if (version >= 1) {
+      ar & format;
+      ar & halves;
+    }
+  }
+};
+BOOST_CLASS_VERSION(QuantizedMatrix, 1)
+
+// Drop-in replacement for a StandardSoftmaxBuilder at inference time.
+class QuantizedSoftmax {
+public:
+  void Quantize(const Parameter& w, const Parameter& b, StorageType format = kInt8);
+
+  size_t bytes() const;
+  vector<float> LogDistribution(const vector<float>& h) const;
+  float NegLogSoftmax(const vector<float>& h, unsigned ref) const;
+
+private:
+  QuantizedMatrix w;
+  vector<float> b;
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive& ar, const unsigned int) {
+    ar & w;
+    ar & b;
+  }
+};
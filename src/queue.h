@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cassert>
+#include <cstddef>
+
+using namespace std;
+
+// Bounded multi-producer, multi-consumer queue without locks (Dmitry
+// Vyukov's design). Each cell carries a sequence number that tells
+// producers and consumers whose turn it is, so claiming a cell is a single
+// compare-and-swap on the head or tail position.
+//
+// Push and Pop wait (spinning briefly, then yielding, then sleeping) while
+// the queue is full or empty, which is what lets a pipeline of stages run
+// at the speed of its slowest stage. Once every producer has called Close,
+// Pop returns false as soon as the queue is drained.
+template <class T>
+class BoundedQueue {
+public:
+  // capacity is rounded up to a power of two.
+  BoundedQueue(size_t capacity, unsigned producers = 1) : cells(RoundUp(capacity)), mask(cells.size() - 1), open_producers(producers), head(0), tail(0) {
+    for (size_t i = 0; i < cells.size(); ++i) {
+      cells[i].sequence.store(i, memory_order_relaxed);
+    }
+  }
+
+  bool TryPush(T& item) {
+    size_t position = tail.load(memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells[position & mask];
+      size_t sequence = cell.sequence.load(memory_order_acquire);
+      ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)position;
+      if (difference == 0) {
+        if (tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+          cell.item = move(item);
+          cell.sequence.store(position + 1, memory_order_release);
+          return true;
+        }
+      }
+      else if (difference < 0) {
+        return false;
+      }
+      else {
+        position = tail.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  bool TryPop(T& item) {
+    size_t position = head.load(memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells[position & mask];
+      size_t sequence = cell.sequence.load(memory_order_acquire);
+      ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)(position + 1);
+      if (difference == 0) {
+        if (head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+          item = move(cell.item);
+          cell.sequence.store(position + mask + 1, memory_order_release);
+          return true;
+        }
+      }
+      else if (difference < 0) {
+        return false;
+      }
+      else {
+        position = head.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  void Push(T item) {
+    for (unsigned attempt = 0; !TryPush(item); ++attempt) {
+      Wait(attempt);
+    }
+  }
+
+  // Returns false once the queue is empty and closed.
+  bool Pop(T& item) {
+    for (unsigned attempt = 0; !TryPop(item); ++attempt) {
+      if (open_producers.load(memory_order_acquire) == 0) {
+        // Anything pushed before the last Close is visible by now.
+        return TryPop(item);
+      }
+      Wait(attempt);
+    }
+    return true;
+  }
+
+  // Called by each producer when it has pushed its last item.
+  void Close() {
+    unsigned previous = open_producers.fetch_sub(1, memory_order_acq_rel);
+    assert (previous > 0);
+  }
+
+private:
+  static size_t RoundUp(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    return size;
+  }
+
+  static void Wait(unsigned attempt) {
+    if (attempt < 64) {
+      return;
+    }
+    else if (attempt < 128) {
+      this_thread::yield();
+    }
+    else {
+      this_thread::sleep_for(chrono::microseconds(50));
+    }
+  }
+
+  struct Cell {
+    atomic<size_t> sequence;
+    T item;
+    Cell() : sequence(0) {}
+  };
+
+  vector<Cell> cells;
+  size_t mask;
+  atomic<unsigned> open_producers;
+  // Keep the positions on separate cache lines, so producers and consumers
+  // don't slow each other down.
+  alignas(64) atomic<size_t> head;
+  alignas(64) atomic<size_t> tail;
+};
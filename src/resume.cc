@@ -0,0 +1,201 @@
+#include <cstring>
+#include <sstream>
+#include <typeinfo>
+#include "dynet/globals.h"
+#include "resume.h"
+
+const string kCheckpointMagic = "MorphLM training checkpoint\n";
+
+// DyNet's trainers keep their state in protected members. A class derived
+// from a trainer may take pointers to those members, and such pointers work
+// on any instance of the trainer, so these classes are never instantiated.
+struct TrainerAccess : Trainer {
+  static bool& AuxAllocated(Trainer& t) { return t.*(&TrainerAccess::aux_allocated); }
+  static void Allocate(Trainer& t) { (t.*(&TrainerAccess::alloc_impl))(); }
+};
+
+struct MomentumAccess : MomentumSGDTrainer {
+  static vector<ShadowParameters>& VP(MomentumSGDTrainer& t) { return t.*(&MomentumAccess::vp); }
+  static vector<ShadowLookupParameters>& VLP(MomentumSGDTrainer& t) { return t.*(&MomentumAccess::vlp); }
+};
+
+struct AdagradAccess : AdagradTrainer {
+  static vector<ShadowParameters>& VP(AdagradTrainer& t) { return t.*(&AdagradAccess::vp); }
+  static vector<ShadowLookupParameters>& VLP(AdagradTrainer& t) { return t.*(&AdagradAccess::vlp); }
+};
+
+struct AdadeltaAccess : AdadeltaTrainer {
+  static vector<ShadowParameters>& HG(AdadeltaTrainer& t) { return t.*(&AdadeltaAccess::hg); }
+  static vector<ShadowLookupParameters>& HLG(AdadeltaTrainer& t) { return t.*(&AdadeltaAccess::hlg); }
+  static vector<ShadowParameters>& HD(AdadeltaTrainer& t) { return t.*(&AdadeltaAccess::hd); }
+  static vector<ShadowLookupParameters>& HLD(AdadeltaTrainer& t) { return t.*(&AdadeltaAccess::hld); }
+};
+
+struct RmsPropAccess : RmsPropTrainer {
+  static vector<real>& HG(RmsPropTrainer& t) { return t.*(&RmsPropAccess::hg); }
+  static vector<vector<real>>& HLG(RmsPropTrainer& t) { return t.*(&RmsPropAccess::hlg); }
+};
+
+struct AdamAccess : AdamTrainer {
+  static vector<ShadowParameters>& M(AdamTrainer& t) { return t.*(&AdamAccess::m); }
+  static vector<ShadowLookupParameters>& LM(AdamTrainer& t) { return t.*(&AdamAccess::lm); }
+  static vector<ShadowParameters>& V(AdamTrainer& t) { return t.*(&AdamAccess::v); }
+  static vector<ShadowLookupParameters>& LV(AdamTrainer& t) { return t.*(&AdamAccess::lv); }
+};
+
+static void TransferTensor(boost::archive::binary_oarchive& ar, Tensor& t) {
+  vector<float> values(t.v, t.v + t.d.size());
+  ar & values;
+}
+
+static void TransferTensor(boost::archive::binary_iarchive& ar, Tensor& t) {
+  vector<float> values;
+  ar & values;
+  if (values.size() != t.d.size()) {
+    cerr << "Training checkpoint does not match the model: expected a tensor of " << t.d.size() << " values but found " << values.size() << endl;
+    exit(1);
+  }
+  memcpy(t.v, values.data(), sizeof(float) * values.size());
+}
+
+// Writes a count, or checks it against the one that was written.
+template <class Archive>
+static void TransferCount(Archive& ar, size_t count, const char* what) {
+  size_t stored = count;
+  ar & stored;
+  if (stored != count) {
+    cerr << "Training checkpoint does not match the model: expected " << count << " " << what << " but found " << stored << endl;
+    exit(1);
+  }
+}
+
+template <class Archive>
+static void TransferShadows(Archive& ar, vector<ShadowParameters>& shadows) {
+  TransferCount(ar, shadows.size(), "optimizer parameters");
+  for (ShadowParameters& shadow : shadows) {
+    TransferTensor(ar, shadow.h);
+  }
+}
+
+template <class Archive>
+static void TransferShadows(Archive& ar, vector<ShadowLookupParameters>& shadows) {
+  TransferCount(ar, shadows.size(), "optimizer lookup parameters");
+  for (ShadowLookupParameters& shadow : shadows) {
+    TransferCount(ar, shadow.h.size(), "optimizer lookup rows");
+    for (Tensor& row : shadow.h) {
+      TransferTensor(ar, row);
+    }
+  }
+}
+
+static string TrainerName(const Trainer& trainer) {
+  if (dynamic_cast<const MomentumSGDTrainer*>(&trainer) != nullptr) {
+    return "momentum";
+  }
+  else if (dynamic_cast<const AdagradTrainer*>(&trainer) != nullptr) {
+    return "adagrad";
+  }
+  else if (dynamic_cast<const AdadeltaTrainer*>(&trainer) != nullptr) {
+    return "adadelta";
+  }
+  else if (dynamic_cast<const RmsPropTrainer*>(&trainer) != nullptr) {
+    return "rmsprop";
+  }
+  else if (dynamic_cast<const AdamTrainer*>(&trainer) != nullptr) {
+    return "adam";
+  }
+  else if (dynamic_cast<const SimpleSGDTrainer*>(&trainer) != nullptr) {
+    return "sgd";
+  }
+  cerr << "Unable to checkpoint a trainer of type " << typeid(trainer).name() << endl;
+  exit(1);
+}
+
+template <class Archive>
+static void TransferTrainingState(Archive& ar, Model& model, Trainer& trainer) {
+  // Parameters are transferred in place, so that the MorphLM built around
+  // the model keeps pointing at them.
+  TransferCount(ar, model.parameters_list().size(), "parameters");
+  for (ParameterStorage* p : model.parameters_list()) {
+    TransferTensor(ar, p->values);
+  }
+  TransferCount(ar, model.lookup_parameters_list().size(), "lookup parameters");
+  for (LookupParameterStorage* p : model.lookup_parameters_list()) {
+    TransferCount(ar, p->values.size(), "lookup rows");
+    for (Tensor& row : p->values) {
+      TransferTensor(ar, row);
+    }
+  }
+
+  string name = TrainerName(trainer);
+  string stored_name = name;
+  ar & stored_name;
+  if (stored_name != name) {
+    cerr << "Training checkpoint was written with --" << stored_name << ", not --" << name << endl;
+    exit(1);
+  }
+  ar & trainer.eta;
+  ar & trainer.epoch;
+  ar & trainer.clips;
+  ar & trainer.updates;
+  ar & trainer.clips_since_status;
+  ar & trainer.updates_since_status;
+
+  // Trainers allocate their state on their first update.
+  bool& aux_allocated = TrainerAccess::AuxAllocated(trainer);
+  bool allocated = aux_allocated;
+  ar & allocated;
+  if (!allocated) {
+    return;
+  }
+  if (!aux_allocated) {
+    TrainerAccess::Allocate(trainer);
+    aux_allocated = true;
+  }
+
+  if (name == "momentum") {
+    MomentumSGDTrainer& t = dynamic_cast<MomentumSGDTrainer&>(trainer);
+    TransferShadows(ar, MomentumAccess::VP(t));
+    TransferShadows(ar, MomentumAccess::VLP(t));
+  }
+  else if (name == "adagrad") {
+    AdagradTrainer& t = dynamic_cast<AdagradTrainer&>(trainer);
+    TransferShadows(ar, AdagradAccess::VP(t));
+    TransferShadows(ar, AdagradAccess::VLP(t));
+  }
+  else if (name == "adadelta") {
+    AdadeltaTrainer& t = dynamic_cast<AdadeltaTrainer&>(trainer);
+    TransferShadows(ar, AdadeltaAccess::HG(t));
+    TransferShadows(ar, AdadeltaAccess::HLG(t));
+    TransferShadows(ar, AdadeltaAccess::HD(t));
+    TransferShadows(ar, AdadeltaAccess::HLD(t));
+  }
+  else if (name == "rmsprop") {
+    RmsPropTrainer& t = dynamic_cast<RmsPropTrainer&>(trainer);
+    ar & RmsPropAccess::HG(t);
+    ar & RmsPropAccess::HLG(t);
+  }
+  else if (name == "adam") {
+    AdamTrainer& t = dynamic_cast<AdamTrainer&>(trainer);
+    TransferShadows(ar, AdamAccess::M(t));
+    TransferShadows(ar, AdamAccess::LM(t));
+    TransferShadows(ar, AdamAccess::V(t));
+    TransferShadows(ar, AdamAccess::LV(t));
+  }
+}
+
+void SaveTrainingState(boost::archive::binary_oarchive& oa, Model& model, Trainer& trainer) {
+  TransferTrainingState(oa, model, trainer);
+  ostringstream rng_state;
+  rng_state << *rndeng;
+  string rng_string = rng_state.str();
+  oa & rng_string;
+}
+
+void LoadTrainingState(boost::archive::binary_iarchive& ia, Model& model, Trainer& trainer) {
+  TransferTrainingState(ia, model, trainer);
+  string rng_string;
+  ia & rng_string;
+  istringstream rng_state(rng_string);
+  rng_state >> *rndeng;
+}
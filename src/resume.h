@@ -0,0 +1,176 @@
+#pragma once
+#include "dynet/dynet.h"
+#include "dynet/globals.h"
+#include "dynet/training.h"
+#include "dynet/mp.h"
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/string.hpp>
+
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <cassert>
+
+using namespace dynet;
+using namespace dynet::mp;
+using namespace std;
+
+// Resumable training. A training checkpoint holds everything that the
+// model file doesn't: the current (rather than the best) parameter values,
+// the trainer's state (learning rate schedule, Adam moments, ...), DyNet's
+// random number generator, and where in the data we were. Restarting from
+// one continues training exactly as if it had never stopped.
+
+extern const string kCheckpointMagic;
+
+// Transfers the parameters, the trainer's state and the RNG. Loading
+// requires a model built by the same sequence of add_parameters calls and
+// a trainer of the same type.
+void SaveTrainingState(boost::archive::binary_oarchive& oa, Model& model, Trainer& trainer);
+void LoadTrainingState(boost::archive::binary_iarchive& ia, Model& model, Trainer& trainer);
+
+// Where the training loop is.
+template <class S>
+struct TrainingCursor {
+  unsigned iteration;
+  // Index into order of the next example
+  unsigned position;
+  // This iteration's shuffled order
+  vector<unsigned> order;
+  S report_stats;
+  // Whether the dev set is due before the next example
+  bool dev_pending;
+  bool has_best_dev;
+  S best_dev_stats;
+
+  TrainingCursor() : iteration(0), position(0), dev_pending(false), has_best_dev(false) {}
+
+  template<class Archive>
+  void serialize(Archive& ar, const unsigned int) {
+    ar & iteration;
+    ar & position;
+    ar & order;
+    ar & report_stats;
+    ar & dev_pending;
+    ar & has_best_dev;
+    ar & best_dev_stats;
+  }
+};
+
+// Writes to a temporary file first, so that being killed halfway through
+// never leaves a broken checkpoint behind.
+template <class S>
+void SaveTrainingCheckpoint(const string& filename, Model& model, Trainer& trainer, const TrainingCursor<S>& cursor) {
+  const string temp_filename = filename + ".tmp";
+  {
+    ofstream f(temp_filename, ios::binary);
+    if (!f.is_open()) {
+      cerr << "Unable to write training checkpoint to " << temp_filename << endl;
+      return;
+    }
+    f << kCheckpointMagic;
+    boost::archive::binary_oarchive oa(f);
+    oa & cursor;
+    SaveTrainingState(oa, model, trainer);
+  }
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    cerr << "Unable to move training checkpoint into place at " << filename << endl;
+  }
+}
+
+// Returns false if there is no checkpoint to resume from.
+template <class S>
+bool LoadTrainingCheckpoint(const string& filename, Model& model, Trainer& trainer, TrainingCursor<S>& cursor) {
+  ifstream f(filename, ios::binary);
+  if (!f.is_open()) {
+    return false;
+  }
+  string magic(kCheckpointMagic.size(), '\0');
+  f.read(&magic[0], magic.size());
+  if (!f || magic != kCheckpointMagic) {
+    cerr << filename << " is not a training checkpoint" << endl;
+    exit(1);
+  }
+  boost::archive::binary_iarchive ia(f);
+  ia & cursor;
+  LoadTrainingState(ia, model, trainer);
+  return true;
+}
+
+// Same schedule as dynet::mp::run_single_process (shuffle every iteration,
+// run the dev set every dev_frequency examples, save the model on a new
+// best), but it starts from cursor, and writes a checkpoint every
+// checkpoint_frequency examples, after every dev run and when stopped.
+template <class D, class S>
+void RunResumable(ILearner<D, S>* learner, Trainer* trainer, Model& model, const vector<D>& train_data, const vector<D>& dev_data, unsigned num_iterations, unsigned dev_frequency, unsigned report_frequency, const string& checkpoint_filename, unsigned checkpoint_frequency, TrainingCursor<S>& cursor) {
+  assert (dev_frequency > 0 && report_frequency > 0 && checkpoint_frequency > 0);
+  auto save_checkpoint = [&]() {
+    SaveTrainingCheckpoint(checkpoint_filename, model, *trainer, cursor);
+  };
+
+  for (; cursor.iteration < num_iterations && !stop_requested; ++cursor.iteration) {
+    if (cursor.order.size() != train_data.size()) {
+      cursor.order.resize(train_data.size());
+      iota(cursor.order.begin(), cursor.order.end(), 0);
+      shuffle(cursor.order.begin(), cursor.order.end(), *rndeng);
+      cursor.position = 0;
+    }
+
+    while (true) {
+      double fractional_iter = cursor.iteration + 1.0 * cursor.position / cursor.order.size();
+      if (cursor.dev_pending) {
+        S dev_stats;
+        for (const D& dev_datum : dev_data) {
+          dev_stats += learner->LearnFromDatum(dev_datum, false);
+        }
+        if (stop_requested) {
+          save_checkpoint();
+          return;
+        }
+        bool new_best = !cursor.has_best_dev || dev_stats < cursor.best_dev_stats;
+        cerr << fractional_iter << "\t" << "dev loss = " << dev_stats << (new_best ? " (New best!)" : "") << endl;
+        if (new_best) {
+          learner->SaveModel();
+          cursor.best_dev_stats = dev_stats;
+          cursor.has_best_dev = true;
+        }
+        cursor.dev_pending = false;
+        save_checkpoint();
+      }
+      if (cursor.position == cursor.order.size()) {
+        break;
+      }
+
+      const D& datum = train_data[cursor.order[cursor.position]];
+      cursor.report_stats += learner->LearnFromDatum(datum, true);
+      trainer->update(1.0);
+      cursor.position++;
+      cursor.dev_pending = (cursor.position % dev_frequency == 0 || cursor.position == cursor.order.size());
+
+      if (cursor.position % report_frequency == 0) {
+        fractional_iter = cursor.iteration + 1.0 * cursor.position / cursor.order.size();
+        cerr << fractional_iter << "\t" << "loss = " << cursor.report_stats << endl;
+        cursor.report_stats = S();
+      }
+      if (stop_requested) {
+        save_checkpoint();
+        return;
+      }
+      if (!cursor.dev_pending && cursor.position % checkpoint_frequency == 0) {
+        save_checkpoint();
+      }
+    }
+
+    trainer->update_epoch();
+    // The next iteration reshuffles.
+    cursor.order.clear();
+    cursor.position = 0;
+  }
+  save_checkpoint();
+}
@@ -7,21 +7,26 @@
 #include <fstream>
 
 #include "io.h"
+#include "memory.h"
 #include "utils.h"
 #include "morphlm.h"
+#include "metrics.h"
 
 using namespace dynet;
 using namespace std;
 namespace po = boost::program_options;
 
 int main(int argc, char** argv) {  
-  dynet::initialize(argc, argv);
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
 
   po::options_description desc("description");
   desc.add_options()
   ("help", "Display this help message")
   ("model", po::value<string>()->required(), "model file, as output by train")
-  ("max_length", po::value<unsigned>()->default_value(100), "Maximum length of output sentences");
+  ("max_length", po::value<unsigned>()->default_value(100), "Maximum length of output sentences")
+  ("samples,n", po::value<unsigned>()->default_value(0), "Number of sentences to sample (0 for no limit)");
+
+  AddMetricsOptions(desc);
 
   po::positional_options_description positional_options;
   positional_options.add("model", 1);
@@ -35,9 +40,17 @@ int main(int argc, char** argv) {
   }
 
   po::notify(vm);
+  if (!ConfigureMetrics(vm, "sample")) {
+    return 1;
+  }
 
   string model_filename = vm["model"].as<string>();
   unsigned max_length = vm["max_length"].as<unsigned>();
+  unsigned samples = vm["samples"].as<unsigned>();
+
+  SentenceShape shape = kDefaultShape;
+  shape.words = max_length;
+  InitializeDynetForModel(dynet_args, model_filename, shape);
 
   Model dynet_model;
   MorphLM lm;
@@ -54,7 +67,8 @@ int main(int argc, char** argv) {
   lm.config.use_morphology ? &root_vocab : nullptr,
   &char_vocab);
 
-  while (true) {
+  for (unsigned n = 0; samples == 0 || n < samples; ++n) {
+    metrics.StartSentence();
     ComputationGraph cg;
     Sentence sample = lm.Sample(max_length, cg, wfo);
     vector<string> words;
@@ -72,7 +86,10 @@ int main(int argc, char** argv) {
     } 
     cout << boost::algorithm::join(words, " ") << endl;
     cout.flush();
+    metrics.EndSentence(sample);
   }
 
+  FinishMetrics(vm);
+
   return 0;
 }
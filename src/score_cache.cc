@@ -0,0 +1,347 @@
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "score_cache.h"
+
+const char kScoreCacheMagic[8] = {'M', 'L', 'M', 'S', 'C', 'O', 'R', 'E'};
+const uint32_t kScoreCacheVersion = 1;
+const uint64_t kInitialBuckets = 1 << 14;
+const uint64_t kInitialDataBytes = 1 << 22;
+// Keys made before SetModel is called are seeded with this.
+const ScoreKey kNoModelKey = {0x6d6f7270686c6dULL, 0x73636f7265ULL};
+
+struct ScoreCache::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t unused;
+  // Always a power of two, and at least twice entry_count.
+  uint64_t bucket_count;
+  uint64_t entry_count;
+  uint64_t data_capacity;
+  uint64_t data_size;
+};
+
+// An entry's rows are stored as a row count, the length of every row, and
+// then the values of all of them. bytes is zero for empty buckets, and is
+// written last, so that a run that dies mid-insert leaves no half-written
+// entry behind.
+struct ScoreCache::Bucket {
+  uint64_t hi;
+  uint64_t lo;
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+// The splitmix64 finalizer.
+static inline uint64_t Mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// Two independently seeded 64-bit lanes, so that collisions need both to
+// collide at once.
+class KeyHasher {
+public:
+  explicit KeyHasher(const ScoreKey& seed) : hi(seed.hi), lo(seed.lo) {}
+  void Add(uint64_t v) {
+    hi = Mix(hi ^ v);
+    lo = Mix(lo + v * 0x9e3779b97f4a7c15ULL);
+  }
+  void Add(const char* bytes, size_t length) {
+    Add(length);
+    for (size_t i = 0; i < length; i += 8) {
+      uint64_t v = 0;
+      memcpy(&v, bytes + i, min<size_t>(8, length - i));
+      Add(v);
+    }
+  }
+  ScoreKey key() const { return {hi, lo}; }
+
+private:
+  uint64_t hi;
+  uint64_t lo;
+};
+
+size_t ScoreCache::FileBytes(uint64_t bucket_count, uint64_t data_capacity) {
+  return sizeof(Header) + bucket_count * sizeof(Bucket) + data_capacity;
+}
+
+ScoreCache::ScoreCache() : hits(0), misses(0), fd(-1), header(nullptr), mapped_bytes(0), model_key(kNoModelKey), inserted(0) {}
+
+ScoreCache::~ScoreCache() {
+  Unmap();
+}
+
+bool ScoreCache::Open(const string& filename) {
+  Unmap();
+  this->filename = filename;
+  int new_fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (new_fd < 0) {
+    cerr << "Unable to open score cache " << filename << ": " << strerror(errno) << endl;
+    return false;
+  }
+  if (flock(new_fd, LOCK_EX | LOCK_NB) != 0) {
+    cerr << "Score cache " << filename << " is in use by another process" << endl;
+    close(new_fd);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(new_fd, &st) != 0) {
+    close(new_fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    return Map(new_fd, kInitialBuckets, kInitialDataBytes, true);
+  }
+
+  Header h;
+  if (st.st_size < (off_t)sizeof(Header) || pread(new_fd, &h, sizeof(h), 0) != sizeof(h) ||
+      memcmp(h.magic, kScoreCacheMagic, sizeof(h.magic)) != 0 || h.version != kScoreCacheVersion ||
+      (off_t)FileBytes(h.bucket_count, h.data_capacity) != st.st_size) {
+    cerr << filename << " is not a score cache, or was written by a different version" << endl;
+    close(new_fd);
+    return false;
+  }
+  return Map(new_fd, h.bucket_count, h.data_capacity, false);
+}
+
+bool ScoreCache::Map(int new_fd, uint64_t bucket_count, uint64_t data_capacity, bool create) {
+  size_t bytes = FileBytes(bucket_count, data_capacity);
+  if (create && ftruncate(new_fd, bytes) != 0) {
+    cerr << "Unable to resize score cache " << filename << ": " << strerror(errno) << endl;
+    close(new_fd);
+    return false;
+  }
+  void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, new_fd, 0);
+  if (p == MAP_FAILED) {
+    cerr << "Unable to map score cache " << filename << ": " << strerror(errno) << endl;
+    close(new_fd);
+    return false;
+  }
+
+  fd = new_fd;
+  header = (Header*)p;
+  mapped_bytes = bytes;
+  if (create) {
+    // ftruncate zero-filled everything else, which is an empty table.
+    memcpy(header->magic, kScoreCacheMagic, sizeof(header->magic));
+    header->version = kScoreCacheVersion;
+    header->bucket_count = bucket_count;
+    header->data_capacity = data_capacity;
+  }
+  return true;
+}
+
+void ScoreCache::Unmap() {
+  if (header != nullptr) {
+    munmap(header, mapped_bytes);
+    header = nullptr;
+    mapped_bytes = 0;
+  }
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+bool ScoreCache::Grow(uint64_t entries, uint64_t data_bytes) {
+  uint64_t bucket_count = header->bucket_count;
+  while (bucket_count < 2 * entries) {
+    bucket_count *= 2;
+  }
+  uint64_t data_capacity = header->data_capacity;
+  while (data_capacity < data_bytes) {
+    data_capacity *= 2;
+  }
+
+  // Build the bigger table next to the old one and swap it in, so that the
+  // file is complete at every point.
+  const string temp_filename = filename + ".tmp";
+  int new_fd = open(temp_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (new_fd < 0) {
+    cerr << "Unable to create " << temp_filename << ": " << strerror(errno) << endl;
+    return false;
+  }
+  ScoreCache grown;
+  grown.filename = temp_filename;
+  if (!grown.Map(new_fd, bucket_count, data_capacity, true)) {
+    unlink(temp_filename.c_str());
+    return false;
+  }
+
+  // Entries keep their offsets, so the rows are copied in one go.
+  memcpy(grown.data(), data(), header->data_size);
+  grown.header->data_size = header->data_size;
+  for (uint64_t i = 0; i < header->bucket_count; ++i) {
+    const Bucket& bucket = buckets()[i];
+    if (bucket.bytes != 0) {
+      *grown.Probe({bucket.hi, bucket.lo}) = bucket;
+    }
+  }
+  grown.header->entry_count = header->entry_count;
+
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0 || flock(grown.fd, LOCK_EX | LOCK_NB) != 0) {
+    cerr << "Unable to replace score cache " << filename << ": " << strerror(errno) << endl;
+    unlink(temp_filename.c_str());
+    return false;
+  }
+  Unmap();
+  fd = grown.fd;
+  header = grown.header;
+  mapped_bytes = grown.mapped_bytes;
+  grown.fd = -1;
+  grown.header = nullptr;
+  return true;
+}
+
+ScoreCache::Bucket* ScoreCache::buckets() const {
+  return (Bucket*)(header + 1);
+}
+
+char* ScoreCache::data() const {
+  return (char*)(buckets() + header->bucket_count);
+}
+
+ScoreCache::Bucket* ScoreCache::Probe(const ScoreKey& key) const {
+  const uint64_t mask = header->bucket_count - 1;
+  for (uint64_t i = key.lo & mask;; i = (i + 1) & mask) {
+    Bucket* bucket = buckets() + i;
+    if (bucket->bytes == 0 || (bucket->hi == key.hi && bucket->lo == key.lo)) {
+      return bucket;
+    }
+  }
+}
+
+bool ScoreCache::SetModel(const string& model_filename, const string& settings) {
+  ifstream f(model_filename, ios::binary);
+  if (!f.is_open()) {
+    cerr << "Unable to read " << model_filename << " to fingerprint it" << endl;
+    return false;
+  }
+  KeyHasher hasher(kNoModelKey);
+  vector<char> buffer(1 << 20);
+  while (f) {
+    f.read(buffer.data(), buffer.size());
+    hasher.Add(buffer.data(), f.gcount());
+  }
+  hasher.Add(settings.data(), settings.size());
+  model_key = hasher.key();
+  return true;
+}
+
+ScoreKey ScoreCache::Key(const Sentence& sentence) const {
+  KeyHasher hasher(model_key);
+  hasher.Add(sentence.size());
+  for (unsigned i = 0; i < sentence.size(); ++i) {
+    hasher.Add(sentence.words[i]);
+    hasher.Add(sentence.chars[i].size());
+    for (WordId c : sentence.chars[i]) {
+      hasher.Add(c);
+    }
+    hasher.Add(sentence.analyses[i].size());
+    for (unsigned j = 0; j < sentence.analyses[i].size(); ++j) {
+      const Analysis& analysis = sentence.analyses[i][j];
+      uint32_t prob_bits;
+      memcpy(&prob_bits, &sentence.analysis_probs[i][j], sizeof(prob_bits));
+      hasher.Add(prob_bits);
+      hasher.Add(analysis.root);
+      hasher.Add(analysis.affixes.size());
+      for (WordId affix : analysis.affixes) {
+        hasher.Add(affix);
+      }
+    }
+  }
+  return hasher.key();
+}
+
+bool ScoreCache::Find(const ScoreKey& key, vector<vector<float>>& rows) {
+  if (!is_open()) {
+    return false;
+  }
+  const Bucket* bucket = Probe(key);
+  if (bucket->bytes == 0 || bucket->offset + bucket->bytes > header->data_size) {
+    misses++;
+    return false;
+  }
+
+  const char* in = data() + bucket->offset;
+  uint32_t row_count;
+  memcpy(&row_count, in, sizeof(row_count));
+  vector<uint32_t> lengths(row_count);
+  memcpy(lengths.data(), in + sizeof(uint32_t), row_count * sizeof(uint32_t));
+  in += (row_count + 1) * sizeof(uint32_t);
+  rows.resize(row_count);
+  for (uint32_t i = 0; i < row_count; ++i) {
+    rows[i].resize(lengths[i]);
+    memcpy(rows[i].data(), in, lengths[i] * sizeof(float));
+    in += lengths[i] * sizeof(float);
+  }
+  hits++;
+  return true;
+}
+
+bool ScoreCache::Insert(const ScoreKey& key, const vector<vector<float>>& rows) {
+  if (!is_open()) {
+    return false;
+  }
+  uint64_t bytes = (rows.size() + 1) * sizeof(uint32_t);
+  for (const vector<float>& row : rows) {
+    bytes += row.size() * sizeof(float);
+  }
+  if (Probe(key)->bytes != 0) {
+    return true;
+  }
+  if (2 * (header->entry_count + 1) > header->bucket_count || header->data_size + bytes > header->data_capacity) {
+    if (!Grow(header->entry_count + 1, header->data_size + bytes)) {
+      return false;
+    }
+  }
+
+  char* out = data() + header->data_size;
+  uint32_t row_count = rows.size();
+  memcpy(out, &row_count, sizeof(row_count));
+  out += sizeof(uint32_t);
+  for (const vector<float>& row : rows) {
+    uint32_t length = row.size();
+    memcpy(out, &length, sizeof(length));
+    out += sizeof(uint32_t);
+  }
+  for (const vector<float>& row : rows) {
+    memcpy(out, row.data(), row.size() * sizeof(float));
+    out += row.size() * sizeof(float);
+  }
+
+  Bucket* bucket = Probe(key);
+  bucket->hi = key.hi;
+  bucket->lo = key.lo;
+  bucket->offset = header->data_size;
+  header->data_size += bytes;
+  header->entry_count++;
+  bucket->bytes = bytes;
+  inserted++;
+  return true;
+}
+
+size_t ScoreCache::size() const {
+  return is_open() ? header->entry_count : 0;
+}
+
+void ScoreCache::Report(ostream& out) const {
+  unsigned long long lookups = hits + misses;
+  out << "Score cache: " << hits << " hits, " << misses << " misses";
+  if (lookups > 0) {
+    out << " (" << 100.0 * hits / lookups << "% hit rate)";
+  }
+  out << ", " << inserted << " new entries, " << size() << " in " << filename << endl;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdint>
+#include "utils.h"
+
+using namespace std;
+
+// Scores of sentences we've already scored, so that repeated input
+// (boilerplate, headlines, repeated queries) skips the model entirely, both
+// within a run and across runs. Entries are keyed by a 128-bit hash of
+// everything the model sees of a sentence (its word, root, affix and
+// character ids and its analysis probabilities) together with a fingerprint
+// of the model file and of the settings that change the scores. A value is
+// a list of rows of floats, e.g. one row per token.
+//
+// The cache lives in a file that is mapped into memory: a header, an open
+// addressing hash table, then the rows of every entry, appended in the
+// order they were inserted. When either part fills up, the file is
+// rewritten at twice the size. Only one process may use a file at a time.
+
+struct ScoreKey {
+  uint64_t hi;
+  uint64_t lo;
+};
+
+class ScoreCache {
+public:
+  ScoreCache();
+  ~ScoreCache();
+
+  // Opens the cache file, creating it if it doesn't exist.
+  bool Open(const string& filename);
+  bool is_open() const { return header != nullptr; }
+
+  // Every key made after this includes a hash of the model file's contents
+  // and of settings, which should name the tool and any option that changes
+  // its output (e.g. "loss prune_modes=0.001").
+  bool SetModel(const string& model_filename, const string& settings);
+
+  ScoreKey Key(const Sentence& sentence) const;
+  // Returns false, and leaves rows alone, if the key isn't in the cache.
+  bool Find(const ScoreKey& key, vector<vector<float>>& rows);
+  bool Insert(const ScoreKey& key, const vector<vector<float>>& rows);
+
+  size_t size() const;
+  void Report(ostream& out) const;
+
+  unsigned long long hits;
+  unsigned long long misses;
+
+private:
+  struct Header;
+  struct Bucket;
+
+  ScoreCache(const ScoreCache&) = delete;
+  ScoreCache& operator=(const ScoreCache&) = delete;
+
+  static size_t FileBytes(uint64_t bucket_count, uint64_t data_capacity);
+  // Maps the file open as new_fd, laid out for the given sizes. With create,
+  // the file is first sized and given an empty table.
+  bool Map(int new_fd, uint64_t bucket_count, uint64_t data_capacity, bool create);
+  void Unmap();
+  // Rewrites the file with room for at least the given number of entries
+  // and bytes of rows.
+  bool Grow(uint64_t entries, uint64_t data_bytes);
+  Bucket* buckets() const;
+  char* data() const;
+  Bucket* Probe(const ScoreKey& key) const;
+
+  string filename;
+  int fd;
+  Header* header;
+  size_t mapped_bytes;
+  ScoreKey model_key;
+  unsigned long long inserted;
+};
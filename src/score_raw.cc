@@ -0,0 +1,263 @@
+#include "dynet/dynet.h"
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <map>
+#include <cmath>
+#include <thread>
+#include <chrono>
+
+#include "io.h"
+#include "memory.h"
+#include "engine.h"
+#include "analyzer.h"
+#include "queue.h"
+#include "utils.h"
+
+using namespace dynet;
+using namespace std;
+namespace po = boost::program_options;
+typedef chrono::steady_clock Clock;
+
+// Scores raw tokenized text in one pass, as a pipeline of concurrent
+// stages connected by bounded queues:
+//
+//   read -> analyze -> build sentences -> score (N threads) -> write
+//
+// Reading splits stdin into sentences, analysis runs them through a pool of
+// analyzer coprocesses (and the analysis cache), building looks the
+// analyses up in the model's vocabularies, scoring runs the graph-free
+// inference engine, and writing puts the scores back into input order.
+// Each stage only waits when its input queue is empty or its output queue
+// is full, so the pipeline runs as fast as its slowest stage.
+
+struct RawItem {
+  unsigned long index;
+  vector<string> words;
+};
+
+struct AnalyzedItem {
+  unsigned long index;
+  vector<string> words;
+  vector<WordAnalysis> analyses;
+};
+
+struct SentenceItem {
+  unsigned long index;
+  Sentence sentence;
+};
+
+struct ScoredItem {
+  unsigned long index;
+  float loss;
+  unsigned words;
+};
+
+// Time a stage spent working, as opposed to waiting on its queues.
+struct StageTimer {
+  StageTimer() : seconds(0.0) {}
+  void Start() { start = Clock::now(); }
+  void Stop() { seconds += chrono::duration<double>(Clock::now() - start).count(); }
+
+  Clock::time_point start;
+  double seconds;
+};
+
+int main(int argc, char** argv) {
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
+
+  po::options_description desc("description");
+  desc.add_options()
+  ("model", po::value<string>()->required(), "model files, as output by train")
+  ("analyzer", po::value<string>()->required(), "Analyzer command, e.g. a wrapper around omorfi-analyse-tokenised.sh (see scripts/stub-analyzer.py)")
+  ("analyzer_processes", po::value<unsigned>()->default_value(1), "Number of analyzer processes to run")
+  ("analyzer_batch_size", po::value<unsigned>()->default_value(64), "Number of words to write to an analyzer at once")
+  ("sentences_per_batch", po::value<unsigned>()->default_value(64), "Largest number of queued sentences to analyze together")
+  ("cache", po::value<string>(), "Word analysis cache. Read at startup if it exists, and written at the end")
+  ("threads,t", po::value<unsigned>()->default_value(1), "Number of scoring threads")
+  ("queue_size", po::value<unsigned>()->default_value(1024), "Capacity of the queues between stages, in sentences")
+  ("perp,p", "Show model perplexity instead of negative log loss")
+  ("help", "Display this help message");
+
+  AddAnalysisLimitOptions(desc);
+
+  po::positional_options_description positional_options;
+  positional_options.add("model", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(positional_options).run(), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+  if (!ConfigureAnalysisLimit(vm)) {
+    return 1;
+  }
+
+  const string model_filename = vm["model"].as<string>();
+  const bool show_perp = vm.count("perp") > 0;
+  const unsigned num_threads = max(vm["threads"].as<unsigned>(), 1u);
+  const unsigned queue_size = vm["queue_size"].as<unsigned>();
+  const unsigned sentences_per_batch = max(vm["sentences_per_batch"].as<unsigned>(), 1u);
+
+  InitializeDynetForModel(dynet_args, model_filename);
+
+  Model dynet_model;
+  Dict word_vocab, root_vocab, affix_vocab, char_vocab;
+  MorphLM lm;
+  cerr << "Loading model from " << model_filename << "...";
+  Deserialize(model_filename, word_vocab, root_vocab, affix_vocab, char_vocab, lm, dynet_model);
+  cerr << " Done!" << endl;
+  InferenceEngine engine(lm);
+
+  AnalysisCache cache;
+  if (vm.count("cache") && cache.Load(vm["cache"].as<string>())) {
+    cerr << "Loaded " << cache.size() << " word analyses from " << vm["cache"].as<string>() << endl;
+  }
+  AnalyzerPool analyzer(vm["analyzer"].as<string>(), vm["analyzer_processes"].as<unsigned>(), vm["analyzer_batch_size"].as<unsigned>(), &cache);
+
+  BoundedQueue<RawItem> raw_queue(queue_size);
+  BoundedQueue<AnalyzedItem> analyzed_queue(queue_size);
+  BoundedQueue<SentenceItem> sentence_queue(queue_size);
+  BoundedQueue<ScoredItem> scored_queue(queue_size, num_threads);
+  StageTimer read_timer, analyze_timer, build_timer, write_timer;
+  vector<StageTimer> score_timers(num_threads);
+
+  thread reader([&]() {
+    unsigned long index = 0;
+    while (true) {
+      read_timer.Start();
+      vector<vector<string>> sentences = ReadTokenizedSentences(cin, 1);
+      read_timer.Stop();
+      if (sentences.empty()) {
+        break;
+      }
+      raw_queue.Push(RawItem {index++, sentences[0]});
+    }
+    raw_queue.Close();
+  });
+
+  // Analyzes whatever has piled up (up to sentences_per_batch sentences) at
+  // once, so the analyzers get bigger batches when they're the bottleneck.
+  thread analysis([&]() {
+    vector<RawItem> batch;
+    RawItem item;
+    while (raw_queue.Pop(item)) {
+      batch.clear();
+      batch.push_back(move(item));
+      while (batch.size() < sentences_per_batch && raw_queue.TryPop(item)) {
+        batch.push_back(move(item));
+      }
+
+      analyze_timer.Start();
+      vector<string> words;
+      for (const RawItem& raw : batch) {
+        words.insert(words.end(), raw.words.begin(), raw.words.end());
+      }
+      vector<WordAnalysis> analyses = analyzer.Analyze(words);
+      analyze_timer.Stop();
+
+      auto next = analyses.begin();
+      for (RawItem& raw : batch) {
+        AnalyzedItem analyzed;
+        analyzed.index = raw.index;
+        analyzed.analyses.assign(next, next + raw.words.size());
+        next += raw.words.size();
+        analyzed.words = move(raw.words);
+        analyzed_queue.Push(move(analyzed));
+      }
+    }
+    analyzed_queue.Close();
+  });
+
+  // The vocabularies are only read (they are frozen), but Dict isn't
+  // thread safe, so one thread does all of the lookups.
+  thread builder([&]() {
+    AnalyzedItem item;
+    while (analyzed_queue.Pop(item)) {
+      build_timer.Start();
+      SentenceItem built;
+      built.index = item.index;
+      for (unsigned i = 0; i < item.words.size(); ++i) {
+        HandleMorphLine(FormatMorphLine(item.words[i], item.analyses[i]), word_vocab, root_vocab, affix_vocab, char_vocab, built.sentence);
+      }
+      EndMorphSentence(word_vocab, root_vocab, char_vocab, built.sentence);
+      build_timer.Stop();
+      sentence_queue.Push(move(built));
+    }
+    sentence_queue.Close();
+  });
+
+  vector<thread> scorers;
+  for (unsigned t = 0; t < num_threads; ++t) {
+    scorers.push_back(thread([&, t]() {
+      // Each thread has its own scratch space.
+      InferenceEngine thread_engine(engine);
+      SentenceItem item;
+      while (sentence_queue.Pop(item)) {
+        score_timers[t].Start();
+        float loss = thread_engine.ScoreSentence(item.sentence);
+        score_timers[t].Stop();
+        scored_queue.Push(ScoredItem {item.index, loss, item.sentence.size()});
+      }
+      scored_queue.Close();
+    }));
+  }
+
+  // Scores arrive out of order when there are several scoring threads.
+  map<unsigned long, ScoredItem> waiting;
+  unsigned long next_index = 0;
+  double total_loss = 0.0;
+  unsigned long total_words = 0;
+  ScoredItem scored;
+  while (scored_queue.Pop(scored)) {
+    write_timer.Start();
+    waiting[scored.index] = scored;
+    while (!waiting.empty() && waiting.begin()->first == next_index) {
+      const ScoredItem& s = waiting.begin()->second;
+      if (show_perp) {
+        cout << exp(s.loss / s.words) << "\n";
+      }
+      else {
+        cout << s.loss << "\n";
+      }
+      total_loss += s.loss;
+      total_words += s.words;
+      waiting.erase(waiting.begin());
+      next_index++;
+    }
+    cout.flush();
+    write_timer.Stop();
+  }
+  assert (waiting.empty());
+
+  reader.join();
+  analysis.join();
+  builder.join();
+  for (thread& scorer : scorers) {
+    scorer.join();
+  }
+
+  if (show_perp) {
+    cout << "Total: " << exp(total_loss / total_words) << endl;
+  }
+  else {
+    cout << "Total: " << total_loss << endl;
+  }
+
+  double score_seconds = 0.0;
+  for (const StageTimer& timer : score_timers) {
+    score_seconds += timer.seconds;
+  }
+  cerr << "Scored " << next_index << " sentences. Busy time per stage: read " << read_timer.seconds << "s, analyze " << analyze_timer.seconds << "s, build " << build_timer.seconds << "s, score " << score_seconds / num_threads << "s per thread, write " << write_timer.seconds << "s" << endl;
+  cerr << "Analysis cache: " << cache.hits << " tokens from the cache, " << cache.misses << " word types from the analyzer" << endl;
+  if (vm.count("cache")) {
+    cache.Save(vm["cache"].as<string>());
+  }
+
+  analysis_limit.Report(cerr);
+  return 0;
+}
@@ -0,0 +1,259 @@
+#include "dynet/dynet.h"
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "io.h"
+#include "memory.h"
+#include "engine.h"
+#include "utils.h"
+#include "framing.h"
+
+using namespace dynet;
+using namespace std;
+namespace po = boost::program_options;
+typedef chrono::steady_clock Clock;
+
+struct ScoreRequest {
+  Sentence sentence;
+  vector<float> token_losses;
+  Clock::time_point arrival;
+  bool done;
+};
+
+// Requests from all connections end up here. A single scoring thread owns the
+// model (DyNet only allows one live ComputationGraph), so it drains the queue
+// in batches: a batch is closed either when it is full or when its oldest
+// request has waited max_delay.
+class BatchQueue {
+public:
+  BatchQueue(unsigned max_batch_size, Clock::duration max_delay) : max_batch_size(max_batch_size), max_delay(max_delay) {}
+
+  void Submit(ScoreRequest* request) {
+    unique_lock<mutex> lock(m);
+    request->arrival = Clock::now();
+    request->done = false;
+    pending.push_back(request);
+    ready.notify_one();
+    finished.wait(lock, [request]{ return request->done; });
+  }
+
+  vector<ScoreRequest*> NextBatch() {
+    unique_lock<mutex> lock(m);
+    ready.wait(lock, [this]{ return !pending.empty(); });
+    Clock::time_point deadline = pending.front()->arrival + max_delay;
+    while (pending.size() < max_batch_size) {
+      if (ready.wait_until(lock, deadline) == cv_status::timeout) {
+        break;
+      }
+    }
+
+    unsigned batch_size = min((unsigned)pending.size(), max_batch_size);
+    vector<ScoreRequest*> batch(pending.begin(), pending.begin() + batch_size);
+    pending.erase(pending.begin(), pending.begin() + batch_size);
+    return batch;
+  }
+
+  void Finish(const vector<ScoreRequest*>& batch) {
+    lock_guard<mutex> lock(m);
+    for (ScoreRequest* request : batch) {
+      request->done = true;
+    }
+    finished.notify_all();
+  }
+
+private:
+  const unsigned max_batch_size;
+  const Clock::duration max_delay;
+  mutex m;
+  condition_variable ready;
+  condition_variable finished;
+  deque<ScoreRequest*> pending;
+};
+
+// HandleMorphLine asserts on malformed input, which is fine for our own
+// corpora but not for a long-running server, so requests are checked first.
+bool ValidateRequest(const string& payload, string& error) {
+  istringstream ss(payload);
+  unsigned line_number = 0;
+  for (string line; getline(ss, line);) {
+    line_number++;
+    unsigned offset;
+    if (!ValidUTF8(line, offset)) {
+      error = "line " + to_string(line_number) + " is not valid UTF-8 at byte " + to_string(offset + 1);
+      return false;
+    }
+    line = strip(line);
+    if (line.length() == 0) {
+      error = "blank line " + to_string(line_number) + " inside sentence";
+      return false;
+    }
+    vector<string> pieces = tokenize(line, "\t");
+    if (pieces.size() % 2 != 1 || pieces.size() < 3) {
+      error = "line " + to_string(line_number) + " has " + to_string(pieces.size()) + " fields";
+      return false;
+    }
+  }
+  if (line_number == 0) {
+    error = "empty sentence";
+    return false;
+  }
+  return true;
+}
+
+void ScoreBatches(MorphLM& lm, InferenceEngine& engine, BatchQueue& queue, bool engine_only) {
+  unsigned batch_count = 0;
+  unsigned request_count = 0;
+  while (true) {
+    vector<ScoreRequest*> batch = queue.NextBatch();
+
+    // Whatever doesn't fit in DyNet's memory pools along with the rest of
+    // the batch is scored by the inference engine instead.
+    vector<ScoreRequest*> graph_batch;
+    size_t graph_bytes = 0;
+    for (ScoreRequest* request : batch) {
+      size_t bytes = EstimateGraphBytes(lm.config, ShapeOf(request->sentence));
+      if (!engine_only && memory_monitor.Fits(graph_bytes + bytes)) {
+        graph_batch.push_back(request);
+        graph_bytes += bytes;
+      }
+      else {
+        engine.ScoreSentence(request->sentence, &request->token_losses);
+      }
+    }
+
+    if (graph_batch.size() > 0) {
+      ComputationGraph cg;
+      lm.NewGraph(cg);
+      vector<vector<Expression>> token_losses(graph_batch.size());
+      vector<Expression> sentence_losses(graph_batch.size());
+      for (unsigned i = 0; i < graph_batch.size(); ++i) {
+        token_losses[i] = lm.ComputeTokenLosses(graph_batch[i]->sentence, cg);
+        sentence_losses[i] = sum(token_losses[i]);
+      }
+      cg.forward(sum(sentence_losses));
+      memory_monitor.Sample();
+
+      for (unsigned i = 0; i < graph_batch.size(); ++i) {
+        graph_batch[i]->token_losses.resize(token_losses[i].size());
+        for (unsigned j = 0; j < token_losses[i].size(); ++j) {
+          graph_batch[i]->token_losses[j] = as_scalar(token_losses[i][j].value());
+        }
+      }
+    }
+    queue.Finish(batch);
+
+    batch_count++;
+    request_count += batch.size();
+    if (batch_count % 1000 == 0) {
+      cerr << "Scored " << request_count << " sentences in " << batch_count << " batches (" << (float)request_count / batch_count << " per batch)" << endl;
+      memory_monitor.Report(cerr);
+  analysis_limit.Report(cerr);
+    }
+  }
+}
+
+void ServeConnection(int fd, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, BatchQueue& queue) {
+  string payload;
+  while (ReadFrame(fd, payload)) {
+    string error;
+    string response;
+    if (ValidateRequest(payload, error)) {
+      ScoreRequest request;
+      istringstream ss(payload);
+      ReadMorphSentence(ss, word_vocab, root_vocab, affix_vocab, char_vocab, request.sentence);
+      queue.Submit(&request);
+      response = FormatScores(request.token_losses);
+    }
+    else {
+      response = "ERROR " + error;
+    }
+
+    if (!WriteFrame(fd, response)) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+int main(int argc, char** argv) {
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
+
+  po::options_description desc("description");
+  desc.add_options()
+  ("model", po::value<string>()->required(), "model file, as output by train")
+  ("socket,s", po::value<string>()->default_value("morphlm.sock"), "Path of the Unix domain socket to listen on")
+  ("max_batch_size,b", po::value<unsigned>()->default_value(32), "Maximum number of sentences scored in one computation graph")
+  ("max_delay,t", po::value<unsigned>()->default_value(5), "Maximum time (in milliseconds) a request waits for its batch to fill up")
+  ("engine_threads", po::value<unsigned>()->default_value(1), "If more than 1, score every request with the inference engine, splitting each sentence across this many threads for lower latency")
+  ("help", "Display this help message");
+
+  AddAnalysisLimitOptions(desc);
+
+  po::positional_options_description positional_options;
+  positional_options.add("model", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(positional_options).run(), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+  if (!ConfigureAnalysisLimit(vm)) {
+    return 1;
+  }
+
+  const string model_filename = vm["model"].as<string>();
+  const string socket_path = vm["socket"].as<string>();
+  const unsigned max_batch_size = vm["max_batch_size"].as<unsigned>();
+  const unsigned max_delay = vm["max_delay"].as<unsigned>();
+  const unsigned engine_threads = vm["engine_threads"].as<unsigned>();
+  assert (max_batch_size > 0);
+
+  InitializeDynetForModel(dynet_args, model_filename, kDefaultShape, max_batch_size);
+
+  Model dynet_model;
+  Dict word_vocab, root_vocab, affix_vocab, char_vocab;
+  MorphLM lm;
+  cerr << "Loading model from " << model_filename << "...";
+  Deserialize(model_filename, word_vocab, root_vocab, affix_vocab, char_vocab, lm, dynet_model);
+  cerr << " Done!" << endl;
+  lm.SetDropout(0.0f);
+  InferenceEngine engine(lm);
+  engine.SetThreads(engine_threads);
+
+  int listen_fd = ListenUnixSocket(socket_path);
+  if (listen_fd < 0) {
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  cerr << "Listening on " << socket_path << endl;
+
+  BatchQueue queue(max_batch_size, chrono::milliseconds(max_delay));
+  thread scorer(ScoreBatches, ref(lm), ref(engine), ref(queue), engine_threads > 1);
+  scorer.detach();
+
+  while (true) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    thread connection(ServeConnection, fd, ref(word_vocab), ref(root_vocab), ref(affix_vocab), ref(char_vocab), ref(queue));
+    connection.detach();
+  }
+
+  return 0;
+}
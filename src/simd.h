@@ -0,0 +1,149 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+
+// Vector operations for the numeric kernels in utils.cc, kernels.cc and
+// quantized.cc, which pick an instruction set at run time instead of relying
+// on the flags the program is compiled with. Each instruction set is a
+// struct of operations compiled for it with a target attribute. A kernel is
+// written once, as an always_inline template over those structs, and
+// instantiated in a function with the same target attribute, so everything
+// inlines into code for that instruction set. simd_level() says which
+// instantiation to call.
+
+enum SimdLevel {
+  kScalarSimd = 0,
+  kAvx2Simd,
+  kAvx512Simd,
+};
+
+// The level the numeric kernels use (see numeric_kernels() in utils.h).
+SimdLevel simd_level();
+
+#define SIMD_INLINE inline __attribute__((always_inline))
+
+// One float at a time, in plain C++: the fallback, and the tails of the
+// vector loops.
+struct Scalar {
+  typedef float V;
+  static const unsigned kWidth = 1;
+  static inline V Load(const float* p) { return *p; }
+  static inline void Store(float* p, V x) { *p = x; }
+  static inline V Set(float x) { return x; }
+  static inline V Add(V a, V b) { return a + b; }
+  static inline V Sub(V a, V b) { return a - b; }
+  static inline V Mul(V a, V b) { return a * b; }
+  static inline V Div(V a, V b) { return a / b; }
+  static inline V Fma(V a, V b, V c) { return a * b + c; }
+  static inline V Max(V a, V b) { return std::max(a, b); }
+  static inline V Min(V a, V b) { return std::min(a, b); }
+  static inline float ReduceMax(V x) { return x; }
+  static inline float ReduceAdd(V x) { return x; }
+};
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cstdint>
+#include <immintrin.h>
+#define HAVE_SIMD_DISPATCH
+#define AVX2_TARGET __attribute__((target("avx2,fma,f16c")))
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+struct Avx2 {
+  typedef __m256 V;
+  static const unsigned kWidth = 8;
+  AVX2_TARGET static inline V Load(const float* p) { return _mm256_loadu_ps(p); }
+  AVX2_TARGET static inline void Store(float* p, V x) { _mm256_storeu_ps(p, x); }
+  AVX2_TARGET static inline V Set(float x) { return _mm256_set1_ps(x); }
+  AVX2_TARGET static inline V Add(V a, V b) { return _mm256_add_ps(a, b); }
+  AVX2_TARGET static inline V Sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  AVX2_TARGET static inline V Mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  AVX2_TARGET static inline V Div(V a, V b) { return _mm256_div_ps(a, b); }
+  // a * b + c
+  AVX2_TARGET static inline V Fma(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+  AVX2_TARGET static inline V Max(V a, V b) { return _mm256_max_ps(a, b); }
+  AVX2_TARGET static inline V Min(V a, V b) { return _mm256_min_ps(a, b); }
+  AVX2_TARGET static inline V Floor(V x) { return _mm256_floor_ps(x); }
+  // 2^n for integral n
+  AVX2_TARGET static inline V Pow2(V n) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(n), _mm256_set1_epi32(127)), 23));
+  }
+  // Zeroes the lanes of x where a < b.
+  AVX2_TARGET static inline V ZeroBelow(V x, V a, V b) { return _mm256_and_ps(x, _mm256_cmp_ps(a, b, _CMP_GE_OQ)); }
+  AVX2_TARGET static inline float ReduceMax(V x) {
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+  }
+  AVX2_TARGET static inline float ReduceAdd(V x) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+  }
+  // Widen kWidth stored values to floats.
+  AVX2_TARGET static inline V LoadInt8(const int8_t* p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+  }
+  AVX2_TARGET static inline V LoadHalf(const uint16_t* p) { return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p)); }
+  AVX2_TARGET static inline V LoadBFloat16(const uint16_t* p) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p)), 16));
+  }
+};
+
+struct Avx512 {
+  typedef __m512 V;
+  static const unsigned kWidth = 16;
+  AVX512_TARGET static inline V Load(const float* p) { return _mm512_loadu_ps(p); }
+  AVX512_TARGET static inline void Store(float* p, V x) { _mm512_storeu_ps(p, x); }
+  AVX512_TARGET static inline V Set(float x) { return _mm512_set1_ps(x); }
+  AVX512_TARGET static inline V Add(V a, V b) { return _mm512_add_ps(a, b); }
+  AVX512_TARGET static inline V Sub(V a, V b) { return _mm512_sub_ps(a, b); }
+  AVX512_TARGET static inline V Mul(V a, V b) { return _mm512_mul_ps(a, b); }
+  AVX512_TARGET static inline V Div(V a, V b) { return _mm512_div_ps(a, b); }
+  AVX512_TARGET static inline V Fma(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+  AVX512_TARGET static inline V Max(V a, V b) { return _mm512_max_ps(a, b); }
+  AVX512_TARGET static inline V Min(V a, V b) { return _mm512_min_ps(a, b); }
+  AVX512_TARGET static inline V Floor(V x) { return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+  AVX512_TARGET static inline V Pow2(V n) {
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(n), _mm512_set1_epi32(127)), 23));
+  }
+  AVX512_TARGET static inline V ZeroBelow(V x, V a, V b) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, b, _CMP_GE_OQ), x); }
+  AVX512_TARGET static inline float ReduceMax(V x) { return _mm512_reduce_max_ps(x); }
+  AVX512_TARGET static inline float ReduceAdd(V x) { return _mm512_reduce_add_ps(x); }
+  AVX512_TARGET static inline V LoadInt8(const int8_t* p) { return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)p))); }
+  AVX512_TARGET static inline V LoadHalf(const uint16_t* p) { return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)p)); }
+  AVX512_TARGET static inline V LoadBFloat16(const uint16_t* p) {
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)p)), 16));
+  }
+};
+#endif
+
+// Cephes-style expf: range reduction by ln(2), then a degree 5 polynomial.
+// Relative error is around 1e-7. Results below exp(-87.3) are flushed to
+// zero, so exp(-inf) is 0, and inputs are clamped to 88.3, so nothing
+// overflows. Scalar code uses the standard library's exp, likewise clamped.
+template <typename S>
+SIMD_INLINE typename S::V SimdExp(typename S::V x) {
+  typedef typename S::V V;
+  const V lowest = S::Set(-87.3f);
+  const V unclamped = x;
+  x = S::Min(S::Max(x, lowest), S::Set(88.3f));
+  V n = S::Floor(S::Fma(x, S::Set(1.44269504088896341f), S::Set(0.5f)));
+  x = S::Sub(x, S::Mul(n, S::Set(0.693359375f)));
+  x = S::Sub(x, S::Mul(n, S::Set(-2.12194440e-4f)));
+
+  V y = S::Set(1.9875691500e-4f);
+  y = S::Fma(y, x, S::Set(1.3981999507e-3f));
+  y = S::Fma(y, x, S::Set(8.3334519073e-3f));
+  y = S::Fma(y, x, S::Set(4.1665795894e-2f));
+  y = S::Fma(y, x, S::Set(1.6666665459e-1f));
+  y = S::Fma(y, x, S::Set(5.0000001201e-1f));
+  y = S::Fma(y, S::Mul(x, x), S::Add(x, S::Set(1.0f)));
+  return S::ZeroBelow(S::Mul(y, S::Pow2(n)), unclamped, lowest);
+}
+
+template <>
+SIMD_INLINE float SimdExp<Scalar>(float x) {
+  return (x >= -87.3f) ? std::exp(std::min(x, 88.3f)) : 0.0f;
+}
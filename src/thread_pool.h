@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+// Fork-join pool for splitting one piece of work across cores. ParallelFor
+// hands out the indices of a loop one at a time to the calling thread and
+// the pool's threads, and returns once every index has been run. Each call
+// is told which worker (0 is the calling thread) runs it, so that workers
+// can keep their own scratch space.
+class ThreadPool {
+public:
+  // Starts threads - 1 background threads.
+  explicit ThreadPool(unsigned threads) : task(nullptr), task_count(0), next(0), busy(0), generation(0), stopping(false) {
+    for (unsigned worker = 1; worker < threads; ++worker) {
+      workers.push_back(thread(&ThreadPool::Work, this, worker));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      lock_guard<mutex> lock(m);
+      stopping = true;
+    }
+    start.notify_all();
+    for (thread& worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  unsigned size() const { return workers.size() + 1; }
+
+  // Runs f(i, worker) for each i in [0, count). Not reentrant.
+  void ParallelFor(unsigned count, const function<void(unsigned, unsigned)>& f) {
+    if (workers.size() == 0 || count <= 1) {
+      for (unsigned i = 0; i < count; ++i) {
+        f(i, 0);
+      }
+      return;
+    }
+
+    {
+      lock_guard<mutex> lock(m);
+      task = &f;
+      task_count = count;
+      next.store(0);
+      busy = workers.size();
+      generation++;
+    }
+    start.notify_all();
+    RunTasks(0);
+
+    unique_lock<mutex> lock(m);
+    done.wait(lock, [this]() { return busy == 0; });
+    task = nullptr;
+  }
+
+private:
+  void RunTasks(unsigned worker) {
+    for (unsigned i = next++; i < task_count; i = next++) {
+      (*task)(i, worker);
+    }
+  }
+
+  void Work(unsigned worker) {
+    unsigned long seen = 0;
+    while (true) {
+      {
+        unique_lock<mutex> lock(m);
+        start.wait(lock, [&]() { return stopping || generation != seen; });
+        if (stopping) {
+          return;
+        }
+        seen = generation;
+      }
+      RunTasks(worker);
+      lock_guard<mutex> lock(m);
+      if (--busy == 0) {
+        done.notify_one();
+      }
+    }
+  }
+
+  vector<thread> workers;
+  mutex m;
+  condition_variable start;
+  condition_variable done;
+  const function<void(unsigned, unsigned)>* task;
+  unsigned task_count;
+  atomic<unsigned> next;
+  unsigned busy;
+  unsigned long generation;
+  bool stopping;
+};
@@ -9,24 +9,94 @@ namespace po = boost::program_options;
 class Learner : public ILearner<Sentence, SufficientStats> {
 public:
   Learner(Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, MorphLM& lm, Model& dynet_model) :
-    word_vocab(word_vocab), root_vocab(root_vocab), affix_vocab(affix_vocab), char_vocab(char_vocab), lm(lm), dynet_model(dynet_model) {}
+    profiler(nullptr), checkpointed_loss(nullptr), recompute_chunk(0), word_vocab(word_vocab), root_vocab(root_vocab), affix_vocab(affix_vocab), char_vocab(char_vocab), lm(lm), dynet_model(dynet_model), main_pid(getpid()), profiled_sentences(0), engine_scored(0), recomputed(0), skipped(0) {}
   ~Learner() {}
   SufficientStats LearnFromDatum(const Sentence& datum, bool learn) {
-    ComputationGraph cg;
+    if (!memory_monitor.Fits(EstimateGraphBytes(lm.config, ShapeOf(datum), 1, recompute_chunk))) {
+      return LearnFromLongDatum(datum, learn);
+    }
     if (learn) {
       lm.SetDropout(dropout_rate);
     }
     else {
       lm.SetDropout(0.0f);
     }
+    if (checkpointed_loss != nullptr) {
+      dynet::real loss = checkpointed_loss->Compute(datum, learn);
+      return SufficientStats(loss, datum.size(), 1);
+    }
+    ComputationGraph cg;
+    if (profiler != nullptr) {
+      profiler->StartGraph(cg);
+    }
     Expression loss_expr = lm.BuildGraph(datum, cg);
-    dynet::real loss = as_scalar(cg.forward(loss_expr));
+    dynet::real loss = as_scalar((profiler != nullptr) ? profiler->Forward(cg, loss_expr) : cg.forward(loss_expr));
     if (learn) {
-      cg.backward(loss_expr);
+      if (profiler != nullptr) {
+        profiler->Backward(cg, loss_expr);
+      }
+      else {
+        cg.backward(loss_expr);
+      }
+    }
+    memory_monitor.Sample();
+    if (profiler != nullptr) {
+      profiler->EndSentence(datum.size(), learn);
+      if (learn && ++profiled_sentences % report_frequency == 0) {
+        WriteProfile();
+      }
     }
     return SufficientStats(loss, datum.size(), 1);
   }
 
+  // For sentences whose graph doesn't fit in DyNet's memory pools. Dev
+  // sentences are scored by the inference engine instead, which gives the
+  // same loss, so the dev score still covers the whole dev set. Training
+  // sentences are recomputed one position at a time (see CheckpointedLoss),
+  // and only skipped if even that doesn't fit, or dropout rules it out.
+  SufficientStats LearnFromLongDatum(const Sentence& datum, bool learn) {
+    if (!learn) {
+      // Built for each sentence, since it copies the current weights.
+      InferenceEngine engine(lm);
+      engine_scored++;
+      return SufficientStats(engine.ScoreSentence(datum), datum.size(), 1);
+    }
+    if (dropout_rate == 0.0f && memory_monitor.Fits(EstimateGraphBytes(lm.config, ShapeOf(datum), 1, 1))) {
+      if (!fallback_loss) {
+        fallback_loss.reset(new CheckpointedLoss(lm, 1));
+      }
+      lm.SetDropout(0.0f);
+      recomputed++;
+      return SufficientStats(fallback_loss->Compute(datum, true), datum.size(), 1);
+    }
+    cerr << "Skipping a training sentence of " << datum.size() << " words that does not fit in DyNet's memory pools" << endl;
+    skipped++;
+    return SufficientStats();
+  }
+
+  // Counts from this process only: with --cores, each worker process prints
+  // the sentences it skips as it goes.
+  void ReportLongSentences(ostream& out) const {
+    if (engine_scored > 0) {
+      out << engine_scored << " dev sentences did not fit in DyNet's memory pools and were scored by the inference engine" << endl;
+    }
+    if (recomputed > 0) {
+      out << recomputed << " training sentences did not fit in DyNet's memory pools and were trained with --recompute_chunk 1" << endl;
+    }
+    if (skipped > 0) {
+      out << "Skipped " << skipped << " training sentences that did not fit in DyNet's memory pools" << endl;
+    }
+  }
+
+  void WriteProfile() {
+    profiler->Report(cerr);
+    if (!profile_output.empty()) {
+      // Hogwild and multi-process workers each write their own file.
+      pid_t pid = getpid();
+      profiler->WriteFile((pid == main_pid) ? profile_output : profile_output + "." + to_string(pid));
+    }
+  }
+
   void SaveModel() {
     if (!quiet) {
       Serialize(word_vocab, root_vocab, affix_vocab, char_vocab, lm, dynet_model);
@@ -35,6 +105,12 @@ public:
 
   bool quiet;
   float dropout_rate;
+  Profiler* profiler;
+  string profile_output;
+  unsigned report_frequency;
+  // Set (along with recompute_chunk) to trade compute for memory on long sentences
+  CheckpointedLoss* checkpointed_loss;
+  unsigned recompute_chunk;
 private:
   Dict& word_vocab;
   Dict& root_vocab;
@@ -42,6 +118,12 @@ private:
   Dict& char_vocab;
   MorphLM& lm;
   Model& dynet_model;
+  pid_t main_pid;
+  unsigned profiled_sentences;
+  unique_ptr<CheckpointedLoss> fallback_loss;
+  unsigned engine_scored;
+  unsigned recomputed;
+  unsigned skipped;
 };
 
 // This function lets us elegantly handle the user pressing ctrl-c.
@@ -69,7 +151,7 @@ int main(int argc, char** argv) {
   }
   cerr << "\n";
 
-  dynet::initialize(argc, argv, true);
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
 
   po::options_description desc("description");
   desc.add_options()
@@ -79,19 +161,33 @@ int main(int argc, char** argv) {
   ("word_vocab", po::value<string>()->required(), "Surface form vocab list of words. Anything outside this list must be generated via morphology or characters")
   ("root_vocab", po::value<string>()->required(), "Vocabulary of word stems. Anything outside this list must be generated as a character stream (or maybe as whole words, but probably not)")
   ("char_vocab", po::value<string>()->required(), "Vocabulary of characters. Anything outside this list is replaced with an UNK character")
+  ("affix_vocab", po::value<string>(), "Vocabulary of affixes (see build_vocab). Anything outside this list is replaced with an UNK affix. Without it, every affix in the training text is kept")
   ("bidir", "Use bidirectional model (e.g. for morphological disambiguation). This is no longer a real language model.")
   ("num_iterations,i", po::value<unsigned>()->default_value(UINT_MAX), "Number of epochs to train for")
   ("cores,j", po::value<unsigned>()->default_value(1), "Number of CPU cores to use for training")
+  ("hogwild", "With --cores > 1, train with lock-free Hogwild workers instead of DyNet's multi-process trainer")
+  ("nodes", po::value<string>(), "Train one model across several processes or machines: a comma separated list of host:port (or Unix socket) addresses, one per node. Start train on every node with the same data and vocabularies, changing only --node")
+  ("node", po::value<unsigned>()->default_value(0), "With --nodes, this process's position in the list. Node 0 runs the dev set and writes the model")
+  ("sync_every", po::value<unsigned>()->default_value(1), "With --nodes, sum the gradients of all nodes after every this many sentences on each node")
+  ("async_dev", "Score the dev set on a snapshot of the model while training continues (implies --hogwild)")
   ("dropout_rate", po::value<float>()->default_value(0.0), "Dropout rate (should be >= 0.0 and < 1)")
   ("report_frequency,r", po::value<unsigned>()->default_value(100), "Show the training loss of every r examples")
   ("dev_frequency,d", po::value<unsigned>()->default_value(10000), "Run the dev set every d examples. Save the model if the score is a new best")
   ("quiet,q", "Do not output model")
   ("no_words,W", "Do not use word-level information")
   ("no_morphology,M", "Do not use morpheme-level information")
-  ("model", po::value<string>(), "Reload this model and continue learning");
+  ("model", po::value<string>(), "Reload this model and continue learning")
+  ("freeze", po::value<string>(), "Comma separated parts of the model to hold fixed, e.g. to adapt a --model to a new domain quickly: input_word_embeddings, input_morpheme_embeddings, input_char_embeddings, input_affix_lstm, input_char_lstm, main_lstm, model_chooser, output_embeddings, output_affix_lstm, output_char_lstm, or the groups input_encoders and embeddings")
+  ("profile", "Report time and graph nodes per model component every report_frequency examples")
+  ("profile_output", po::value<string>(), "With --profile, also write the profile to this file (JSON if it ends in .json, otherwise CSV)")
+  ("checkpoint", po::value<string>(), "Keep the full training state (parameters, optimizer, RNG and position in the data) in this file, and resume from it if it exists. The best model keeps going to stdout, so redirect it with 1<> rather than > when resuming")
+  ("checkpoint_frequency", po::value<unsigned>(), "With --checkpoint, also write it every this many examples between dev runs (default: only after dev runs)")
+  ("recompute_chunk", po::value<unsigned>()->default_value(0), "Build the per-position decoders this many positions at a time and recompute the main LSTM for the backward pass, so memory no longer grows with sentence length times decoder size. Smaller is leaner but slower. 0 disables");
 
   AddTrainerOptions(desc);
 
+  AddAnalysisLimitOptions(desc);
+
   po::positional_options_description positional_options;
   positional_options.add("train_text", 1);
   positional_options.add("dev_text", 1);
@@ -105,6 +201,14 @@ int main(int argc, char** argv) {
   }
 
   po::notify(vm);
+  if (!ConfigureAnalysisLimit(vm)) {
+    return 1;
+  }
+
+  unsigned frozen_components = 0;
+  if (vm.count("freeze") && !ParseFreezableComponents(vm["freeze"].as<string>(), frozen_components)) {
+    return 1;
+  }
 
   const unsigned num_cores = vm["cores"].as<unsigned>();
   const unsigned num_iterations = vm["num_iterations"].as<unsigned>();
@@ -113,16 +217,60 @@ int main(int argc, char** argv) {
   const string word_vocab_filename = vm["word_vocab"].as<string>();
   const string root_vocab_filename = vm["root_vocab"].as<string>();
   const string char_vocab_filename = vm["char_vocab"].as<string>();
+  const unsigned recompute_chunk = vm["recompute_chunk"].as<unsigned>();
+  if (recompute_chunk > 0 && vm["dropout_rate"].as<float>() > 0.0f) {
+    cerr << "--recompute_chunk can't be combined with dropout, since the recomputed graph would drop different units" << endl;
+    return 1;
+  }
+  if (vm.count("checkpoint") && (num_cores > 1 || vm.count("async_dev"))) {
+    cerr << "--checkpoint only supports single-process training" << endl;
+    return 1;
+  }
+  if (vm.count("nodes") && (num_cores > 1 || vm.count("async_dev") || vm.count("checkpoint"))) {
+    cerr << "--nodes can't be combined with --cores, --async_dev or --checkpoint" << endl;
+    return 1;
+  }
+  if (vm["sync_every"].as<unsigned>() == 0) {
+    cerr << "--sync_every must be at least 1" << endl;
+    return 1;
+  }
+  unique_ptr<RingAllreduce> ring;
+  if (vm.count("nodes")) {
+    vector<string> addresses = strip(tokenize(vm["nodes"].as<string>(), ','), true);
+    const unsigned node = vm["node"].as<unsigned>();
+    if (node >= addresses.size()) {
+      cerr << "--node " << node << " is not in --nodes, which lists " << addresses.size() << " nodes" << endl;
+      return 1;
+    }
+    ring.reset(new RingAllreduce(node, addresses));
+  }
+  if (recompute_chunk > 0 && vm.count("profile")) {
+    cerr << "--recompute_chunk can't be combined with --profile" << endl;
+    return 1;
+  }
 
   Dict word_vocab, root_vocab, affix_vocab, char_vocab;
   Model dynet_model;
   MorphLM* lm = nullptr;
   Trainer* trainer = nullptr;
 
+  // DyNet's memory pools can't grow, so size them for the longest sentences
+  // we are going to see before initializing it.
+  SentenceShape shape = ScanMorphText(train_text_filename);
+  shape.Update(ScanMorphText(dev_text_filename));
+  const unsigned parameter_copies = ParameterCopies(vm);
+
   if (vm.count("model")) {
     lm = new MorphLM();
     string model_filename = vm["model"].as<string>();
+    MorphLMConfig config;
+    bool has_config = PeekModelConfig(model_filename, config);
+    InitializeDynet(dynet_args, has_config ? &config : nullptr, shape, 1, true, parameter_copies, true, recompute_chunk);
     Deserialize(model_filename, word_vocab, root_vocab, affix_vocab, char_vocab, *lm, dynet_model);
+    if (lm->config.storage != kFloat32) {
+      cerr << "Quantized models can only be used for inference" << endl;
+      return 1;
+    }
     assert (word_vocab.is_frozen());
     assert (root_vocab.is_frozen());
     assert (affix_vocab.is_frozen());
@@ -152,6 +300,11 @@ int main(int argc, char** argv) {
   root_vocab.set_unk("UNK");
   char_vocab.freeze();
   char_vocab.set_unk("UNK");
+  if (vm.count("affix_vocab") && !vm.count("model")) {
+    ReadVocab(vm["affix_vocab"].as<string>(), affix_vocab);
+    affix_vocab.freeze();
+    affix_vocab.set_unk("UNK");
+  }
 
   vector<Sentence> train_text = ReadMorphText(train_text_filename, word_vocab, root_vocab, affix_vocab, char_vocab); 
 
@@ -175,10 +328,13 @@ int main(int argc, char** argv) {
     config.affix_lstm_dim = 128; // 1 16 128
     config.char_lstm_dim = 64; // 1 16 64
     // Maybe only need 1 layer on input LSTMs
+    InitializeDynet(dynet_args, &config, shape, 1, true, parameter_copies, true, recompute_chunk);
     lm = new MorphLM(dynet_model, config);
 
-    affix_vocab.freeze();
-    affix_vocab.set_unk("UNK");
+    if (!affix_vocab.is_frozen()) {
+      affix_vocab.freeze();
+      affix_vocab.set_unk("UNK");
+    }
     cerr << "Dicts frozen" << endl;
   }
 
@@ -186,19 +342,68 @@ int main(int argc, char** argv) {
 
   cerr << "Vocabulary sizes: " << word_vocab.size() << " words, " << root_vocab.size() << " roots, " << affix_vocab.size() << " affixes, " << char_vocab.size() << " chars" << endl;
   cerr << "Total parameters: " << dynet_model.parameter_count() << endl;
+  if (frozen_components != 0) {
+    cerr << "Frozen parameters: " << lm->Freeze(dynet_model, frozen_components) << endl;
+  }
 
   trainer = CreateTrainer(dynet_model, vm);
   Learner learner(word_vocab, root_vocab, affix_vocab, char_vocab, *lm, dynet_model);
-  learner.quiet = vm.count("quiet") > 0;
+  learner.quiet = vm.count("quiet") > 0 || (ring && ring->rank() != 0);
   learner.dropout_rate = vm["dropout_rate"].as<float>();
+  unique_ptr<CheckpointedLoss> checkpointed_loss;
+  if (recompute_chunk > 0) {
+    checkpointed_loss.reset(new CheckpointedLoss(*lm, recompute_chunk));
+    learner.checkpointed_loss = checkpointed_loss.get();
+    learner.recompute_chunk = recompute_chunk;
+  }
   unsigned dev_frequency = vm["dev_frequency"].as<unsigned>();
   unsigned report_frequency = vm["report_frequency"].as<unsigned>();
-  if (num_cores > 1) {
+  Profiler profiler;
+  if (vm.count("profile")) {
+    lm->profiler = &profiler;
+    learner.profiler = &profiler;
+    learner.report_frequency = report_frequency;
+    if (vm.count("profile_output")) {
+      learner.profile_output = vm["profile_output"].as<string>();
+    }
+  }
+  if (vm.count("checkpoint")) {
+    const string checkpoint_filename = vm["checkpoint"].as<string>();
+    const unsigned checkpoint_frequency = vm.count("checkpoint_frequency") ? vm["checkpoint_frequency"].as<unsigned>() : UINT_MAX;
+    TrainingCursor<SufficientStats> cursor;
+    if (LoadTrainingCheckpoint(checkpoint_filename, dynet_model, *trainer, cursor)) {
+      cerr << "Resuming from " << checkpoint_filename << " at iteration " << cursor.iteration << ", example " << cursor.position << endl;
+      struct stat model_stat;
+      if (cursor.has_best_dev && fstat(fileno(stdout), &model_stat) == 0 && S_ISREG(model_stat.st_mode) && model_stat.st_size == 0) {
+        cerr << "Warning: stdout is empty, so the best model so far is lost until the dev loss beats " << cursor.best_dev_stats << endl;
+      }
+    }
+    RunResumable<Sentence>(&learner, trainer, dynet_model, train_text, dev_text, num_iterations, dev_frequency, report_frequency, checkpoint_filename, checkpoint_frequency, cursor);
+  }
+  else if (ring) {
+    if (!ring->Connect() || !BroadcastParameters(*ring, dynet_model)) {
+      return 1;
+    }
+    RunDistributed<Sentence>(*ring, &learner, trainer, dynet_model, train_text, dev_text, num_iterations, dev_frequency, report_frequency, vm["sync_every"].as<unsigned>());
+  }
+  else if (vm.count("async_dev")) {
+    RunHogwild<Sentence>(num_cores, &learner, trainer, train_text, dev_text, num_iterations, dev_frequency, report_frequency, &dynet_model);
+  }
+  else if (num_cores > 1 && vm.count("hogwild")) {
+    RunHogwild<Sentence>(num_cores, &learner, trainer, train_text, dev_text, num_iterations, dev_frequency, report_frequency);
+  }
+  else if (num_cores > 1) {
     run_multi_process<Sentence>(num_cores, &learner, trainer, train_text, dev_text, num_iterations, dev_frequency, report_frequency);
   }
   else {
     run_single_process<Sentence>(&learner, trainer, train_text, dev_text, num_iterations, dev_frequency, report_frequency, 1);
   }
+  memory_monitor.Report(cerr);
+  learner.ReportLongSentences(cerr);
+  analysis_limit.Report(cerr);
+  if (vm.count("profile")) {
+    learner.WriteProfile();
+  }
 
   return 0;
 }
@@ -4,9 +4,17 @@
 #include <boost/program_options.hpp>
 
 #include <iostream>
+#include <memory>
 #include <csignal>
+#include <sys/stat.h>
 #include "morphlm.h"
+#include "checkpoint.h"
+#include "engine.h"
 #include "io.h"
+#include "memory.h"
+#include "hogwild.h"
+#include "distributed.h"
+#include "resume.h"
 #include "utils.h"
 
 using namespace dynet;
@@ -41,6 +49,13 @@ public:
     return loss < rhs.loss;
   }
 
+  template<class Archive>
+  void serialize(Archive& ar, const unsigned int) {
+    ar & loss;
+    ar & word_count;
+    ar & sentence_count;
+  }
+
   friend std::ostream& operator<< (std::ostream& stream, const SufficientStats& stats) {
     return stream << exp(stats.loss / stats.word_count) << " (" << stats.loss << " over " << stats.word_count << " words)";
   }
@@ -64,6 +79,18 @@ void AddTrainerOptions(po::options_description& desc) {
   ("no_clipping", "Disable clipping of gradients");
 }
 
+// How many copies of the parameters (including their values and gradients)
+// exist once the chosen trainer has allocated its own state.
+unsigned ParameterCopies(const po::variables_map& vm) {
+  if (vm.count("adam") || vm.count("adadelta")) {
+    return 4;
+  }
+  else if (vm.count("momentum") || vm.count("adagrad") || vm.count("rmsprop")) {
+    return 3;
+  }
+  return 2;
+}
+
 Trainer* CreateTrainer(Model& dynet_model, const po::variables_map& vm) {
   double eta_decay = vm["eta_decay"].as<double>();
   bool clipping_enabled = (vm.count("no_clipping") == 0);
@@ -0,0 +1,207 @@
+#include "dynet/dynet.h"
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+
+#include "io.h"
+#include "memory.h"
+#include "utils.h"
+
+using namespace dynet;
+using namespace std;
+namespace po = boost::program_options;
+
+// UNK, <s> and </s> are the first three words and roots, and are always kept.
+const unsigned kReservedIds = 3;
+
+// Returns the total loss of the corpus and the time (in seconds) it took.
+pair<dynet::real, double> Evaluate(MorphLM& lm, const vector<Sentence>& corpus) {
+  auto start = chrono::steady_clock::now();
+  dynet::real total_loss = 0;
+  for (const Sentence& sentence : corpus) {
+    ComputationGraph cg;
+    Expression loss_expr = lm.BuildGraph(sentence, cg);
+    total_loss += as_scalar(loss_expr.value());
+    memory_monitor.Sample();
+  }
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return make_pair(total_loss, elapsed);
+}
+
+// Picks the ids to keep, most frequent first. Without counts, the vocabulary's
+// own order (that of the vocab file it was trained with) is used instead.
+vector<WordId> ChooseKept(const vector<unsigned>& counts, unsigned vocab_size, unsigned max_size, unsigned min_count) {
+  vector<WordId> candidates;
+  for (unsigned id = kReservedIds; id < vocab_size; ++id) {
+    if (counts.size() == 0 || counts[id] >= min_count) {
+      candidates.push_back(id);
+    }
+  }
+  if (counts.size() > 0) {
+    stable_sort(candidates.begin(), candidates.end(), [&](WordId a, WordId b) { return counts[a] > counts[b]; });
+  }
+
+  vector<WordId> kept;
+  for (unsigned id = 0; id < kReservedIds; ++id) {
+    kept.push_back(id);
+  }
+  for (WordId id : candidates) {
+    if (kept.size() >= max_size) {
+      break;
+    }
+    kept.push_back(id);
+  }
+  // Keeping the original order makes the trimmed vocabulary a subsequence of
+  // the old one.
+  sort(kept.begin(), kept.end());
+  return kept;
+}
+
+Dict TrimVocab(const Dict& vocab, const vector<WordId>& kept) {
+  Dict trimmed;
+  for (WordId id : kept) {
+    trimmed.convert(vocab.convert(id));
+  }
+  trimmed.freeze();
+  trimmed.set_unk("UNK");
+  return trimmed;
+}
+
+int main(int argc, char** argv) {
+  vector<string> dynet_args = ExtractDynetArgs(argc, argv);
+
+  po::options_description desc("description");
+  desc.add_options()
+  ("model", po::value<string>()->required(), "model file, as output by train")
+  ("word_vocab_size", po::value<unsigned>(), "Number of words to keep, including UNK, <s> and </s>")
+  ("root_vocab_size", po::value<unsigned>(), "Number of roots to keep, including UNK, <s> and </s>")
+  ("counts_text", po::value<string>(), "Morphologically analyzed text to count words and roots in. Without it, the first entries of each vocabulary are kept")
+  ("min_count", po::value<unsigned>()->default_value(1), "With --counts_text, drop words and roots seen fewer times than this")
+  ("dev_text", po::value<string>(), "Morphologically analyzed text used to report the perplexity and speed change")
+  ("help", "Display this help message");
+
+  AddAnalysisLimitOptions(desc);
+
+  po::positional_options_description positional_options;
+  positional_options.add("model", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(positional_options).run(), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+  if (!ConfigureAnalysisLimit(vm)) {
+    return 1;
+  }
+
+  if (!vm.count("word_vocab_size") && !vm.count("root_vocab_size") && !vm.count("counts_text")) {
+    cerr << "Nothing to trim: give --word_vocab_size, --root_vocab_size or --counts_text" << endl;
+    return 1;
+  }
+
+  const string model_filename = vm["model"].as<string>();
+  SentenceShape shape = kDefaultShape;
+  if (vm.count("dev_text")) {
+    shape = ScanMorphText(vm["dev_text"].as<string>());
+  }
+  // The trimmed copy is smaller than the original, so planning for two
+  // full models leaves enough room for both.
+  InitializeDynetForModel(dynet_args, model_filename, shape, 1, 2);
+
+  Model dynet_model;
+  Dict word_vocab, root_vocab, affix_vocab, char_vocab;
+  MorphLM lm;
+  cerr << "Loading model from " << model_filename << "...";
+  Deserialize(model_filename, word_vocab, root_vocab, affix_vocab, char_vocab, lm, dynet_model);
+  cerr << " Done!" << endl;
+
+  if (lm.config.storage != kFloat32) {
+    cerr << "Quantized models can't be trimmed. Trim the original model, then quantize it" << endl;
+    return 1;
+  }
+
+  vector<unsigned> word_counts, root_counts;
+  const unsigned min_count = vm["min_count"].as<unsigned>();
+  if (vm.count("counts_text")) {
+    word_counts.resize(word_vocab.size());
+    root_counts.resize(root_vocab.size());
+    vector<Sentence> counts_text = ReadMorphText(vm["counts_text"].as<string>(), word_vocab, root_vocab, affix_vocab, char_vocab);
+    for (const Sentence& sentence : counts_text) {
+      for (unsigned i = 0; i < sentence.size(); ++i) {
+        word_counts[sentence.words[i]]++;
+        for (const Analysis& analysis : sentence.analyses[i]) {
+          root_counts[analysis.root]++;
+        }
+      }
+    }
+  }
+
+  const unsigned word_vocab_size = vm.count("word_vocab_size") ? vm["word_vocab_size"].as<unsigned>() : word_vocab.size();
+  const unsigned root_vocab_size = vm.count("root_vocab_size") ? vm["root_vocab_size"].as<unsigned>() : root_vocab.size();
+  vector<WordId> kept_words = ChooseKept(word_counts, word_vocab.size(), word_vocab_size, min_count);
+  vector<WordId> kept_roots = ChooseKept(root_counts, root_vocab.size(), root_vocab_size, min_count);
+  cerr << "Keeping " << kept_words.size() << " of " << word_vocab.size() << " words and " << kept_roots.size() << " of " << root_vocab.size() << " roots" << endl;
+
+  MorphLMConfig config = lm.config;
+  config.word_vocab_size = kept_words.size();
+  config.root_vocab_size = kept_roots.size();
+  Model trimmed_model;
+  MorphLM trimmed_lm(trimmed_model, config);
+
+  // Both models are built by the same constructor, so their parameters have
+  // the same indices.
+  map<unsigned, vector<WordId>> kept_rows;
+  map<unsigned, vector<WordId>> kept_lookup_rows;
+  Parameter w, b;
+  if (config.use_words) {
+    kept_lookup_rows[lm.input_word_embeddings.index] = kept_words;
+    lm.GetSoftmaxParameters(lm.word_softmax, w, b);
+    kept_rows[w.index] = kept_words;
+    kept_rows[b.index] = kept_words;
+  }
+  if (config.use_morphology) {
+    kept_lookup_rows[lm.input_root_embeddings.index] = kept_roots;
+    kept_lookup_rows[lm.output_root_embeddings.index] = kept_roots;
+    lm.GetSoftmaxParameters(lm.root_softmax, w, b);
+    kept_rows[w.index] = kept_roots;
+    kept_rows[b.index] = kept_roots;
+  }
+  CopyParameters(dynet_model, trimmed_model, kept_rows, kept_lookup_rows);
+
+  Dict trimmed_word_vocab = TrimVocab(word_vocab, kept_words);
+  Dict trimmed_root_vocab = TrimVocab(root_vocab, kept_roots);
+
+  size_t original_bytes = sizeof(float) * dynet_model.parameter_count();
+  size_t final_bytes = sizeof(float) * trimmed_model.parameter_count();
+  cerr << "Model size: " << original_bytes / 1048576.0 << " MB -> " << final_bytes / 1048576.0 << " MB" << endl;
+
+  if (vm.count("dev_text")) {
+    lm.SetDropout(0.0f);
+    trimmed_lm.SetDropout(0.0f);
+    // Word and root ids differ between the two models, so the text is read
+    // once with each set of vocabularies.
+    vector<Sentence> dev_text = ReadMorphText(vm["dev_text"].as<string>(), word_vocab, root_vocab, affix_vocab, char_vocab);
+    vector<Sentence> trimmed_dev_text = ReadMorphText(vm["dev_text"].as<string>(), trimmed_word_vocab, trimmed_root_vocab, affix_vocab, char_vocab);
+    unsigned word_count = 0;
+    for (const Sentence& sentence : dev_text) {
+      word_count += sentence.size();
+    }
+
+    pair<dynet::real, double> before = Evaluate(lm, dev_text);
+    pair<dynet::real, double> after = Evaluate(trimmed_lm, trimmed_dev_text);
+    cerr << "Dev perplexity: " << exp(before.first / word_count) << " -> " << exp(after.first / word_count) << endl;
+    cerr << "Dev words/sec: " << word_count / before.second << " -> " << word_count / after.second << endl;
+  }
+
+  memory_monitor.Report(cerr);
+  analysis_limit.Report(cerr);
+  Serialize(trimmed_word_vocab, trimmed_root_vocab, affix_vocab, char_vocab, trimmed_lm, trimmed_model);
+  return 0;
+}
@@ -4,10 +4,12 @@
 #include <map>
 #include <cassert>
 #include <cctype>
+#include <cmath>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/regex.hpp>
 #include "utils.h"
+#include "simd.h"
 
 using namespace std;
 
@@ -37,6 +39,25 @@ unsigned int UTF8StringLen(const string& x) {
   return len;
 }
 
+bool ValidUTF8(const string& x, unsigned& error_offset) {
+  unsigned pos = 0;
+  while (pos < x.size()) {
+    unsigned len = UTF8Len(x[pos]);
+    if (len == 0 || pos + len > x.size()) {
+      error_offset = pos;
+      return false;
+    }
+    for (unsigned i = 1; i < len; ++i) {
+      if (((unsigned char)x[pos + i] >> 6) != 0x02) {
+        error_offset = pos + i;
+        return false;
+      }
+    }
+    pos += len;
+  }
+  return true;
+}
+
 vector<string> tokenize(string input, string delimiter, unsigned max_times) {
   vector<string> tokens;
   //tokens.reserve(max_times);
@@ -91,18 +112,201 @@ map<string, double> parse_feature_string(string input) {
   return output;
 }
 
+// Kernels behind logsumexp, log_softmax and sample_log_probs. The SIMD
+// versions are compiled for their instruction set regardless of the flags
+// the rest of the program is built with, and picked by what the CPU
+// supports when they're first used. kernels.cc and quantized.cc follow the
+// same choice, through simd_level().
+struct NumericKernels {
+  const char* name;
+  SimdLevel level;
+  float (*max)(const float* x, unsigned n);
+  // Returns sum_i exp(x[i] - shift), and stores the terms in out unless it's
+  // null. Terms below exp(-87.3) are flushed to zero, so -inf scores count
+  // for nothing.
+  float (*sum_exp)(const float* x, unsigned n, float shift, float* out);
+};
+
+template <typename S>
+SIMD_INLINE float SimdMax(const float* x, unsigned n) {
+  unsigned i = 0;
+  float m = -INFINITY;
+  if (n >= S::kWidth) {
+    typename S::V vm = S::Load(x);
+    for (i = S::kWidth; i + S::kWidth <= n; i += S::kWidth) {
+      vm = S::Max(vm, S::Load(x + i));
+    }
+    m = S::ReduceMax(vm);
+  }
+  for (; i < n; ++i) {
+    m = max(m, x[i]);
+  }
+  return m;
+}
+
+template <typename S>
+SIMD_INLINE float SimdSumExp(const float* x, unsigned n, float shift, float* out) {
+  unsigned i = 0;
+  typename S::V vshift = S::Set(shift);
+  typename S::V vsum = S::Set(0.0f);
+  for (; i + S::kWidth <= n; i += S::kWidth) {
+    typename S::V e = SimdExp<S>(S::Sub(S::Load(x + i), vshift));
+    if (out != nullptr) {
+      S::Store(out + i, e);
+    }
+    vsum = S::Add(vsum, e);
+  }
+  float sum = S::ReduceAdd(vsum);
+  for (; i < n; ++i) {
+    float e = SimdExp<Scalar>(x[i] - shift);
+    if (out != nullptr) {
+      out[i] = e;
+    }
+    sum += e;
+  }
+  return sum;
+}
+
+static float ScalarMax(const float* x, unsigned n) {
+  return SimdMax<Scalar>(x, n);
+}
+
+static float ScalarSumExp(const float* x, unsigned n, float shift, float* out) {
+  return SimdSumExp<Scalar>(x, n, shift, out);
+}
+
+static const NumericKernels kScalarKernels = {"scalar", kScalarSimd, ScalarMax, ScalarSumExp};
+
+#ifdef HAVE_SIMD_DISPATCH
+AVX2_TARGET static float Avx2Max(const float* x, unsigned n) {
+  return SimdMax<Avx2>(x, n);
+}
+
+AVX2_TARGET static float Avx2SumExp(const float* x, unsigned n, float shift, float* out) {
+  return SimdSumExp<Avx2>(x, n, shift, out);
+}
+
+AVX512_TARGET static float Avx512Max(const float* x, unsigned n) {
+  return SimdMax<Avx512>(x, n);
+}
+
+AVX512_TARGET static float Avx512SumExp(const float* x, unsigned n, float shift, float* out) {
+  return SimdSumExp<Avx512>(x, n, shift, out);
+}
+
+static const NumericKernels kAvx2Kernels = {"avx2", kAvx2Simd, Avx2Max, Avx2SumExp};
+static const NumericKernels kAvx512Kernels = {"avx512", kAvx512Simd, Avx512Max, Avx512SumExp};
+#endif
+
+static bool CpuSupports(const NumericKernels& kernels) {
+#ifdef HAVE_SIMD_DISPATCH
+  __builtin_cpu_init();
+  if (&kernels == &kAvx512Kernels) {
+    return __builtin_cpu_supports("avx512f");
+  }
+  if (&kernels == &kAvx2Kernels) {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+  }
+#endif
+  return &kernels == &kScalarKernels;
+}
+
+static const NumericKernels* AllKernels[] = {
+#ifdef HAVE_SIMD_DISPATCH
+  &kAvx512Kernels, &kAvx2Kernels,
+#endif
+  &kScalarKernels
+};
+
+static const NumericKernels* SelectKernels() {
+  for (const NumericKernels* kernels : AllKernels) {
+    if (CpuSupports(*kernels)) {
+      return kernels;
+    }
+  }
+  return &kScalarKernels;
+}
+
+static const NumericKernels*& ActiveKernels() {
+  static const NumericKernels* kernels = SelectKernels();
+  return kernels;
+}
+
+const char* numeric_kernels() {
+  return ActiveKernels()->name;
+}
+
+SimdLevel simd_level() {
+  return ActiveKernels()->level;
+}
+
+vector<string> supported_numeric_kernels() {
+  vector<string> names;
+  for (const NumericKernels* kernels : AllKernels) {
+    if (CpuSupports(*kernels)) {
+      names.push_back(kernels->name);
+    }
+  }
+  return names;
+}
+
+bool set_numeric_kernels(const string& name) {
+  for (const NumericKernels* kernels : AllKernels) {
+    if (name == kernels->name && CpuSupports(*kernels)) {
+      ActiveKernels() = kernels;
+      return true;
+    }
+  }
+  return false;
+}
+
+float logsumexp(const float* x, unsigned n) {
+  assert (n > 0);
+  const NumericKernels* kernels = ActiveKernels();
+  float m = kernels->max(x, n);
+  if (std::isinf(m)) {
+    // All -inf, or some +inf.
+    return m;
+  }
+  return m + log(kernels->sum_exp(x, n, m, nullptr));
+}
+
 float logsumexp(const vector<float>& v) {
   assert (v.size() > 0);
-  float m = v[0];
-  for (unsigned i = 1; i < v.size(); ++i) {
-    if (v[i] < m) {
-      m = v[i];
-    }
+  return logsumexp(&v[0], v.size());
+}
+
+void log_softmax(const float* x, unsigned n, float* out) {
+  float z = logsumexp(x, n);
+  for (unsigned i = 0; i < n; ++i) {
+    out[i] = x[i] - z;
   }
+}
 
-  float sum = 0.0f;
-  for (unsigned i = 0; i < v.size(); ++i) {
-    sum += exp(v[i] - m);
+vector<float> log_softmax(const vector<float>& v) {
+  vector<float> out(v.size());
+  log_softmax(&v[0], v.size(), &out[0]);
+  return out;
+}
+
+unsigned sample_log_probs(const float* logprobs, unsigned n, float u) {
+  assert (n > 0);
+  static thread_local vector<float> probs;
+  probs.resize(n);
+  const NumericKernels* kernels = ActiveKernels();
+  float m = kernels->max(logprobs, n);
+  float r = u * kernels->sum_exp(logprobs, n, m, &probs[0]);
+
+  // If rounding leaves r past the end, take the last possible outcome.
+  unsigned last = n - 1;
+  for (unsigned i = 0; i < n; ++i) {
+    if (probs[i] > 0.0f) {
+      if (r < probs[i]) {
+        return i;
+      }
+      r -= probs[i];
+      last = i;
+    }
   }
-  return m + log(sum);
+  return last;
 }
@@ -31,6 +31,9 @@ struct Sentence {
 
 unsigned int UTF8Len(unsigned char x);
 unsigned int UTF8StringLen(const string& x);
+// True if every character starts with a byte UTF8Len knows and has all of
+// its continuation bytes. Otherwise sets error_offset to the bad byte.
+bool ValidUTF8(const string& x, unsigned& error_offset);
 
 vector<string> tokenize(string input, string delimiter, unsigned max_times);
 vector<string> tokenize(string input, string delimiter);
@@ -41,32 +44,27 @@ vector<string> strip(const vector<string>& input, bool removeEmpty = false);
 
 map<string, double> parse_feature_string(string input);
 
+// Numeric kernels for vectors of scores. They use the widest of AVX-512,
+// AVX2+FMA or plain C++ that the CPU supports, picked at run time, so they
+// don't rely on the flags the program was compiled with.
+float logsumexp(const float* x, unsigned n);
 float logsumexp(const vector<float>& v);
+void log_softmax(const float* x, unsigned n, float* out);
+vector<float> log_softmax(const vector<float>& v);
+// Samples i with probability proportional to exp(logprobs[i]), by inverting
+// the CDF at u, which should be uniform in [0, 1).
+unsigned sample_log_probs(const float* logprobs, unsigned n, float u);
+
+// Which kernels are in use ("avx512", "avx2" or "scalar"), and the ones this
+// CPU could use. set_numeric_kernels is meant for benchmarks and tests, and
+// is not thread safe. It returns false if the CPU lacks the instructions.
+const char* numeric_kernels();
+vector<string> supported_numeric_kernels();
+bool set_numeric_kernels(const string& name);
 
 template <typename RNG>
 unsigned sample_multinomial(const vector<float>& logprobs, RNG& rng) {
   assert (logprobs.size() > 0);
-  float M = logprobs[0];
-  for (unsigned i = 1; i < logprobs.size(); ++i) {
-    M = max(logprobs[i], M);
-  }
-
-  float sum = 0.0;
-  for (unsigned i = 0; i < logprobs.size(); ++i) {
-    sum += exp(logprobs[i] - M);
-  }
-
   uniform_real_distribution<float> dist(0, 1);
-  float r = sum * dist(rng);
-  for (unsigned i = 0; i < logprobs.size(); ++i) {
-    float p = exp(logprobs[i] - M);
-    if (r < p) {
-      return i;
-    }
-    else {
-      r -= p;
-    }
-  }
-  return logprobs.size() - 1;
+  return sample_log_probs(&logprobs[0], logprobs.size(), dist(rng));
 }
-